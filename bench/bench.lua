@@ -0,0 +1,313 @@
+--
+-- Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+--
+-- SPDX-License-Identifier: BSD-2-Clause
+--
+
+-- Usage: bench.lua [-o outfile] [bench ...]
+--
+-- Runs the named benchmarks, or all of them, and writes one JSON object per
+-- result to stdout (and outfile, if specified) so that runs against different
+-- releases can be compared mechanically.  BENCH_SCALE in the environment
+-- scales up the size of each run for more stable numbers.
+
+require('./libtest')
+local actions = require('porch.actions')
+local core = require('porch.core')
+local matchers = require('porch.matchers')
+local porch = require('porch')
+
+local scale = tonumber(os.getenv("BENCH_SCALE") or "1") or 1
+local outfile
+
+local function encode(val)
+	local vtype = type(val)
+
+	if vtype == "number" then
+		if val ~= val or val == math.huge or val == -math.huge then
+			return "null"
+		elseif math.type(val) == "integer" then
+			return tostring(val)
+		end
+		return string.format("%.6g", val)
+	elseif vtype == "string" then
+		return '"' .. val:gsub('[%c"\\]', function(ch)
+			return string.format("\\u%04x", ch:byte())
+		end) .. '"'
+	elseif vtype == "boolean" then
+		return tostring(val)
+	elseif vtype == "table" then
+		local keys = {}
+		for k in pairs(val) do
+			keys[#keys + 1] = k
+		end
+		table.sort(keys)
+
+		local elems = {}
+		for _, k in ipairs(keys) do
+			elems[#elems + 1] = encode(k) .. ":" .. encode(val[k])
+		end
+		return "{" .. table.concat(elems, ",") .. "}"
+	end
+
+	return "null"
+end
+
+local function report(result)
+	local line = encode(result)
+
+	print(line)
+	if outfile then
+		outfile:write(line .. "\n")
+	end
+end
+
+-- Summarize a set of samples, given in seconds, in the requested unit.
+local function summarize(samples, mult)
+	table.sort(samples)
+
+	local function pct(p)
+		local idx = math.max(1, math.ceil(#samples * p))
+		return samples[idx] * mult
+	end
+
+	local sum = 0
+	for _, v in ipairs(samples) do
+		sum = sum + v
+	end
+
+	return {
+		mean = sum * mult / #samples,
+		min = samples[1] * mult,
+		p50 = pct(0.50),
+		p99 = pct(0.99),
+		samples = #samples,
+	}
+end
+
+local function iterations(base)
+	return math.max(1, math.floor(base * scale))
+end
+
+local benches = {}
+local bench_order = {}
+
+local function bench(name, func)
+	benches[name] = func
+	bench_order[#bench_order + 1] = name
+end
+
+-- Bytes per second from the emitter into the MatchBuffer, for a few different
+-- line lengths since that dictates how many reads we end up doing.
+bench("pty_throughput", function()
+	local size = iterations(2) * 1024 * 1024
+
+	for _, linelen in ipairs({16, 80, 1024}) do
+		local proc = assert(porch.spawn("./bench_emitter", "-s",
+		    tostring(size), "-l", tostring(linelen)))
+		proc.timeout = 120
+
+		local start = core.monotime()
+		assert(proc:eof(), "emitter did not finish")
+		local elapsed = core.monotime() - start
+		local buffered = #proc._process.buffer:contents()
+
+		assert(proc:close())
+		report({
+			bench = "pty_throughput",
+			params = { bytes = size, linelen = linelen },
+			unit = "MB/s",
+			value = (buffered / (1024 * 1024)) / elapsed,
+		})
+	end
+end)
+
+-- Cost of a single match attempt over a full buffer for each matcher, with a
+-- varying number of patterns that will only hit at the very end.
+bench("match_latency", function()
+	local filler = string.rep("x", 79) .. "\n"
+	local buffer = filler:rep(64 * 1024 // #filler) .. "needle\n"
+	local niter = iterations(200)
+
+	for _, mname in ipairs({"lua", "plain", "iplain", "posix"}) do
+		local matcher = matchers.available[mname]
+
+		for _, npatterns in ipairs({1, 8, 64}) do
+			local action = actions.MatchAction:new("match")
+			local patterns = {}
+
+			for i = 2, npatterns do
+				patterns["miss" .. i] = {}
+			end
+			patterns["needle"] = {}
+
+			if matcher.compile then
+				for pat, def in pairs(patterns) do
+					def._compiled = matcher.compile(pat)
+				end
+			end
+
+			action.matcher = matcher
+			action.patterns = patterns
+
+			local samples = {}
+			for i = 1, niter do
+				local start = core.monotime()
+				assert(action:matches(buffer))
+				samples[i] = core.monotime() - start
+			end
+
+			local result = summarize(samples, 1e6)
+			result.bench = "match_latency"
+			result.params = {
+				bytes = #buffer,
+				matcher = mname,
+				patterns = npatterns,
+			}
+			result.unit = "us"
+			report(result)
+		end
+	end
+end)
+
+-- Scan rate of the plain matchers through a buffer of noise that mostly starts
+-- with the needle's first byte, against string.find() as a baseline.
+bench("plain_throughput", function()
+	local filler = string.rep("nee nedle neeedl ", 5) .. "\n"
+	local buffer = filler:rep(4 * 1024 * 1024 // #filler) .. "needle\n"
+	local niter = iterations(20)
+	local finders = {
+		{ "string.find", function()
+			return buffer:find("needle", 1, true)
+		end },
+	}
+
+	for _, mname in ipairs({"plain", "iplain"}) do
+		local matcher = matchers.available[mname]
+		local compiled = matcher.compile("needle")
+
+		finders[#finders + 1] = { mname, function()
+			return matcher.match(compiled, buffer)
+		end }
+	end
+
+	for _, finder in ipairs(finders) do
+		local name, find = finder[1], finder[2]
+
+		local start = core.monotime()
+		for _ = 1, niter do
+			assert(find())
+		end
+		local elapsed = core.monotime() - start
+
+		report({
+			bench = "plain_throughput",
+			params = { bytes = #buffer, matcher = name },
+			unit = "MB/s",
+			value = (#buffer * niter / (1024 * 1024)) / elapsed,
+		})
+	end
+end)
+
+-- Time from spawn() until we've seen the first output, which includes the
+-- fork, tty setup, release and exec.
+bench("spawn_first_byte", function()
+	local samples = {}
+
+	for i = 1, iterations(20) do
+		local start = core.monotime()
+		local proc = assert(porch.spawn("./bench_emitter", "-s", "0"))
+
+		proc.timeout = 10
+		assert(proc:match("BENCH-END", matchers.available.plain),
+		    "emitter produced no output")
+		samples[i] = core.monotime() - start
+		assert(proc:close())
+	end
+
+	local result = summarize(samples, 1e3)
+	result.bench = "spawn_first_byte"
+	result.unit = "ms"
+	report(result)
+end)
+
+-- Round trip through porch_ipc to the child before it's released; chdir() is
+-- about as cheap an acked request as we have.
+bench("ipc_rtt", function()
+	local proc = assert(porch.spawn("./bench_echo"))
+	local cproc = proc._process._process
+	local samples = {}
+
+	for i = 1, iterations(1000) do
+		local start = core.monotime()
+		assert(cproc:chdir("."))
+		samples[i] = core.monotime() - start
+	end
+
+	assert(proc:close())
+
+	local result = summarize(samples, 1e6)
+	result.bench = "ipc_rtt"
+	result.unit = "us"
+	report(result)
+end)
+
+-- Full write/match cycle through the pty against a process that responds
+-- immediately.
+bench("echo_rtt", function()
+	local proc = assert(porch.spawn("./bench_echo"))
+	local samples = {}
+
+	proc.timeout = 10
+	for i = 1, iterations(1000) do
+		local start = core.monotime()
+		assert(proc:write("ping " .. i .. "\r"))
+		assert(proc:match("pong ping " .. i .. "\r\n",
+		    matchers.available.plain), "no response to ping " .. i)
+		samples[i] = core.monotime() - start
+	end
+
+	assert(proc:close())
+
+	local result = summarize(samples, 1e6)
+	result.bench = "echo_rtt"
+	result.unit = "us"
+	report(result)
+end)
+
+local selected = {}
+local argi = 1
+while argi <= #arg do
+	if arg[argi] == "-o" then
+		outfile = assert(io.open(assert(arg[argi + 1], "-o needs a file"),
+		    "w"))
+		argi = argi + 2
+	else
+		if not benches[arg[argi]] then
+			io.stderr:write("unknown benchmark: " .. arg[argi] .. "\n")
+			os.exit(1)
+		end
+
+		selected[#selected + 1] = arg[argi]
+		argi = argi + 1
+	end
+end
+
+if #selected == 0 then
+	selected = bench_order
+end
+
+report({
+	bench = "meta",
+	lua = _VERSION,
+	porch = os.getenv("PORCH_VERSION") or "unknown",
+	scale = scale,
+})
+
+for _, name in ipairs(selected) do
+	benches[name]()
+end
+
+if outfile then
+	outfile:close()
+end
@@ -0,0 +1,25 @@
+#!/bin/sh
+#
+# Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+#
+# SPDX-License-Identifier: BSD-2-Clause
+#
+
+scriptdir=$(dirname $(realpath "$0"))
+schemes="lua${LUA_VERSION_MAJOR}${LUA_VERSION_MINOR}"
+schemes="$schemes lua${LUA_VERSION_MAJOR}.${LUA_VERSION_MINOR}"
+
+for bin in $schemes; do
+	if command -v $bin >/dev/null; then
+		LUA="$bin"
+		break
+	fi
+done
+
+if [ -z "$LUA" ]; then
+	1>&2 echo "Could not find suitable binary named any of: $schemes"
+	exit 1
+fi
+
+cd "$scriptdir"
+exec $LUA "$scriptdir"/bench.lua "$@"
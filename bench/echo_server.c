@@ -0,0 +1,49 @@
+/*-
+ * Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Echo server for the round-trip benchmarks: every line that comes in goes
+ * right back out with a "pong " prefix, unbuffered, so that the driver can time
+ * a write/match cycle through the pty without any stdio delays muddying it.
+ */
+int
+main(void)
+{
+	char buf[4096 + sizeof("pong ")];
+	ssize_t readsz, wsz;
+	size_t off;
+
+	memcpy(buf, "pong ", sizeof("pong ") - 1);
+	for (;;) {
+		readsz = read(STDIN_FILENO, &buf[sizeof("pong ") - 1],
+		    sizeof(buf) - (sizeof("pong ") - 1));
+		if (readsz == -1 && errno == EINTR)
+			continue;
+		if (readsz <= 0)
+			break;
+
+		off = 0;
+		readsz += sizeof("pong ") - 1;
+		while (off < (size_t)readsz) {
+			wsz = write(STDOUT_FILENO, &buf[off], readsz - off);
+			if (wsz == -1 && errno == EINTR)
+				continue;
+			if (wsz == -1) {
+				fprintf(stderr, "write: %s\n", strerror(errno));
+				return (1);
+			}
+
+			off += wsz;
+		}
+	}
+
+	return (0);
+}
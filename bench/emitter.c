@@ -0,0 +1,165 @@
+/*-
+ * Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Load generator for the benchmarks: writes lines of a fixed length to stdout
+ * until we've written the requested amount, optionally throttled to a given
+ * rate.  The final line is always "BENCH-END" so that a driver has something
+ * to match on that can't appear in the filler.
+ *
+ * usage: bench_emitter [-l linelen] [-r bytes/sec] [-s bytes]
+ */
+
+#define	EMIT_BATCH	(64 * 1024)
+
+static void
+usage(void)
+{
+
+	fprintf(stderr,
+	    "usage: bench_emitter [-l linelen] [-r bytes/sec] [-s bytes]\n");
+	exit(1);
+}
+
+static long long
+parse_num(const char *str)
+{
+	char *endp;
+	long long val;
+
+	errno = 0;
+	val = strtoll(str, &endp, 10);
+	if (errno != 0 || val < 0)
+		usage();
+
+	switch (*endp) {
+	case 'k':
+	case 'K':
+		val *= 1024;
+		endp++;
+		break;
+	case 'm':
+	case 'M':
+		val *= 1024 * 1024;
+		endp++;
+		break;
+	default:
+		break;
+	}
+
+	if (*endp != '\0')
+		usage();
+
+	return (val);
+}
+
+static void
+write_all(const char *buf, size_t bufsz)
+{
+	ssize_t wsz;
+
+	while (bufsz > 0) {
+		wsz = write(STDOUT_FILENO, buf, bufsz);
+		if (wsz == -1) {
+			if (errno == EINTR)
+				continue;
+
+			fprintf(stderr, "write: %s\n", strerror(errno));
+			exit(1);
+		}
+
+		buf += wsz;
+		bufsz -= wsz;
+	}
+}
+
+static void
+throttle(const struct timespec *start, long long sent, long long rate)
+{
+	struct timespec now, ts;
+	double ahead, elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - start->tv_sec) +
+	    (now.tv_nsec - start->tv_nsec) / 1e9;
+
+	ahead = ((double)sent / rate) - elapsed;
+	if (ahead <= 0)
+		return;
+
+	ts.tv_sec = (time_t)ahead;
+	ts.tv_nsec = (long)((ahead - ts.tv_sec) * 1e9);
+	while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+		continue;
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const char trailer[] = "BENCH-END\n";
+	struct timespec start;
+	char *buf;
+	long long linelen, rate, sent, size;
+	size_t batchsz, chunk;
+	int ch;
+
+	linelen = 80;
+	rate = 0;
+	size = 1024 * 1024;
+	while ((ch = getopt(argc, argv, "l:r:s:")) != -1) {
+		switch (ch) {
+		case 'l':
+			linelen = parse_num(optarg);
+			if (linelen < 1)
+				usage();
+			break;
+		case 'r':
+			rate = parse_num(optarg);
+			break;
+		case 's':
+			size = parse_num(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	/* Fill a batch with whole lines so that every write is line-aligned. */
+	batchsz = EMIT_BATCH - (EMIT_BATCH % linelen);
+	if (batchsz == 0)
+		batchsz = linelen;
+	buf = malloc(batchsz);
+	if (buf == NULL) {
+		fprintf(stderr, "malloc: %s\n", strerror(errno));
+		return (1);
+	}
+
+	memset(buf, 'x', batchsz);
+	for (size_t off = linelen - 1; off < batchsz; off += linelen)
+		buf[off] = '\n';
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (sent = 0; sent < size; sent += chunk) {
+		chunk = batchsz;
+		if ((long long)chunk > size - sent)
+			chunk = size - sent;
+
+		write_all(buf, chunk);
+		if (rate != 0)
+			throttle(&start, sent + chunk, rate);
+	}
+
+	write_all(trailer, sizeof(trailer) - 1);
+	free(buf);
+	return (0);
+}
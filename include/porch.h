@@ -24,6 +24,9 @@
 	__attribute__((__format__ (__printf__, fmtarg, firstvararg)))
 #endif
 
+/* porch_agent.c */
+int porch_agent(void);
+
 /* porch_compat.c */
 #ifdef __linux__
 size_t strlcpy(char * __restrict, const char * __restrict, size_t);
@@ -34,6 +37,9 @@ size_t strlcat(char * __restrict, const char * __restrict, size_t);
 int tcsetsid(int, int);
 #endif
 
+/* porch_sched.c */
+int porch_sched_self(const char *, const char *, const char *);
+
 /* porch_lua.c */
 int luaopen_porch_core(lua_State *);
 int luaopen_porch_tty(lua_State *);
@@ -0,0 +1,747 @@
+/*-
+ * Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "porch.h"
+#include "porch_lib.h"
+
+/*
+ * porch --agent: the remote half of rporch -a.  rporch starts us over the rsh
+ * once, then sends spawn requests and everything else about the processes it
+ * wants to drive as porch_ipc messages over our stdin; their output, exit
+ * statuses and acks go back over our stdout, with each payload tagged by the
+ * id that rporch gave the process.  Processes are spawned with porch_spawn(),
+ * just as the core would locally, and are all killed if rporch goes away.
+ */
+
+#define	AGENT_READSZ	4096
+#define	AGENT_KILLWAIT	5	/* Seconds between SIGTERM and SIGKILL */
+
+struct porch_agent_proc {
+	struct porch_process	 proc;
+	struct porch_agent_proc	*next;
+	time_t			 deadline;	/* SIGKILL, once closing */
+	int			 status;
+	uint32_t		 id;
+	bool			 closing;
+	bool			 reaped;
+};
+
+static struct porch_agent_proc *porch_agent_procs;
+static porch_ipc_t porch_agent_ctl;
+static int porch_agent_sigpipe[2] = { -1, -1 };
+
+static void
+porch_agent_sigchld(int signo __unused)
+{
+	int serrno = errno;
+
+	(void)write(porch_agent_sigpipe[1], "", 1);
+	errno = serrno;
+}
+
+static time_t
+porch_agent_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec);
+}
+
+static int
+porch_agent_reply(enum porch_ipc_tag tag, uint32_t id, int32_t arg,
+    const void *data, size_t datasz)
+{
+	struct porch_agent_hdr *hdr;
+	struct porch_ipc_msg *msg;
+	int error;
+
+	msg = porch_ipc_msg_alloc(tag, sizeof(*hdr) + datasz, (void **)&hdr);
+	if (msg == NULL)
+		return (-1);
+
+	hdr->id = id;
+	hdr->arg = arg;
+	if (datasz != 0)
+		memcpy(hdr + 1, data, datasz);
+
+	error = porch_ipc_send(porch_agent_ctl, msg);
+	porch_ipc_msg_free(msg);
+	return (error);
+}
+
+/*
+ * Errors go back as a string as well as the errno, since the two ends needn't
+ * agree on what the numbers mean.
+ */
+static int
+porch_agent_ack(enum porch_ipc_tag tag, uint32_t id, int error)
+{
+	const char *errstr;
+
+	if (error == 0)
+		return (porch_agent_reply(tag, id, 0, NULL, 0));
+
+	errstr = strerror(error);
+	return (porch_agent_reply(tag, id, error, errstr, strlen(errstr)));
+}
+
+static struct porch_agent_proc *
+porch_agent_lookup(uint32_t id)
+{
+	struct porch_agent_proc *aproc;
+
+	for (aproc = porch_agent_procs; aproc != NULL; aproc = aproc->next) {
+		if (aproc->id == id)
+			return (aproc);
+	}
+
+	return (NULL);
+}
+
+static void
+porch_agent_free(struct porch_agent_proc *aproc)
+{
+	struct porch_agent_proc **prevp;
+
+	for (prevp = &porch_agent_procs; *prevp != aproc;
+	    prevp = &(*prevp)->next)
+		continue;
+	*prevp = aproc->next;
+
+	porch_ipc_close(aproc->proc.ipc);
+	if (aproc->proc.termctl != -1)
+		close(aproc->proc.termctl);
+	free(aproc);
+}
+
+/*
+ * Exit statuses go out once the process has been reaped and we're done with its
+ * terminal, so that it always follows the last of the output.  There's nothing
+ * left to keep around after that if rporch already closed it.
+ */
+static int
+porch_agent_exited(struct porch_agent_proc *aproc)
+{
+	int status = aproc->status, error;
+
+	if (!aproc->reaped || aproc->proc.termctl != -1)
+		return (0);
+
+	error = porch_agent_reply(IPC_AGENT_EXIT, aproc->id,
+	    WIFEXITED(status) ? WEXITSTATUS(status) : -WTERMSIG(status),
+	    NULL, 0);
+	if (aproc->closing)
+		porch_agent_free(aproc);
+	return (error);
+}
+
+static int
+porch_agent_reap(void)
+{
+	struct porch_agent_proc *aproc;
+	char buf[32];
+	pid_t pid;
+	int status;
+
+	while (read(porch_agent_sigpipe[0], buf, sizeof(buf)) > 0)
+		continue;
+
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		for (aproc = porch_agent_procs; aproc != NULL;
+		    aproc = aproc->next) {
+			if (aproc->proc.pid == pid)
+				break;
+		}
+
+		if (aproc == NULL)
+			continue;
+
+		aproc->proc.pid = 0;
+		aproc->status = status;
+		aproc->reaped = true;
+		if (porch_agent_exited(aproc) != 0)
+			return (-1);
+	}
+
+	return (0);
+}
+
+static int
+porch_agent_child_error(porch_ipc_t ipc __unused, struct porch_ipc_msg *msg,
+    void *cookie)
+{
+	struct porch_agent_proc *aproc = cookie;
+	const char *errstr;
+	size_t errsz;
+
+	/* It'll exit shortly; pass the reason along to the rsh's stderr. */
+	errstr = porch_ipc_msg_payload(msg, &errsz);
+	if (errstr != NULL && errsz != 0 && errstr[errsz - 1] == '\0')
+		fprintf(stderr, "porch agent: process %u: %s\n", aproc->id,
+		    errstr);
+	return (0);
+}
+
+/*
+ * Send `msg` to a process that hasn't been released yet and wait for the
+ * `ack_type` reply; acks with an errno in them have it returned in *errorp.
+ */
+static int
+porch_agent_acked(struct porch_agent_proc *aproc, struct porch_ipc_msg *msg,
+    enum porch_ipc_tag ack_type, int *errorp)
+{
+	struct porch_ipc_msg *ack;
+	porch_ipc_t ipc = aproc->proc.ipc;
+	const int *ackerr;
+	size_t ackerrsz;
+	bool eof;
+
+	*errorp = 0;
+	if (porch_ipc_send(ipc, msg) != 0) {
+		*errorp = errno;
+		return (0);
+	}
+
+	for (ack = NULL; ack == NULL;) {
+		if (porch_ipc_wait(ipc, &eof) == -1 ||
+		    porch_ipc_recv(ipc, &ack) != 0) {
+			*errorp = errno;
+			return (0);
+		} else if (eof && ack == NULL) {
+			*errorp = EPIPE;
+			return (0);
+		}
+	}
+
+	if (porch_ipc_msg_tag(ack) != ack_type) {
+		*errorp = EINVAL;
+	} else {
+		ackerr = porch_ipc_msg_payload(ack, &ackerrsz);
+		if (ackerr != NULL && ackerrsz == sizeof(*ackerr))
+			*errorp = *ackerr;
+	}
+
+	porch_ipc_msg_free(ack);
+	return (0);
+}
+
+static int
+porch_agent_spawn(uint32_t id, const char *data, size_t datasz)
+{
+	struct porch_agent_term term = { 0 };
+	struct porch_agent_proc *aproc;
+	struct termios t;
+	struct winsize winsz;
+	const char **argv;
+	int argc, error;
+
+	if (porch_agent_lookup(id) != NULL) {
+		error = EEXIST;
+		goto fail;
+	} else if (datasz == 0 || data[datasz - 1] != '\0') {
+		error = EINVAL;
+		goto fail;
+	}
+
+	argc = 0;
+	for (size_t i = 0; i < datasz; i++) {
+		if (data[i] == '\0')
+			argc++;
+	}
+
+	aproc = calloc(1, sizeof(*aproc));
+	argv = calloc(argc + 1, sizeof(*argv));
+	if (aproc == NULL || argv == NULL) {
+		free(aproc);
+		free(argv);
+		error = ENOMEM;
+		goto fail;
+	}
+
+	for (int i = 0; i < argc; i++) {
+		argv[i] = data;
+		data = strchr(data, '\0') + 1;
+	}
+
+	aproc->id = id;
+	aproc->proc.pty = true;
+	aproc->proc.errctl = -1;
+	aproc->proc.last_signal = -1;
+	if (porch_spawn(argc, argv, &aproc->proc,
+	    porch_agent_child_error) != 0) {
+		error = errno;
+		free(argv);
+		free(aproc);
+		goto fail;
+	}
+
+	free(argv);
+	aproc->next = porch_agent_procs;
+	porch_agent_procs = aproc;
+
+	/* The process will start out with whatever the pty defaults to. */
+	if (tcgetattr(aproc->proc.termctl, &t) == 0) {
+		term.iflag = t.c_iflag;
+		term.oflag = t.c_oflag;
+		term.cflag = t.c_cflag;
+		term.lflag = t.c_lflag;
+	}
+	if (ioctl(aproc->proc.termctl, TIOCGWINSZ, &winsz) == 0) {
+		term.cols = winsz.ws_col;
+		term.rows = winsz.ws_row;
+	}
+
+	return (porch_agent_reply(IPC_AGENT_SPAWNED, id, 0, &term,
+	    sizeof(term)));
+fail:
+	return (porch_agent_ack(IPC_AGENT_SPAWNED, id, error));
+}
+
+static int
+porch_agent_chdir(struct porch_agent_proc *aproc, const char *dir,
+    size_t dirsz)
+{
+	struct porch_ipc_msg *msg;
+	char *mdir;
+	int error;
+
+	if (aproc->proc.ipc == NULL) {
+		error = EBUSY;
+		goto out;
+	} else if (dirsz == 0) {
+		error = EINVAL;
+		goto out;
+	}
+
+	msg = porch_ipc_msg_alloc(IPC_CHDIR, dirsz + 1, (void **)&mdir);
+	if (msg == NULL) {
+		error = ENOMEM;
+		goto out;
+	}
+
+	memcpy(mdir, dir, dirsz);
+	porch_agent_acked(aproc, msg, IPC_CHDIR_ACK, &error);
+	porch_ipc_msg_free(msg);
+out:
+	return (porch_agent_ack(IPC_AGENT_ACK, aproc->id, error));
+}
+
+/*
+ * Environment changes ride along with the release, as they do for the core:
+ * `clear` and the NUL-terminated name=value pairs to set.
+ */
+static int
+porch_agent_release(struct porch_agent_proc *aproc, bool clear,
+    const char *env, size_t envsz)
+{
+	struct porch_env *penv;
+	struct porch_ipc_msg *msg;
+	int error;
+
+	error = 0;
+	if (aproc->proc.ipc == NULL) {
+		error = EBUSY;
+		goto out;
+	}
+
+	if (clear || envsz != 0) {
+		msg = porch_ipc_msg_alloc(IPC_ENV_SETUP, sizeof(*penv) + envsz,
+		    (void **)&penv);
+		if (msg == NULL) {
+			error = ENOMEM;
+			goto out;
+		}
+
+		penv->clear = clear;
+		penv->setsz = envsz;
+		penv->unsetsz = 0;
+		memcpy(&penv->envstr[0], env, envsz);
+		porch_agent_acked(aproc, msg, IPC_ENV_ACK, &error);
+		porch_ipc_msg_free(msg);
+		if (error != 0)
+			goto out;
+	}
+
+	if (porch_release(aproc->proc.ipc) != 0)
+		error = errno;
+	porch_ipc_close(aproc->proc.ipc);
+	aproc->proc.ipc = NULL;
+	aproc->proc.released = true;
+out:
+	return (porch_agent_ack(IPC_AGENT_ACK, aproc->id, error));
+}
+
+static int
+porch_agent_term(struct porch_agent_proc *aproc, const void *data,
+    size_t datasz)
+{
+	struct porch_agent_term term;
+	struct termios t;
+	struct winsize winsz;
+	int error, fd = aproc->proc.termctl;
+
+	error = 0;
+	if (datasz != sizeof(term)) {
+		error = EINVAL;
+		goto out;
+	} else if (fd == -1) {
+		error = EIO;
+		goto out;
+	}
+
+	memcpy(&term, data, sizeof(term));
+	if (tcgetattr(fd, &t) != 0) {
+		error = errno;
+		goto out;
+	}
+
+	t.c_iflag = term.iflag;
+	t.c_oflag = term.oflag;
+	t.c_cflag = term.cflag;
+	t.c_lflag = term.lflag;
+	if (tcsetattr(fd, TCSANOW, &t) != 0) {
+		error = errno;
+		goto out;
+	}
+
+	if (term.cols != 0 || term.rows != 0) {
+		memset(&winsz, 0, sizeof(winsz));
+		winsz.ws_col = term.cols;
+		winsz.ws_row = term.rows;
+		if (ioctl(fd, TIOCSWINSZ, &winsz) != 0)
+			error = errno;
+	}
+out:
+	return (porch_agent_ack(IPC_AGENT_ACK, aproc->id, error));
+}
+
+static int
+porch_agent_signal(struct porch_agent_proc *aproc, int signo)
+{
+	int error;
+
+	error = 0;
+	if (!aproc->proc.released)
+		error = EBUSY;
+	else if (aproc->reaped)
+		error = ESRCH;
+	else if (kill(aproc->proc.pid, signo) != 0)
+		error = errno;
+
+	return (porch_agent_ack(IPC_AGENT_ACK, aproc->id, error));
+}
+
+static void
+porch_agent_write(struct porch_agent_proc *aproc, const char *data,
+    size_t datasz)
+{
+	ssize_t writesz;
+
+	/* Anything written after it's gone is just lost, as it would be. */
+	while (datasz != 0 && aproc->proc.termctl != -1) {
+		writesz = write(aproc->proc.termctl, data, datasz);
+		if (writesz == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		data += writesz;
+		datasz -= writesz;
+	}
+}
+
+/*
+ * rporch is done with it: ask it to terminate, and kill it outright if it
+ * hasn't a few seconds later.  Nobody's listening for output anymore.
+ */
+static int
+porch_agent_close(struct porch_agent_proc *aproc)
+{
+
+	if (aproc->reaped && aproc->proc.termctl == -1) {
+		/* Its exit status has already been sent. */
+		porch_agent_free(aproc);
+		return (0);
+	}
+
+	aproc->closing = true;
+	aproc->deadline = porch_agent_now() + AGENT_KILLWAIT;
+	if (!aproc->proc.released) {
+		porch_ipc_close(aproc->proc.ipc);
+		aproc->proc.ipc = NULL;
+		close(aproc->proc.termctl);
+		aproc->proc.termctl = -1;
+	}
+
+	if (!aproc->reaped)
+		kill(aproc->proc.pid, SIGTERM);
+	return (porch_agent_exited(aproc));
+}
+
+static int
+porch_agent_dispatch(struct porch_ipc_msg *msg)
+{
+	struct porch_agent_proc *aproc;
+	struct porch_agent_hdr *hdr;
+	enum porch_ipc_tag tag;
+	const char *data;
+	size_t datasz;
+
+	tag = porch_ipc_msg_tag(msg);
+	hdr = porch_ipc_msg_payload(msg, &datasz);
+	if (hdr == NULL || datasz < sizeof(*hdr)) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	data = (const char *)(hdr + 1);
+	datasz -= sizeof(*hdr);
+	if (tag == IPC_AGENT_SPAWN)
+		return (porch_agent_spawn(hdr->id, data, datasz));
+
+	aproc = porch_agent_lookup(hdr->id);
+	if (aproc == NULL || aproc->closing) {
+		/* Input for something that's already gone is fine. */
+		if (tag == IPC_AGENT_WRITE || tag == IPC_AGENT_CLOSE)
+			return (0);
+		return (porch_agent_ack(IPC_AGENT_ACK, hdr->id, ESRCH));
+	}
+
+	switch (tag) {
+	case IPC_AGENT_CHDIR:
+		return (porch_agent_chdir(aproc, data, datasz));
+	case IPC_AGENT_RELEASE:
+		return (porch_agent_release(aproc, hdr->arg != 0, data,
+		    datasz));
+	case IPC_AGENT_TERM:
+		return (porch_agent_term(aproc, data, datasz));
+	case IPC_AGENT_SIGNAL:
+		return (porch_agent_signal(aproc, hdr->arg));
+	case IPC_AGENT_WRITE:
+		porch_agent_write(aproc, data, datasz);
+		return (0);
+	case IPC_AGENT_CLOSE:
+		return (porch_agent_close(aproc));
+	default:
+		errno = EINVAL;
+		return (-1);
+	}
+}
+
+static int
+porch_agent_output(struct porch_agent_proc *aproc)
+{
+	char buf[AGENT_READSZ];
+	ssize_t readsz;
+
+	readsz = read(aproc->proc.termctl, buf, sizeof(buf));
+	if (readsz == -1 && (errno == EINTR || errno == EAGAIN))
+		return (0);
+
+	/*
+	 * As with the core, EIO is how some platforms say EOF on a pty.  Once
+	 * it's closing, rporch has stopped listening for output.
+	 */
+	if (readsz > 0) {
+		if (aproc->closing)
+			return (0);
+		return (porch_agent_reply(IPC_AGENT_OUTPUT, aproc->id, 0, buf,
+		    readsz));
+	}
+
+	close(aproc->proc.termctl);
+	aproc->proc.termctl = -1;
+	if (!aproc->closing &&
+	    porch_agent_reply(IPC_AGENT_OUTPUT, aproc->id, 0, NULL, 0) != 0)
+		return (-1);
+	return (porch_agent_exited(aproc));
+}
+
+/*
+ * Anything that was asked to close a while ago and still hasn't exited gets a
+ * SIGKILL, and we drop its terminal the way the core would.  Returns how long
+ * select() can wait before the next one is due, or -1 for no deadline.
+ */
+static int
+porch_agent_deadlines(void)
+{
+	struct porch_agent_proc *aproc, *next;
+	time_t now, wait;
+
+	now = porch_agent_now();
+	wait = -1;
+	for (aproc = porch_agent_procs; aproc != NULL; aproc = next) {
+		next = aproc->next;
+		if (!aproc->closing || aproc->reaped)
+			continue;
+
+		if (aproc->deadline > now) {
+			if (wait == -1 || aproc->deadline - now < wait)
+				wait = aproc->deadline - now;
+			continue;
+		}
+
+		kill(aproc->proc.pid, SIGKILL);
+		if (aproc->proc.termctl != -1) {
+			close(aproc->proc.termctl);
+			aproc->proc.termctl = -1;
+		}
+	}
+
+	return ((int)wait);
+}
+
+static void
+porch_agent_shutdown(void)
+{
+	struct porch_agent_proc *aproc;
+
+	for (aproc = porch_agent_procs; aproc != NULL; aproc = aproc->next) {
+		if (!aproc->reaped)
+			kill(aproc->proc.pid, SIGKILL);
+	}
+
+	while (porch_agent_procs != NULL) {
+		aproc = porch_agent_procs;
+		if (!aproc->reaped) {
+			while (waitpid(aproc->proc.pid, NULL, 0) == -1 &&
+			    errno == EINTR)
+				continue;
+		}
+
+		porch_agent_free(aproc);
+	}
+}
+
+int
+porch_agent(void)
+{
+	struct sigaction sa = { .sa_handler = porch_agent_sigchld };
+	struct porch_agent_proc *aproc, *next;
+	struct porch_ipc_msg *msg;
+	struct timeval tv;
+	fd_set rfds;
+	int maxfd, ret, wait;
+
+	if (isatty(STDIN_FILENO)) {
+		fprintf(stderr, "porch: --agent is meant to be started by rporch -a\n");
+		return (1);
+	}
+
+	if (pipe(porch_agent_sigpipe) == -1) {
+		perror("pipe");
+		return (1);
+	}
+
+	for (int i = 0; i < 2; i++) {
+		fcntl(porch_agent_sigpipe[i], F_SETFD, FD_CLOEXEC);
+		fcntl(porch_agent_sigpipe[i], F_SETFL,
+		    fcntl(porch_agent_sigpipe[i], F_GETFL) | O_NONBLOCK);
+	}
+
+	/*
+	 * Our stdin and stdout may well be the same socket or a pair of pipes,
+	 * depending on the rsh.  Neither can block us while there's output to
+	 * forward.
+	 */
+	fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+	fcntl(STDOUT_FILENO, F_SETFL,
+	    fcntl(STDOUT_FILENO, F_GETFL) | O_NONBLOCK);
+
+	porch_agent_ctl = porch_ipc_open_pair(STDIN_FILENO, STDOUT_FILENO);
+	if (porch_agent_ctl == NULL) {
+		perror("porch_ipc_open");
+		return (1);
+	}
+
+	sa.sa_flags = SA_NOCLDSTOP;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGCHLD, &sa, NULL);
+
+	ret = 0;
+	while (porch_ipc_okay(porch_agent_ctl)) {
+		/* Anything already queued up needs to be handled first. */
+		if (porch_ipc_recv(porch_agent_ctl, &msg) != 0) {
+			ret = 1;
+			break;
+		} else if (msg != NULL) {
+			if (porch_agent_dispatch(msg) != 0)
+				ret = 1;
+			porch_ipc_msg_free(msg);
+			if (ret != 0)
+				break;
+			continue;
+		}
+
+		if (!porch_ipc_okay(porch_agent_ctl))
+			break;
+
+		FD_ZERO(&rfds);
+		FD_SET(STDIN_FILENO, &rfds);
+		FD_SET(porch_agent_sigpipe[0], &rfds);
+		maxfd = porch_agent_sigpipe[0];
+		for (aproc = porch_agent_procs; aproc != NULL;
+		    aproc = aproc->next) {
+			if (!aproc->proc.released || aproc->proc.termctl == -1)
+				continue;
+
+			FD_SET(aproc->proc.termctl, &rfds);
+			if (aproc->proc.termctl > maxfd)
+				maxfd = aproc->proc.termctl;
+		}
+
+		wait = porch_agent_deadlines();
+		tv.tv_sec = wait;
+		tv.tv_usec = 0;
+		if (select(maxfd + 1, &rfds, NULL, NULL,
+		    wait >= 0 ? &tv : NULL) == -1) {
+			if (errno == EINTR)
+				continue;
+			perror("select");
+			ret = 1;
+			break;
+		}
+
+		if (FD_ISSET(porch_agent_sigpipe[0], &rfds) &&
+		    porch_agent_reap() != 0) {
+			ret = 1;
+			break;
+		}
+
+		for (aproc = porch_agent_procs; aproc != NULL; aproc = next) {
+			next = aproc->next;
+			if (aproc->proc.termctl == -1 ||
+			    !FD_ISSET(aproc->proc.termctl, &rfds))
+				continue;
+
+			if (porch_agent_output(aproc) != 0) {
+				ret = 1;
+				break;
+			}
+		}
+	}
+
+	/* rporch hung up, or we can't talk to it anymore. */
+	porch_agent_shutdown();
+	porch_ipc_close(porch_agent_ctl);
+	return (ret);
+}
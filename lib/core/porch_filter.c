@@ -0,0 +1,558 @@
+/*-
+ * Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sys/param.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "porch_lua.h"
+
+#ifndef nitems
+#define	nitems(x)	(sizeof((x)) / sizeof((x)[0]))
+#endif
+
+/*
+ * Output normalization: a chain of filters that the process' output passes
+ * through on its way to the match buffer, so that scripts can match against
+ * the text they care about rather than writing patterns around the noise.  The
+ * raw output is still what gets logged, recorded and fed to the screen model.
+ *
+ * Sequences may be split across reads, so each stage carries its parser state
+ * from one chunk to the next and may hold back the bytes that it hasn't been
+ * able to decide on yet; those are released on the next chunk, or when the
+ * chain is flushed at EOF.
+ *
+ * The stages spend most of their time looking for a single byte, ESC or CR,
+ * so they use memchr(3) to skip ahead; libc implementations generally
+ * vectorize it, and the runs in between are copied in bulk.
+ */
+
+#define	FILTER_MAXHOLD	16	/* Longest sequence we'll hold back */
+#define	FILTER_ESC	'\033'
+#define	FILTER_BEL	'\007'
+
+enum porch_filter_type {
+	FILTER_STRIP_ANSI,
+	FILTER_CRLF,
+	FILTER_BRACKETED_PASTE,
+};
+
+enum porch_filter_state {
+	FSTATE_GROUND,
+	FSTATE_ESC,
+	FSTATE_ESC_SKIP,	/* ESC followed by one more byte, e.g., ESC ( B */
+	FSTATE_CSI,
+	FSTATE_STRING,		/* OSC, DCS, etc. until ST or BEL */
+	FSTATE_STRING_ESC,
+};
+
+struct porch_filter_stage {
+	enum porch_filter_type	 type;
+	enum porch_filter_state	 state;
+	size_t			 holdsz;
+	char			 hold[FILTER_MAXHOLD];
+};
+
+struct porch_filter {
+	struct porch_filter_stage	*stages;
+	size_t				 nstages;
+	char				*buf[2];
+	size_t				 bufsz;
+};
+
+static const struct {
+	const char		*name;
+	enum porch_filter_type	 type;
+} porch_filter_types[] = {
+	{ "bracketed_paste",	FILTER_BRACKETED_PASTE },
+	{ "crlf",		FILTER_CRLF },
+	{ "strip_ansi",		FILTER_STRIP_ANSI },
+};
+
+/* Sequences that bracketed_paste strips, without the leading ESC [. */
+static const char *porch_filter_paste_seqs[] = {
+	"200~", "201~", "?2004h", "?2004l",
+};
+
+/*
+ * Drop every escape sequence.  Nothing is ever held back here, since we know
+ * that we're dropping a sequence as soon as it starts.
+ */
+static size_t
+porch_filter_strip_ansi(struct porch_filter_stage *stage, const char *in,
+    size_t insz, char *out)
+{
+	const char *end = in + insz, *esc;
+	size_t outsz = 0;
+	unsigned char ch;
+
+	while (in < end) {
+		if (stage->state == FSTATE_GROUND) {
+			esc = memchr(in, FILTER_ESC, end - in);
+			if (esc == NULL)
+				esc = end;
+
+			memcpy(&out[outsz], in, esc - in);
+			outsz += esc - in;
+			in = esc;
+			if (in == end)
+				break;
+
+			stage->state = FSTATE_ESC;
+			in++;
+			continue;
+		}
+
+		ch = *in++;
+		switch (stage->state) {
+		case FSTATE_ESC:
+			if (ch == '[')
+				stage->state = FSTATE_CSI;
+			else if (ch == ']' || ch == 'P' || ch == 'X' ||
+			    ch == '^' || ch == '_')
+				stage->state = FSTATE_STRING;
+			else if (ch == '(' || ch == ')' || ch == '*' ||
+			    ch == '+' || ch == '#' || ch == '%')
+				stage->state = FSTATE_ESC_SKIP;
+			else
+				stage->state = FSTATE_GROUND;
+			break;
+		case FSTATE_ESC_SKIP:
+			stage->state = FSTATE_GROUND;
+			break;
+		case FSTATE_CSI:
+			if (ch >= 0x40 && ch <= 0x7e) {
+				stage->state = FSTATE_GROUND;
+			} else if (ch < 0x20) {
+				/* Malformed; let the control through. */
+				stage->state = FSTATE_GROUND;
+				if (ch == FILTER_ESC)
+					stage->state = FSTATE_ESC;
+				else
+					out[outsz++] = ch;
+			}
+			break;
+		case FSTATE_STRING:
+			if (ch == FILTER_BEL)
+				stage->state = FSTATE_GROUND;
+			else if (ch == FILTER_ESC)
+				stage->state = FSTATE_STRING_ESC;
+			break;
+		case FSTATE_STRING_ESC:
+			stage->state = (ch == '\\') ? FSTATE_GROUND :
+			    FSTATE_STRING;
+			break;
+		case FSTATE_GROUND:
+			break;
+		}
+	}
+
+	return (outsz);
+}
+
+/*
+ * Collapse CR LF into LF.  A CR at the very end of a chunk is held back until we
+ * know what follows it.
+ */
+static size_t
+porch_filter_crlf(struct porch_filter_stage *stage, const char *in,
+    size_t insz, char *out)
+{
+	const char *end = in + insz, *cr;
+	size_t outsz = 0;
+
+	if (stage->holdsz != 0 && insz != 0) {
+		stage->holdsz = 0;
+		if (*in != '\n')
+			out[outsz++] = '\r';
+	}
+
+	while (in < end) {
+		cr = memchr(in, '\r', end - in);
+		if (cr == NULL)
+			cr = end;
+
+		memcpy(&out[outsz], in, cr - in);
+		outsz += cr - in;
+		in = cr;
+		if (in == end)
+			break;
+
+		if (in + 1 == end) {
+			stage->hold[0] = '\r';
+			stage->holdsz = 1;
+			break;
+		}
+
+		/* Drop the CR if it's followed by LF, keep it otherwise. */
+		if (in[1] != '\n')
+			out[outsz++] = '\r';
+		in++;
+	}
+
+	return (outsz);
+}
+
+static bool
+porch_filter_paste_seq(const struct porch_filter_stage *stage)
+{
+
+	/* hold[] starts with ESC [ */
+	for (size_t i = 0; i < nitems(porch_filter_paste_seqs); i++) {
+		const char *seq = porch_filter_paste_seqs[i];
+
+		if (stage->holdsz - 2 == strlen(seq) &&
+		    memcmp(&stage->hold[2], seq, stage->holdsz - 2) == 0)
+			return (true);
+	}
+
+	return (false);
+}
+
+/*
+ * Drop the bracketed paste markers and the mode changes that enable them,
+ * leaving any other sequences alone.  CSI sequences are held until we've seen
+ * enough of them to know whether they're one of ours.
+ */
+static size_t
+porch_filter_bracketed_paste(struct porch_filter_stage *stage, const char *in,
+    size_t insz, char *out)
+{
+	const char *end = in + insz, *esc;
+	size_t outsz = 0;
+	unsigned char ch;
+
+	while (in < end) {
+		if (stage->state == FSTATE_GROUND) {
+			esc = memchr(in, FILTER_ESC, end - in);
+			if (esc == NULL)
+				esc = end;
+
+			memcpy(&out[outsz], in, esc - in);
+			outsz += esc - in;
+			in = esc;
+			if (in == end)
+				break;
+
+			stage->hold[0] = *in++;
+			stage->holdsz = 1;
+			stage->state = FSTATE_ESC;
+			continue;
+		}
+
+		ch = *in++;
+		stage->hold[stage->holdsz++] = ch;
+		if (stage->state == FSTATE_ESC) {
+			if (ch == '[') {
+				stage->state = FSTATE_CSI;
+				continue;
+			}
+		} else if (ch >= 0x40 && ch <= 0x7e) {
+			/* The end of a CSI sequence. */
+			if (porch_filter_paste_seq(stage))
+				stage->holdsz = 0;
+		} else if (ch >= 0x20 && stage->holdsz < FILTER_MAXHOLD) {
+			continue;
+		}
+
+		/* Whatever it was, it isn't ours; let it through. */
+		memcpy(&out[outsz], stage->hold, stage->holdsz);
+		outsz += stage->holdsz;
+		stage->holdsz = 0;
+		stage->state = FSTATE_GROUND;
+	}
+
+	return (outsz);
+}
+
+static size_t
+porch_filter_stage_apply(struct porch_filter_stage *stage, const char *in,
+    size_t insz, char *out)
+{
+
+	switch (stage->type) {
+	case FILTER_STRIP_ANSI:
+		return (porch_filter_strip_ansi(stage, in, insz, out));
+	case FILTER_CRLF:
+		return (porch_filter_crlf(stage, in, insz, out));
+	case FILTER_BRACKETED_PASTE:
+		return (porch_filter_bracketed_paste(stage, in, insz, out));
+	}
+
+	return (0);
+}
+
+/* Release whatever the stage was holding back, e.g., at EOF. */
+static size_t
+porch_filter_stage_flush(struct porch_filter_stage *stage, char *out)
+{
+	size_t outsz;
+
+	outsz = stage->holdsz;
+	memcpy(out, stage->hold, outsz);
+	stage->holdsz = 0;
+	stage->state = FSTATE_GROUND;
+	return (outsz);
+}
+
+struct porch_filter *
+porch_filter_alloc(void)
+{
+
+	return (porch_mem_calloc(PORCH_MEM_CORE, 1,
+	    sizeof(struct porch_filter)));
+}
+
+void
+porch_filter_free(struct porch_filter *filter)
+{
+
+	if (filter == NULL)
+		return;
+
+	porch_mem_free(filter->stages);
+	porch_mem_free(filter->buf[0]);
+	porch_mem_free(filter->buf[1]);
+	porch_mem_free(filter);
+}
+
+/*
+ * Append the stage called `name` to the chain.  Returns -1 with errno set to
+ * EINVAL if there's no such filter.
+ */
+int
+porch_filter_add(struct porch_filter *filter, const char *name)
+{
+	struct porch_filter_stage *stages;
+	size_t i;
+
+	for (i = 0; i < nitems(porch_filter_types); i++) {
+		if (strcmp(porch_filter_types[i].name, name) == 0)
+			break;
+	}
+
+	if (i == nitems(porch_filter_types)) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	stages = porch_mem_realloc(PORCH_MEM_CORE, filter->stages,
+	    (filter->nstages + 1) * sizeof(*stages));
+	if (stages == NULL)
+		return (-1);
+
+	filter->stages = stages;
+	memset(&stages[filter->nstages], 0, sizeof(*stages));
+	stages[filter->nstages].type = porch_filter_types[i].type;
+	filter->nstages++;
+	return (0);
+}
+
+/*
+ * Run `in` through the chain, or flush everything that the chain is holding
+ * back if `in` is NULL.  The result is only valid until the next call.
+ */
+const char *
+porch_filter_apply(struct porch_filter *filter, const char *in, size_t insz,
+    size_t *outsz)
+{
+	const char *src = in;
+	char *dst, *nbuf;
+	size_t need, srcsz = insz;
+
+	/*
+	 * Each stage may release everything it was holding in addition to what
+	 * it was given, so that bounds how much room we need.
+	 */
+	need = MAX(insz, 1) + filter->nstages * FILTER_MAXHOLD;
+	if (need > filter->bufsz) {
+		for (int i = 0; i < 2; i++) {
+			nbuf = porch_mem_realloc(PORCH_MEM_CORE,
+			    filter->buf[i], need);
+			if (nbuf == NULL)
+				return (NULL);
+			filter->buf[i] = nbuf;
+		}
+
+		filter->bufsz = need;
+	}
+
+	for (size_t i = 0; i < filter->nstages; i++) {
+		struct porch_filter_stage *stage = &filter->stages[i];
+		size_t dstsz;
+
+		dst = filter->buf[i % 2];
+		if (in == NULL) {
+			/*
+			 * Flushing: what an earlier stage released still needs
+			 * to go through this one before it gives up its own.
+			 */
+			dstsz = 0;
+			if (i != 0)
+				dstsz = porch_filter_stage_apply(stage, src,
+				    srcsz, dst);
+			dstsz += porch_filter_stage_flush(stage, &dst[dstsz]);
+		} else {
+			dstsz = porch_filter_stage_apply(stage, src, srcsz, dst);
+		}
+
+		src = dst;
+		srcsz = dstsz;
+	}
+
+	if (src == NULL)
+		src = "";
+	*outsz = srcsz;
+	return (src);
+}
+
+/*
+ * Build a chain from the list of filter names at `idx`, which may be nil or
+ * empty for no chain at all.  Returns 0 on success, or pushes fail and an error
+ * and returns the number of values pushed.
+ */
+int
+porchlua_filter_build(lua_State *L, int idx, struct porch_filter **ofilter)
+{
+	struct porch_filter *filter;
+	const char *name;
+	lua_Integer nfilters;
+
+	*ofilter = NULL;
+	if (lua_isnoneornil(L, idx))
+		return (0);
+
+	luaL_checktype(L, idx, LUA_TTABLE);
+	nfilters = luaL_len(L, idx);
+	if (nfilters == 0)
+		return (0);
+
+	filter = porch_filter_alloc();
+	if (filter == NULL)
+		goto err;
+
+	for (lua_Integer i = 1; i <= nfilters; i++) {
+		lua_geti(L, idx, i);
+		name = lua_tostring(L, -1);
+		if (name == NULL) {
+			porch_filter_free(filter);
+			luaL_pushfail(L);
+			lua_pushfstring(L, "filter at index %d not a string",
+			    (int)i);
+			return (2);
+		}
+
+		if (porch_filter_add(filter, name) != 0) {
+			int serrno = errno;
+
+			porch_filter_free(filter);
+			luaL_pushfail(L);
+			if (serrno == EINVAL)
+				lua_pushfstring(L, "unknown filter '%s'", name);
+			else
+				lua_pushstring(L, strerror(serrno));
+			return (2);
+		}
+
+		lua_pop(L, 1);
+	}
+
+	*ofilter = filter;
+	return (0);
+err:
+	luaL_pushfail(L);
+	lua_pushstring(L, strerror(errno));
+	return (2);
+}
+
+/*
+ * filter(list) -- returns a standalone filter chain, for output that doesn't
+ * come through the core's read path.
+ */
+int
+porchlua_filter(lua_State *L)
+{
+	struct porch_filter **filterp;
+	struct porch_filter *filter;
+	int ret;
+
+	ret = porchlua_filter_build(L, 1, &filter);
+	if (ret != 0)
+		return (ret);
+
+	filterp = lua_newuserdata(L, sizeof(*filterp));
+	*filterp = filter;
+	luaL_setmetatable(L, ORCHLUA_FILTERHANDLE);
+	return (1);
+}
+
+/*
+ * filter:apply(data) -- returns `data` after filtering, or everything that the
+ * chain was holding back if `data` is nil.
+ */
+static int
+porchlua_filter_apply(lua_State *L)
+{
+	struct porch_filter *filter;
+	const char *in, *out;
+	size_t insz, outsz;
+
+	filter = *(struct porch_filter **)luaL_checkudata(L, 1,
+	    ORCHLUA_FILTERHANDLE);
+	in = luaL_optlstring(L, 2, NULL, &insz);
+	if (filter == NULL) {
+		lua_pushlstring(L, in != NULL ? in : "", in != NULL ? insz : 0);
+		return (1);
+	}
+
+	out = porch_filter_apply(filter, in, insz, &outsz);
+	if (out == NULL) {
+		int serrno = errno;
+
+		luaL_pushfail(L);
+		lua_pushstring(L, strerror(serrno));
+		return (2);
+	}
+
+	lua_pushlstring(L, out, outsz);
+	return (1);
+}
+
+static int
+porchlua_filter_gc(lua_State *L)
+{
+	struct porch_filter **filterp;
+
+	filterp = luaL_checkudata(L, 1, ORCHLUA_FILTERHANDLE);
+	porch_filter_free(*filterp);
+	*filterp = NULL;
+	return (0);
+}
+
+static const luaL_Reg porchlua_filter_methods[] = {
+	{ "apply", porchlua_filter_apply },
+	{ NULL, NULL },
+};
+
+static const luaL_Reg porchlua_filter_meta[] = {
+	{ "__index", NULL },	/* Set during registration */
+	{ "__gc", porchlua_filter_gc },
+	{ NULL, NULL },
+};
+
+void
+porchlua_register_filter_metatable(lua_State *L)
+{
+	luaL_newmetatable(L, ORCHLUA_FILTERHANDLE);
+	luaL_setfuncs(L, porchlua_filter_meta, 0);
+
+	luaL_newlibtable(L, porchlua_filter_methods);
+	luaL_setfuncs(L, porchlua_filter_methods, 0);
+	lua_setfield(L, -2, "__index");
+	lua_pop(L, 1);
+}
@@ -56,11 +56,13 @@ struct porch_ipc {
 	struct porch_ipc_msgq		*head;
 	struct porch_ipc_msgq		*tail;
 	int				 sockfd;
+	int				 wrfd;		/* Usually sockfd */
 };
 
 static int porch_ipc_drain(porch_ipc_t);
 static int porch_ipc_pop(porch_ipc_t, struct porch_ipc_msg **);
 static int porch_ipc_poll(porch_ipc_t, bool *);
+static int porch_ipc_poll_write(porch_ipc_t);
 
 int
 porch_ipc_close(porch_ipc_t ipc)
@@ -71,6 +73,10 @@ porch_ipc_close(porch_ipc_t ipc)
 		return (0);
 
 	error = 0;
+	if (ipc->wrfd != -1 && ipc->wrfd != ipc->sockfd)
+		close(ipc->wrfd);
+	ipc->wrfd = -1;
+
 	if (ipc->sockfd != -1) {
 		shutdown(ipc->sockfd, SHUT_WR);
 
@@ -98,23 +104,35 @@ porch_ipc_close(porch_ipc_t ipc)
 	error = porch_ipc_pop(ipc, NULL);
 	assert(ipc->head == NULL);
 
-	free(ipc);
+	porch_mem_free(ipc);
 
 	return (error);
 }
 
 porch_ipc_t
 porch_ipc_open(int fd)
+{
+
+	return (porch_ipc_open_pair(fd, fd));
+}
+
+/*
+ * For when messages come in and go out on different descriptors, e.g., the
+ * stdin and stdout of porch --agent.  Both are closed with the handle.
+ */
+porch_ipc_t
+porch_ipc_open_pair(int rfd, int wfd)
 {
 	porch_ipc_t hdl;
 
-	hdl = malloc(sizeof(*hdl));
+	hdl = porch_mem_alloc(PORCH_MEM_IPC, sizeof(*hdl));
 	if (hdl == NULL)
 		return (NULL);
 
 	memset(&hdl->callbacks[0], 0, sizeof(hdl->callbacks));
 	hdl->head = hdl->tail = NULL;
-	hdl->sockfd = fd;
+	hdl->sockfd = rfd;
+	hdl->wrfd = wfd;
 	return (hdl);
 }
 
@@ -133,7 +151,7 @@ porch_ipc_msg_alloc(enum porch_ipc_tag tag, size_t payloadsz, void **payload)
 	assert(payloadsz == 0 || payload != NULL);
 	assert(tag != IPC_NOXMIT);
 
-	msg = calloc(1, IPC_MSG_SIZE(payloadsz));
+	msg = porch_mem_calloc(PORCH_MEM_IPC, 1, IPC_MSG_SIZE(payloadsz));
 	if (msg == NULL)
 		return (NULL);
 
@@ -174,7 +192,7 @@ void
 porch_ipc_msg_free(struct porch_ipc_msg *msg)
 {
 
-	free(msg);
+	porch_mem_free(msg);
 }
 
 static int
@@ -199,22 +217,40 @@ porch_ipc_drain(porch_ipc_t ipc)
 			goto eof;
 		}
 
+		/*
+		 * A socketpair hands us the whole header at once, but a pipe,
+		 * e.g., to an agent at the other end of an rsh, might not.
+		 */
+		for (off = readsz; off < sizeof(hdr); off += readsz) {
+			readsz = read(ipc->sockfd, (char *)&hdr + off,
+			    sizeof(hdr) - off);
+			if (readsz == -1) {
+				if (errno != EAGAIN ||
+				    porch_ipc_poll(ipc, NULL) == -1)
+					return (-1);
+				readsz = 0;
+			} else if (readsz == 0) {
+				goto eof;
+			}
+		}
+
 		/*
 		 * We might have an empty payload, but we should never have less
 		 * than a header's worth of data.
 		 */
-		if (hdr.size < sizeof(hdr) || hdr.tag == IPC_NOXMIT) {
+		if (hdr.size < sizeof(hdr) || hdr.tag == IPC_NOXMIT ||
+		    hdr.tag >= IPC_LAST) {
 			errno = EINVAL;
 			return (-1);
 		}
 
-		msg = malloc(IPC_MSG_SIZE(hdr.size));
+		msg = porch_mem_alloc(PORCH_MEM_IPC, IPC_MSG_SIZE(hdr.size));
 		if (msg == NULL)
 			return (-1);
 
-		msgq = malloc(sizeof(*msgq));
+		msgq = porch_mem_alloc(PORCH_MEM_IPC, sizeof(*msgq));
 		if (msgq == NULL) {
-			free(msg);
+			porch_mem_free(msg);
 			errno = ENOMEM;
 			return (-1);
 		}
@@ -231,18 +267,18 @@ porch_ipc_drain(porch_ipc_t ipc)
 			readsz = read(ipc->sockfd, &msg->data[off], resid);
 			if (readsz == -1) {
 				if (errno != EAGAIN) {
-					free(msg);
+					porch_mem_free(msg);
 					return (-1);
 				}
 
 				if (porch_ipc_poll(ipc, NULL) == -1) {
-					free(msg);
+					porch_mem_free(msg);
 					return (-1);
 				}
 
 				continue;
 			} else if (readsz == 0) {
-				free(msg);
+				porch_mem_free(msg);
 				msg = NULL;
 
 				goto eof;
@@ -268,6 +304,8 @@ eof:
 
 	assert(ipc->sockfd >= 0);
 	close(ipc->sockfd);
+	if (ipc->wrfd == ipc->sockfd)
+		ipc->wrfd = -1;
 	ipc->sockfd = -1;
 
 	return (0);
@@ -290,7 +328,7 @@ porch_ipc_pop(porch_ipc_t ipc, struct porch_ipc_msg **omsg)
 		/* Free the container */
 		msg = msgq->msg;
 
-		free(msgq);
+		porch_mem_free(msgq);
 		msgq = NULL;
 
 		/* Do we have a handler for it? */
@@ -302,7 +340,7 @@ porch_ipc_pop(porch_ipc_t ipc, struct porch_ipc_msg **omsg)
 			if (error != 0)
 				serr = errno;
 
-			free(msg);
+			porch_mem_free(msg);
 			msg = NULL;
 
 			if (error != 0) {
@@ -323,7 +361,7 @@ porch_ipc_pop(porch_ipc_t ipc, struct porch_ipc_msg **omsg)
 		 * an omsg, we're just draining so we'll free the msg here.
 		 */
 		if (omsg == NULL) {
-			free(msg);
+			porch_mem_free(msg);
 			msg = NULL;
 
 			continue;
@@ -373,9 +411,9 @@ retry:
 	if (porch_ipc_drain(ipc) != 0)
 		return (-1);
 
-	writesz = write(ipc->sockfd, &msg->hdr, sizeof(msg->hdr));
+	writesz = write(ipc->wrfd, &msg->hdr, sizeof(msg->hdr));
 	if (writesz == -1) {
-		if (errno != EAGAIN)
+		if (errno != EAGAIN || porch_ipc_poll_write(ipc) != 0)
 			return (-1);
 		goto retry;
 	} else if ((size_t)writesz < sizeof(msg->hdr)) {
@@ -386,9 +424,9 @@ retry:
 	off = 0;
 	resid = IPC_MSG_PAYLOAD_SIZE(msg);
 	while (resid != 0) {
-		writesz = write(ipc->sockfd, &msg->data[off], resid);
+		writesz = write(ipc->wrfd, &msg->data[off], resid);
 		if (writesz == -1) {
-			if (errno != EAGAIN)
+			if (errno != EAGAIN || porch_ipc_poll_write(ipc) != 0)
 				return (-1);
 			continue;
 		}
@@ -436,6 +474,48 @@ porch_ipc_poll(porch_ipc_t ipc, bool *eof_seen)
 	return (error);
 }
 
+/*
+ * Wait for room to write on a non-blocking descriptor, e.g., porch --agent's
+ * stdout over a slow rsh, rather than spinning on EAGAIN.  We keep reading
+ * while the other side catches up, in case it's stuck trying to send us
+ * something, too.
+ */
+static int
+porch_ipc_poll_write(porch_ipc_t ipc)
+{
+	fd_set rfd, wfd;
+	int maxfd;
+
+	for (;;) {
+		if (ipc->wrfd == -1) {
+			errno = EPIPE;
+			return (-1);
+		}
+
+		FD_ZERO(&rfd);
+		FD_ZERO(&wfd);
+		FD_SET(ipc->wrfd, &wfd);
+		maxfd = ipc->wrfd;
+		if (ipc->sockfd != -1) {
+			FD_SET(ipc->sockfd, &rfd);
+			if (ipc->sockfd > maxfd)
+				maxfd = ipc->sockfd;
+		}
+
+		if (select(maxfd + 1, &rfd, &wfd, NULL, NULL) == -1) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+
+		if (FD_ISSET(ipc->wrfd, &wfd))
+			return (0);
+		if (ipc->sockfd != -1 && FD_ISSET(ipc->sockfd, &rfd) &&
+		    porch_ipc_drain(ipc) != 0)
+			return (-1);
+	}
+}
+
 int
 porch_ipc_wait(porch_ipc_t ipc, bool *eof_seen)
 {
@@ -0,0 +1,478 @@
+/*-
+ * Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sys/param.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "porch_lua.h"
+
+/*
+ * Process logs, written off of the read path.  Chunks are copied into the front
+ * half of a double buffer, and a writer thread swaps the halves and writes out
+ * the back one whenever enough has piled up or enough time has passed.  A slow
+ * disk then only costs us the copy; if the writer falls so far behind that the
+ * front half fills up, chunks are dropped and counted rather than stalling the
+ * script and, in turn, the process writing into a full pty.
+ *
+ * The writer thread only ever touches the log's own state and its fd; both
+ * halves are allocated and freed by the Lua thread, since porch_mem's counters
+ * aren't safe to touch from anywhere else.
+ */
+
+#define	LOG_DEFAULT_BUFSZ	(256 * 1024)
+#define	LOG_DEFAULT_INTERVAL	0.1	/* seconds */
+
+struct porch_log {
+	pthread_mutex_t		 lock;
+	pthread_cond_t		 wakeup;	/* To the writer */
+	pthread_cond_t		 drained;	/* From the writer */
+	pthread_t		 thread;
+	char			*buf[2];
+	size_t			 bufsz;
+	size_t			 fill;		/* Of the front half */
+	size_t			 threshold;
+	struct timespec		 interval;
+	uint64_t		 written;
+	uint64_t		 dropped;
+	uint64_t		 writes;	/* write(2) calls */
+	uint64_t		 flushgen;	/* Flushes requested */
+	uint64_t		 flushed;	/* ... and completed */
+	int			 front;
+	int			 fd;
+	int			 error;
+	bool			 owned;		/* We opened the fd */
+	bool			 closing;
+	bool			 closed;
+};
+
+static void
+porch_log_deadline(const struct porch_log *log, struct timespec *ts)
+{
+
+	clock_gettime(CLOCK_REALTIME, ts);
+	ts->tv_sec += log->interval.tv_sec;
+	ts->tv_nsec += log->interval.tv_nsec;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+static void *
+porch_log_writer(void *arg)
+{
+	struct porch_log *log = arg;
+	struct timespec deadline;
+	const char *p;
+	size_t len;
+	ssize_t nw;
+	uint64_t gen;
+	int error;
+
+	pthread_mutex_lock(&log->lock);
+	for (;;) {
+		/*
+		 * Sleep until the front half passes the threshold, a flush is
+		 * requested, or the interval is up with something to write.
+		 */
+		porch_log_deadline(log, &deadline);
+		while (!log->closing && log->flushed == log->flushgen &&
+		    log->fill < log->threshold) {
+			if (pthread_cond_timedwait(&log->wakeup, &log->lock,
+			    &deadline) == ETIMEDOUT) {
+				if (log->fill > 0)
+					break;
+				porch_log_deadline(log, &deadline);
+			}
+		}
+
+		gen = log->flushgen;
+		len = log->fill;
+		p = log->buf[log->front];
+		log->front = !log->front;
+		log->fill = 0;
+		pthread_mutex_unlock(&log->lock);
+
+		/* The Lua thread only appends to the new front half. */
+		error = 0;
+		while (len > 0) {
+			nw = write(log->fd, p, len);
+			if (nw == -1) {
+				if (errno == EINTR)
+					continue;
+				error = errno;
+				break;
+			}
+
+			pthread_mutex_lock(&log->lock);
+			log->written += nw;
+			log->writes++;
+			pthread_mutex_unlock(&log->lock);
+
+			p += nw;
+			len -= nw;
+		}
+
+		pthread_mutex_lock(&log->lock);
+		if (error != 0) {
+			/* Whatever we couldn't write is as good as dropped. */
+			log->dropped += len;
+			if (log->error == 0)
+				log->error = error;
+		}
+
+		log->flushed = gen;
+		pthread_cond_broadcast(&log->drained);
+		if (log->closing && log->fill == 0)
+			break;
+	}
+	pthread_mutex_unlock(&log->lock);
+
+	return (NULL);
+}
+
+static int
+porch_log_open(struct porch_log *log, int fd, bool owned, size_t bufsz,
+    size_t threshold, double interval)
+{
+	int error;
+
+	memset(log, 0, sizeof(*log));
+	log->fd = fd;
+	log->owned = owned;
+	log->bufsz = bufsz;
+	log->threshold = threshold;
+	log->interval.tv_sec = (time_t)interval;
+	log->interval.tv_nsec = (long)((interval - floor(interval)) * 1e9);
+
+	for (int i = 0; i < 2; i++) {
+		log->buf[i] = porch_mem_alloc(PORCH_MEM_LOG, bufsz);
+		if (log->buf[i] == NULL)
+			goto nomem;
+	}
+
+	pthread_mutex_init(&log->lock, NULL);
+	pthread_cond_init(&log->wakeup, NULL);
+	pthread_cond_init(&log->drained, NULL);
+
+	error = pthread_create(&log->thread, NULL, porch_log_writer, log);
+	if (error != 0) {
+		pthread_cond_destroy(&log->drained);
+		pthread_cond_destroy(&log->wakeup);
+		pthread_mutex_destroy(&log->lock);
+		porch_mem_free(log->buf[0]);
+		porch_mem_free(log->buf[1]);
+		errno = error;
+		return (-1);
+	}
+
+	return (0);
+nomem:
+	porch_mem_free(log->buf[0]);
+	errno = ENOMEM;
+	return (-1);
+}
+
+/*
+ * Copy a chunk into the front half.  Chunks are kept whole, so one that won't
+ * fit is dropped entirely.
+ */
+static void
+porch_log_append(struct porch_log *log, const char *data, size_t len)
+{
+
+	pthread_mutex_lock(&log->lock);
+	if (log->fill + len > log->bufsz) {
+		log->dropped += len;
+	} else {
+		memcpy(&log->buf[log->front][log->fill], data, len);
+		log->fill += len;
+		if (log->fill >= log->threshold)
+			pthread_cond_signal(&log->wakeup);
+	}
+	pthread_mutex_unlock(&log->lock);
+}
+
+/*
+ * Wait for everything appended so far to be written out.
+ */
+static int
+porch_log_flush(struct porch_log *log)
+{
+	uint64_t gen;
+	int error;
+
+	pthread_mutex_lock(&log->lock);
+	gen = ++log->flushgen;
+	pthread_cond_signal(&log->wakeup);
+	while (log->flushed < gen)
+		pthread_cond_wait(&log->drained, &log->lock);
+	error = log->error;
+	pthread_mutex_unlock(&log->lock);
+
+	return (error);
+}
+
+static int
+porch_log_close(struct porch_log *log)
+{
+	int error;
+
+	if (log->closed)
+		return (0);
+
+	pthread_mutex_lock(&log->lock);
+	log->closing = true;
+	pthread_cond_signal(&log->wakeup);
+	pthread_mutex_unlock(&log->lock);
+
+	/* The writer drains the front half before it exits. */
+	pthread_join(log->thread, NULL);
+	pthread_cond_destroy(&log->drained);
+	pthread_cond_destroy(&log->wakeup);
+	pthread_mutex_destroy(&log->lock);
+
+	porch_mem_free(log->buf[0]);
+	porch_mem_free(log->buf[1]);
+	log->buf[0] = log->buf[1] = NULL;
+
+	error = log->error;
+	if (log->owned && close(log->fd) != 0 && error == 0)
+		error = errno;
+
+	log->closed = true;
+	return (error);
+}
+
+/*
+ * logfile(file[, cfg]) -- `file` is either a path to open for appending, or an
+ * open Lua file handle that remains the caller's to close once we're done with
+ * it.  The optional `cfg` table may set:
+ *  - buffer: the size of each half of the buffer, in bytes
+ *  - threshold: bytes buffered before the writer is woken up, half of the
+ *    buffer by default
+ *  - interval: seconds after which anything buffered is written regardless,
+ *    0.1 by default
+ */
+int
+porchlua_logfile(lua_State *L)
+{
+	struct porch_log *log;
+	luaL_Stream *stream;
+	const char *path;
+	lua_Integer bufsz, threshold;
+	lua_Number interval;
+	int fd;
+	bool owned;
+
+	bufsz = LOG_DEFAULT_BUFSZ;
+	threshold = -1;
+	interval = LOG_DEFAULT_INTERVAL;
+	if (!lua_isnoneornil(L, 2)) {
+		luaL_checktype(L, 2, LUA_TTABLE);
+
+		if (lua_getfield(L, 2, "buffer") != LUA_TNIL)
+			bufsz = luaL_checkinteger(L, -1);
+		if (lua_getfield(L, 2, "threshold") != LUA_TNIL)
+			threshold = luaL_checkinteger(L, -1);
+		if (lua_getfield(L, 2, "interval") != LUA_TNIL)
+			interval = luaL_checknumber(L, -1);
+		lua_pop(L, 3);
+
+		if (bufsz <= 0)
+			return (luaL_error(L, "buffer must be positive"));
+		if (threshold == 0 || threshold > bufsz)
+			return (luaL_error(L,
+			    "threshold must be between 1 and the buffer size"));
+		if (!(interval > 0))
+			return (luaL_error(L, "interval must be positive"));
+	}
+
+	if (threshold < 0)
+		threshold = MAX(bufsz / 2, 1);
+
+	stream = luaL_testudata(L, 1, LUA_FILEHANDLE);
+	if (stream != NULL) {
+		if (stream->closef == NULL)
+			return (luaL_error(L, "attempt to log to a closed file"));
+
+		/* Anything it already buffered has to come first. */
+		fflush(stream->f);
+		fd = fileno(stream->f);
+		owned = false;
+	} else {
+		path = luaL_checkstring(L, 1);
+		fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+		    0644);
+		if (fd == -1)
+			goto err;
+		owned = true;
+	}
+
+	log = lua_newuserdata(L, sizeof(*log));
+	log->closed = true;	/* Until it's open, for __gc */
+	luaL_setmetatable(L, ORCHLUA_LOGHANDLE);
+
+	/* Hold onto the file handle so that it can't be collected under us. */
+	lua_pushvalue(L, 1);
+	lua_setuservalue(L, -2);
+
+	if (porch_log_open(log, fd, owned, bufsz, threshold, interval) != 0) {
+		int serrno = errno;
+
+		log->closed = true;
+		if (owned)
+			close(fd);
+		errno = serrno;
+		goto err;
+	}
+
+	return (1);
+err:
+	luaL_pushfail(L);
+	lua_pushstring(L, strerror(errno));
+	return (2);
+}
+
+static struct porch_log *
+porchlua_log_check(lua_State *L)
+{
+	struct porch_log *log;
+
+	log = luaL_checkudata(L, 1, ORCHLUA_LOGHANDLE);
+	if (log->closed)
+		luaL_error(L, "attempt to use a closed log");
+
+	return (log);
+}
+
+static int
+porchlua_log_write(lua_State *L)
+{
+	struct porch_log *log;
+	const char *data;
+	size_t datasz;
+
+	log = porchlua_log_check(L);
+	data = luaL_checklstring(L, 2, &datasz);
+
+	if (datasz > 0)
+		porch_log_append(log, data, datasz);
+
+	lua_pushboolean(L, 1);
+	return (1);
+}
+
+static int
+porchlua_log_flush(lua_State *L)
+{
+	struct porch_log *log;
+	int error;
+
+	log = porchlua_log_check(L);
+	if ((error = porch_log_flush(log)) != 0) {
+		luaL_pushfail(L);
+		lua_pushstring(L, strerror(error));
+		return (2);
+	}
+
+	lua_pushboolean(L, 1);
+	return (1);
+}
+
+static int
+porchlua_log_close(lua_State *L)
+{
+	struct porch_log *log;
+	int error;
+
+	log = luaL_checkudata(L, 1, ORCHLUA_LOGHANDLE);
+	if ((error = porch_log_close(log)) != 0) {
+		luaL_pushfail(L);
+		lua_pushstring(L, strerror(error));
+		return (2);
+	}
+
+	lua_pushboolean(L, 1);
+	return (1);
+}
+
+static int
+porchlua_log_stats(lua_State *L)
+{
+	struct porch_log *log;
+	bool locked;
+
+	log = luaL_checkudata(L, 1, ORCHLUA_LOGHANDLE);
+
+	/* A closed log's writer is gone, so its counters are settled. */
+	locked = !log->closed;
+	if (locked)
+		pthread_mutex_lock(&log->lock);
+
+	lua_createtable(L, 0, 4);
+	lua_pushinteger(L, log->written);
+	lua_setfield(L, -2, "written");
+	lua_pushinteger(L, log->dropped);
+	lua_setfield(L, -2, "dropped");
+	lua_pushinteger(L, log->writes);
+	lua_setfield(L, -2, "writes");
+	lua_pushinteger(L, log->fill);
+	lua_setfield(L, -2, "pending");
+
+	if (locked)
+		pthread_mutex_unlock(&log->lock);
+	return (1);
+}
+
+static int
+porchlua_log_gc(lua_State *L)
+{
+	struct porch_log *log;
+
+	log = luaL_checkudata(L, 1, ORCHLUA_LOGHANDLE);
+	(void)porch_log_close(log);
+	return (0);
+}
+
+#define	LOG_SIMPLE(n)	{ #n, porchlua_log_ ## n }
+static const luaL_Reg porchlua_log[] = {
+	LOG_SIMPLE(close),
+	LOG_SIMPLE(flush),
+	LOG_SIMPLE(stats),
+	LOG_SIMPLE(write),
+	{ NULL, NULL },
+};
+
+static const luaL_Reg porchlua_log_meta[] = {
+	{ "__index", NULL },	/* Set during registration */
+	{ "__gc", porchlua_log_gc },
+	{ "__close", porchlua_log_gc },
+	{ NULL, NULL },
+};
+
+void
+porchlua_register_log_metatable(lua_State *L)
+{
+
+	luaL_newmetatable(L, ORCHLUA_LOGHANDLE);
+	luaL_setfuncs(L, porchlua_log_meta, 0);
+
+	luaL_newlibtable(L, porchlua_log);
+	luaL_setfuncs(L, porchlua_log, 0);
+	lua_setfield(L, -2, "__index");
+
+	lua_pop(L, 1);
+}
@@ -44,6 +44,32 @@
 #endif
 
 #define	ORCHLUA_REGEXHANDLE	"porchlua_regex_t"
+#define	ORCHLUA_PATCACHE	"porchlua_pattern_cache"
+
+#define	PATCACHE_DEFAULT	64
+
+/*
+ * Compiled patterns, both posix regular expressions and lua patterns, are
+ * interned in a per-state LRU cache keyed on the matcher, pattern and flags, so
+ * that matching the same pattern over and over only compiles it once.  The
+ * cache's userdata lives in the registry and holds the LRU list, while its user
+ * value is the table that maps keys to the compiled userdata and keeps the
+ * cached ones alive.
+ */
+struct porchlua_cache {
+	struct porchlua_cache_entry	*head;		/* Most recently used */
+	struct porchlua_cache_entry	*tail;
+	size_t				 entries;
+	size_t				 limit;
+	lua_Integer			 hits;
+	lua_Integer			 misses;
+};
+
+struct porchlua_regex {
+	struct porchlua_cache_entry	 entry;
+	regex_t				 regex;
+	bool				 compiled;
+};
 
 static struct porchlua_cfg {
 	int			 dirfd;
@@ -138,6 +164,61 @@ porchlua_gid(lua_State *L)
 	return (1);
 }
 
+/*
+ * lines(str[, init]) -- split the complete lines in `str` from `init` onward
+ * into a table, with their LF or CRLF endings stripped.  Also returns the
+ * position just past the last complete line, where the partial line, if any,
+ * starts.
+ */
+static int
+porchlua_lines(lua_State *L)
+{
+	const char *end, *line, *nl, *str;
+	size_t linesz, strsz;
+	lua_Integer init;
+	int nlines;
+
+	str = luaL_checklstring(L, 1, &strsz);
+	init = luaL_optinteger(L, 2, 1);
+	init = MAX(init, 1);
+	init = MIN(init, (lua_Integer)strsz + 1);
+
+	end = &str[strsz];
+	line = &str[init - 1];
+	nlines = 0;
+
+	lua_newtable(L);
+	while ((nl = memchr(line, '\n', end - line)) != NULL) {
+		linesz = nl - line;
+		if (linesz > 0 && line[linesz - 1] == '\r')
+			linesz--;
+
+		lua_pushlstring(L, line, linesz);
+		lua_rawseti(L, -2, ++nlines);
+		line = nl + 1;
+	}
+
+	lua_pushinteger(L, line - str + 1);
+	return (2);
+}
+
+/*
+ * monotime() -- a fractional number of seconds on the monotonic clock, for
+ * when time() is far too coarse (e.g., measuring latencies).
+ */
+static int
+porchlua_monotime(lua_State *L)
+{
+	struct timespec tv;
+	int error __diagused;
+
+	error = clock_gettime(CLOCK_MONOTONIC, &tv);
+	assert(error == 0);
+
+	lua_pushnumber(L, (lua_Number)tv.tv_sec + (lua_Number)tv.tv_nsec / 1e9);
+	return (1);
+}
+
 static int
 porchlua_open(lua_State *L)
 {
@@ -236,24 +317,227 @@ porchlua_open(lua_State *L)
 	return (rvals);
 }
 
+/*
+ * Push the cache's lookup table and return the cache.
+ */
+static struct porchlua_cache *
+porchlua_cache_get(lua_State *L)
+{
+	struct porchlua_cache *cache;
+
+	lua_getfield(L, LUA_REGISTRYINDEX, ORCHLUA_PATCACHE);
+	cache = lua_touserdata(L, -1);
+	lua_getuservalue(L, -1);
+	lua_remove(L, -2);
+	return (cache);
+}
+
+static void
+porchlua_cache_link(struct porchlua_cache *cache,
+    struct porchlua_cache_entry *entry)
+{
+
+	entry->prev = NULL;
+	entry->next = cache->head;
+	if (cache->head != NULL)
+		cache->head->prev = entry;
+	else
+		cache->tail = entry;
+	cache->head = entry;
+	cache->entries++;
+}
+
+static void
+porchlua_cache_unlink(struct porchlua_cache *cache,
+    struct porchlua_cache_entry *entry)
+{
+
+	if (entry->prev != NULL)
+		entry->prev->next = entry->next;
+	else
+		cache->head = entry->next;
+	if (entry->next != NULL)
+		entry->next->prev = entry->prev;
+	else
+		cache->tail = entry->prev;
+
+	entry->prev = entry->next = NULL;
+	cache->entries--;
+}
+
+/*
+ * Drop the least recently used pattern from the cache; anyone still holding it
+ * can keep using it, and it will be freed once they're done with it.
+ */
+static void
+porchlua_cache_evict(lua_State *L, struct porchlua_cache *cache, int tidx)
+{
+	struct porchlua_cache_entry *entry;
+
+	entry = cache->tail;
+	assert(entry != NULL);
+
+	porchlua_cache_unlink(cache, entry);
+
+	lua_pushlstring(L, entry->key, entry->keysz);
+	lua_pushnil(L);
+	lua_rawset(L, tidx);
+
+	porchlua_cache_release(entry);
+}
+
+/*
+ * Look up `key` in the cache, pushing the compiled pattern and returning true
+ * if it's there.  Nothing is pushed on a miss.
+ */
+bool
+porchlua_cache_fetch(lua_State *L, const char *key, size_t keysz)
+{
+	struct porchlua_cache *cache;
+	struct porchlua_cache_entry *entry;
+
+	cache = porchlua_cache_get(L);
+	lua_pushlstring(L, key, keysz);
+	if (lua_rawget(L, -2) == LUA_TNIL) {
+		lua_pop(L, 2);
+		cache->misses++;
+		return (false);
+	}
+
+	entry = lua_touserdata(L, -1);
+	lua_remove(L, -2);
+
+	cache->hits++;
+	porchlua_cache_unlink(cache, entry);
+	porchlua_cache_link(cache, entry);
+	return (true);
+}
+
+/*
+ * Cache the compiled pattern at the top of the stack, which starts with
+ * `entry`, under `key`.  It's left on the stack either way.
+ */
+void
+porchlua_cache_insert(lua_State *L, struct porchlua_cache_entry *entry,
+    const char *key, size_t keysz)
+{
+	struct porchlua_cache *cache;
+	int tidx;
+
+	cache = porchlua_cache_get(L);
+	tidx = lua_gettop(L);
+
+	/* If we can't stash the key, it just doesn't get cached. */
+	if (cache->limit == 0 ||
+	    (entry->key = porch_mem_alloc(PORCH_MEM_CORE, keysz)) == NULL) {
+		lua_pop(L, 1);
+		return;
+	}
+
+	memcpy(entry->key, key, keysz);
+	entry->keysz = keysz;
+	entry->shared = true;
+
+	lua_pushlstring(L, key, keysz);
+	lua_pushvalue(L, tidx - 1);
+	lua_rawset(L, tidx);
+
+	porchlua_cache_link(cache, entry);
+	while (cache->entries > cache->limit)
+		porchlua_cache_evict(L, cache, tidx);
+
+	lua_pop(L, 1);
+}
+
+/*
+ * Cached patterns are only collected along with the cache, at which point the
+ * LRU list is going away, too, so there's no need to unlink.
+ */
+void
+porchlua_cache_release(struct porchlua_cache_entry *entry)
+{
+
+	porch_mem_free(entry->key);
+	entry->key = NULL;
+	entry->keysz = 0;
+}
+
+static int
+porchlua_regcache(lua_State *L)
+{
+	struct porchlua_cache *cache;
+	lua_Integer limit;
+	int tidx;
+
+	limit = luaL_optinteger(L, 1, -1);
+	luaL_argcheck(L, limit >= 0 || lua_isnoneornil(L, 1), 1,
+	    "limit must be non-negative");
+	lua_settop(L, 1);
+
+	cache = porchlua_cache_get(L);
+	tidx = lua_gettop(L);
+
+	if (limit >= 0) {
+		cache->limit = limit;
+		while (cache->entries > cache->limit)
+			porchlua_cache_evict(L, cache, tidx);
+	}
+
+	lua_createtable(L, 0, 4);
+	lua_pushinteger(L, cache->entries);
+	lua_setfield(L, -2, "entries");
+	lua_pushinteger(L, cache->limit);
+	lua_setfield(L, -2, "limit");
+	lua_pushinteger(L, cache->hits);
+	lua_setfield(L, -2, "hits");
+	lua_pushinteger(L, cache->misses);
+	lua_setfield(L, -2, "misses");
+	return (1);
+}
+
+/*
+ * regcomp(pattern[, flags]) -- compile `pattern` as an extended regular
+ * expression, or fetch it from the cache if it was compiled recently.  `flags`
+ * may contain "i" for REG_ICASE and "n" for REG_NEWLINE.
+ */
 static int
 porchlua_regcomp(lua_State *L)
 {
-	const char *pattern;
-	regex_t *regex;
-	int error;
+	struct porchlua_regex *regex;
+	const char *flags, *key, *pattern;
+	size_t keysz;
+	int cflags, error;
 
 	pattern = luaL_checkstring(L, 1);
+	flags = luaL_optstring(L, 2, "");
+
+	cflags = REG_EXTENDED;
+	for (const char *flag = flags; *flag != '\0'; flag++) {
+		switch (*flag) {
+		case 'i':
+			cflags |= REG_ICASE;
+			break;
+		case 'n':
+			cflags |= REG_NEWLINE;
+			break;
+		default:
+			return (luaL_argerror(L, 2, "unknown regex flag"));
+		}
+	}
 
-	regex = lua_newuserdata(L, sizeof(*regex));
-	luaL_setmetatable(L, ORCHLUA_REGEXHANDLE);
+	key = lua_pushfstring(L, "posix:%d:%s", cflags, pattern);
+	keysz = lua_rawlen(L, -1);
+	if (porchlua_cache_fetch(L, key, keysz))
+		return (1);
 
-	if ((error = regcomp(regex, pattern, REG_EXTENDED)) != 0) {
+	regex = lua_newuserdata(L, sizeof(*regex));
+	memset(regex, 0, sizeof(*regex));
+	if ((error = regcomp(&regex->regex, pattern, cflags)) != 0) {
 		char errbuf[64];
 
-		(void)regerror(error, regex, errbuf, sizeof(errbuf));
+		(void)regerror(error, &regex->regex, errbuf, sizeof(errbuf));
 
-		/* Pop the regex_t */
+		/* Pop the regex */
 		lua_pop(L, 1);
 
 		luaL_pushfail(L);
@@ -261,6 +545,10 @@ porchlua_regcomp(lua_State *L)
 		return (2);
 	}
 
+	regex->compiled = true;
+	luaL_setmetatable(L, ORCHLUA_REGEXHANDLE);
+
+	porchlua_cache_insert(L, &regex->entry, key, keysz);
 	return (1);
 }
 
@@ -315,9 +603,30 @@ porchlua_spawn(lua_State *L)
 {
 	struct porch_process *proc;
 	const char **argv;
-	int argc;
+	int argbase, argc;
+	bool pty, split_stderr;
 
-	if (lua_gettop(L) == 0) {
+	/*
+	 * An options table may precede the command: `pty` may be set to false
+	 * to connect the process to a socket rather than a terminal, and
+	 * `stderr` may be set to "separate" to give stderr a pipe of its own.
+	 */
+	argbase = 1;
+	pty = true;
+	split_stderr = false;
+	if (lua_type(L, 1) == LUA_TTABLE) {
+		static const char *stderr_modes[] = { "merged", "separate", NULL };
+
+		if (lua_getfield(L, 1, "pty") != LUA_TNIL)
+			pty = lua_toboolean(L, -1);
+		if (lua_getfield(L, 1, "stderr") != LUA_TNIL)
+			split_stderr = luaL_checkoption(L, -1, NULL,
+			    stderr_modes) == 1;
+		lua_pop(L, 2);
+		argbase++;
+	}
+
+	if (lua_gettop(L) < argbase) {
 		luaL_pushfail(L);
 		lua_pushstring(L, "No command specified to spawn");
 		return (2);
@@ -327,8 +636,8 @@ porchlua_spawn(lua_State *L)
 	 * The script can table.unpack its args, so we'll expect all strings even if
 	 * they choose to build it up via table.
 	 */
-	argc = lua_gettop(L);
-	argv = calloc(argc + 1, sizeof(*argv));
+	argc = lua_gettop(L) - argbase + 1;
+	argv = porch_mem_calloc(PORCH_MEM_CORE, argc + 1, sizeof(*argv));
 	if (argv == NULL) {
 		int serrno = 0;
 
@@ -338,11 +647,12 @@ porchlua_spawn(lua_State *L)
 	}
 
 	for (int i = 0; i < argc; i++) {
-		argv[i] = lua_tostring(L, i + 1);
+		argv[i] = lua_tostring(L, i + argbase);
 		if (argv[i] == NULL) {
-			free(argv);
+			porch_mem_free(argv);
 			luaL_pushfail(L);
-			lua_pushfstring(L, "Argument at index %d not a string", i + 1);
+			lua_pushfstring(L, "Argument at index %d not a string",
+			    i + argbase);
 			return (2);
 		}
 
@@ -359,10 +669,19 @@ porchlua_spawn(lua_State *L)
 	proc->L = L;
 	proc->last_signal = -1;
 	proc->term = NULL;
+	memset(&proc->stats, 0, sizeof(proc->stats));
+	proc->record = NULL;
+	proc->vt = NULL;
+	proc->filter = NULL;
+	memset(&proc->read_timer, 0, sizeof(proc->read_timer));
+	memset(&proc->pulse_timer, 0, sizeof(proc->pulse_timer));
 	proc->status = 0;
 	proc->pid = 0;
 	proc->buffered = proc->eof = proc->released = proc->draining = false;
 	proc->error = false;
+	proc->pty = pty;
+	proc->split_stderr = split_stderr;
+	proc->errctl = -1;
 	proc->uid = geteuid();
 	proc->gid = getegid();
 
@@ -374,7 +693,7 @@ porchlua_spawn(lua_State *L)
 	if (sigprocmask(SIG_SETMASK, NULL, &proc->sigmask) != 0) {
 		int serrno = errno;
 
-		free(argv);
+		porch_mem_free(argv);
 
 		luaL_pushfail(L);
 		lua_pushstring(L, strerror(serrno));
@@ -385,7 +704,7 @@ porchlua_spawn(lua_State *L)
 	if (porch_fetch_sigcaught(&proc->sigcaughtmask) != 0) {
 		int serrno = errno;
 
-		free(argv);
+		porch_mem_free(argv);
 
 		luaL_pushfail(L);
 		lua_pushstring(L, strerror(serrno));
@@ -394,17 +713,20 @@ porchlua_spawn(lua_State *L)
 
 	luaL_setmetatable(L, ORCHLUA_PROCESSHANDLE);
 
+	porch_trace_begin("core", "spawn", NULL);
 	if (porch_spawn(argc, argv, proc, &porchlua_child_error) != 0) {
 		int serrno = errno;
 
-		free(argv);
+		porch_trace_end("core", "spawn", NULL);
+		porch_mem_free(argv);
 
 		luaL_pushfail(L);
 		lua_pushstring(L, strerror(serrno));
 		return (2);
 	}
 
-	free(argv);
+	porch_trace_end("core", "spawn", "\"pid\":%d", (int)proc->pid);
+	porch_mem_free(argv);
 
 	return (1);
 }
@@ -432,14 +754,31 @@ porchlua_uid(lua_State *L)
 
 #define	REG_SIMPLE(n)	{ #n, porchlua_ ## n }
 static const struct luaL_Reg porchlib[] = {
+	{ "exec", porchlua_process_exec },
+	REG_SIMPLE(agent),
+	REG_SIMPLE(filter),
 	REG_SIMPLE(gid),
+	REG_SIMPLE(lines),
+	REG_SIMPLE(logfile),
+	REG_SIMPLE(luapat),
+	REG_SIMPLE(memacct),
+	REG_SIMPLE(memstats),
+	REG_SIMPLE(monotime),
 	REG_SIMPLE(open),
+	REG_SIMPLE(plain),
+	REG_SIMPLE(regcache),
 	REG_SIMPLE(regcomp),
 	REG_SIMPLE(reset),
+	REG_SIMPLE(sched),
 	REG_SIMPLE(sleep),
 	REG_SIMPLE(spawn),
 	REG_SIMPLE(time),
+	REG_SIMPLE(timer),
+	{ "trace_begin", porchlua_trace_begin },
+	{ "trace_end", porchlua_trace_end },
+	{ "tracing", porchlua_tracing },
 	REG_SIMPLE(uid),
+	REG_SIMPLE(vt),
 	{ "wrap_status", porchlua_process_wrap_status },
 	{ NULL, NULL },
 };
@@ -502,21 +841,27 @@ static int
 porchlua_regex_find(lua_State *L)
 {
 	const char *subject;
-	regex_t *self;
+	struct porchlua_regex *self;
 	regmatch_t match;
 	int error;
 
 	self = luaL_checkudata(L, 1, ORCHLUA_REGEXHANDLE);
 	subject = luaL_checkstring(L, 2);
 
-	error = regexec(self, subject, 1, &match, 0);
+	if (!self->compiled) {
+		luaL_pushfail(L);
+		lua_pushstring(L, "regex is closed");
+		return (2);
+	}
+
+	error = regexec(&self->regex, subject, 1, &match, 0);
 	if (error != 0) {
 		if (error == REG_NOMATCH) {
 			lua_pushnil(L);
 			return (1);
 		}
 
-		return (porchlua_regex_error(L, self, error));
+		return (porchlua_regex_error(L, &self->regex, error));
 	}
 
 	/*
@@ -529,13 +874,38 @@ porchlua_regex_find(lua_State *L)
 	return (2);
 }
 
+/*
+ * A regex that has ever been cached may have been handed out to other users of
+ * the same pattern, even if it's since been evicted, so an explicit close
+ * leaves it to the collector to free once the last of them is done with it.
+ */
 static int
 porchlua_regex_close(lua_State *L)
 {
-	regex_t *self;
+	struct porchlua_regex *self;
 
 	self = luaL_checkudata(L, 1, ORCHLUA_REGEXHANDLE);
-	regfree(self);
+	if (!self->entry.shared && self->compiled) {
+		regfree(&self->regex);
+		self->compiled = false;
+	}
+
+	return (0);
+}
+
+static int
+porchlua_regex_gc(lua_State *L)
+{
+	struct porchlua_regex *self;
+
+	self = luaL_checkudata(L, 1, ORCHLUA_REGEXHANDLE);
+	porchlua_cache_release(&self->entry);
+
+	if (self->compiled) {
+		regfree(&self->regex);
+		self->compiled = false;
+	}
+
 	return (0);
 }
 
@@ -547,7 +917,7 @@ static const luaL_Reg porchlua_regex[] = {
 
 static const luaL_Reg porchlua_regex_meta[] = {
 	{ "__index", NULL },	/* Set during registration */
-	{ "__gc", porchlua_regex_close },
+	{ "__gc", porchlua_regex_gc },
 	{ "__close", porchlua_regex_close },
 	{ NULL, NULL },
 };
@@ -565,6 +935,21 @@ porchlua_register_regex_metatable(lua_State *L)
 	lua_pop(L, 1);
 }
 
+static void
+porchlua_register_cache(lua_State *L)
+{
+	struct porchlua_cache *cache;
+
+	cache = lua_newuserdata(L, sizeof(*cache));
+	memset(cache, 0, sizeof(*cache));
+	cache->limit = PATCACHE_DEFAULT;
+
+	lua_newtable(L);
+	lua_setuservalue(L, -2);
+
+	lua_setfield(L, LUA_REGISTRYINDEX, ORCHLUA_PATCACHE);
+}
+
 static int
 porchlua_add_execpath(const char *path)
 {
@@ -596,13 +981,23 @@ int
 luaopen_porch_core(lua_State *L)
 {
 
+	porch_trace_init();
+	porch_mem_init(L);
 	luaL_newlib(L, porchlib);
 
 	porchlua_install_signals(L);
 	porchlua_setup_tty(L);
 
+	porchlua_register_agent_metatable(L);
+	porchlua_register_filter_metatable(L);
+	porchlua_register_log_metatable(L);
+	porchlua_register_luapat_metatable(L);
+	porchlua_register_plain_metatable(L);
 	porchlua_register_process_metatable(L);
 	porchlua_register_regex_metatable(L);
+	porchlua_register_timer_metatable(L);
+	porchlua_register_vt_metatable(L);
+	porchlua_register_cache(L);
 
 	return (1);
 }
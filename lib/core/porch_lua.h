@@ -9,7 +9,56 @@
 #include "porch.h"
 #include "porch_lib.h"
 
+#define	ORCHLUA_AGENTHANDLE	"porchlua_agent"
+#define	ORCHLUA_FILTERHANDLE	"porchlua_filter"
+#define	ORCHLUA_LOGHANDLE	"porchlua_log"
+#define	ORCHLUA_LUAPATHANDLE	"porchlua_luapat"
+#define	ORCHLUA_PLAINHANDLE	"porchlua_plain"
 #define	ORCHLUA_PROCESSHANDLE	"porchlua_process"
+#define	ORCHLUA_TIMERHANDLE	"porchlua_timer"
+#define	ORCHLUA_VTHANDLE	"porchlua_vt"
 
+/*
+ * Header for compiled patterns that may be interned in the pattern cache; it
+ * must be the first member of the userdata.
+ */
+struct porchlua_cache_entry {
+	struct porchlua_cache_entry	*prev;
+	struct porchlua_cache_entry	*next;
+	char				*key;		/* Non-NULL while cached */
+	size_t				 keysz;
+	bool				 shared;	/* Ever cached */
+};
+
+void porchlua_register_agent_metatable(lua_State *L);
+void porchlua_register_filter_metatable(lua_State *L);
+void porchlua_register_log_metatable(lua_State *L);
+void porchlua_register_luapat_metatable(lua_State *L);
+void porchlua_register_plain_metatable(lua_State *L);
 void porchlua_register_process_metatable(lua_State *L);
+void porchlua_register_timer_metatable(lua_State *L);
+void porchlua_register_vt_metatable(lua_State *L);
+bool porchlua_cache_fetch(lua_State *L, const char *key, size_t keysz);
+void porchlua_cache_insert(lua_State *L, struct porchlua_cache_entry *entry,
+    const char *key, size_t keysz);
+void porchlua_cache_release(struct porchlua_cache_entry *entry);
+int porchlua_agent(lua_State *L);
+int porchlua_filter(lua_State *L);
+int porchlua_filter_build(lua_State *L, int idx, struct porch_filter **filter);
+int porchlua_logfile(lua_State *L);
+int porchlua_luapat(lua_State *L);
+int porchlua_plain(lua_State *L);
+int porchlua_memacct(lua_State *L);
+int porchlua_memstats(lua_State *L);
+int porchlua_process_exec(lua_State *L);
 int porchlua_process_wrap_status(lua_State *L);
+int porchlua_sched(lua_State *L);
+int porchlua_sched_build(lua_State *L, int idx, struct porch_sched *sched);
+int porchlua_timer(lua_State *L);
+int porchlua_trace_begin(lua_State *L);
+int porchlua_trace_end(lua_State *L);
+int porchlua_tracing(lua_State *L);
+int porchlua_vt(lua_State *L);
+int porchlua_vt_push_screen(lua_State *L, const struct porch_vt *vt, int idx);
+void porchlua_vt_region(lua_State *L, const struct porch_vt *vt, int idx,
+    int *top, int *bottom, int *left, int *right);
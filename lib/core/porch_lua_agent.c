@@ -0,0 +1,342 @@
+/*-
+ * Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "porch_lua.h"
+
+/*
+ * The local end of a connection to porch --agent: the rsh command that starts
+ * the agent is spawned once, with a socket for its stdin and stdout, and every
+ * remote process is then multiplexed over that one connection with porch_ipc
+ * messages.  This only moves messages; the process handles built on top of it
+ * live in agent.lua, and the agent itself in porch_agent.c.
+ */
+
+struct porchlua_agent {
+	porch_ipc_t	 ipc;
+	pid_t		 pid;
+	int		 fd;
+};
+
+static const char *porchlua_agent_tags[IPC_LAST] = {
+	[IPC_AGENT_SPAWN] = "spawn",
+	[IPC_AGENT_SPAWNED] = "spawned",
+	[IPC_AGENT_CHDIR] = "chdir",
+	[IPC_AGENT_RELEASE] = "release",
+	[IPC_AGENT_TERM] = "term",
+	[IPC_AGENT_SIGNAL] = "signal",
+	[IPC_AGENT_ACK] = "ack",
+	[IPC_AGENT_WRITE] = "write",
+	[IPC_AGENT_OUTPUT] = "output",
+	[IPC_AGENT_EXIT] = "exit",
+	[IPC_AGENT_CLOSE] = "close",
+};
+
+static int
+porchlua_agent_tag(lua_State *L, int idx)
+{
+	const char *name;
+
+	name = luaL_checkstring(L, idx);
+	for (int tag = IPC_AGENT_SPAWN; tag < IPC_LAST; tag++) {
+		if (strcmp(porchlua_agent_tags[tag], name) == 0)
+			return (tag);
+	}
+
+	return (luaL_argerror(L, idx, "unknown agent message"));
+}
+
+/*
+ * agent(argv) -- spawn `argv`, which is expected to end up running
+ * porch --agent somewhere, and return a handle to talk to it.
+ */
+int
+porchlua_agent(lua_State *L)
+{
+	struct porchlua_agent *agent;
+	const char **argv;
+	lua_Integer argc;
+	int error, sv[2];
+	pid_t pid;
+
+	luaL_checktype(L, 1, LUA_TTABLE);
+	argc = luaL_len(L, 1);
+	if (argc == 0)
+		return (luaL_argerror(L, 1, "empty command"));
+
+	argv = lua_newuserdata(L, (argc + 1) * sizeof(*argv));
+	for (lua_Integer i = 1; i <= argc; i++) {
+		lua_geti(L, 1, i);
+		argv[i - 1] = luaL_checkstring(L, -1);
+		lua_pop(L, 1);
+	}
+	argv[argc] = NULL;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+		goto err;
+
+	pid = fork();
+	if (pid == -1) {
+		error = errno;
+		close(sv[0]);
+		close(sv[1]);
+		errno = error;
+		goto err;
+	} else if (pid == 0) {
+		signal(SIGTERM, SIG_DFL);
+		close(sv[0]);
+		if (dup2(sv[1], STDIN_FILENO) == -1 ||
+		    dup2(sv[1], STDOUT_FILENO) == -1)
+			_exit(127);
+		if (sv[1] != STDIN_FILENO && sv[1] != STDOUT_FILENO)
+			close(sv[1]);
+
+		execvp(argv[0], (char * const *)(const void *)argv);
+		fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+		_exit(127);
+	}
+
+	close(sv[1]);
+	if (fcntl(sv[0], F_SETFD, FD_CLOEXEC) == -1 ||
+	    fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK) == -1)
+		goto fail;
+
+	agent = lua_newuserdata(L, sizeof(*agent));
+	agent->pid = pid;
+	agent->fd = sv[0];
+	agent->ipc = porch_ipc_open(sv[0]);
+	if (agent->ipc == NULL) {
+		errno = ENOMEM;
+		goto fail;
+	}
+
+	luaL_setmetatable(L, ORCHLUA_AGENTHANDLE);
+	return (1);
+fail:
+	error = errno;
+	close(sv[0]);
+	kill(pid, SIGKILL);
+	while (waitpid(pid, NULL, 0) == -1 && errno == EINTR)
+		continue;
+	errno = error;
+err:
+	luaL_pushfail(L);
+	lua_pushstring(L, strerror(errno));
+	return (2);
+}
+
+static struct porchlua_agent *
+porchlua_agent_check(lua_State *L)
+{
+	struct porchlua_agent *agent;
+
+	agent = luaL_checkudata(L, 1, ORCHLUA_AGENTHANDLE);
+	if (agent->ipc == NULL)
+		luaL_error(L, "agent already closed");
+	return (agent);
+}
+
+/*
+ * agent:send(message, id[, arg[, data]]) -- send `message` about process `id`.
+ */
+static int
+porchlua_agent_send(lua_State *L)
+{
+	struct porch_agent_hdr *hdr;
+	struct porchlua_agent *agent;
+	struct porch_ipc_msg *msg;
+	const char *data;
+	lua_Integer arg, id;
+	size_t datasz;
+	int error, tag;
+
+	agent = porchlua_agent_check(L);
+	tag = porchlua_agent_tag(L, 2);
+	id = luaL_checkinteger(L, 3);
+	arg = luaL_optinteger(L, 4, 0);
+	data = luaL_optlstring(L, 5, "", &datasz);
+
+	msg = porch_ipc_msg_alloc(tag, sizeof(*hdr) + datasz, (void **)&hdr);
+	if (msg == NULL) {
+		luaL_pushfail(L);
+		lua_pushstring(L, strerror(ENOMEM));
+		return (2);
+	}
+
+	hdr->id = id;
+	hdr->arg = arg;
+	memcpy(hdr + 1, data, datasz);
+
+	error = porch_ipc_send(agent->ipc, msg);
+	if (error != 0)
+		error = errno;
+	porch_ipc_msg_free(msg);
+
+	if (error != 0) {
+		luaL_pushfail(L);
+		lua_pushstring(L, strerror(error));
+		return (2);
+	}
+
+	lua_pushboolean(L, 1);
+	return (1);
+}
+
+/*
+ * agent:recv([timeout]) -- wait up to `timeout` seconds, or forever, for the
+ * next message from the agent.  Returns the message, process id, arg and data,
+ * just nil on timeout, or nil and an error if the agent went away.
+ */
+static int
+porchlua_agent_recv(lua_State *L)
+{
+	struct porch_agent_hdr *hdr;
+	struct porchlua_agent *agent;
+	struct porch_ipc_msg *msg;
+	struct timeval tv, *tvp;
+	fd_set rfds;
+	lua_Number timeout;
+	size_t payloadsz;
+	int tag;
+
+	agent = porchlua_agent_check(L);
+	timeout = luaL_optnumber(L, 2, -1);
+
+	tvp = NULL;
+	if (timeout >= 0) {
+		tv.tv_sec = (time_t)timeout;
+		tv.tv_usec = (suseconds_t)((timeout - tv.tv_sec) * 1000000);
+		tvp = &tv;
+	}
+
+	for (int tries = 0; tries < 2; tries++) {
+		if (porch_ipc_recv(agent->ipc, &msg) != 0)
+			goto err;
+		if (msg != NULL)
+			break;
+		if (!porch_ipc_okay(agent->ipc)) {
+			luaL_pushfail(L);
+			lua_pushstring(L, "agent connection closed");
+			return (2);
+		} else if (tries != 0) {
+			/* Only part of a message has come in so far. */
+			luaL_pushfail(L);
+			return (1);
+		}
+
+		FD_ZERO(&rfds);
+		FD_SET(agent->fd, &rfds);
+		switch (select(agent->fd + 1, &rfds, NULL, NULL, tvp)) {
+		case -1:
+			if (errno != EINTR)
+				goto err;
+			/* FALLTHROUGH */
+		case 0:
+			luaL_pushfail(L);
+			return (1);
+		default:
+			break;
+		}
+	}
+
+	tag = porch_ipc_msg_tag(msg);
+	hdr = porch_ipc_msg_payload(msg, &payloadsz);
+	if (tag < IPC_AGENT_SPAWN || payloadsz < sizeof(*hdr)) {
+		porch_ipc_msg_free(msg);
+		luaL_pushfail(L);
+		lua_pushfstring(L, "unexpected message type '%d' from agent",
+		    tag);
+		return (2);
+	}
+
+	lua_pushstring(L, porchlua_agent_tags[tag]);
+	lua_pushinteger(L, hdr->id);
+	lua_pushinteger(L, hdr->arg);
+	lua_pushlstring(L, (const char *)(hdr + 1), payloadsz - sizeof(*hdr));
+	porch_ipc_msg_free(msg);
+	return (4);
+err:
+	luaL_pushfail(L);
+	lua_pushstring(L, strerror(errno));
+	return (2);
+}
+
+/*
+ * agent:close() -- hang up on the agent, which kills anything it still has
+ * running, and reap the rsh.
+ */
+static int
+porchlua_agent_close(lua_State *L)
+{
+	struct porchlua_agent *agent;
+	int status;
+
+	agent = luaL_checkudata(L, 1, ORCHLUA_AGENTHANDLE);
+	if (agent->ipc == NULL) {
+		lua_pushboolean(L, 1);
+		return (1);
+	}
+
+	porch_ipc_close(agent->ipc);
+	agent->ipc = NULL;
+
+	while (waitpid(agent->pid, &status, 0) == -1) {
+		if (errno != EINTR) {
+			luaL_pushfail(L);
+			lua_pushstring(L, strerror(errno));
+			return (2);
+		}
+	}
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		luaL_pushfail(L);
+		lua_pushfstring(L, "agent exited with status %d",
+		    WIFEXITED(status) ? WEXITSTATUS(status) : -WTERMSIG(status));
+		return (2);
+	}
+
+	lua_pushboolean(L, 1);
+	return (1);
+}
+
+#define	AGENT_SIMPLE(n)	{ #n, porchlua_agent_ ## n }
+static const luaL_Reg porchlua_agent_methods[] = {
+	AGENT_SIMPLE(close),
+	AGENT_SIMPLE(recv),
+	AGENT_SIMPLE(send),
+	{ NULL, NULL },
+};
+
+static const luaL_Reg porchlua_agent_meta[] = {
+	{ "__index", NULL },	/* Set during registration */
+	{ "__gc", porchlua_agent_close },
+	{ "__close", porchlua_agent_close },
+	{ NULL, NULL },
+};
+
+void
+porchlua_register_agent_metatable(lua_State *L)
+{
+	luaL_newmetatable(L, ORCHLUA_AGENTHANDLE);
+	luaL_setfuncs(L, porchlua_agent_meta, 0);
+
+	luaL_newlibtable(L, porchlua_agent_methods);
+	luaL_setfuncs(L, porchlua_agent_methods, 0);
+	lua_setfield(L, -2, "__index");
+	lua_pop(L, 1);
+}
@@ -8,16 +8,19 @@
 
 #include <sys/param.h>
 #include <sys/select.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 
 #include <assert.h>
 #include <err.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <grp.h>
 #include <poll.h>
 #include <pwd.h>
 #include <signal.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <termios.h>
@@ -32,6 +35,10 @@
 
 #define	ORCHLUA_PSTATUSHANDLE	"porchlua_process_status"
 static void porchlua_register_pstatus_metatable(lua_State *L);
+static void porchlua_register_piped_metatable(lua_State *L);
+
+/* Batch size for send_file() if the caller doesn't specify one. */
+#define	FEED_CHUNK_DEFAULT	(64 * 1024)
 
 struct process_status {
 	int		status;
@@ -41,10 +48,92 @@ struct process_status {
 	bool		is_stopped;
 };
 
+/* Describes a source being streamed into the process' terminal. */
+struct porchlua_feed {
+	const char	*eol;		/* Replaces each \n, if not NULL */
+	size_t		 eolsz;
+	size_t		 chunksz;	/* Size of each read from the source */
+	off_t		 total;		/* Size of the source, or -1 */
+	int		 readfn;	/* Stack index of the output callback */
+	int		 errfn;		/* Stack index of the stderr callback, or 0 */
+	int		 progressfn;	/* Stack index, or 0 if none */
+	int		 writefn;	/* Stack index, or 0 if none */
+	int		 escstate;	/* Escape in progress, see below */
+	bool		 escape;	/* Process ^X and \ escapes */
+};
+
+#define	FEED_ESC_NONE		0
+#define	FEED_ESC_QUOTED		1	/* Previous char was \ */
+#define	FEED_ESC_CNTRL		2	/* Previous char was ^ */
+
+/*
+ * A helper command spawned for exec() or pipe(), wrapped up so that it gets
+ * cleaned up if a callback errors out while we're servicing it.
+ */
+#define	ORCHLUA_PIPEDHANDLE	"porchlua_piped"
+struct porchlua_piped {
+	char		*carry;		/* Incomplete line, for exec() */
+	pid_t		 pid;
+	int		 fd;
+};
+
+static int porchlua_process_feed(lua_State *, struct porch_process *, int,
+    struct porchlua_feed *, size_t *);
+static struct porchlua_piped *porchlua_piped_spawn(lua_State *, int);
+static int porchlua_piped_reap(struct porchlua_piped *, int *);
+
+/* Push a pstatus object describing the wait(2) status `status`. */
+static void
+porchlua_pstatus_push(lua_State *L, int status)
+{
+	struct process_status *pstatus;
+
+	pstatus = lua_newuserdata(L, sizeof(*pstatus));
+	memset(pstatus, 0, sizeof(*pstatus));
+	pstatus->raw_status = status;
+	pstatus->is_exited = WIFEXITED(status);
+	pstatus->is_signaled = WIFSIGNALED(status);
+	pstatus->is_stopped = WIFSTOPPED(status);
+
+	if (pstatus->is_exited) {
+		pstatus->status = WEXITSTATUS(status);
+	} else if (pstatus->is_signaled) {
+		pstatus->status = WTERMSIG(status);
+	} else if (pstatus->is_stopped) {
+		pstatus->status = WSTOPSIG(status);
+	}
+
+	luaL_setmetatable(L, ORCHLUA_PSTATUSHANDLE);
+}
+
+/*
+ * Write to the process' terminal, or its socket if it doesn't have one.  The
+ * latter would raise SIGPIPE at us if the process has gone away, where the pty
+ * would just hand back an error.
+ */
+static ssize_t
+porchlua_process_termwrite(struct porch_process *self, const void *buf,
+    size_t bufsz)
+{
+
+#ifdef MSG_NOSIGNAL
+	if (!self->pty)
+		return (send(self->termctl, buf, bufsz, MSG_NOSIGNAL));
+#endif
+	return (write(self->termctl, buf, bufsz));
+}
+
+static volatile sig_atomic_t porchlua_process_alarmed;
+
 static void
 porchlua_process_close_alarm(int signo __unused)
 {
-	/* XXX Ignored, just don't terminate us. */
+	/*
+	 * Mostly ignored, just don't terminate us.  We do note that it fired so
+	 * that a drain can tell it apart from any other signal that might have
+	 * interrupted it, e.g., SIGPROF while porch(1) is profiling.
+	 */
+	porchlua_process_alarmed = 1;
 }
 
 static int
@@ -171,12 +260,14 @@ porchlua_process_close(lua_State *L)
 	self = luaL_checkudata(L, 1, ORCHLUA_PROCESSHANDLE);
 	if (self->pid != 0 && porchlua_process_killed(self, &sig, false) &&
 	    sig != 0) {
+		porch_record_close(self);
 		luaL_pushfail(L);
 		lua_pushfstring(L, "spawned process killed with signal '%d'", sig);
 		return (2);
 	}
 
 	if (lua_gettop(L) < 2 || lua_isnil(L, 2)) {
+		porch_record_close(self);
 		luaL_pushfail(L);
 		lua_pushstring(L, "missing drain callback");
 		return (2);
@@ -200,8 +291,10 @@ again:
 			warn("kill %d", sig);
 
 		/* XXX Configurable? */
-		if (sig != SIGKILL)
+		if (sig != SIGKILL) {
+			porchlua_process_alarmed = 0;
 			alarm(5);
+		}
 		if (sig == SIGKILL) {
 			/*
 			 * Once we've sent SIGKILL, we're tired of it; just drop the pty and
@@ -242,7 +335,11 @@ again:
 	if (self->termctl != -1)
 		close(self->termctl);
 	self->termctl = -1;
+	if (self->errctl != -1)
+		close(self->errctl);
+	self->errctl = -1;
 
+	porch_record_close(self);
 	if (failed) {
 		luaL_pushfail(L);
 		lua_pushstring(L, "could not kill process with SIGTERM");
@@ -294,7 +391,6 @@ static int
 porchlua_process_eof(lua_State *L)
 {
 	struct porch_process *self;
-	struct process_status *pstatus;
 	int timeout;
 
 	self = luaL_checkudata(L, 1, ORCHLUA_PROCESSHANDLE);
@@ -352,23 +448,31 @@ porchlua_process_eof(lua_State *L)
 
 	assert(self->pid == 0);
 
-	pstatus = lua_newuserdata(L, sizeof(*pstatus));
-	pstatus->raw_status = self->status;
-	pstatus->is_exited = WIFEXITED(self->status);
-	pstatus->is_signaled = WIFSIGNALED(self->status);
-	pstatus->is_stopped = WIFSTOPPED(self->status);
+	porchlua_pstatus_push(L, self->status);
+	return (2);
+}
 
-	if (pstatus->is_exited) {
-		pstatus->status = WEXITSTATUS(self->status);
-	} else if (pstatus->is_signaled) {
-		pstatus->status = WTERMSIG(self->status);
-	} else if (pstatus->is_stopped) {
-		pstatus->status = WSTOPSIG(self->status);
-	}
+/*
+ * filters([list]) -- replace the chain of filters that output passes through
+ * before it's handed to the read callback; nil or an empty list removes it.
+ */
+static int
+porchlua_process_filters(lua_State *L)
+{
+	struct porch_process *self;
+	struct porch_filter *filter;
+	int ret;
 
-	luaL_setmetatable(L, ORCHLUA_PSTATUSHANDLE);
+	self = luaL_checkudata(L, 1, ORCHLUA_PROCESSHANDLE);
+	ret = porchlua_filter_build(L, 2, &filter);
+	if (ret != 0)
+		return (ret);
 
-	return (2);
+	porch_filter_free(self->filter);
+	self->filter = filter;
+
+	lua_pushboolean(L, 1);
+	return (1);
 }
 
 static int
@@ -381,8 +485,82 @@ porchlua_process_gid(lua_State *L)
 	return (1);
 }
 
+/*
+ * pipe(cmd, readfn[, cfg]) -- run `cmd` and feed its output into the process,
+ * draining the process into `readfn` as send_file() does.  The `cfg` may set
+ * `escape` to process escapes as write() would, `written` to observe each
+ * batch as it's sent, and `stderr` to drain a separate stderr as read() does.
+ * Returns a pstatus for `cmd` once it has finished.
+ */
+static int
+porchlua_process_pipe(lua_State *L)
+{
+	struct porchlua_feed feed = { 0 };
+	struct porchlua_piped *piped;
+	struct porch_process *self;
+	size_t sent;
+	int ret, status;
+
+	self = luaL_checkudata(L, 1, ORCHLUA_PROCESSHANDLE);
+	luaL_checktype(L, 3, LUA_TFUNCTION);
+	feed.readfn = 3;
+	feed.chunksz = FEED_CHUNK_DEFAULT;
+	feed.total = -1;
+
+	if (!lua_isnoneornil(L, 4)) {
+		luaL_checktype(L, 4, LUA_TTABLE);
+
+		lua_getfield(L, 4, "escape");
+		feed.escape = lua_toboolean(L, -1);
+		lua_pop(L, 1);
+
+		if (lua_getfield(L, 4, "stderr") != LUA_TNIL) {
+			luaL_checktype(L, -1, LUA_TFUNCTION);
+			feed.errfn = lua_gettop(L);
+		}
+		if (lua_getfield(L, 4, "written") != LUA_TNIL) {
+			luaL_checktype(L, -1, LUA_TFUNCTION);
+			feed.writefn = lua_gettop(L);
+		}
+	}
+
+	if (self->termctl == -1) {
+		luaL_pushfail(L);
+		lua_pushstring(L, "process has already closed its terminal");
+		return (2);
+	}
+
+	piped = porchlua_piped_spawn(L, 2);
+	if (piped == NULL)
+		return (2);
+
+	ret = porchlua_process_feed(L, self, piped->fd, &feed, &sent);
+	if (ret != 0) {
+		/* Don't leave it waiting on us to read the rest. */
+		(void)kill(piped->pid, SIGTERM);
+	}
+
+	if (porchlua_piped_reap(piped, &status) != 0) {
+		int serrno = errno;
+
+		luaL_pushfail(L);
+		lua_pushstring(L, strerror(serrno));
+		return (2);
+	} else if (ret != 0) {
+		return (ret);
+	}
+
+	porchlua_pstatus_push(L, status);
+	return (1);
+}
+
+/*
+ * Read from `fd` into the Lua function at `fn`; `proc` is the process to record
+ * and model it against, if it's the process' output.
+ */
 static int
-porchlua_process_proxy_read(lua_State *L, int fd, int fn, bool *eof)
+porchlua_process_proxy_read(lua_State *L, struct porch_process *proc, int fd,
+    int fn, bool *eof)
 {
 	char buf[4096];
 	ssize_t readsz;
@@ -404,6 +582,10 @@ retry:
 		*eof = true;
 		lua_pushnil(L);
 	} else {
+		if (proc != NULL) {
+			porch_record_event(proc, 'o', buf, readsz);
+			porch_vt_feed(proc->vt, buf, readsz);
+		}
 		lua_pushlstring(L, buf, readsz);
 	}
 
@@ -427,6 +609,7 @@ porchlua_process_proxy(lua_State *L)
 	luaL_Stream *p;
 	FILE *inf;
 	struct termios term;
+	struct timespec wait;
 	int infd, outfd, ready, ret, timeout;
 	bool bailed, eof, has_pulse;
 
@@ -436,12 +619,8 @@ porchlua_process_proxy(lua_State *L)
 	luaL_checktype(L, 3, LUA_TFUNCTION);	/* outputfn */
 	luaL_checktype(L, 4, LUA_TFUNCTION);	/* inputfn */
 	has_pulse = lua_gettop(L) >= 5 && !lua_isnil(L, 5);
-	if (has_pulse) {
+	if (has_pulse)
 		luaL_checktype(L, 5, LUA_TFUNCTION);	/* pulsefn */
-		timeout = 1000;	/* pulsefn invoked every second. */
-	} else {
-		timeout = INFTIM;
-	}
 
 	inf = p->f;
 	outfd = self->termctl;
@@ -479,34 +658,56 @@ porchlua_process_proxy(lua_State *L)
 	pfd[1].fd = infd;
 	pfd[1].events = POLLIN;
 
+	/* pulsefn invoked every second, rearmed whenever there's activity. */
+	if (has_pulse && porch_timer_arm(&self->pulse_timer, 1) != 0) {
+		luaL_pushfail(L);
+		lua_pushstring(L, strerror(ENOMEM));
+		return (2);
+	}
+
 	while (!eof) {
+		porch_timer_expire();
+		if (has_pulse && porch_timer_fired(&self->pulse_timer)) {
+			lua_pushvalue(L, 5);
+			lua_call(L, 0, 1);
+			bailed = !lua_toboolean(L, -1);
+			lua_pop(L, 1);
+
+			if (bailed)
+				break;
+
+			(void)porch_timer_arm(&self->pulse_timer, 1);
+		}
+
+		timeout = INFTIM;
+		if (porch_timer_next(&wait)) {
+			timeout = wait.tv_sec * 1000 +
+			    (wait.tv_nsec + 999999) / 1000000;
+		}
+
 		ready = poll(pfd, 2, timeout);
 		if (ready == -1 && errno == EINTR)
 			continue;
 		if (ready == -1) {
 			int serrno = errno;
 
+			porch_timer_disarm(&self->pulse_timer);
 			luaL_pushfail(L);
 			lua_pushstring(L, strerror(serrno));
 			return (2);
 		}
 
-		if (ready == 0) {
-			assert(has_pulse);
-
-			lua_pushvalue(L, 5);
-			lua_call(L, 0, 1);
-			bailed = !lua_toboolean(L, -1);
-			lua_pop(L, 1);
-
-			if (bailed)
-				break;
+		self->stats.wakeups++;
 
+		/* Something came due, see if it was the pulse. */
+		if (ready == 0)
 			continue;
-		}
+
+		if (has_pulse)
+			(void)porch_timer_arm(&self->pulse_timer, 1);
 
 		if ((pfd[0].revents & POLLIN) != 0) {
-			ret = porchlua_process_proxy_read(L, outfd, 3, &eof);
+			ret = porchlua_process_proxy_read(L, self, outfd, 3, &eof);
 
 			if (ret > 0)
 				return (ret);
@@ -523,7 +724,7 @@ porchlua_process_proxy(lua_State *L)
 		}
 
 		if ((pfd[1].revents & POLLIN) != 0) {
-			ret = porchlua_process_proxy_read(L, infd, 4, &eof);
+			ret = porchlua_process_proxy_read(L, NULL, infd, 4, &eof);
 			if (ret > 0)
 				return (ret);
 
@@ -540,74 +741,235 @@ porchlua_process_proxy(lua_State *L)
 		}
 	}
 
+	porch_timer_disarm(&self->pulse_timer);
 	lua_pushboolean(L, !bailed);
 	return (1);
 }
 
 /*
- * read(callback[, timeout]) -- returns true if we finished, false if we
- * hit EOF, or a fail, error pair otherwise.
+ * Push the output callback's arguments for a chunk of output: the data after
+ * it's been through the filter chain, followed by the raw data if there is a
+ * chain so that it can still be logged as-is.  Returns the number of values
+ * pushed, or -1 with errno set on failure.
  */
 static int
-porchlua_process_read(lua_State *L)
+porchlua_process_push_output(lua_State *L, struct porch_process *self,
+    const char *buf, size_t bufsz)
+{
+	const char *out;
+	size_t outsz;
+
+	if (self->filter == NULL) {
+		lua_pushlstring(L, buf, bufsz);
+		return (1);
+	}
+
+	out = porch_filter_apply(self->filter, buf, bufsz, &outsz);
+	if (out == NULL)
+		return (-1);
+
+	lua_pushlstring(L, out, outsz);
+	lua_pushlstring(L, buf, bufsz);
+	return (2);
+}
+
+/*
+ * Like porchlua_process_push_output(), but for whatever the filter chain was
+ * still holding back at EOF.  Returns 0 if there was nothing.
+ */
+static int
+porchlua_process_push_flush(lua_State *L, struct porch_process *self)
+{
+	const char *out;
+	size_t outsz;
+
+	if (self->filter == NULL)
+		return (0);
+
+	out = porch_filter_apply(self->filter, NULL, 0, &outsz);
+	if (out == NULL)
+		return (-1);
+	if (outsz == 0)
+		return (0);
+
+	lua_pushlstring(L, out, outsz);
+	lua_pushliteral(L, "");
+	return (2);
+}
+
+/*
+ * Read what's available from a separate stderr and push the callback at `errfn`
+ * along with it, or nil at EOF, for the caller to invoke.  Returns 1 if the
+ * call is ready, 0 if there was nothing to read after all, or -1 with errno set
+ * on error.  Only the terminal's output goes through the filters, since their
+ * state can't be shared between two streams.
+ */
+static int
+porchlua_process_push_stderr(lua_State *L, struct porch_process *self,
+    int errfn)
+{
+	char buf[LINE_MAX];
+	ssize_t readsz;
+
+	readsz = read(self->errctl, buf, sizeof(buf));
+	self->stats.reads++;
+	if (readsz == -1 && (errno == EINTR || errno == EAGAIN))
+		return (0);
+	if (readsz == -1)
+		return (-1);
+
+	lua_pushvalue(L, errfn);
+	if (readsz == 0) {
+		close(self->errctl);
+		self->errctl = -1;
+		lua_pushnil(L);
+	} else {
+		self->stats.bytes_read += readsz;
+		porch_record_event(self, 'o', buf, readsz);
+		porch_vt_feed(self->vt, buf, readsz);
+		lua_pushlstring(L, buf, readsz);
+	}
+
+	return (1);
+}
+
+/*
+ * Check whether any of the script's timers in the list at `idx` have fired.
+ */
+static bool
+porchlua_process_read_woken(lua_State *L, int idx)
+{
+	struct porch_timer *timer;
+	lua_Integer ntimers;
+	bool woken = false;
+
+	ntimers = luaL_len(L, idx);
+	for (lua_Integer i = 1; i <= ntimers && !woken; i++) {
+		lua_geti(L, idx, i);
+		timer = luaL_testudata(L, -1, ORCHLUA_TIMERHANDLE);
+		woken = timer != NULL && porch_timer_fired(timer);
+		lua_pop(L, 1);
+	}
+
+	return (woken);
+}
+
+/*
+ * read(callback[, timeout[, errcallback[, timers]]]) -- returns true if we
+ * finished, false if we hit EOF, or a fail, error pair otherwise.  If the
+ * process has a separate stderr, then its output goes to `errcallback` and it
+ * may also finish the read; without one, stderr isn't read at all.  The read
+ * also ends early if any of the core.timer()s in the `timers` list fire, but
+ * no other timer will interrupt it.
+ */
+static int
+porchlua_process_read_impl(lua_State *L)
 {
 	char buf[LINE_MAX];
 	fd_set rfd;
 	struct porch_process *self;
+	struct timespec wait;
 	struct timeval tv, *tvp;
-	time_t start, now;
 	ssize_t readsz;
-	int fd, ret;
+	int errfn, fd, maxfd, ret, timers;
 	lua_Number timeout;
+	bool first;
 
 	self = luaL_checkudata(L, 1, ORCHLUA_PROCESSHANDLE);
 	luaL_checktype(L, 2, LUA_TFUNCTION);
+	errfn = 0;
+	if (!lua_isnoneornil(L, 4)) {
+		luaL_checktype(L, 4, LUA_TFUNCTION);
+		errfn = 4;
+	}
+	timers = 0;
+	if (!lua_isnoneornil(L, 5)) {
+		luaL_checktype(L, 5, LUA_TTABLE);
+		timers = 5;
+	}
 
-	if (lua_gettop(L) > 2) {
+	/* No timeout == block, at least until some other deadline. */
+	porch_timer_disarm(&self->read_timer);
+	self->read_timer.tm_flags = 0;
+	if (!lua_isnoneornil(L, 3)) {
 		timeout = luaL_checknumber(L, 3);
 		if (timeout < 0) {
 			luaL_pushfail(L);
 			lua_pushstring(L, "Invalid timeout");
 			return (2);
-		} else {
-			timeout = MAX(timeout, 1);
 		}
 
-		tv.tv_sec = timeout;
-		tv.tv_usec = 0;
-		tvp = &tv;
-	} else {
-		/* No timeout == block */
-		tvp = NULL;
+		if (porch_timer_arm(&self->read_timer, timeout) != 0) {
+			luaL_pushfail(L);
+			lua_pushstring(L, strerror(ENOMEM));
+			return (2);
+		}
 	}
 
-	fd = self->termctl;
-	FD_ZERO(&rfd);
+	/* Callbacks are invoked from just above the arguments. */
+	lua_settop(L, 5);
 
-	/* Crude */
-	if (tvp != NULL)
-		start = now = time(NULL);
-	else
-		start = now = timeout = 0;
-	while ((tvp == NULL || now - start < timeout) && !self->error) {
-		FD_SET(fd, &rfd);
-		ret = select(fd + 1, &rfd, NULL, NULL, tvp);
+	/*
+	 * The timeout is fractional and goes into the timer heap along with
+	 * every other deadline, so we only ever sleep until the nearest one of
+	 * them.  We're done when ours fires or when one of the timers that we
+	 * were handed does, but a timeout of zero still gets one look at
+	 * whatever's ready.
+	 */
+	for (first = true; !self->error; first = false) {
+		porch_timer_expire();
+
+		if (porch_timer_fired(&self->read_timer) ||
+		    (timers != 0 && porchlua_process_read_woken(L, timers))) {
+			if (!first)
+				break;
+
+			tv.tv_sec = tv.tv_usec = 0;
+			tvp = &tv;
+		} else if (porch_timer_next(&wait)) {
+			/* Round up, or we'd just wake up early and go again. */
+			tv.tv_sec = wait.tv_sec;
+			tv.tv_usec = (wait.tv_nsec + 999) / 1000;
+			if (tv.tv_usec >= 1000000) {
+				tv.tv_sec++;
+				tv.tv_usec -= 1000000;
+			}
+			tvp = &tv;
+		} else {
+			tvp = NULL;
+		}
+
+		/*
+		 * The terminal may already be gone if we're only here for
+		 * what's left of stderr.
+		 */
+		fd = self->termctl;
+		maxfd = -1;
+		FD_ZERO(&rfd);
+		if (fd != -1) {
+			FD_SET(fd, &rfd);
+			maxfd = fd;
+		}
+		if (errfn != 0 && self->errctl != -1) {
+			FD_SET(self->errctl, &rfd);
+			maxfd = MAX(maxfd, self->errctl);
+		}
+		if (maxfd == -1)
+			break;
+
+		ret = select(maxfd + 1, &rfd, NULL, NULL, tvp);
+		if (ret != -1)
+			self->stats.wakeups++;
 		if (ret == -1 && errno == EINTR) {
 			/*
-			 * Rearm the timeout and go again; we'll just let the loop
-			 * terminate with a negative tv.tv_sec if timeout seconds
-			 * have elapsed.
+			 * Go again; the heap still has the deadlines for the
+			 * next go-around.
 			 */
-			if (tvp != NULL) {
-				now = time(NULL);
-				tv.tv_sec = timeout - (now - start);
-			}
-
-			if (!self->draining)
+			if (!self->draining || !porchlua_process_alarmed)
 				continue;
 
-			/* Timeout */
-			ret = 0;
+			/* Timeout -- not the end of the world. */
+			break;
 		}
 
 		if (ret == -1) {
@@ -617,13 +979,42 @@ porchlua_process_read(lua_State *L)
 			lua_pushstring(L, strerror(err));
 			return (2);
 		} else if (ret == 0) {
-			/* Timeout -- not the end of the world. */
-			lua_pushboolean(L, 1);
-			return (1);
+			/* Something came due, see whose it was. */
+			continue;
+		}
+
+		if (errfn != 0 && self->errctl != -1 &&
+		    FD_ISSET(self->errctl, &rfd)) {
+			bool done;
+
+			ret = porchlua_process_push_stderr(L, self, errfn);
+			if (ret == -1) {
+				int err = errno;
+
+				luaL_pushfail(L);
+				lua_pushstring(L, strerror(err));
+				return (2);
+			} else if (ret != 0) {
+				self->stats.callbacks++;
+				lua_call(L, 1, 1);
+				done = lua_toboolean(L, -1);
+				lua_pop(L, 1);
+				if (done)
+					break;
+			}
 		}
 
+		if (fd == -1 || !FD_ISSET(fd, &rfd))
+			continue;
+
 		/* Read it */
 		readsz = read(fd, buf, sizeof(buf));
+		self->stats.reads++;
+		if (readsz > 0) {
+			self->stats.bytes_read += readsz;
+			porch_record_event(self, 'o', buf, readsz);
+			porch_vt_feed(self->vt, buf, readsz);
+		}
 
 		/*
 		 * Some platforms will return `0` when the slave side of a pty
@@ -642,21 +1033,44 @@ porchlua_process_read(lua_State *L)
 			int nargs = 0;
 
 			/*
-			 * Duplicate the function value, it'll get popped by the call.
+			 * Anything that the filters were holding back needs to
+			 * go out ahead of the EOF.
 			 */
-			lua_settop(L, 3);
-			lua_copy(L, -2, -1);
+			lua_settop(L, 5);
+			if (readsz == 0) {
+				lua_pushvalue(L, 2);
+				nargs = porchlua_process_push_flush(L, self);
+				if (nargs > 0) {
+					self->stats.callbacks++;
+					lua_call(L, nargs, 0);
+					nargs = 0;
+				} else {
+					lua_pop(L, 1);
+				}
+			}
 
-			/* callback([data]) -- nil data == EOF */
-			if (readsz > 0) {
-				lua_pushlstring(L, buf, readsz);
-				nargs++;
+			/*
+			 * Duplicate the function value, it'll get popped by the call.
+			 */
+			lua_pushvalue(L, 2);
+
+			/* callback([data[, raw]]) -- nil data == EOF */
+			if (readsz > 0)
+				nargs = porchlua_process_push_output(L, self, buf,
+				    readsz);
+			if (nargs < 0) {
+				int err = errno;
+
+				luaL_pushfail(L);
+				lua_pushstring(L, strerror(err));
+				return (2);
 			}
 
 			/*
 			 * Callback should return true if it's done, false if it
 			 * wants more.
 			 */
+			self->stats.callbacks++;
 			lua_call(L, nargs, 1);
 
 			if (readsz == 0) {
@@ -696,6 +1110,41 @@ porchlua_process_read(lua_State *L)
 	return (1);
 }
 
+/*
+ * The callback may raise, e.g., for a script's exit(), so we run the read
+ * protected to be sure that the timeout is disarmed and the trace gets its end
+ * before the error goes any further.  The arguments are copied for the call so
+ * that the process can't be collected out from under us in the meantime.
+ */
+static int
+porchlua_process_read(lua_State *L)
+{
+	struct porch_process *self;
+	uint64_t before;
+	int error, nargs, top;
+
+	self = luaL_checkudata(L, 1, ORCHLUA_PROCESSHANDLE);
+	before = self->stats.bytes_read;
+	if (porch_trace_enabled)
+		porch_trace_begin("core", "read", NULL);
+
+	top = lua_gettop(L);
+	lua_pushcfunction(L, porchlua_process_read_impl);
+	for (nargs = 1; nargs <= top; nargs++)
+		lua_pushvalue(L, nargs);
+	error = lua_pcall(L, top, LUA_MULTRET, 0);
+
+	porch_timer_disarm(&self->read_timer);
+	if (porch_trace_enabled) {
+		porch_trace_end("core", "read", "\"bytes\":%ju",
+		    (uintmax_t)(self->stats.bytes_read - before));
+	}
+
+	if (error != LUA_OK)
+		return (lua_error(L));
+	return (lua_gettop(L) - top);
+}
+
 static bool
 porchlua_do_env(lua_State *L, struct porch_process *self, int index)
 {
@@ -723,69 +1172,601 @@ porchlua_do_env(lua_State *L, struct porch_process *self, int index)
 		return (2);
 	}
 
-	assert(setsz != 0 || unsetsz != 0 || clear);
+	assert(setsz != 0 || unsetsz != 0 || clear);
+
+	envsz = sizeof(*penv) + setsz + unsetsz;
+	msg = porch_ipc_msg_alloc(IPC_ENV_SETUP, envsz, (void **)&penv);
+	if (msg == NULL) {
+		luaL_pushfail(L);
+		lua_pushstring(L, strerror(ENOMEM));
+		return (2);
+	}
+
+	penv->clear = clear;
+	penv->setsz = setsz;
+	penv->unsetsz = unsetsz;
+	if (setsz > 0)
+		memcpy(&penv->envstr[0], setstr, setsz);
+	if (unsetsz > 0)
+		memcpy(&penv->envstr[setsz], unsetstr, unsetsz);
+	lua_pop(L, 2);
+
+	return (porch_lua_ipc_send_acked(L, self, msg, IPC_ENV_ACK));
+}
+
+/*
+ * record(path[, command]) -- start recording the session to `path` in the
+ * asciicast v2 format, replacing any recording already in progress.  A nil
+ * `path` just stops the current recording.
+ */
+static int
+porchlua_process_record(lua_State *L)
+{
+	struct porch_process *self;
+	const char *command, *path;
+
+	self = luaL_checkudata(L, 1, ORCHLUA_PROCESSHANDLE);
+	path = luaL_optstring(L, 2, NULL);
+	command = luaL_optstring(L, 3, NULL);
+
+	if (path == NULL) {
+		porch_record_close(self);
+	} else if (porch_record_open(self, path, command) != 0) {
+		int serrno = errno;
+
+		luaL_pushfail(L);
+		lua_pushfstring(L, "%s: %s", path, strerror(serrno));
+		return (2);
+	}
+
+	lua_pushboolean(L, 1);
+	return (1);
+}
+
+static int
+porchlua_process_release(lua_State *L)
+{
+	struct porch_process *self;
+	int error;
+
+	self = luaL_checkudata(L, 1, ORCHLUA_PROCESSHANDLE);
+
+	if (lua_istable(L, 2)) {
+		int ret;
+
+		ret = porchlua_do_env(L, self, 2);
+		if (ret != 0)
+			return (ret);
+	}
+
+	porch_trace_begin("core", "release", NULL);
+	error = porch_release(self->ipc);
+	porch_ipc_close(self->ipc);
+	self->ipc = NULL;
+	if (error == 0)
+		self->stats.ipc_msgs++;
+	porch_trace_end("core", "release", NULL);
+
+	if (error != 0) {
+		error = errno;
+
+		luaL_pushfail(L);
+		lua_pushstring(L, strerror(error));
+		return (2);
+	}
+
+	self->released = true;
+
+	lua_pushboolean(L, 1);
+	return (1);
+}
+
+static int
+porchlua_process_released(lua_State *L)
+{
+	struct porch_process *self;
+
+	self = luaL_checkudata(L, 1, ORCHLUA_PROCESSHANDLE);
+	lua_pushboolean(L, self->released);
+	return (1);
+}
+
+/*
+ * Invoke a callback on behalf of porchlua_process_feed().  The terminal is in
+ * non-blocking mode while we're feeding it, so we need to be able to put it
+ * back before we let an error propagate any further.
+ */
+static int
+porchlua_process_feed_call(lua_State *L, struct porch_process *self,
+    int nargs, int nresults, int oflags)
+{
+
+	self->stats.callbacks++;
+	if (lua_pcall(L, nargs, nresults, 0) == LUA_OK)
+		return (0);
+
+	if (self->termctl != -1)
+		(void)fcntl(self->termctl, F_SETFL, oflags);
+	return (lua_error(L));
+}
+
+/*
+ * Translate a batch of input for porchlua_process_feed(), applying the same
+ * escape processing that write() does in non-raw mode if requested and
+ * replacing newlines with the configured eol, which may be empty to strip them.
+ * Escapes may straddle batches, so the state is carried in the feed.  `out` may
+ * be the same buffer as `in` unless the eol is longer than a newline, since
+ * nothing else ever grows the input.  Returns an error string on malformed
+ * input, or NULL.
+ */
+static const char *
+porchlua_feed_xlate(struct porchlua_feed *feed, const char *in, size_t insz,
+    char *out, size_t *outsz)
+{
+	static char errbuf[32];
+	size_t outpos;
+	char ch;
+
+	outpos = 0;
+	for (size_t i = 0; i < insz; i++) {
+		ch = in[i];
+
+		switch (feed->escstate) {
+		case FEED_ESC_QUOTED:
+			feed->escstate = FEED_ESC_NONE;
+			out[outpos++] = ch;
+			continue;
+		case FEED_ESC_CNTRL:
+			feed->escstate = FEED_ESC_NONE;
+			if (ch < 0x40 || ch > 0x5f) {
+				snprintf(errbuf, sizeof(errbuf),
+				    "Invalid escape of '%c'", ch);
+				return (errbuf);
+			}
+
+			out[outpos++] = ch - 0x40;
+			continue;
+		default:
+			break;
+		}
+
+		if (feed->escape && ch == '\\') {
+			feed->escstate = FEED_ESC_QUOTED;
+		} else if (feed->escape && ch == '^') {
+			feed->escstate = FEED_ESC_CNTRL;
+		} else if (ch == '\n' && feed->eol != NULL) {
+			memcpy(&out[outpos], feed->eol, feed->eolsz);
+			outpos += feed->eolsz;
+		} else {
+			out[outpos++] = ch;
+		}
+	}
+
+	*outsz = outpos;
+	return (NULL);
+}
+
+/*
+ * Report progress for porchlua_process_feed(), in bytes of the source consumed
+ * so that it's in the same units as the total, regardless of how the eol
+ * replacement or escape processing may have changed the size of what we
+ * actually wrote.
+ */
+static void
+porchlua_process_feed_progress(lua_State *L, struct porch_process *self,
+    struct porchlua_feed *feed, size_t consumed, int oflags)
+{
+
+	if (feed->progressfn == 0)
+		return;
+
+	lua_pushvalue(L, feed->progressfn);
+	lua_pushinteger(L, consumed);
+	if (feed->total >= 0)
+		lua_pushinteger(L, feed->total);
+	else
+		lua_pushnil(L);
+	porchlua_process_feed_call(L, self, 2, 0, oflags);
+}
+
+/*
+ * Push the contents of `srcfd` into the process until we hit EOF on it.  We
+ * keep draining the process' output into the `readfn` while we're waiting for
+ * the terminal to accept more, so that a process that echoes its input back to
+ * us can't wedge the both of us.  Returns 0 on success, or the number of values
+ * pushed onto the stack to describe the failure.
+ */
+static int
+porchlua_process_feed(lua_State *L, struct porch_process *self, int srcfd,
+    struct porchlua_feed *feed, size_t *osent)
+{
+	char rbuf[LINE_MAX];
+	struct pollfd pfd[3];
+	char *inbuf, *outbuf;
+	size_t chunkin, consumed, outoff, pending, sent;
+	const char *errstr;
+	ssize_t readsz, writesz;
+	int error, nargs, oflags, ready;
+	bool srceof;
+
+	inbuf = lua_newuserdata(L, feed->chunksz);
+	if (feed->eolsz > 1)
+		outbuf = lua_newuserdata(L, feed->chunksz * feed->eolsz);
+	else
+		outbuf = inbuf;
+
+	oflags = fcntl(self->termctl, F_GETFL);
+	if (oflags == -1 ||
+	    fcntl(self->termctl, F_SETFL, oflags | O_NONBLOCK) == -1) {
+		error = errno;
+		goto err;
+	}
+
+	error = 0;
+	errstr = NULL;
+	chunkin = consumed = outoff = pending = sent = 0;
+	srceof = false;
+	while (!srceof || pending != 0) {
+		pfd[0].fd = self->termctl;
+		pfd[0].events = POLLIN;
+		if (pending != 0)
+			pfd[0].events |= POLLOUT;
+
+		/* We only want more from the source once we've sent it all. */
+		pfd[1].fd = (pending == 0 && !srceof) ? srcfd : -1;
+		pfd[1].events = POLLIN;
+
+		/* A separate stderr needs draining too, or the process may stall. */
+		pfd[2].fd = (feed->errfn != 0) ? self->errctl : -1;
+		pfd[2].events = POLLIN;
+
+		ready = poll(pfd, 3, INFTIM);
+		if (ready == -1 && errno == EINTR)
+			continue;
+		if (ready == -1) {
+			error = errno;
+			break;
+		}
+
+		self->stats.wakeups++;
+		if ((pfd[2].revents & (POLLIN | POLLHUP)) != 0) {
+			nargs = porchlua_process_push_stderr(L, self, feed->errfn);
+			if (nargs == -1) {
+				error = errno;
+				break;
+			} else if (nargs != 0) {
+				porchlua_process_feed_call(L, self, 1, 0, oflags);
+			}
+		}
+		if ((pfd[0].revents & (POLLIN | POLLHUP)) != 0) {
+			readsz = read(self->termctl, rbuf, sizeof(rbuf));
+			self->stats.reads++;
+			if (readsz > 0) {
+				self->stats.bytes_read += readsz;
+				porch_record_event(self, 'o', rbuf, readsz);
+				porch_vt_feed(self->vt, rbuf, readsz);
+			}
+			if (readsz == -1 && errno == EIO)
+				readsz = 0;
+			if (readsz == -1 && errno != EAGAIN && errno != EINTR) {
+				error = errno;
+				break;
+			}
+
+			if (readsz >= 0) {
+				/*
+				 * At EOF, anything that the filters were holding
+				 * back needs to go out first.
+				 */
+				lua_pushvalue(L, feed->readfn);
+				if (readsz > 0)
+					nargs = porchlua_process_push_output(L, self,
+					    rbuf, readsz);
+				else
+					nargs = porchlua_process_push_flush(L, self);
+				if (nargs < 0) {
+					error = errno;
+					lua_pop(L, 1);
+					break;
+				} else if (nargs > 0) {
+					porchlua_process_feed_call(L, self, nargs, 0,
+					    oflags);
+				} else {
+					lua_pop(L, 1);
+				}
+
+				if (readsz == 0) {
+					lua_pushvalue(L, feed->readfn);
+					lua_pushnil(L);
+					porchlua_process_feed_call(L, self, 1, 0,
+					    oflags);
+				}
+			}
+
+			if (readsz == 0) {
+				/*
+				 * The other side went away before it took
+				 * everything; mark it the same way that read()
+				 * would so that nobody tries to use the pty.
+				 */
+				self->eof = true;
+
+				(void)fcntl(self->termctl, F_SETFL, oflags);
+				close(self->termctl);
+				self->termctl = -1;
+
+				luaL_pushfail(L);
+				lua_pushfstring(L,
+				    "process closed its terminal after %I bytes",
+				    (lua_Integer)sent);
+				return (2);
+			}
+		}
+
+		if (pending != 0 && (pfd[0].revents & POLLOUT) != 0) {
+			writesz = porchlua_process_termwrite(self, &outbuf[outoff],
+			    pending);
+			self->stats.writes++;
+			if (writesz == -1) {
+				if (errno == EAGAIN || errno == EINTR)
+					continue;
+				error = errno;
+				break;
+			}
+
+			porch_record_event(self, 'i', &outbuf[outoff], writesz);
+			outoff += writesz;
+			pending -= writesz;
+			sent += writesz;
+			self->stats.bytes_written += writesz;
+
+			if (pending == 0) {
+				consumed += chunkin;
+				porchlua_process_feed_progress(L, self, feed,
+				    consumed, oflags);
+			}
+		}
+
+		if ((pfd[1].revents & (POLLIN | POLLHUP)) != 0) {
+			readsz = read(srcfd, inbuf, feed->chunksz);
+			if (readsz == -1) {
+				if (errno == EAGAIN || errno == EINTR)
+					continue;
+				error = errno;
+				break;
+			} else if (readsz == 0) {
+				srceof = true;
+				if (feed->escstate == FEED_ESC_CNTRL) {
+					errstr = "Incomplete CNTRL character at "
+					    "end of buffer";
+					break;
+				}
+				continue;
+			}
+
+			outoff = 0;
+			if (feed->eol != NULL || feed->escape) {
+				errstr = porchlua_feed_xlate(feed, inbuf, readsz,
+				    outbuf, &pending);
+				if (errstr != NULL)
+					break;
+			} else {
+				pending = readsz;
+			}
+
+			if (feed->writefn != 0) {
+				lua_pushvalue(L, feed->writefn);
+				lua_pushlstring(L, outbuf, pending);
+				porchlua_process_feed_call(L, self, 1, 0, oflags);
+			}
+
+			/* Escapes alone may not leave us anything to write. */
+			chunkin = readsz;
+			if (pending == 0) {
+				consumed += chunkin;
+				porchlua_process_feed_progress(L, self, feed,
+				    consumed, oflags);
+			}
+		}
+	}
+
+	(void)fcntl(self->termctl, F_SETFL, oflags);
+	if (errstr != NULL) {
+		luaL_pushfail(L);
+		lua_pushstring(L, errstr);
+		return (2);
+	} else if (error != 0) {
+		goto err;
+	}
+
+	*osent = sent;
+	return (0);
+err:
+	luaL_pushfail(L);
+	lua_pushstring(L, strerror(error));
+	return (2);
+}
 
-	envsz = sizeof(*penv) + setsz + unsetsz;
-	msg = porch_ipc_msg_alloc(IPC_ENV_SETUP, envsz, (void **)&penv);
-	if (msg == NULL) {
+/*
+ * screen([top[, bottom[, left[, right]]]]) -- returns the text in the given
+ * region of the screen model, one line per row with trailing blanks trimmed,
+ * along with the generation that the region last changed in and the cursor's
+ * row and column.
+ */
+static int
+porchlua_process_screen(lua_State *L)
+{
+	struct porch_process *self;
+
+	self = luaL_checkudata(L, 1, ORCHLUA_PROCESSHANDLE);
+	if (self->vt == NULL) {
 		luaL_pushfail(L);
-		lua_pushstring(L, strerror(ENOMEM));
+		lua_pushstring(L, "screen model not enabled");
 		return (2);
 	}
 
-	penv->clear = clear;
-	penv->setsz = setsz;
-	penv->unsetsz = unsetsz;
-	if (setsz > 0)
-		memcpy(&penv->envstr[0], setstr, setsz);
-	if (unsetsz > 0)
-		memcpy(&penv->envstr[setsz], unsetstr, unsetsz);
-	lua_pop(L, 2);
-
-	return (porch_lua_ipc_send_acked(L, self, msg, IPC_ENV_ACK));
+	return (porchlua_vt_push_screen(L, self->vt, 2));
 }
 
+/*
+ * screen_enable() -- start modeling the screen from the output we read from
+ * here on, sized from the terminal's window size.  This is a no-op if it's
+ * already enabled.
+ */
 static int
-porchlua_process_release(lua_State *L)
+porchlua_process_screen_enable(lua_State *L)
 {
+	struct winsize winsz;
 	struct porch_process *self;
-	int error;
 
 	self = luaL_checkudata(L, 1, ORCHLUA_PROCESSHANDLE);
+	if (self->vt != NULL) {
+		lua_pushboolean(L, 1);
+		return (1);
+	}
 
-	if (lua_istable(L, 2)) {
-		int ret;
-
-		ret = porchlua_do_env(L, self, 2);
-		if (ret != 0)
-			return (ret);
+	if (self->term != NULL && self->term->winsz_valid) {
+		winsz = self->term->winsz;
+	} else if (self->termctl == -1 ||
+	    ioctl(self->termctl, TIOCGWINSZ, &winsz) != 0) {
+		winsz.ws_col = winsz.ws_row = 0;
 	}
 
-	error = porch_release(self->ipc);
-	porch_ipc_close(self->ipc);
-	self->ipc = NULL;
+	if (winsz.ws_col == 0 || winsz.ws_row == 0) {
+		winsz.ws_col = PORCH_VT_DEFAULT_COLS;
+		winsz.ws_row = PORCH_VT_DEFAULT_ROWS;
+	}
 
-	if (error != 0) {
-		error = errno;
+	self->vt = porch_vt_alloc(winsz.ws_col, winsz.ws_row);
+	if (self->vt == NULL) {
+		int serrno = errno;
 
 		luaL_pushfail(L);
-		lua_pushstring(L, strerror(error));
+		lua_pushstring(L, strerror(serrno));
 		return (2);
 	}
 
-	self->released = true;
-
 	lua_pushboolean(L, 1);
 	return (1);
 }
 
+/*
+ * screen_gen([top[, bottom]]) -- returns the generation that the given rows of
+ * the screen model last changed in, so that a caller can tell whether it needs
+ * to look at them again.
+ */
 static int
-porchlua_process_released(lua_State *L)
+porchlua_process_screen_gen(lua_State *L)
 {
 	struct porch_process *self;
+	int bottom, left, right, top;
 
 	self = luaL_checkudata(L, 1, ORCHLUA_PROCESSHANDLE);
-	lua_pushboolean(L, self->released);
+	if (self->vt == NULL) {
+		luaL_pushfail(L);
+		lua_pushstring(L, "screen model not enabled");
+		return (2);
+	}
+
+	lua_settop(L, 3);
+	porchlua_vt_region(L, self->vt, 2, &top, &bottom, &left, &right);
+	lua_pushinteger(L,
+	    (lua_Integer)porch_vt_generation(self->vt, top, bottom));
+	return (1);
+}
+
+/*
+ * send_file(file, readfn[, cfg]) -- stream the contents of `file` into the
+ * process.  Anything the process writes back while we're sending is passed to
+ * `readfn` in whatever size chunks we happened to read it in, and the `cfg`
+ * may specify:
+ *  - eol: a string to replace each newline in the file with
+ *  - chunk: the size of each batch that we'll read from the file and send
+ *  - progress: a function called with (sent, total) after each batch
+ *  - stderr: a function to drain a separate stderr into, as read() does
+ *  - written: a function called with each batch as it's sent, for logging
+ */
+static int
+porchlua_process_send_file(lua_State *L)
+{
+	struct porchlua_feed feed = { 0 };
+	struct stat sb;
+	struct porch_process *self;
+	luaL_Stream *p;
+	size_t sent;
+	off_t foff;
+	int fd, ret;
+
+	self = luaL_checkudata(L, 1, ORCHLUA_PROCESSHANDLE);
+	p = (luaL_Stream *)luaL_checkudata(L, 2, LUA_FILEHANDLE);
+	luaL_checktype(L, 3, LUA_TFUNCTION);
+	feed.readfn = 3;
+	feed.chunksz = FEED_CHUNK_DEFAULT;
+	feed.total = -1;
+
+	if (!lua_isnoneornil(L, 4)) {
+		luaL_checktype(L, 4, LUA_TTABLE);
+
+		if (lua_getfield(L, 4, "eol") != LUA_TNIL)
+			feed.eol = luaL_checklstring(L, -1, &feed.eolsz);
+		if (lua_getfield(L, 4, "chunk") != LUA_TNIL) {
+			lua_Integer chunksz = luaL_checkinteger(L, -1);
+
+			if (chunksz <= 0) {
+				luaL_pushfail(L);
+				lua_pushstring(L, "Invalid chunk size");
+				return (2);
+			}
+
+			feed.chunksz = chunksz;
+		}
+		if (lua_getfield(L, 4, "stderr") != LUA_TNIL) {
+			luaL_checktype(L, -1, LUA_TFUNCTION);
+			feed.errfn = lua_gettop(L);
+		}
+		if (lua_getfield(L, 4, "progress") != LUA_TNIL) {
+			luaL_checktype(L, -1, LUA_TFUNCTION);
+			feed.progressfn = lua_gettop(L);
+		}
+		if (lua_getfield(L, 4, "written") != LUA_TNIL) {
+			luaL_checktype(L, -1, LUA_TFUNCTION);
+			feed.writefn = lua_gettop(L);
+		}
+
+		/*
+		 * The eol string is still anchored in the cfg table, so we
+		 * don't care that we're leaving it on the stack.
+		 */
+	}
+
+	if (self->termctl == -1) {
+		luaL_pushfail(L);
+		lua_pushstring(L, "process has already closed its terminal");
+		return (2);
+	} else if (p->f == NULL) {
+		luaL_pushfail(L);
+		lua_pushstring(L, "attempt to use a closed file");
+		return (2);
+	}
+
+	/*
+	 * We bypass stdio for the file, so we need to start from wherever the
+	 * caller left the stream and leave it at the end when we're done.
+	 */
+	fd = fileno(p->f);
+	foff = ftello(p->f);
+	if (foff != (off_t)-1)
+		(void)lseek(fd, foff, SEEK_SET);
+	if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode))
+		feed.total = sb.st_size - MAX(foff, 0);
+
+	ret = porchlua_process_feed(L, self, fd, &feed, &sent);
+	if (foff != (off_t)-1)
+		(void)fseeko(p->f, 0, SEEK_END);
+	if (ret != 0)
+		return (ret);
+
+	lua_pushinteger(L, sent);
 	return (1);
 }
 
@@ -823,6 +1804,39 @@ porch_resolve_uid(const char *idstr, uid_t *uid)
 	return (true);
 }
 
+static int
+porchlua_process_sched(lua_State *L)
+{
+	struct porch_ipc_msg *msg;
+	struct porch_process *self;
+	struct porch_sched sched;
+	void *msched;
+	int error, ret;
+
+	self = luaL_checkudata(L, 1, ORCHLUA_PROCESSHANDLE);
+	ret = porchlua_sched_build(L, 2, &sched);
+	if (ret != 0)
+		return (ret);
+
+	msg = porch_ipc_msg_alloc(IPC_SCHED, sizeof(sched), &msched);
+	if (msg == NULL)
+		goto err;
+
+	memcpy(msched, &sched, sizeof(sched));
+	error = porch_lua_ipc_send_acked_errno(L, self, msg, IPC_SCHED_ACK);
+	if (error < 0)
+		goto err;
+	else if (error > 0)
+		return (error);
+
+	lua_pushboolean(L, 1);
+	return (1);
+err:
+	luaL_pushfail(L);
+	lua_pushstring(L, strerror(errno));
+	return (2);
+}
+
 static int
 porchlua_process_setgroups(lua_State *L)
 {
@@ -837,7 +1851,7 @@ porchlua_process_setgroups(lua_State *L)
 	nargs = lua_gettop(L) - 1;
 
 	sgrpsz = PORCH_SETGROUPS_SIZE(nargs);
-	sgrp = malloc(sgrpsz);
+	sgrp = porch_mem_alloc(PORCH_MEM_CORE, sgrpsz);
 	if (sgrp == NULL)
 		goto err;
 
@@ -874,7 +1888,7 @@ porchlua_process_setgroups(lua_State *L)
 	if (nargs > 0)
 		self->gid = sgrp->setgroups_gids[0];
 #endif
-	free(sgrp);
+	porch_mem_free(sgrp);
 
 	lua_pushboolean(L, 1);
 	return (1);
@@ -882,7 +1896,7 @@ porchlua_process_setgroups(lua_State *L)
 err:
 	serrno = errno;
 
-	free(sgrp);
+	porch_mem_free(sgrp);
 	luaL_pushfail(L);
 	lua_pushstring(L, strerror(serrno));
 	return (2);
@@ -1030,6 +2044,35 @@ porch_table2sigset(lua_State *L, int idx, sigset_t *sigset)
 	}
 }
 
+/*
+ * shutdown() -- close the write side of the socket for a process spawned
+ * without a pty, so that it sees EOF on its stdin.  A terminal's line
+ * discipline already does that for a ^D, so there's nothing to do for one.
+ */
+static int
+porchlua_process_shutdown(lua_State *L)
+{
+	struct porch_process *self;
+
+	self = luaL_checkudata(L, 1, ORCHLUA_PROCESSHANDLE);
+	if (self->pty) {
+		luaL_pushfail(L);
+		lua_pushstring(L, "process has a terminal");
+		return (2);
+	}
+
+	if (shutdown(self->termctl, SHUT_WR) != 0) {
+		int err = errno;
+
+		luaL_pushfail(L);
+		lua_pushstring(L, strerror(err));
+		return (2);
+	}
+
+	lua_pushboolean(L, 1);
+	return (1);
+}
+
 static int
 porchlua_process_sigcatch(lua_State *L)
 {
@@ -1182,6 +2225,34 @@ porchlua_process_signal(lua_State *L)
 	return (1);
 }
 
+/*
+ * Returns a table of the I/O counters we've accumulated for this process; the
+ * Lua side folds in its own matching counters.
+ */
+static int
+porchlua_process_stats(lua_State *L)
+{
+	struct porch_process *self;
+
+	self = luaL_checkudata(L, 1, ORCHLUA_PROCESSHANDLE);
+
+	lua_createtable(L, 0, 7);
+#define	PROCESS_STAT(n)	do {						\
+	lua_pushinteger(L, (lua_Integer)self->stats.n);			\
+	lua_setfield(L, -2, #n);					\
+} while (0)
+	PROCESS_STAT(reads);
+	PROCESS_STAT(bytes_read);
+	PROCESS_STAT(writes);
+	PROCESS_STAT(bytes_written);
+	PROCESS_STAT(wakeups);
+	PROCESS_STAT(callbacks);
+	PROCESS_STAT(ipc_msgs);
+#undef PROCESS_STAT
+
+	return (1);
+}
+
 static int
 porchlua_process_stop(lua_State *L)
 {
@@ -1225,7 +2296,11 @@ porchlua_process_term(lua_State *L)
 
 	retvals = 0;
 	self = luaL_checkudata(L, 1, ORCHLUA_PROCESSHANDLE);
-	if (!porch_ipc_okay(self->ipc)) {
+	if (!self->pty) {
+		luaL_pushfail(L);
+		lua_pushstring(L, "process has no terminal");
+		return (2);
+	} else if (!porch_ipc_okay(self->ipc)) {
 		luaL_pushfail(L);
 		lua_pushstring(L, "process already released");
 		return (2);
@@ -1251,6 +2326,8 @@ porchlua_process_term(lua_State *L)
 		goto out;
 	}
 
+	self->stats.ipc_msgs++;
+
 	if (porch_ipc_wait(self->ipc, NULL) == -1) {
 		error = errno;
 		goto out;
@@ -1261,6 +2338,7 @@ porchlua_process_term(lua_State *L)
 		goto out;
 	}
 
+	self->stats.ipc_msgs++;
 	if (cmsg != NULL) {
 		luaL_pushfail(L);
 		lua_pushfstring(L, "unexpected message type '%d'",
@@ -1310,27 +2388,34 @@ porchlua_process_write(lua_State *L)
 	const char *buf;
 	size_t bufsz, totalsz;
 	ssize_t writesz;
-	int fd;
 
 	self = luaL_checkudata(L, 1, ORCHLUA_PROCESSHANDLE);
 	buf = luaL_checklstring(L, 2, &bufsz);
 
-	fd = self->termctl;
 	totalsz = 0;
+	porch_trace_begin("core", "write", NULL);
 	while (totalsz < bufsz) {
-		writesz = write(fd, &buf[totalsz], bufsz - totalsz);
+		writesz = porchlua_process_termwrite(self, &buf[totalsz],
+		    bufsz - totalsz);
+		self->stats.writes++;
 		if (writesz == -1 && errno == EINTR) {
 			continue;
 		} else if (writesz == -1) {
 			int err = errno;
 
+			self->stats.bytes_written += totalsz;
+			porch_trace_end("core", "write", "\"bytes\":%zu",
+			    totalsz);
 			luaL_pushfail(L);
 			lua_pushstring(L, strerror(err));
 			return (2);
 		}
 
+		porch_record_event(self, 'i', &buf[totalsz], writesz);
 		totalsz += writesz;
 	}
+	self->stats.bytes_written += totalsz;
+	porch_trace_end("core", "write", "\"bytes\":%zu", totalsz);
 
 	lua_pushnumber(L, totalsz);
 	return (1);
@@ -1343,16 +2428,26 @@ static const luaL_Reg porchlua_process[] = {
 	PROCESS_SIMPLE(close),
 	PROCESS_SIMPLE(continue),
 	PROCESS_SIMPLE(eof),
+	PROCESS_SIMPLE(filters),
 	PROCESS_SIMPLE(gid),
+	PROCESS_SIMPLE(pipe),
 	PROCESS_SIMPLE(proxy),
 	PROCESS_SIMPLE(read),
+	PROCESS_SIMPLE(record),
 	PROCESS_SIMPLE(release),
 	PROCESS_SIMPLE(released),
+	PROCESS_SIMPLE(sched),
+	PROCESS_SIMPLE(screen),
+	PROCESS_SIMPLE(screen_enable),
+	PROCESS_SIMPLE(screen_gen),
+	PROCESS_SIMPLE(send_file),
 	PROCESS_SIMPLE(setgroups),
 	PROCESS_SIMPLE(setid),
+	PROCESS_SIMPLE(shutdown),
 	PROCESS_SIMPLE(sigcatch),
 	PROCESS_SIMPLE(sigmask),
 	PROCESS_SIMPLE(signal),
+	PROCESS_SIMPLE(stats),
 	PROCESS_SIMPLE(stop),
 	PROCESS_SIMPLE(term),
 	PROCESS_SIMPLE(uid),
@@ -1360,9 +2455,30 @@ static const luaL_Reg porchlua_process[] = {
 	{ NULL, NULL },
 };
 
+/*
+ * The screen model outlives close() so that the final screen can still be
+ * inspected, so it's only released once the process is collected; the filter
+ * chain goes with it.
+ */
+static int
+porchlua_process_gc(lua_State *L)
+{
+	struct porch_process *self;
+
+	self = luaL_checkudata(L, 1, ORCHLUA_PROCESSHANDLE);
+	porch_timer_disarm(&self->read_timer);
+	porch_timer_disarm(&self->pulse_timer);
+	porch_vt_free(self->vt);
+	self->vt = NULL;
+	porch_filter_free(self->filter);
+	self->filter = NULL;
+
+	return (porchlua_process_close(L));
+}
+
 static const luaL_Reg porchlua_process_meta[] = {
 	{ "__index", NULL },	/* Set during registration */
-	{ "__gc", porchlua_process_close },
+	{ "__gc", porchlua_process_gc },
 	{ "__close", porchlua_process_close },
 	{ NULL, NULL },
 };
@@ -1379,6 +2495,7 @@ porchlua_register_process_metatable(lua_State *L)
 	lua_pop(L, 1);
 
 	porchlua_register_pstatus_metatable(L);
+	porchlua_register_piped_metatable(L);
 }
 
 static int
@@ -1442,6 +2559,226 @@ porchlua_pstatus_raw_status(lua_State *L)
 	return (1);
 }
 
+/*
+ * Spawn the command at `idx` with its output connected to a pipe.  A table is
+ * used as the argv as-is, while a string is handed to sh(1) to preserve the
+ * semantics of the io.popen() implementation that this replaced.  Returns NULL
+ * with a fail and error pushed if we couldn't start it.
+ */
+static struct porchlua_piped *
+porchlua_piped_spawn(lua_State *L, int idx)
+{
+	struct porchlua_piped *piped;
+	const char **argv;
+	int argc, serrno;
+
+	if (lua_type(L, idx) == LUA_TSTRING) {
+		argv = lua_newuserdata(L, 4 * sizeof(*argv));
+		argv[0] = "/bin/sh";
+		argv[1] = "-c";
+		argv[2] = lua_tostring(L, idx);
+		argv[3] = NULL;
+	} else if (lua_type(L, idx) == LUA_TTABLE) {
+		argc = luaL_len(L, idx);
+		if (argc == 0) {
+			luaL_pushfail(L);
+			lua_pushstring(L, "No command specified to execute");
+			return (NULL);
+		}
+
+		/*
+		 * The strings remain anchored by the table, so it's fine to
+		 * hold onto pointers to them after we pop them.
+		 */
+		argv = lua_newuserdata(L, (argc + 1) * sizeof(*argv));
+		for (int i = 0; i < argc; i++) {
+			lua_geti(L, idx, i + 1);
+			if (lua_type(L, -1) != LUA_TSTRING) {
+				luaL_pushfail(L);
+				lua_pushfstring(L,
+				    "Argument at index %d not a string", i + 1);
+				return (NULL);
+			}
+
+			argv[i] = lua_tostring(L, -1);
+			lua_pop(L, 1);
+		}
+
+		argv[argc] = NULL;
+	} else {
+		luaL_pushfail(L);
+		lua_pushstring(L, "Command must be a string or a table");
+		return (NULL);
+	}
+
+	piped = lua_newuserdata(L, sizeof(*piped));
+	piped->carry = NULL;
+	piped->pid = 0;
+	piped->fd = -1;
+	luaL_setmetatable(L, ORCHLUA_PIPEDHANDLE);
+
+	if (porch_spawn_piped(argv, &piped->pid, &piped->fd) != 0) {
+		serrno = errno;
+
+		luaL_pushfail(L);
+		lua_pushfstring(L, "%s: %s", argv[0], strerror(serrno));
+		return (NULL);
+	}
+
+	return (piped);
+}
+
+static int
+porchlua_piped_reap(struct porchlua_piped *piped, int *status)
+{
+	pid_t pid;
+
+	porch_mem_free(piped->carry);
+	piped->carry = NULL;
+
+	if (piped->fd != -1) {
+		close(piped->fd);
+		piped->fd = -1;
+	}
+
+	if (piped->pid == 0)
+		return (0);
+
+	pid = piped->pid;
+	piped->pid = 0;
+	while (waitpid(pid, status, 0) == -1) {
+		if (errno != EINTR)
+			return (-1);
+	}
+
+	return (0);
+}
+
+static int
+porchlua_piped_close(lua_State *L)
+{
+	struct porchlua_piped *piped;
+	int status;
+
+	piped = luaL_checkudata(L, 1, ORCHLUA_PIPEDHANDLE);
+	if (piped->pid != 0)
+		(void)kill(piped->pid, SIGTERM);
+	(void)porchlua_piped_reap(piped, &status);
+	return (0);
+}
+
+/*
+ * exec(cmd[, collectfn[, cfg]]) -- run `cmd` to completion and return a pstatus
+ * for it.  The output is passed to `collectfn` a line at a time, or in batches
+ * of complete lines if `cfg.batch` is set, and discarded if there's no
+ * `collectfn`.  An incomplete line at EOF is passed along as-is.
+ */
+int
+porchlua_process_exec(lua_State *L)
+{
+	char rbuf[16384];
+	struct porchlua_piped *piped;
+	char *carry, *nl;
+	size_t carrycap, carrysz, linesz, off;
+	ssize_t readsz;
+	int collectfn, serrno, status;
+	bool batch;
+
+	collectfn = 0;
+	if (!lua_isnoneornil(L, 2)) {
+		luaL_checktype(L, 2, LUA_TFUNCTION);
+		collectfn = 2;
+	}
+
+	batch = false;
+	if (!lua_isnoneornil(L, 3)) {
+		luaL_checktype(L, 3, LUA_TTABLE);
+
+		lua_getfield(L, 3, "batch");
+		batch = lua_toboolean(L, -1);
+		lua_pop(L, 1);
+	}
+
+	piped = porchlua_piped_spawn(L, 1);
+	if (piped == NULL)
+		return (2);
+
+	carrycap = carrysz = 0;
+	for (;;) {
+		readsz = read(piped->fd, rbuf, sizeof(rbuf));
+		if (readsz == -1 && errno == EINTR)
+			continue;
+		if (readsz == -1)
+			goto err;
+		if (readsz == 0)
+			break;
+		if (collectfn == 0)
+			continue;
+
+		if (carrysz + readsz > carrycap) {
+			carrycap = MAX(carrycap * 2, carrysz + readsz);
+			carry = porch_mem_realloc(PORCH_MEM_CORE, piped->carry,
+			    carrycap);
+			if (carry == NULL)
+				goto err;
+			piped->carry = carry;
+		}
+
+		carry = piped->carry;
+		memcpy(&carry[carrysz], rbuf, readsz);
+		carrysz += readsz;
+
+		off = 0;
+		if (batch) {
+			/* Everything up to the last newline goes together. */
+			for (linesz = carrysz; linesz > 0; linesz--) {
+				if (carry[linesz - 1] == '\n')
+					break;
+			}
+
+			if (linesz != 0) {
+				lua_pushvalue(L, collectfn);
+				lua_pushlstring(L, carry, linesz);
+				lua_call(L, 1, 0);
+				off = linesz;
+			}
+		} else {
+			while ((nl = memchr(&carry[off], '\n',
+			    carrysz - off)) != NULL) {
+				linesz = nl - &carry[off] + 1;
+
+				lua_pushvalue(L, collectfn);
+				lua_pushlstring(L, &carry[off], linesz);
+				lua_call(L, 1, 0);
+				off += linesz;
+			}
+		}
+
+		if (off != 0) {
+			memmove(carry, &carry[off], carrysz - off);
+			carrysz -= off;
+		}
+	}
+
+	if (carrysz != 0) {
+		lua_pushvalue(L, collectfn);
+		lua_pushlstring(L, piped->carry, carrysz);
+		lua_call(L, 1, 0);
+	}
+
+	if (porchlua_piped_reap(piped, &status) != 0)
+		goto err;
+
+	porchlua_pstatus_push(L, status);
+	return (1);
+err:
+	serrno = errno;
+
+	luaL_pushfail(L);
+	lua_pushstring(L, strerror(serrno));
+	return (2);
+}
+
 int
 porchlua_process_wrap_status(lua_State *L)
 {
@@ -1501,3 +2838,17 @@ porchlua_register_pstatus_metatable(lua_State *L)
 	lua_setfield(L, -2, "__index");
 	lua_pop(L, 1);
 }
+
+static const luaL_Reg porchlua_piped_meta[] = {
+	{ "__gc", porchlua_piped_close },
+	{ "__close", porchlua_piped_close },
+	{ NULL, NULL },
+};
+
+static void
+porchlua_register_piped_metatable(lua_State *L)
+{
+	luaL_newmetatable(L, ORCHLUA_PIPEDHANDLE);
+	luaL_setfuncs(L, porchlua_piped_meta, 0);
+	lua_pop(L, 1);
+}
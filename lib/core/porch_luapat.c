@@ -0,0 +1,984 @@
+/*-
+ * Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sys/param.h>
+
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "porch_lua.h"
+
+/*
+ * Compiled lua patterns: string.find() interprets the pattern from scratch on
+ * every call, which adds up when the same handful of patterns are tried against
+ * the match buffer on every refill.  Instead, we parse the pattern once into a
+ * list of items, with every single-character class (a literal, `.`, `%a`, a
+ * set, ...) flattened into a bitmap, and run that.
+ *
+ * The matcher itself is a straight port of the one in lstrlib.c, just walking
+ * items rather than pattern bytes, so the results are the same as string.find()
+ * for any pattern.  The only difference is when errors are raised: mistakes in
+ * the pattern are caught when it's compiled, rather than when (and if) the
+ * matcher trips over them.  Character classes are evaluated against the ctype
+ * locale in effect when the pattern is compiled.
+ *
+ * Unanchored patterns that must start with a particular byte or run of bytes
+ * skip ahead to the next candidate with memchr(3) rather than attempting a
+ * match at every offset.
+ */
+
+#define	LUAPAT_ESC		'%'
+#define	LUAPAT_MAXPREFIX	16
+
+#ifdef LUA_MAXCAPTURES
+#define	LUAPAT_MAXCAPTURES	LUA_MAXCAPTURES
+#else
+#define	LUAPAT_MAXCAPTURES	32
+#endif
+
+/* Same recursion limit as lstrlib.c */
+#define	LUAPAT_MAXCCALLS	200
+
+#define	CAP_UNFINISHED		(-1)
+#define	CAP_POSITION		(-2)
+
+enum luapat_kind {
+	LUAPAT_SINGLE,		/* One byte from `set`, with a quantifier */
+	LUAPAT_BALANCE,		/* %bxy */
+	LUAPAT_FRONTIER,	/* %f[set] */
+	LUAPAT_BACKREF,		/* %1-%9 */
+	LUAPAT_OPEN,		/* ( */
+	LUAPAT_POSITION,	/* () */
+	LUAPAT_CLOSE,		/* ) */
+	LUAPAT_END,		/* Trailing $ */
+};
+
+struct luapat_item {
+	uint8_t		 kind;
+	char		 quant;		/* '\0' or one of "*+-?" */
+	unsigned char	 arg[2];	/* Balance delimiters, or capture index */
+	uint8_t		 set[UCHAR_MAX / 8 + 1];
+};
+
+struct porchlua_luapat {
+	struct porchlua_cache_entry	 entry;
+	struct luapat_item		*items;
+	size_t				 nitems;
+	bool				 anchor;
+
+	/* For skipping ahead to the next possible match. */
+	const struct luapat_item	*first;
+	size_t				 prefixlen;
+	unsigned char			 prefix[LUAPAT_MAXPREFIX];
+};
+
+struct luapat_state {
+	const struct porchlua_luapat	*pat;
+	const char			*src_init;
+	const char			*src_end;
+	lua_State			*L;
+	int				 matchdepth;
+	int				 level;
+	bool				 hitend;	/* Looked past src_end */
+	struct {
+		const char	*init;
+		ptrdiff_t	 len;
+	} capture[LUAPAT_MAXCAPTURES];
+};
+
+static inline bool
+luapat_isset(const uint8_t *set, unsigned char c)
+{
+
+	return ((set[c >> 3] & (1 << (c & 7))) != 0);
+}
+
+/*
+ * The next three are lstrlib's match_class(), matchbracketclass() and
+ * singlematch(), only used to build the bitmaps.
+ */
+static bool
+luapat_class(int c, int cl)
+{
+	bool res;
+
+	switch (tolower(cl)) {
+	case 'a':
+		res = isalpha(c);
+		break;
+	case 'c':
+		res = iscntrl(c);
+		break;
+	case 'd':
+		res = isdigit(c);
+		break;
+	case 'g':
+		res = isgraph(c);
+		break;
+	case 'l':
+		res = islower(c);
+		break;
+	case 'p':
+		res = ispunct(c);
+		break;
+	case 's':
+		res = isspace(c);
+		break;
+	case 'u':
+		res = isupper(c);
+		break;
+	case 'w':
+		res = isalnum(c);
+		break;
+	case 'x':
+		res = isxdigit(c);
+		break;
+	default:
+		return (cl == c);
+	}
+
+	if (isupper(cl))
+		res = !res;
+	return (res);
+}
+
+static bool
+luapat_bracketclass(int c, const char *p, const char *ec)
+{
+	bool sig = true;
+
+	if (*(p + 1) == '^') {
+		sig = false;
+		p++;
+	}
+
+	while (++p < ec) {
+		if (*p == LUAPAT_ESC) {
+			p++;
+			if (luapat_class(c, (unsigned char)*p))
+				return (sig);
+		} else if (*(p + 1) == '-' && p + 2 < ec) {
+			p += 2;
+			if ((unsigned char)*(p - 2) <= c &&
+			    c <= (unsigned char)*p)
+				return (sig);
+		} else if ((unsigned char)*p == c) {
+			return (sig);
+		}
+	}
+
+	return (!sig);
+}
+
+static bool
+luapat_singleclass(int c, const char *p, const char *ep)
+{
+
+	switch (*p) {
+	case '.':
+		return (true);
+	case LUAPAT_ESC:
+		return (luapat_class(c, (unsigned char)*(p + 1)));
+	case '[':
+		return (luapat_bracketclass(c, p, ep - 1));
+	default:
+		return ((unsigned char)*p == c);
+	}
+}
+
+static void
+luapat_buildset(uint8_t *set, const char *p, const char *ep)
+{
+
+	memset(set, 0, UCHAR_MAX / 8 + 1);
+	if (ep - p == 1 && *p != '.') {
+		set[(unsigned char)*p >> 3] |= 1 << ((unsigned char)*p & 7);
+		return;
+	}
+
+	for (int c = 0; c <= UCHAR_MAX; c++) {
+		if (luapat_singleclass(c, p, ep))
+			set[c >> 3] |= 1 << (c & 7);
+	}
+}
+
+/*
+ * lstrlib's classEnd(): returns the end of the single-character class at `p`,
+ * or NULL with an error pushed.
+ */
+static const char *
+luapat_classend(lua_State *L, const char *p, const char *p_end)
+{
+
+	switch (*p++) {
+	case LUAPAT_ESC:
+		if (p == p_end) {
+			lua_pushliteral(L,
+			    "malformed pattern (ends with '%')");
+			return (NULL);
+		}
+		return (p + 1);
+	case '[':
+		if (p < p_end && *p == '^')
+			p++;
+		do {
+			if (p >= p_end) {
+				lua_pushliteral(L,
+				    "malformed pattern (missing ']')");
+				return (NULL);
+			}
+			if (*(p++) == LUAPAT_ESC && p < p_end)
+				p++;
+		} while (p >= p_end || *p != ']');
+		return (p + 1);
+	default:
+		return (p);
+	}
+}
+
+static bool
+luapat_nospecials(const char *p, size_t plen)
+{
+	static const char specials[] = "^$*+?.([%-";
+
+	for (size_t i = 0; i < plen; i++) {
+		if (p[i] != '\0' && strchr(specials, p[i]) != NULL)
+			return (false);
+	}
+
+	return (true);
+}
+
+/*
+ * Parse the pattern into pat->items, following lstrlib's do_match() to decide
+ * what each piece of the pattern is.  On error, the message is pushed and -1
+ * returned.
+ */
+static int
+luapat_compile(lua_State *L, struct porchlua_luapat *pat, const char *p,
+    size_t plen)
+{
+	const char *ep, *p_end;
+	struct luapat_item *item;
+	bool closed[LUAPAT_MAXCAPTURES];
+	int open[LUAPAT_MAXCAPTURES];
+	int level, nopen;
+
+	p_end = p + plen;
+
+	/*
+	 * Like string.find(), a pattern without any special characters is just
+	 * a string to look for, even if it contains, e.g., a stray ')'.
+	 */
+	if (luapat_nospecials(p, plen)) {
+		for (; p < p_end; p++) {
+			item = &pat->items[pat->nitems++];
+			memset(item, 0, sizeof(*item));
+			item->kind = LUAPAT_SINGLE;
+			luapat_buildset(item->set, p, p + 1);
+		}
+
+		return (0);
+	}
+
+	if (p < p_end && *p == '^') {
+		pat->anchor = true;
+		p++;
+	}
+
+	level = nopen = 0;
+	while (p < p_end) {
+		item = &pat->items[pat->nitems++];
+		memset(item, 0, sizeof(*item));
+
+		switch (*p) {
+		case '(':
+			if (level >= LUAPAT_MAXCAPTURES) {
+				lua_pushliteral(L, "too many captures");
+				return (-1);
+			}
+
+			if (p + 1 < p_end && *(p + 1) == ')') {
+				item->kind = LUAPAT_POSITION;
+				closed[level++] = true;
+				p += 2;
+			} else {
+				item->kind = LUAPAT_OPEN;
+				closed[level] = false;
+				open[nopen++] = level++;
+				p++;
+			}
+			continue;
+		case ')':
+			if (nopen == 0) {
+				lua_pushliteral(L, "invalid pattern capture");
+				return (-1);
+			}
+
+			item->kind = LUAPAT_CLOSE;
+			closed[open[--nopen]] = true;
+			p++;
+			continue;
+		case '$':
+			if (p + 1 == p_end) {
+				item->kind = LUAPAT_END;
+				p++;
+				continue;
+			}
+			break;
+		case LUAPAT_ESC:
+			if (p + 1 == p_end)
+				break;	/* classend() will complain */
+
+			switch (*(p + 1)) {
+			case 'b':
+				if (p + 3 >= p_end) {
+					lua_pushliteral(L, "malformed pattern "
+					    "(missing arguments to '%b')");
+					return (-1);
+				}
+
+				item->kind = LUAPAT_BALANCE;
+				item->arg[0] = *(p + 2);
+				item->arg[1] = *(p + 3);
+				p += 4;
+				continue;
+			case 'f':
+				p += 2;
+				if (p >= p_end || *p != '[') {
+					lua_pushliteral(L,
+					    "missing '[' after '%f' in pattern");
+					return (-1);
+				}
+
+				ep = luapat_classend(L, p, p_end);
+				if (ep == NULL)
+					return (-1);
+
+				item->kind = LUAPAT_FRONTIER;
+				luapat_buildset(item->set, p, ep);
+				p = ep;
+				continue;
+			case '0': case '1': case '2': case '3': case '4':
+			case '5': case '6': case '7': case '8': case '9': {
+				int l = *(p + 1) - '1';
+
+				if (l < 0 || l >= level || !closed[l]) {
+					lua_pushfstring(L,
+					    "invalid capture index %%%d", l + 1);
+					return (-1);
+				}
+
+				item->kind = LUAPAT_BACKREF;
+				item->arg[0] = l;
+				p += 2;
+				continue;
+			}
+			default:
+				break;
+			}
+			break;
+		default:
+			break;
+		}
+
+		ep = luapat_classend(L, p, p_end);
+		if (ep == NULL)
+			return (-1);
+
+		item->kind = LUAPAT_SINGLE;
+		luapat_buildset(item->set, p, ep);
+		if (ep < p_end && *ep != '\0' && strchr("*+-?", *ep) != NULL) {
+			item->quant = *ep;
+			ep++;
+		}
+
+		p = ep;
+	}
+
+	if (nopen != 0) {
+		lua_pushliteral(L, "unfinished capture");
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Figure out what any match must start with, so that find() can skip straight
+ * to it: either a run of literal bytes, or a byte from some set.  Captures
+ * don't consume anything, so they don't get in the way.
+ */
+static void
+luapat_analyze(struct porchlua_luapat *pat)
+{
+	const struct luapat_item *item;
+	int c;
+
+	if (pat->anchor)
+		return;
+
+	for (size_t i = 0; i < pat->nitems; i++) {
+		item = &pat->items[i];
+		if (item->kind == LUAPAT_OPEN || item->kind == LUAPAT_POSITION ||
+		    item->kind == LUAPAT_CLOSE)
+			continue;
+		if (item->kind != LUAPAT_SINGLE)
+			break;
+
+		if (pat->first == NULL &&
+		    (item->quant == '\0' || item->quant == '+'))
+			pat->first = item;
+
+		if (item->quant != '\0' || pat->prefixlen == LUAPAT_MAXPREFIX)
+			break;
+
+		/* Literals have exactly one bit set. */
+		c = -1;
+		for (int b = 0; b <= UCHAR_MAX; b++) {
+			if (!luapat_isset(item->set, b))
+				continue;
+			if (c != -1) {
+				c = -2;
+				break;
+			}
+			c = b;
+		}
+		if (c < 0)
+			break;
+
+		pat->prefix[pat->prefixlen++] = c;
+	}
+}
+
+static const char *luapat_match(struct luapat_state *, const char *, size_t);
+
+static inline bool
+luapat_single(struct luapat_state *ms, const char *s,
+    const struct luapat_item *item)
+{
+
+	if (s >= ms->src_end) {
+		ms->hitend = true;
+		return (false);
+	}
+	return (luapat_isset(item->set, (unsigned char)*s));
+}
+
+static const char *
+luapat_balance(struct luapat_state *ms, const char *s,
+    const struct luapat_item *item)
+{
+	int cont;
+
+	if (s >= ms->src_end) {
+		ms->hitend = true;
+		return (NULL);
+	} else if ((unsigned char)*s != item->arg[0]) {
+		return (NULL);
+	}
+
+	cont = 1;
+	while (++s < ms->src_end) {
+		if ((unsigned char)*s == item->arg[1]) {
+			if (--cont == 0)
+				return (s + 1);
+		} else if ((unsigned char)*s == item->arg[0]) {
+			cont++;
+		}
+	}
+
+	ms->hitend = true;
+	return (NULL);
+}
+
+static const char *
+luapat_max_expand(struct luapat_state *ms, const char *s, size_t i)
+{
+	const struct luapat_item *item = &ms->pat->items[i];
+	const char *res;
+	ptrdiff_t n = 0;
+
+	while (luapat_single(ms, s + n, item))
+		n++;
+
+	/* Try with the maximum repetitions, then back off. */
+	while (n >= 0) {
+		res = luapat_match(ms, s + n, i + 1);
+		if (res != NULL)
+			return (res);
+		n--;
+	}
+
+	return (NULL);
+}
+
+static const char *
+luapat_min_expand(struct luapat_state *ms, const char *s, size_t i)
+{
+	const struct luapat_item *item = &ms->pat->items[i];
+	const char *res;
+
+	for (;;) {
+		res = luapat_match(ms, s, i + 1);
+		if (res != NULL)
+			return (res);
+		else if (luapat_single(ms, s, item))
+			s++;
+		else
+			return (NULL);
+	}
+}
+
+static const char *
+luapat_start_capture(struct luapat_state *ms, const char *s, size_t i,
+    ptrdiff_t what)
+{
+	const char *res;
+
+	ms->capture[ms->level].init = s;
+	ms->capture[ms->level].len = what;
+	ms->level++;
+	if ((res = luapat_match(ms, s, i)) == NULL)
+		ms->level--;
+	return (res);
+}
+
+static const char *
+luapat_end_capture(struct luapat_state *ms, const char *s, size_t i)
+{
+	const char *res;
+	int l;
+
+	/* Compilation made sure that there's one to close. */
+	for (l = ms->level - 1; l >= 0; l--) {
+		if (ms->capture[l].len == CAP_UNFINISHED)
+			break;
+	}
+	assert(l >= 0);
+
+	ms->capture[l].len = s - ms->capture[l].init;
+	if ((res = luapat_match(ms, s, i)) == NULL)
+		ms->capture[l].len = CAP_UNFINISHED;
+	return (res);
+}
+
+static const char *
+luapat_backref(struct luapat_state *ms, const char *s, int l)
+{
+	size_t len;
+
+	len = ms->capture[l].len;
+	if ((size_t)(ms->src_end - s) < len) {
+		ms->hitend = true;
+		return (NULL);
+	}
+
+	if (memcmp(ms->capture[l].init, s, len) == 0)
+		return (s + len);
+	return (NULL);
+}
+
+static const char *
+luapat_match(struct luapat_state *ms, const char *s, size_t i)
+{
+	const struct luapat_item *item;
+	const char *res;
+	unsigned char prev, cur;
+
+	if (ms->matchdepth-- == 0)
+		luaL_error(ms->L, "pattern too complex");
+
+	while (i < ms->pat->nitems) {
+		item = &ms->pat->items[i];
+
+		switch (item->kind) {
+		case LUAPAT_OPEN:
+			s = luapat_start_capture(ms, s, i + 1, CAP_UNFINISHED);
+			goto out;
+		case LUAPAT_POSITION:
+			s = luapat_start_capture(ms, s, i + 1, CAP_POSITION);
+			goto out;
+		case LUAPAT_CLOSE:
+			s = luapat_end_capture(ms, s, i + 1);
+			goto out;
+		case LUAPAT_END:
+			if (s != ms->src_end)
+				s = NULL;
+			goto out;
+		case LUAPAT_BALANCE:
+			s = luapat_balance(ms, s, item);
+			if (s == NULL)
+				goto out;
+			i++;
+			continue;
+		case LUAPAT_FRONTIER:
+			prev = (s == ms->src_init) ? '\0' : *(s - 1);
+			if (s < ms->src_end) {
+				cur = *s;
+			} else {
+				cur = '\0';
+				ms->hitend = true;
+			}
+			if (luapat_isset(item->set, prev) ||
+			    !luapat_isset(item->set, cur)) {
+				s = NULL;
+				goto out;
+			}
+			i++;
+			continue;
+		case LUAPAT_BACKREF:
+			s = luapat_backref(ms, s, item->arg[0]);
+			if (s == NULL)
+				goto out;
+			i++;
+			continue;
+		case LUAPAT_SINGLE:
+			break;
+		}
+
+		if (!luapat_single(ms, s, item)) {
+			if (item->quant == '*' || item->quant == '?' ||
+			    item->quant == '-') {
+				/* Accept the empty match. */
+				i++;
+				continue;
+			}
+
+			s = NULL;
+			goto out;
+		}
+
+		switch (item->quant) {
+		case '?':
+			res = luapat_match(ms, s + 1, i + 1);
+			if (res != NULL) {
+				s = res;
+				goto out;
+			}
+			i++;
+			continue;
+		case '+':
+			s = luapat_max_expand(ms, s + 1, i);
+			goto out;
+		case '*':
+			s = luapat_max_expand(ms, s, i);
+			goto out;
+		case '-':
+			s = luapat_min_expand(ms, s, i);
+			goto out;
+		default:
+			s++;
+			i++;
+			continue;
+		}
+	}
+
+out:
+	ms->matchdepth++;
+	return (s);
+}
+
+/*
+ * Skip to the next offset at or after `s` that a match could start at, or NULL
+ * if there isn't one.
+ */
+static const char *
+luapat_skip(const struct porchlua_luapat *pat, const char *s, const char *end)
+{
+	if (pat->prefixlen > 0) {
+		while ((size_t)(end - s) >= pat->prefixlen) {
+			s = memchr(s, pat->prefix[0], end - s);
+			if (s == NULL || (size_t)(end - s) < pat->prefixlen)
+				return (NULL);
+			if (memcmp(s, pat->prefix, pat->prefixlen) == 0)
+				return (s);
+			s++;
+		}
+
+		return (NULL);
+	}
+
+	if (pat->first == NULL)
+		return (s);
+
+	while (s < end && !luapat_isset(pat->first->set, (unsigned char)*s))
+		s++;
+	return (s < end ? s : NULL);
+}
+
+static int
+luapat_push_captures(struct luapat_state *ms)
+{
+
+	luaL_checkstack(ms->L, ms->level, "too many captures");
+	for (int i = 0; i < ms->level; i++) {
+		if (ms->capture[i].len == CAP_POSITION) {
+			lua_pushinteger(ms->L,
+			    ms->capture[i].init - ms->src_init + 1);
+		} else {
+			lua_pushlstring(ms->L, ms->capture[i].init,
+			    ms->capture[i].len);
+		}
+	}
+
+	return (ms->level);
+}
+
+/*
+ * luapat(pattern) -- compile `pattern`, or fetch it from the pattern cache if
+ * it was compiled recently.
+ */
+int
+porchlua_luapat(lua_State *L)
+{
+	struct porchlua_luapat *pat;
+	const char *key, *pattern;
+	size_t keysz, patsz;
+
+	pattern = luaL_checklstring(L, 1, &patsz);
+
+	lua_pushliteral(L, "lua:");
+	lua_pushvalue(L, 1);
+	lua_concat(L, 2);
+	key = lua_tolstring(L, -1, &keysz);
+	if (porchlua_cache_fetch(L, key, keysz))
+		return (1);
+
+	pat = lua_newuserdata(L, sizeof(*pat));
+	memset(pat, 0, sizeof(*pat));
+	luaL_setmetatable(L, ORCHLUA_LUAPATHANDLE);
+
+	/* Every item takes at least one byte of the pattern. */
+	pat->items = porch_mem_calloc(PORCH_MEM_CORE, MAX(patsz, 1),
+	    sizeof(*pat->items));
+	if (pat->items == NULL) {
+		luaL_pushfail(L);
+		lua_pushstring(L, strerror(ENOMEM));
+		return (2);
+	}
+
+	if (luapat_compile(L, pat, pattern, patsz) != 0) {
+		luaL_pushfail(L);
+		lua_insert(L, -2);
+		return (2);
+	}
+
+	luapat_analyze(pat);
+
+	porchlua_cache_insert(L, &pat->entry, key, keysz);
+	return (1);
+}
+
+/*
+ * Resolve `init` the way string.find() does; false if it's past the end of the
+ * subject, so nothing can match.
+ */
+static bool
+luapat_init(lua_State *L, int idx, size_t subjectsz, lua_Integer *init)
+{
+	lua_Integer pos;
+
+	pos = luaL_optinteger(L, idx, 1);
+
+	/* lstrlib's posrelatI() */
+	if (pos == 0 || pos < -(lua_Integer)subjectsz)
+		pos = 1;
+	else if (pos < 0)
+		pos = subjectsz + pos + 1;
+
+	*init = pos;
+	return (pos <= (lua_Integer)subjectsz + 1);
+}
+
+/*
+ * Look for the first match at or after `s`, returning where it starts; `*endp`
+ * is set to where it ends, and the captures are left in `ms`.
+ *
+ * If there's no match, `*resumep` is set to the first offset whose outcome could
+ * still change if more bytes were appended to the subject: anything before it
+ * failed without ever looking past the end.  Anchored patterns only get the one
+ * attempt, so they don't get an offset to resume from.
+ */
+static const char *
+luapat_search(struct luapat_state *ms, const char *s, const char **endp,
+    const char **resumep)
+{
+	const struct porchlua_luapat *pat = ms->pat;
+	const char *end = ms->src_end, *res, *resume;
+
+	resume = NULL;
+	for (;;) {
+		if (!pat->anchor) {
+			const char *next;
+
+			if ((next = luapat_skip(pat, s, end)) == NULL) {
+				/*
+				 * Only a prefix that's cut off at the end can
+				 * still turn into a match.
+				 */
+				if (resume != NULL)
+					break;
+				else if (pat->prefixlen > 0 &&
+				    (size_t)(end - s) >= pat->prefixlen)
+					resume = end - pat->prefixlen + 1;
+				else if (pat->prefixlen > 0)
+					resume = s;
+				else
+					resume = end;
+				break;
+			}
+
+			s = next;
+		}
+
+		ms->level = 0;
+		ms->matchdepth = LUAPAT_MAXCCALLS;
+		ms->hitend = false;
+		if ((res = luapat_match(ms, s, 0)) != NULL) {
+			*endp = res;
+			return (s);
+		}
+
+		if (ms->hitend && resume == NULL)
+			resume = s;
+		if (pat->anchor || s >= end)
+			break;
+		s++;
+	}
+
+	if (pat->anchor)
+		resume = NULL;
+	else if (resume == NULL)
+		resume = end;
+	*resumep = resume;
+	return (NULL);
+}
+
+static void
+luapat_state_init(struct luapat_state *ms, lua_State *L,
+    const struct porchlua_luapat *pat, const char *subject, size_t subjectsz)
+{
+
+	ms->pat = pat;
+	ms->src_init = subject;
+	ms->src_end = subject + subjectsz;
+	ms->L = L;
+}
+
+/*
+ * luapat:find(subject[, init]) -- same as string.find(subject, pattern, init).
+ */
+static int
+porchlua_luapat_find(lua_State *L)
+{
+	struct luapat_state ms;
+	struct porchlua_luapat *pat;
+	const char *end, *resume, *s, *subject;
+	lua_Integer init;
+	size_t subjectsz;
+
+	pat = luaL_checkudata(L, 1, ORCHLUA_LUAPATHANDLE);
+	subject = luaL_checklstring(L, 2, &subjectsz);
+
+	if (!luapat_init(L, 3, subjectsz, &init)) {
+		luaL_pushfail(L);
+		return (1);
+	}
+
+	luapat_state_init(&ms, L, pat, subject, subjectsz);
+	s = luapat_search(&ms, subject + init - 1, &end, &resume);
+	if (s == NULL) {
+		luaL_pushfail(L);
+		return (1);
+	}
+
+	lua_pushinteger(L, s - subject + 1);
+	lua_pushinteger(L, end - subject);
+	return (luapat_push_captures(&ms) + 2);
+}
+
+/*
+ * luapat:scan(subject[, init]) -- like find(), but without the captures.  If
+ * there's no match, the second return value is where a later scan of the same
+ * subject with more appended to it can start from, if there is such a place.
+ */
+static int
+porchlua_luapat_scan(lua_State *L)
+{
+	struct luapat_state ms;
+	struct porchlua_luapat *pat;
+	const char *end, *resume, *s, *subject;
+	lua_Integer init;
+	size_t subjectsz;
+
+	pat = luaL_checkudata(L, 1, ORCHLUA_LUAPATHANDLE);
+	subject = luaL_checklstring(L, 2, &subjectsz);
+
+	if (!luapat_init(L, 3, subjectsz, &init)) {
+		luaL_pushfail(L);
+		if (pat->anchor)
+			return (1);
+		lua_pushinteger(L, init);
+		return (2);
+	}
+
+	luapat_state_init(&ms, L, pat, subject, subjectsz);
+	s = luapat_search(&ms, subject + init - 1, &end, &resume);
+	if (s == NULL) {
+		luaL_pushfail(L);
+		if (resume == NULL)
+			return (1);
+		lua_pushinteger(L, resume - subject + 1);
+		return (2);
+	}
+
+	lua_pushinteger(L, s - subject + 1);
+	lua_pushinteger(L, end - subject);
+	return (2);
+}
+
+static int
+porchlua_luapat_gc(lua_State *L)
+{
+	struct porchlua_luapat *pat;
+
+	pat = luaL_checkudata(L, 1, ORCHLUA_LUAPATHANDLE);
+	porchlua_cache_release(&pat->entry);
+	porch_mem_free(pat->items);
+	pat->items = NULL;
+	return (0);
+}
+
+#define	LUAPAT_SIMPLE(n)	{ #n, porchlua_luapat_ ## n }
+static const luaL_Reg porchlua_luapat_methods[] = {
+	LUAPAT_SIMPLE(find),
+	LUAPAT_SIMPLE(scan),
+	{ NULL, NULL },
+};
+
+static const luaL_Reg porchlua_luapat_meta[] = {
+	{ "__index", NULL },	/* Set during registration */
+	{ "__gc", porchlua_luapat_gc },
+	{ NULL, NULL },
+};
+
+void
+porchlua_register_luapat_metatable(lua_State *L)
+{
+	luaL_newmetatable(L, ORCHLUA_LUAPATHANDLE);
+	luaL_setfuncs(L, porchlua_luapat_meta, 0);
+
+	luaL_newlibtable(L, porchlua_luapat_methods);
+	luaL_setfuncs(L, porchlua_luapat_methods, 0);
+	lua_setfield(L, -2, "__index");
+	lua_pop(L, 1);
+}
@@ -0,0 +1,302 @@
+/*-
+ * Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "porch_lua.h"
+
+/*
+ * Memory accounting: live and peak bytes for each of the categories in
+ * enum porch_mem_type, reported at exit with PORCH_DEBUG=mem and available to
+ * scripts as core.memstats().
+ *
+ * The Lua heap is tracked by interposing on the state's allocator when the core
+ * is loaded, which works the same whether we were loaded by porch(1) or by some
+ * other Lua interpreter.  Lua hands the allocator the old size of every block,
+ * so we don't need anything more than a counter for it.  The core's own
+ * allocations go through porch_mem_alloc() et al. instead, which stash the size
+ * and category in a small header in front of the block.
+ *
+ * Match buffers live on the Lua heap, so their category is a subset of it that
+ * the Lua side accounts for itself; it's left out of the total.
+ */
+
+struct porch_mem_hdr {
+	size_t				 size;
+	enum porch_mem_type		 type;
+	_Alignas(max_align_t) unsigned char	 data[];
+};
+
+struct porch_mem_counter {
+	size_t		live;
+	size_t		peak;
+};
+
+static const char *const porch_mem_names[PORCH_MEM_NTYPES + 1] = {
+	[PORCH_MEM_LUA] = "lua",
+	[PORCH_MEM_BUFFER] = "buffer",
+	[PORCH_MEM_IPC] = "ipc",
+	[PORCH_MEM_LOG] = "log",
+	[PORCH_MEM_CORE] = "core",
+	[PORCH_MEM_NTYPES] = NULL,
+};
+
+static struct porch_mem_counter porch_mem_counters[PORCH_MEM_NTYPES];
+static struct porch_mem_counter porch_mem_total;
+
+/* The allocator that we interposed on, for the one state we're tracking. */
+static lua_State *porch_mem_L;
+static lua_Alloc porch_mem_lua_allocf;
+static void *porch_mem_lua_ud;
+
+static pid_t porch_mem_report_pid;
+
+void
+porch_mem_account(enum porch_mem_type type, ptrdiff_t delta)
+{
+	struct porch_mem_counter *counter = &porch_mem_counters[type];
+
+	counter->live += delta;
+	if (counter->live > counter->peak)
+		counter->peak = counter->live;
+
+	if (type == PORCH_MEM_BUFFER)
+		return;
+
+	porch_mem_total.live += delta;
+	if (porch_mem_total.live > porch_mem_total.peak)
+		porch_mem_total.peak = porch_mem_total.live;
+}
+
+void *
+porch_mem_alloc(enum porch_mem_type type, size_t size)
+{
+	struct porch_mem_hdr *hdr;
+
+	hdr = malloc(sizeof(*hdr) + size);
+	if (hdr == NULL)
+		return (NULL);
+
+	hdr->size = size;
+	hdr->type = type;
+	porch_mem_account(type, size);
+	return (&hdr->data[0]);
+}
+
+void *
+porch_mem_calloc(enum porch_mem_type type, size_t nmemb, size_t size)
+{
+	void *ptr;
+
+	if (size != 0 && nmemb > SIZE_MAX / size) {
+		errno = ENOMEM;
+		return (NULL);
+	}
+
+	ptr = porch_mem_alloc(type, nmemb * size);
+	if (ptr != NULL)
+		memset(ptr, 0, nmemb * size);
+	return (ptr);
+}
+
+void *
+porch_mem_realloc(enum porch_mem_type type, void *ptr, size_t size)
+{
+	struct porch_mem_hdr *hdr, *nhdr;
+	size_t osize;
+
+	if (ptr == NULL)
+		return (porch_mem_alloc(type, size));
+
+	hdr = (struct porch_mem_hdr *)((char *)ptr -
+	    offsetof(struct porch_mem_hdr, data));
+	assert(hdr->type == type);
+	osize = hdr->size;
+
+	nhdr = realloc(hdr, sizeof(*nhdr) + size);
+	if (nhdr == NULL)
+		return (NULL);
+
+	nhdr->size = size;
+	porch_mem_account(type, (ptrdiff_t)size - (ptrdiff_t)osize);
+	return (&nhdr->data[0]);
+}
+
+void
+porch_mem_free(void *ptr)
+{
+	struct porch_mem_hdr *hdr;
+
+	if (ptr == NULL)
+		return;
+
+	hdr = (struct porch_mem_hdr *)((char *)ptr -
+	    offsetof(struct porch_mem_hdr, data));
+	porch_mem_account(hdr->type, -(ptrdiff_t)hdr->size);
+	free(hdr);
+}
+
+static void *
+porch_mem_lua_alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+	void *nptr;
+
+	/* osize is a type tag rather than a size for new blocks. */
+	if (ptr == NULL)
+		osize = 0;
+
+	nptr = (*porch_mem_lua_allocf)(ud, ptr, osize, nsize);
+	if (nptr == NULL && nsize != 0)
+		return (NULL);
+
+	porch_mem_account(PORCH_MEM_LUA, (ptrdiff_t)nsize - (ptrdiff_t)osize);
+	return (nptr);
+}
+
+/*
+ * The state is being closed, and we may be about to be unloaded along with the
+ * rest of the C modules it loaded.  Whatever is freed after that can't be going
+ * through us anymore, so put the original allocator back while we still can.
+ */
+static int
+porch_mem_lua_restore(lua_State *L)
+{
+
+	if (L != porch_mem_L)
+		return (0);
+
+	lua_setallocf(L, porch_mem_lua_allocf, porch_mem_lua_ud);
+	return (0);
+}
+
+static bool
+porch_mem_debugging(void)
+{
+	const char *debug_env, *cat;
+	size_t catlen;
+
+	debug_env = getenv("PORCH_DEBUG");
+	if (debug_env == NULL)
+		return (false);
+
+	/* Same separators that process.lua accepts. */
+	for (cat = debug_env; *cat != '\0'; cat += catlen) {
+		cat += strspn(cat, ", ");
+		catlen = strcspn(cat, ", ");
+		if (catlen == 3 && strncasecmp(cat, "mem", catlen) == 0)
+			return (true);
+	}
+
+	return (false);
+}
+
+static void
+porch_mem_report(void)
+{
+	struct porch_mem_counter *counter;
+
+	if (getpid() != porch_mem_report_pid)
+		return;
+
+	fprintf(stderr, "porch: memory usage (bytes)\n");
+	fprintf(stderr, "  %-20s %12s %12s\n", "", "live", "peak");
+	for (int type = 0; type < PORCH_MEM_NTYPES; type++) {
+		counter = &porch_mem_counters[type];
+		fprintf(stderr, "  %-20s %12zu %12zu\n", porch_mem_names[type],
+		    counter->live, counter->peak);
+	}
+	fprintf(stderr, "  %-20s %12zu %12zu\n", "total",
+	    porch_mem_total.live, porch_mem_total.peak);
+}
+
+/*
+ * Start accounting for `L`'s heap.  Only the first state that loads us is
+ * tracked, as we'd otherwise need somewhere to keep each state's original
+ * allocator; a library user with more than one state will just see the first.
+ */
+void
+porch_mem_init(lua_State *L)
+{
+	size_t heapsz;
+
+	if (porch_mem_L == NULL) {
+		porch_mem_L = L;
+		porch_mem_lua_allocf = lua_getallocf(L, &porch_mem_lua_ud);
+
+		/*
+		 * Blocks allocated before now will still be freed through us,
+		 * so they need to be accounted for up front.
+		 */
+		heapsz = (size_t)lua_gc(L, LUA_GCCOUNT, 0) * 1024 +
+		    (size_t)lua_gc(L, LUA_GCCOUNTB, 0);
+		porch_mem_account(PORCH_MEM_LUA, heapsz);
+
+		lua_setallocf(L, porch_mem_lua_alloc, porch_mem_lua_ud);
+
+		/*
+		 * Anchor a sentinel in the registry to restore the allocator at
+		 * close; it's created after package's table of loaded C modules,
+		 * so it will be finalized before they're unloaded.
+		 */
+		lua_newuserdata(L, 0);
+		lua_createtable(L, 0, 1);
+		lua_pushcfunction(L, porch_mem_lua_restore);
+		lua_setfield(L, -2, "__gc");
+		lua_setmetatable(L, -2);
+		lua_setfield(L, LUA_REGISTRYINDEX, "porch_mem_sentinel");
+	}
+
+	if (porch_mem_report_pid == 0 && porch_mem_debugging()) {
+		porch_mem_report_pid = getpid();
+		atexit(porch_mem_report);
+	}
+}
+
+/*
+ * Account for memory that the Lua side manages itself, i.e., match buffers.
+ */
+int
+porchlua_memacct(lua_State *L)
+{
+	int type;
+
+	type = luaL_checkoption(L, 1, NULL, porch_mem_names);
+	porch_mem_account(type, luaL_checkinteger(L, 2));
+	return (0);
+}
+
+static void
+porchlua_memstats_push(lua_State *L, const struct porch_mem_counter *counter)
+{
+
+	lua_createtable(L, 0, 2);
+	lua_pushinteger(L, counter->live);
+	lua_setfield(L, -2, "live");
+	lua_pushinteger(L, counter->peak);
+	lua_setfield(L, -2, "peak");
+}
+
+int
+porchlua_memstats(lua_State *L)
+{
+
+	lua_createtable(L, 0, PORCH_MEM_NTYPES + 1);
+	for (int type = 0; type < PORCH_MEM_NTYPES; type++) {
+		porchlua_memstats_push(L, &porch_mem_counters[type]);
+		lua_setfield(L, -2, porch_mem_names[type]);
+	}
+
+	porchlua_memstats_push(L, &porch_mem_total);
+	lua_setfield(L, -2, "total");
+	return (1);
+}
@@ -0,0 +1,388 @@
+/*-
+ * Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "porch_lua.h"
+
+/*
+ * Plain string search for the "plain" and "iplain" matchers.  string.find()
+ * with plain = true looks for the first byte of the needle with memchr(3) and
+ * tries a full compare at every hit, which degrades quickly when the needle
+ * starts with a byte that's common in the output.
+ *
+ * Instead, we look for the first and last bytes of the needle at the same
+ * time, a block of the haystack at a time: a candidate has to match both before
+ * we bother comparing the rest, which weeds out most of the false starts.  On
+ * x86 we do this with SSE2, or AVX2 if the CPU has it, picked once at startup;
+ * elsewhere, or for the tail of the haystack that doesn't fill a block, there's
+ * a scalar version of the same.
+ *
+ * The case-insensitive variant only folds ASCII; the needle is folded when it's
+ * compiled, and the haystack as it's scanned.
+ */
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && \
+    (defined(__GNUC__) || defined(__clang__))
+#define	PLAIN_X86	1
+#endif
+
+struct porchlua_plain {
+	struct porchlua_cache_entry	 entry;
+	size_t				 len;
+	bool				 icase;
+	unsigned char			 needle[];
+};
+
+typedef const char *(plain_scan_fn)(const struct porchlua_plain *,
+    const char *, size_t);
+
+static plain_scan_fn *plain_scan;
+
+static inline unsigned char
+plain_fold(unsigned char c)
+{
+
+	return (c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c);
+}
+
+/*
+ * Compare the candidate at `s` against the whole needle; the anchors have
+ * usually matched already, but it's cheaper to just include them.
+ */
+static inline bool
+plain_verify(const struct porchlua_plain *pat, const char *s)
+{
+
+	if (!pat->icase)
+		return (memcmp(s, pat->needle, pat->len) == 0);
+
+	for (size_t i = 0; i < pat->len; i++) {
+		if (plain_fold(s[i]) != pat->needle[i])
+			return (false);
+	}
+
+	return (true);
+}
+
+static const char *
+plain_scan_scalar(const struct porchlua_plain *pat, const char *s, size_t n)
+{
+	const char *end;
+	unsigned char first, last;
+	size_t k = pat->len;
+
+	if (n < k)
+		return (NULL);
+
+	/* The last position that a match could start at. */
+	end = s + (n - k);
+	first = pat->needle[0];
+	last = pat->needle[k - 1];
+
+	if (!pat->icase) {
+		while (s <= end) {
+			s = memchr(s, first, end - s + 1);
+			if (s == NULL)
+				return (NULL);
+			if ((unsigned char)s[k - 1] == last && plain_verify(pat, s))
+				return (s);
+			s++;
+		}
+
+		return (NULL);
+	}
+
+	for (; s <= end; s++) {
+		if (plain_fold(s[0]) == first &&
+		    plain_fold(s[k - 1]) == last && plain_verify(pat, s))
+			return (s);
+	}
+
+	return (NULL);
+}
+
+#ifdef PLAIN_X86
+/* Fold 'A' through 'Z'; bytes >= 0x80 are negative, so they're left alone. */
+static inline __m128i
+plain_fold_sse2(__m128i block)
+{
+	__m128i upper;
+
+	upper = _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8('A' - 1)),
+	    _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), block));
+	return (_mm_or_si128(block, _mm_and_si128(upper, _mm_set1_epi8(0x20))));
+}
+
+static const char *
+plain_scan_sse2(const struct porchlua_plain *pat, const char *s, size_t n)
+{
+	__m128i first, last, bfirst, blast;
+	size_t i, k = pat->len;
+	unsigned int mask;
+
+	first = _mm_set1_epi8(pat->needle[0]);
+	last = _mm_set1_epi8(pat->needle[k - 1]);
+
+	for (i = 0; n >= k && i + k - 1 + 16 <= n; i += 16) {
+		bfirst = _mm_loadu_si128((const __m128i *)(s + i));
+		blast = _mm_loadu_si128((const __m128i *)(s + i + k - 1));
+		if (pat->icase) {
+			bfirst = plain_fold_sse2(bfirst);
+			blast = plain_fold_sse2(blast);
+		}
+
+		mask = _mm_movemask_epi8(_mm_and_si128(
+		    _mm_cmpeq_epi8(bfirst, first), _mm_cmpeq_epi8(blast, last)));
+		while (mask != 0) {
+			const char *cand = s + i + __builtin_ctz(mask);
+
+			if (plain_verify(pat, cand))
+				return (cand);
+			mask &= mask - 1;
+		}
+	}
+
+	return (plain_scan_scalar(pat, s + i, n - i));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+plain_fold_avx2(__m256i block)
+{
+	__m256i upper;
+
+	upper = _mm256_and_si256(
+	    _mm256_cmpgt_epi8(block, _mm256_set1_epi8('A' - 1)),
+	    _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), block));
+	return (_mm256_or_si256(block,
+	    _mm256_and_si256(upper, _mm256_set1_epi8(0x20))));
+}
+
+__attribute__((target("avx2")))
+static const char *
+plain_scan_avx2(const struct porchlua_plain *pat, const char *s, size_t n)
+{
+	__m256i first, last, bfirst, blast;
+	size_t i, k = pat->len;
+	unsigned int mask;
+
+	first = _mm256_set1_epi8(pat->needle[0]);
+	last = _mm256_set1_epi8(pat->needle[k - 1]);
+
+	for (i = 0; n >= k && i + k - 1 + 32 <= n; i += 32) {
+		bfirst = _mm256_loadu_si256((const __m256i *)(s + i));
+		blast = _mm256_loadu_si256((const __m256i *)(s + i + k - 1));
+		if (pat->icase) {
+			bfirst = plain_fold_avx2(bfirst);
+			blast = plain_fold_avx2(blast);
+		}
+
+		mask = _mm256_movemask_epi8(_mm256_and_si256(
+		    _mm256_cmpeq_epi8(bfirst, first),
+		    _mm256_cmpeq_epi8(blast, last)));
+		while (mask != 0) {
+			const char *cand = s + i + __builtin_ctz(mask);
+
+			if (plain_verify(pat, cand))
+				return (cand);
+			mask &= mask - 1;
+		}
+	}
+
+	return (plain_scan_scalar(pat, s + i, n - i));
+}
+#endif	/* PLAIN_X86 */
+
+static void
+plain_select(void)
+{
+
+#ifdef PLAIN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		plain_scan = plain_scan_avx2;
+	else
+		plain_scan = plain_scan_sse2;
+#else
+	plain_scan = plain_scan_scalar;
+#endif
+}
+
+/*
+ * plain(pattern[, flags]) -- compile `pattern` for plain searching, or fetch it
+ * from the pattern cache.  `flags` may be "i" to ignore (ASCII) case.
+ */
+int
+porchlua_plain(lua_State *L)
+{
+	struct porchlua_plain *pat;
+	const char *flags, *key, *pattern;
+	size_t keysz, patsz;
+	bool icase;
+
+	pattern = luaL_checklstring(L, 1, &patsz);
+	flags = luaL_optstring(L, 2, "");
+
+	icase = false;
+	for (const char *flag = flags; *flag != '\0'; flag++) {
+		if (*flag != 'i')
+			return (luaL_argerror(L, 2, "unknown plain flag"));
+		icase = true;
+	}
+
+	lua_pushstring(L, icase ? "iplain:" : "plain:");
+	lua_pushvalue(L, 1);
+	lua_concat(L, 2);
+	key = lua_tolstring(L, -1, &keysz);
+	if (porchlua_cache_fetch(L, key, keysz))
+		return (1);
+
+	pat = lua_newuserdata(L, sizeof(*pat) + patsz);
+	memset(pat, 0, sizeof(*pat));
+	pat->len = patsz;
+	pat->icase = icase;
+	for (size_t i = 0; i < patsz; i++)
+		pat->needle[i] = icase ? plain_fold(pattern[i]) : pattern[i];
+	luaL_setmetatable(L, ORCHLUA_PLAINHANDLE);
+
+	porchlua_cache_insert(L, &pat->entry, key, keysz);
+	return (1);
+}
+
+/*
+ * Search `subject` from `init`, which has already been resolved the way
+ * string.find() would; NULL if there's no match.
+ */
+static const char *
+plain_search(const struct porchlua_plain *pat, const char *subject,
+    size_t subjectsz, lua_Integer init)
+{
+
+	if (pat->len == 0)
+		return (subject + init - 1);
+
+	return ((*plain_scan)(pat, subject + init - 1, subjectsz - (init - 1)));
+}
+
+static lua_Integer
+plain_init(lua_State *L, int idx, size_t subjectsz)
+{
+	lua_Integer init;
+
+	init = luaL_optinteger(L, idx, 1);
+
+	/* string.find()'s handling of init */
+	if (init == 0 || init < -(lua_Integer)subjectsz)
+		init = 1;
+	else if (init < 0)
+		init = subjectsz + init + 1;
+
+	return (init);
+}
+
+/*
+ * plain:find(subject[, init]) -- same as string.find(subject, pattern, init,
+ * true), but for the case-insensitive variant.
+ */
+static int
+porchlua_plain_find(lua_State *L)
+{
+	const struct porchlua_plain *pat;
+	const char *match, *subject;
+	lua_Integer init;
+	size_t subjectsz;
+
+	pat = luaL_checkudata(L, 1, ORCHLUA_PLAINHANDLE);
+	subject = luaL_checklstring(L, 2, &subjectsz);
+	init = plain_init(L, 3, subjectsz);
+
+	if (init > (lua_Integer)subjectsz + 1 ||
+	    (match = plain_search(pat, subject, subjectsz, init)) == NULL) {
+		luaL_pushfail(L);
+		return (1);
+	}
+
+	lua_pushinteger(L, match - subject + 1);
+	lua_pushinteger(L, match - subject + pat->len);
+	return (2);
+}
+
+/*
+ * plain:scan(subject[, init]) -- same as find(), except that a miss also
+ * returns where a later scan of the same subject with more appended to it can
+ * start from: only the last len - 1 bytes could be the start of a match.
+ */
+static int
+porchlua_plain_scan(lua_State *L)
+{
+	const struct porchlua_plain *pat;
+	const char *match, *subject;
+	lua_Integer init, resume;
+	size_t subjectsz;
+
+	pat = luaL_checkudata(L, 1, ORCHLUA_PLAINHANDLE);
+	subject = luaL_checklstring(L, 2, &subjectsz);
+	init = plain_init(L, 3, subjectsz);
+
+	if (init > (lua_Integer)subjectsz + 1 ||
+	    (match = plain_search(pat, subject, subjectsz, init)) == NULL) {
+		resume = (lua_Integer)subjectsz - (lua_Integer)pat->len + 2;
+		luaL_pushfail(L);
+		lua_pushinteger(L, resume > init ? resume : init);
+		return (2);
+	}
+
+	lua_pushinteger(L, match - subject + 1);
+	lua_pushinteger(L, match - subject + pat->len);
+	return (2);
+}
+
+static int
+porchlua_plain_gc(lua_State *L)
+{
+	struct porchlua_plain *pat;
+
+	pat = luaL_checkudata(L, 1, ORCHLUA_PLAINHANDLE);
+	porchlua_cache_release(&pat->entry);
+	return (0);
+}
+
+#define	PLAIN_SIMPLE(n)	{ #n, porchlua_plain_ ## n }
+static const luaL_Reg porchlua_plain_methods[] = {
+	PLAIN_SIMPLE(find),
+	PLAIN_SIMPLE(scan),
+	{ NULL, NULL },
+};
+
+static const luaL_Reg porchlua_plain_meta[] = {
+	{ "__index", NULL },	/* Set during registration */
+	{ "__gc", porchlua_plain_gc },
+	{ NULL, NULL },
+};
+
+void
+porchlua_register_plain_metatable(lua_State *L)
+{
+
+	if (plain_scan == NULL)
+		plain_select();
+
+	luaL_newmetatable(L, ORCHLUA_PLAINHANDLE);
+	luaL_setfuncs(L, porchlua_plain_meta, 0);
+
+	luaL_newlibtable(L, porchlua_plain_methods);
+	luaL_setfuncs(L, porchlua_plain_methods, 0);
+	lua_setfield(L, -2, "__index");
+	lua_pop(L, 1);
+}
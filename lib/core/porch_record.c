@@ -0,0 +1,293 @@
+/*-
+ * Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sys/param.h>
+#include <sys/ioctl.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "porch_lua.h"
+
+/*
+ * Session recording in the asciicast v2 format: a JSON header line, followed by
+ * one JSON array per event of the form [offset, type, data], with the offset in
+ * seconds since the recording started.  We record "o" events for output read
+ * from the process, "i" events for input written to it, and "r" events for
+ * window size changes.
+ *
+ * The format wants UTF-8 strings, but a process is free to write whatever bytes
+ * it wants.  Valid UTF-8 is written as-is, while control characters and any
+ * bytes that aren't part of a valid sequence are escaped as \u00XX so that
+ * replay can reconstruct the exact bytes.  Sequences split across two reads are
+ * held back until the rest of them shows up.
+ *
+ * Events are written through a large stdio buffer, so we're only paying for the
+ * formatting on the read and write paths.  The buffer is ours rather than
+ * stdio's so that it's accounted for as PORCH_MEM_LOG.
+ */
+
+#define	RECORD_BUFSZ		(64 * 1024)
+#define	RECORD_DEFAULT_COLS	80
+#define	RECORD_DEFAULT_ROWS	24
+#define	RECORD_MAXSEQ		4	/* Longest UTF-8 sequence */
+
+enum {
+	RECORD_OUTPUT,
+	RECORD_INPUT,
+	RECORD_NSTREAMS,
+};
+
+struct porch_record {
+	FILE			*file;
+	char			*buf;
+	struct timespec		 epoch;
+	unsigned char		 carry[RECORD_NSTREAMS][RECORD_MAXSEQ];
+	size_t			 carrysz[RECORD_NSTREAMS];
+};
+
+static int
+porch_record_stream(char type)
+{
+
+	return (type == 'i' ? RECORD_INPUT : RECORD_OUTPUT);
+}
+
+static double
+porch_record_offset(const struct porch_record *rec)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((now.tv_sec - rec->epoch.tv_sec) +
+	    (now.tv_nsec - rec->epoch.tv_nsec) / 1e9);
+}
+
+/*
+ * Returns the length of the UTF-8 sequence at the beginning of `buf`, 0 if it
+ * isn't valid, or -1 if it's valid as far as it goes but incomplete.
+ */
+static int
+porch_record_utf8len(const unsigned char *buf, size_t bufsz)
+{
+	int len;
+
+	if (buf[0] < 0x80)
+		return (1);
+	else if (buf[0] >= 0xc2 && buf[0] <= 0xdf)
+		len = 2;
+	else if (buf[0] >= 0xe0 && buf[0] <= 0xef)
+		len = 3;
+	else if (buf[0] >= 0xf0 && buf[0] <= 0xf4)
+		len = 4;
+	else
+		return (0);
+
+	for (int i = 1; i < len; i++) {
+		if ((size_t)i >= bufsz)
+			return (-1);
+		if ((buf[i] & 0xc0) != 0x80)
+			return (0);
+	}
+
+	return (len);
+}
+
+static void
+porch_record_putdata(struct porch_record *rec, int stream,
+    const unsigned char *buf, size_t bufsz)
+{
+	FILE *f = rec->file;
+	size_t off;
+	int len;
+
+	for (off = 0; off < bufsz; off += len) {
+		len = porch_record_utf8len(&buf[off], bufsz - off);
+		if (len < 0) {
+			/* Hold it for the next event on this stream. */
+			rec->carrysz[stream] = bufsz - off;
+			memcpy(rec->carry[stream], &buf[off], bufsz - off);
+			return;
+		} else if (len == 0) {
+			fprintf(f, "\\u%04x", buf[off]);
+			len = 1;
+			continue;
+		} else if (len > 1) {
+			fwrite(&buf[off], 1, len, f);
+			continue;
+		}
+
+		switch (buf[off]) {
+		case '"':
+		case '\\':
+			fprintf(f, "\\%c", buf[off]);
+			break;
+		case '\n':
+			fputs("\\n", f);
+			break;
+		case '\r':
+			fputs("\\r", f);
+			break;
+		case '\t':
+			fputs("\\t", f);
+			break;
+		default:
+			if (buf[off] < 0x20 || buf[off] == 0x7f)
+				fprintf(f, "\\u%04x", buf[off]);
+			else
+				fputc(buf[off], f);
+			break;
+		}
+	}
+}
+
+void
+porch_record_event(struct porch_process *proc, char type, const char *buf,
+    size_t bufsz)
+{
+	unsigned char joined[RECORD_MAXSEQ];
+	struct porch_record *rec = proc->record;
+	const unsigned char *data = (const unsigned char *)buf;
+	size_t carrysz, joinsz;
+	int len, stream;
+
+	if (rec == NULL || bufsz == 0)
+		return;
+
+	fprintf(rec->file, "[%.6f, \"%c\", \"", porch_record_offset(rec), type);
+
+	/*
+	 * Finish off anything that we held back from the last event first; the
+	 * rest of the sequence will be at the very beginning of this one.
+	 */
+	stream = porch_record_stream(type);
+	carrysz = rec->carrysz[stream];
+	if (carrysz != 0) {
+		rec->carrysz[stream] = 0;
+
+		joinsz = MIN(bufsz, sizeof(joined) - carrysz);
+		memcpy(joined, rec->carry[stream], carrysz);
+		memcpy(&joined[carrysz], data, joinsz);
+
+		len = porch_record_utf8len(joined, carrysz + joinsz);
+		if (len < 0) {
+			/* Still incomplete, this just holds onto it again. */
+			porch_record_putdata(rec, stream, joined,
+			    carrysz + joinsz);
+			len = carrysz + joinsz;
+		} else if (len == 0) {
+			/* Not valid after all, escape what we held. */
+			for (size_t i = 0; i < carrysz; i++)
+				fprintf(rec->file, "\\u%04x", joined[i]);
+			len = carrysz;
+		} else {
+			fwrite(joined, 1, len, rec->file);
+		}
+
+		data += len - carrysz;
+		bufsz -= len - carrysz;
+	}
+
+	porch_record_putdata(rec, stream, data, bufsz);
+	fprintf(rec->file, "\"]\n");
+}
+
+void
+porch_record_resize(struct porch_process *proc, int cols, int rows)
+{
+	struct porch_record *rec = proc->record;
+
+	if (rec == NULL)
+		return;
+
+	fprintf(rec->file, "[%.6f, \"r\", \"%dx%d\"]\n",
+	    porch_record_offset(rec), cols, rows);
+}
+
+int
+porch_record_open(struct porch_process *proc, const char *path,
+    const char *command)
+{
+	struct winsize winsz;
+	struct porch_record *rec;
+	int serrno;
+
+	porch_record_close(proc);
+
+	rec = porch_mem_calloc(PORCH_MEM_LOG, 1, sizeof(*rec));
+	if (rec == NULL)
+		return (-1);
+
+	/* Our own buffer, so that it shows up in the memory accounting. */
+	rec->buf = porch_mem_alloc(PORCH_MEM_LOG, RECORD_BUFSZ);
+	if (rec->buf == NULL)
+		goto err;
+
+	rec->file = fopen(path, "w");
+	if (rec->file == NULL)
+		goto err;
+
+	setvbuf(rec->file, rec->buf, _IOFBF, RECORD_BUFSZ);
+	clock_gettime(CLOCK_MONOTONIC, &rec->epoch);
+
+	if (proc->termctl == -1 ||
+	    ioctl(proc->termctl, TIOCGWINSZ, &winsz) != 0 ||
+	    winsz.ws_col == 0 || winsz.ws_row == 0) {
+		winsz.ws_col = RECORD_DEFAULT_COLS;
+		winsz.ws_row = RECORD_DEFAULT_ROWS;
+	}
+
+	fprintf(rec->file,
+	    "{\"version\": 2, \"width\": %d, \"height\": %d, "
+	    "\"timestamp\": %lld", winsz.ws_col, winsz.ws_row,
+	    (long long)time(NULL));
+	if (command != NULL) {
+		fprintf(rec->file, ", \"command\": \"");
+		porch_record_putdata(rec, RECORD_OUTPUT,
+		    (const unsigned char *)command, strlen(command));
+		rec->carrysz[RECORD_OUTPUT] = 0;
+		fprintf(rec->file, "\"");
+	}
+	fprintf(rec->file, "}\n");
+
+	proc->record = rec;
+	return (0);
+err:
+	serrno = errno;
+	porch_mem_free(rec->buf);
+	porch_mem_free(rec);
+	errno = serrno;
+	return (-1);
+}
+
+void
+porch_record_close(struct porch_process *proc)
+{
+	struct porch_record *rec = proc->record;
+
+	if (rec == NULL)
+		return;
+
+	/* Anything still held back isn't going to be completed now. */
+	for (int stream = 0; stream < RECORD_NSTREAMS; stream++) {
+		if (rec->carrysz[stream] == 0)
+			continue;
+
+		fprintf(rec->file, "[%.6f, \"%c\", \"", porch_record_offset(rec),
+		    stream == RECORD_INPUT ? 'i' : 'o');
+		for (size_t i = 0; i < rec->carrysz[stream]; i++)
+			fprintf(rec->file, "\\u%04x", rec->carry[stream][i]);
+		fprintf(rec->file, "\"]\n");
+	}
+
+	fclose(rec->file);
+	porch_mem_free(rec->buf);
+	porch_mem_free(rec);
+	proc->record = NULL;
+}
@@ -0,0 +1,333 @@
+/*-
+ * Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sys/param.h>
+#include <sys/resource.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "porch_lua.h"
+
+#ifndef nitems
+#define	nitems(x)	(sizeof((x)) / sizeof((x)[0]))
+#endif
+
+/*
+ * CPU affinity, nice level and scheduling policy, for spawned processes via
+ * IPC_SCHED before they're released and for porch itself.  The CPU set travels
+ * as a plain bitmap since not everything has a cpu_set_t; only Linux and
+ * FreeBSD (13.1 and later) have sched_setaffinity(2) to apply it with.
+ */
+#if defined(__linux__) || \
+    (defined(__FreeBSD__) && __FreeBSD_version >= 1301000)
+#define	PORCH_HAVE_AFFINITY
+#endif
+
+/* Policies need sched_setscheduler(2), which macOS and OpenBSD lack. */
+#if defined(_POSIX_PRIORITY_SCHEDULING) && _POSIX_PRIORITY_SCHEDULING >= 0
+#define	PORCH_HAVE_SCHED_POLICY
+#endif
+
+static const struct porch_sched_policy {
+	const char	*name;
+	int		 policy;
+} porch_sched_policies[] = {
+	{ "other",	SCHED_OTHER },
+	{ "fifo",	SCHED_FIFO },
+	{ "rr",		SCHED_RR },
+#ifdef SCHED_BATCH
+	{ "batch",	SCHED_BATCH },
+#endif
+#ifdef SCHED_IDLE
+	{ "idle",	SCHED_IDLE },
+#endif
+};
+
+static int
+porch_sched_setcpu(struct porch_sched *sched, unsigned long cpu)
+{
+
+	if (cpu >= PORCH_SCHED_MAXCPU)
+		return (-1);
+
+	sched->sched_cpus[cpu / 64] |= 1ULL << (cpu % 64);
+	sched->sched_flags |= PSCHED_AFFINITY;
+	return (0);
+}
+
+/*
+ * Parse a CPU list in the usual "0-3,8" form into `sched`.
+ */
+int
+porch_sched_cpus(struct porch_sched *sched, const char *list)
+{
+	const char *p = list;
+	char *end;
+	unsigned long first, last;
+
+	memset(sched->sched_cpus, 0, sizeof(sched->sched_cpus));
+	do {
+		errno = 0;
+		first = strtoul(p, &end, 10);
+		if (errno != 0 || end == p)
+			goto inval;
+
+		last = first;
+		if (*end == '-') {
+			p = end + 1;
+			last = strtoul(p, &end, 10);
+			if (errno != 0 || end == p || last < first)
+				goto inval;
+		}
+
+		for (unsigned long cpu = first; cpu <= last; cpu++) {
+			if (porch_sched_setcpu(sched, cpu) != 0)
+				goto inval;
+		}
+
+		p = end + 1;
+	} while (*end == ',');
+
+	if (*end != '\0')
+		goto inval;
+
+	return (0);
+inval:
+	errno = EINVAL;
+	return (-1);
+}
+
+int
+porch_sched_policy(struct porch_sched *sched, const char *name)
+{
+
+	for (size_t i = 0; i < nitems(porch_sched_policies); i++) {
+		if (strcmp(porch_sched_policies[i].name, name) != 0)
+			continue;
+
+		sched->sched_policy = porch_sched_policies[i].policy;
+		sched->sched_flags |= PSCHED_POLICY;
+		return (0);
+	}
+
+	errno = EINVAL;
+	return (-1);
+}
+
+/*
+ * Apply `sched` to the calling process.  Returns 0 or an errno.
+ */
+int
+porch_sched_apply(const struct porch_sched *sched)
+{
+
+	if ((sched->sched_flags & PSCHED_POLICY) != 0) {
+#ifdef PORCH_HAVE_SCHED_POLICY
+		struct sched_param param = { 0 };
+		int policy = sched->sched_policy;
+
+		/* Only the realtime policies take a priority. */
+		if ((sched->sched_flags & PSCHED_PRIORITY) != 0)
+			param.sched_priority = sched->sched_priority;
+		else if (policy == SCHED_FIFO || policy == SCHED_RR)
+			param.sched_priority = sched_get_priority_min(policy);
+
+		if (sched_setscheduler(0, policy, &param) != 0)
+			return (errno);
+#else
+		return (EOPNOTSUPP);
+#endif
+	}
+
+	if ((sched->sched_flags & PSCHED_NICE) != 0 &&
+	    setpriority(PRIO_PROCESS, 0, sched->sched_nice) != 0)
+		return (errno);
+
+	if ((sched->sched_flags & PSCHED_AFFINITY) != 0) {
+#ifdef PORCH_HAVE_AFFINITY
+		cpu_set_t mask;
+
+		CPU_ZERO(&mask);
+		for (int cpu = 0; cpu < MIN(PORCH_SCHED_MAXCPU, CPU_SETSIZE);
+		    cpu++) {
+			if ((sched->sched_cpus[cpu / 64] &
+			    (1ULL << (cpu % 64))) != 0)
+				CPU_SET(cpu, &mask);
+		}
+
+		if (sched_setaffinity(0, sizeof(mask), &mask) != 0)
+			return (errno);
+#else
+		return (EOPNOTSUPP);
+#endif
+	}
+
+	return (0);
+}
+
+/*
+ * For porch(1)'s --cpus, --nice and --policy, each of which may be NULL.
+ */
+int
+porch_sched_self(const char *cpus, const char *nice, const char *policy)
+{
+	struct porch_sched sched = { 0 };
+	char *end;
+	long val;
+	int error;
+
+	if (cpus != NULL && porch_sched_cpus(&sched, cpus) != 0)
+		return (-1);
+
+	if (nice != NULL) {
+		errno = 0;
+		val = strtol(nice, &end, 10);
+		if (errno != 0 || end == nice || *end != '\0' ||
+		    val < INT_MIN || val > INT_MAX) {
+			errno = EINVAL;
+			return (-1);
+		}
+
+		sched.sched_nice = val;
+		sched.sched_flags |= PSCHED_NICE;
+	}
+
+	if (policy != NULL && porch_sched_policy(&sched, policy) != 0)
+		return (-1);
+
+	if ((error = porch_sched_apply(&sched)) != 0) {
+		errno = error;
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Build a struct porch_sched from the config table at `idx`, with any of the
+ * following fields:
+ *  - cpus: a list like "0-3,8", or a table of CPU numbers
+ *  - nice: the nice level
+ *  - policy: "other", "fifo", "rr", and "batch" or "idle" where supported
+ *  - priority: the priority for the "fifo" or "rr" policies
+ *
+ * Returns 0 on success, or the number of values pushed onto the stack for an
+ * error.
+ */
+int
+porchlua_sched_build(lua_State *L, int idx, struct porch_sched *sched)
+{
+	const char *str;
+	int isnum, type;
+
+	memset(sched, 0, sizeof(*sched));
+	luaL_checktype(L, idx, LUA_TTABLE);
+
+	type = lua_getfield(L, idx, "cpus");
+	if (type == LUA_TSTRING) {
+		str = lua_tostring(L, -1);
+		if (porch_sched_cpus(sched, str) != 0) {
+			luaL_pushfail(L);
+			lua_pushfstring(L, "bad cpu list '%s'", str);
+			return (2);
+		}
+	} else if (type == LUA_TTABLE) {
+		lua_Integer ncpus = luaL_len(L, -1);
+
+		for (lua_Integer i = 1; i <= ncpus; i++) {
+			lua_Integer cpu;
+
+			lua_geti(L, -1, i);
+			cpu = lua_tointegerx(L, -1, &isnum);
+			lua_pop(L, 1);
+
+			if (!isnum || cpu < 0 ||
+			    porch_sched_setcpu(sched, cpu) != 0) {
+				luaL_pushfail(L);
+				lua_pushfstring(L, "bad cpu at index %d",
+				    (int)i);
+				return (2);
+			}
+		}
+
+		if (ncpus == 0) {
+			luaL_pushfail(L);
+			lua_pushstring(L, "empty cpu list");
+			return (2);
+		}
+	} else if (type != LUA_TNIL) {
+		luaL_pushfail(L);
+		lua_pushstring(L, "cpus must be a string or a table");
+		return (2);
+	}
+	lua_pop(L, 1);
+
+	if (lua_getfield(L, idx, "nice") != LUA_TNIL) {
+		sched->sched_nice = lua_tointegerx(L, -1, &isnum);
+		if (!isnum) {
+			luaL_pushfail(L);
+			lua_pushstring(L, "nice must be an integer");
+			return (2);
+		}
+
+		sched->sched_flags |= PSCHED_NICE;
+	}
+	lua_pop(L, 1);
+
+	if (lua_getfield(L, idx, "policy") != LUA_TNIL) {
+		str = lua_tostring(L, -1);
+		if (str == NULL || porch_sched_policy(sched, str) != 0) {
+			luaL_pushfail(L);
+			lua_pushfstring(L, "unknown policy '%s'",
+			    str != NULL ? str : luaL_typename(L, -1));
+			return (2);
+		}
+	}
+	lua_pop(L, 1);
+
+	if (lua_getfield(L, idx, "priority") != LUA_TNIL) {
+		sched->sched_priority = lua_tointegerx(L, -1, &isnum);
+		if (!isnum || (sched->sched_flags & PSCHED_POLICY) == 0) {
+			luaL_pushfail(L);
+			lua_pushstring(L,
+			    "priority must be an integer, with a policy");
+			return (2);
+		}
+
+		sched->sched_flags |= PSCHED_PRIORITY;
+	}
+	lua_pop(L, 1);
+
+	return (0);
+}
+
+/*
+ * sched(cfg) -- applies the scheduling config to porch itself.
+ */
+int
+porchlua_sched(lua_State *L)
+{
+	struct porch_sched sched;
+	int error, ret;
+
+	ret = porchlua_sched_build(L, 1, &sched);
+	if (ret != 0)
+		return (ret);
+
+	if ((error = porch_sched_apply(&sched)) != 0) {
+		luaL_pushfail(L);
+		lua_pushstring(L, strerror(error));
+		return (2);
+	}
+
+	lua_pushboolean(L, 1);
+	return (1);
+}
@@ -41,25 +41,40 @@
 #define	SOCKPAIR_ATTRS	(0)
 #endif
 
+/*
+ * The stdio socket for a process without a pty must block, unlike the command
+ * socket; we also ask for larger buffers than the pty would give us so that
+ * batch programs can stream output without stalling on us.
+ */
+#ifdef SOCK_CLOEXEC
+#define	STDIOSOCK_ATTRS	(SOCK_CLOEXEC)
+#else
+#define	STDIOSOCK_ATTRS	(0)
+#endif
+#define	STDIOSOCK_BUFSZ	(256 * 1024)
+
 extern char **environ;
 
 /* Parent */
 static int porch_newpt(void);
+static void porch_newsock(int [2]);
 
 /* Child */
 static pid_t porch_newsess(porch_ipc_t);
 static void porch_usept(porch_ipc_t, pid_t, int, struct termios *);
+static void porch_usesock(porch_ipc_t, int);
 static void porch_child_error(porch_ipc_t, const char *, ...) __printflike(2, 3);
 static void porch_exec(porch_ipc_t, int, const char *[], struct termios *);
 
 /* Both */
+static int porch_cloexec_pipe(int [2]);
 static int porch_wait(porch_ipc_t);
 
 int
 porch_spawn(int argc, const char *argv[], struct porch_process *p,
     porch_ipc_handler *child_error_handler)
 {
-	int cmdsock[2];
+	int cmdsock[2], errpipe[2], stdiosock[2];
 	pid_t pid, sess;
 
 	if (socketpair(AF_UNIX, SOCK_STREAM | SOCKPAIR_ATTRS, 0,
@@ -82,7 +97,15 @@ porch_spawn(int argc, const char *argv[], struct porch_process *p,
 		err(1, "fcntl");
 #endif
 
-	p->termctl = porch_newpt();
+	if (p->pty) {
+		p->termctl = porch_newpt();
+	} else {
+		porch_newsock(stdiosock);
+		p->termctl = stdiosock[0];
+	}
+
+	if (p->split_stderr && porch_cloexec_pipe(errpipe) == -1)
+		err(1, "pipe");
 
 	pid = fork();
 	if (pid == -1) {
@@ -102,12 +125,25 @@ porch_spawn(int argc, const char *argv[], struct porch_process *p,
 
 		sess = porch_newsess(ipc);
 
-		porch_usept(ipc, sess, p->termctl, &t);
+		if (p->pty) {
+			porch_usept(ipc, sess, p->termctl, &t);
+		} else {
+			porch_usesock(ipc, stdiosock[1]);
+		}
+
+		if (p->split_stderr) {
+			if (dup2(errpipe[1], STDERR_FILENO) == -1)
+				porch_child_error(ipc, "dup2: %s",
+				    strerror(errno));
+			close(errpipe[0]);
+			close(errpipe[1]);
+		}
+
 		assert(p->termctl >= 0);
 		close(p->termctl);
 		p->termctl = -1;
 
-		porch_exec(ipc, argc, argv, &t);
+		porch_exec(ipc, argc, argv, p->pty ? &t : NULL);
 	}
 
 	p->released = false;
@@ -116,12 +152,20 @@ porch_spawn(int argc, const char *argv[], struct porch_process *p,
 
 	/* Parent */
 	close(cmdsock[1]);
+	if (!p->pty)
+		close(stdiosock[1]);
+	if (p->split_stderr) {
+		close(errpipe[1]);
+		p->errctl = errpipe[0];
+	}
 
 	if (p->ipc == NULL) {
 		int status;
 
 		assert(p->termctl >= 0);
 		close(p->termctl);
+		if (p->errctl != -1)
+			close(p->errctl);
 		close(cmdsock[0]);
 
 		kill(pid, SIGKILL);
@@ -142,6 +186,98 @@ porch_spawn(int argc, const char *argv[], struct porch_process *p,
 	return (porch_wait(p->ipc));
 }
 
+static int
+porch_cloexec_pipe(int fds[2])
+{
+
+	if (pipe(fds) == -1)
+		return (-1);
+	if (fcntl(fds[0], F_SETFD, fcntl(fds[0], F_GETFD) | FD_CLOEXEC) == -1 ||
+	    fcntl(fds[1], F_SETFD, fcntl(fds[1], F_GETFD) | FD_CLOEXEC) == -1) {
+		int serrno = errno;
+
+		close(fds[0]);
+		close(fds[1]);
+		errno = serrno;
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Spawn a helper command with its stdout connected to a pipe rather than a
+ * pty; stdin and stderr are inherited from us.  These are short-lived commands
+ * run for exec() and pipe(), so none of the pre-exec configuration that
+ * porch_spawn() offers is available and we don't need a full IPC channel.  We
+ * do use a second pipe to report an exec failure back, so that the caller gets
+ * a proper error rather than having to guess at an exit status.
+ */
+int
+porch_spawn_piped(const char *argv[], pid_t *opid, int *ofd)
+{
+	int errpipe[2], outpipe[2];
+	int error, status;
+	ssize_t readsz;
+	pid_t pid;
+
+	if (porch_cloexec_pipe(outpipe) == -1)
+		return (-1);
+	if (porch_cloexec_pipe(errpipe) == -1) {
+		error = errno;
+		goto out;
+	}
+
+	pid = fork();
+	if (pid == -1) {
+		error = errno;
+		close(errpipe[0]);
+		close(errpipe[1]);
+		goto out;
+	} else if (pid == 0) {
+		/* Child */
+		signal(SIGTERM, SIG_DFL);
+
+		if (dup2(outpipe[1], STDOUT_FILENO) == -1)
+			goto childerr;
+
+		execvp(argv[0], (char * const *)(const void *)argv);
+
+childerr:
+		error = errno;
+		(void)write(errpipe[1], &error, sizeof(error));
+		_exit(127);
+	}
+
+	/* Parent */
+	close(errpipe[1]);
+	close(outpipe[1]);
+
+	/* This will be closed by a successful exec. */
+	while ((readsz = read(errpipe[0], &error, sizeof(error))) == -1 &&
+	    errno == EINTR)
+		continue;
+	close(errpipe[0]);
+
+	if (readsz == sizeof(error)) {
+		close(outpipe[0]);
+		while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+			continue;
+
+		errno = error;
+		return (-1);
+	}
+
+	*opid = pid;
+	*ofd = outpipe[0];
+	return (0);
+out:
+	close(outpipe[0]);
+	close(outpipe[1]);
+	errno = error;
+	return (-1);
+}
+
 static int
 porch_wait(porch_ipc_t ipc)
 {
@@ -324,6 +460,32 @@ porch_child_chdir(porch_ipc_t ipc, struct porch_ipc_msg *msg,
 	return (error);
 }
 
+static int
+porch_child_sched(porch_ipc_t ipc, struct porch_ipc_msg *msg,
+    void *cookie __unused)
+{
+	struct porch_sched *sched;
+	size_t schedsz;
+	int error, *errorp;
+
+	sched = porch_ipc_msg_payload(msg, &schedsz);
+	if (sched == NULL || schedsz != sizeof(*sched)) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	error = porch_sched_apply(sched);
+
+	msg = porch_ipc_msg_alloc(IPC_SCHED_ACK, sizeof(error),
+	    (void **)&errorp);
+
+	*errorp = error;
+	error = porch_ipc_send(ipc, msg);
+	porch_ipc_msg_free(msg);
+
+	return (error);
+}
+
 static int
 porch_child_setgroups(porch_ipc_t ipc, struct porch_ipc_msg *msg,
     void *cookie __unused)
@@ -478,18 +640,22 @@ porch_exec(porch_ipc_t ipc, int argc __unused, const char *argv[],
 
 	/*
 	 * Register a couple of events that the script may want to use:
-	 * - IPC_TERMIOS_INQUIRY: sent our terminal attributes back over.
+	 * - IPC_TERMIOS_INQUIRY: sent our terminal attributes back over, if we
+	 *   have a terminal at all.
 	 * - IPC_ENV_SETUP: setup environment variables.
 	 * - IPC_CHDIR: change cwd.
+	 * - IPC_SCHED: CPU affinity, nice level and scheduling policy
 	 * - IPC_SETGROUPS: setgroups(2)
 	 * - IPC_SETID: setuid(2) or setgid(2)
 	 * - IPC_SETMASK: set signal mask
 	 * - IPC_SIGCATCH: configure caught/uncaught signals
 	 */
-	porch_ipc_register(ipc, IPC_TERMIOS_INQUIRY, porch_child_termios_inquiry,
-	    t);
+	if (t != NULL)
+		porch_ipc_register(ipc, IPC_TERMIOS_INQUIRY,
+		    porch_child_termios_inquiry, t);
 	porch_ipc_register(ipc, IPC_ENV_SETUP, porch_child_env_setup, NULL);
 	porch_ipc_register(ipc, IPC_CHDIR, porch_child_chdir, NULL);
+	porch_ipc_register(ipc, IPC_SCHED, porch_child_sched, NULL);
 	porch_ipc_register(ipc, IPC_SETGROUPS, porch_child_setgroups, NULL);
 	porch_ipc_register(ipc, IPC_SETID, porch_child_setid, NULL);
 	porch_ipc_register(ipc, IPC_SETMASK, porch_child_setmask, NULL);
@@ -540,6 +706,38 @@ porch_newpt(void)
 	return (newpt);
 }
 
+static void
+porch_newsock(int sock[2])
+{
+	int bufsz = STDIOSOCK_BUFSZ;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | STDIOSOCK_ATTRS, 0, sock) == -1)
+		err(1, "socketpair");
+#if (STDIOSOCK_ATTRS & SOCK_CLOEXEC) == 0
+	if (fcntl(sock[0], F_SETFD, fcntl(sock[0], F_GETFD) | FD_CLOEXEC) == -1)
+		err(1, "fcntl");
+	if (fcntl(sock[1], F_SETFD, fcntl(sock[1], F_GETFD) | FD_CLOEXEC) == -1)
+		err(1, "fcntl");
+#endif
+
+	/* Larger buffers are only an optimization, so failure is fine. */
+	for (int i = 0; i < 2; i++) {
+		(void)setsockopt(sock[i], SOL_SOCKET, SO_SNDBUF, &bufsz,
+		    sizeof(bufsz));
+		(void)setsockopt(sock[i], SOL_SOCKET, SO_RCVBUF, &bufsz,
+		    sizeof(bufsz));
+	}
+
+#ifdef SO_NOSIGPIPE
+	{
+		int on = 1;
+
+		(void)setsockopt(sock[0], SOL_SOCKET, SO_NOSIGPIPE, &on,
+		    sizeof(on));
+	}
+#endif
+}
+
 static pid_t
 porch_newsess(porch_ipc_t ipc)
 {
@@ -579,3 +777,20 @@ porch_usept(porch_ipc_t ipc, pid_t sess, int termctl, struct termios *t)
 	if (target > STDERR_FILENO)
 		close(target);
 }
+
+/*
+ * The non-pty flavor of porch_usept(): stdin, stdout and stderr all go to our
+ * end of the socket, so the script sees the same combined stream that it would
+ * on a terminal.
+ */
+static void
+porch_usesock(porch_ipc_t ipc, int target)
+{
+
+	if (dup2(target, STDIN_FILENO) == -1 ||
+	    dup2(target, STDOUT_FILENO) == -1 ||
+	    dup2(target, STDERR_FILENO) == -1)
+		porch_child_error(ipc, "dup2: %s", strerror(errno));
+	if (target > STDERR_FILENO)
+		close(target);
+}
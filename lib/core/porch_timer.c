@@ -0,0 +1,386 @@
+/*-
+ * Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sys/param.h>
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "porch_lua.h"
+
+/*
+ * Deadlines for the event loop: read timeouts, proxy() pulses and whatever the
+ * scripts register with core.timer(), e.g., the branches of a one() block.  They
+ * all live in a single binary min-heap keyed on the deadline, so whichever loop
+ * is waiting can always sleep until exactly the nearest one.
+ *
+ * The heap is 1-indexed so that a zeroed timer reads as disarmed, and each
+ * timer remembers its own slot so that it can be disarmed or rearmed in
+ * O(log n) without searching for it.  Timers don't carry callbacks: expiry just
+ * marks them fired, and it's up to their owners to notice.  In particular, a
+ * script's timer only ends a read that it was explicitly handed to, so that a
+ * deadline for one thing can't cut short a wait for something else.
+ */
+
+#define	TIMER_HEAP_MIN	16
+
+static struct porch_timer **porch_timers;	/* [1, porch_timers_cnt] */
+static size_t porch_timers_cnt;
+static size_t porch_timers_cap;
+
+static bool
+porch_timer_before(const struct timespec *a, const struct timespec *b)
+{
+
+	if (a->tv_sec != b->tv_sec)
+		return (a->tv_sec < b->tv_sec);
+	return (a->tv_nsec < b->tv_nsec);
+}
+
+static void
+porch_timer_place(struct porch_timer *timer, size_t slot)
+{
+
+	porch_timers[slot] = timer;
+	timer->tm_slot = slot;
+}
+
+static void
+porch_timer_sift_up(struct porch_timer *timer)
+{
+	struct porch_timer *parent;
+	size_t slot = timer->tm_slot;
+
+	while (slot > 1) {
+		parent = porch_timers[slot / 2];
+		if (!porch_timer_before(&timer->tm_deadline,
+		    &parent->tm_deadline))
+			break;
+
+		porch_timer_place(parent, slot);
+		slot /= 2;
+	}
+
+	porch_timer_place(timer, slot);
+}
+
+static void
+porch_timer_sift_down(struct porch_timer *timer)
+{
+	struct porch_timer *child;
+	size_t cslot, slot = timer->tm_slot;
+
+	while ((cslot = slot * 2) <= porch_timers_cnt) {
+		child = porch_timers[cslot];
+		if (cslot < porch_timers_cnt &&
+		    porch_timer_before(&porch_timers[cslot + 1]->tm_deadline,
+		    &child->tm_deadline))
+			child = porch_timers[++cslot];
+		if (!porch_timer_before(&child->tm_deadline,
+		    &timer->tm_deadline))
+			break;
+
+		porch_timer_place(child, slot);
+		slot = cslot;
+	}
+
+	porch_timer_place(timer, slot);
+}
+
+/*
+ * Arm `timer` to fire `secs` seconds from now, rearming it if it's already
+ * armed.  This can only fail if the heap needs to grow and can't.
+ */
+int
+porch_timer_arm(struct porch_timer *timer, double secs)
+{
+	struct timespec *deadline = &timer->tm_deadline;
+	double whole;
+
+	if (timer->tm_slot == 0 && porch_timers_cnt + 1 >= porch_timers_cap) {
+		struct porch_timer **heap;
+		size_t ncap;
+
+		ncap = MAX(porch_timers_cap * 2, TIMER_HEAP_MIN);
+		heap = porch_mem_realloc(PORCH_MEM_CORE, porch_timers,
+		    ncap * sizeof(*heap));
+		if (heap == NULL)
+			return (-1);
+
+		porch_timers = heap;
+		porch_timers_cap = ncap;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, deadline);
+	secs = MAX(secs, 0);
+	deadline->tv_nsec += (long)(modf(secs, &whole) * 1e9);
+	deadline->tv_sec += (time_t)whole;
+	if (deadline->tv_nsec >= 1000000000) {
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000;
+	}
+
+	timer->tm_flags &= ~PTIMER_FIRED;
+	if (timer->tm_slot == 0) {
+		timer->tm_slot = ++porch_timers_cnt;
+		porch_timer_sift_up(timer);
+	} else {
+		porch_timer_sift_up(timer);
+		porch_timer_sift_down(timer);
+	}
+
+	return (0);
+}
+
+void
+porch_timer_disarm(struct porch_timer *timer)
+{
+	struct porch_timer *last;
+	size_t slot = timer->tm_slot;
+
+	if (slot == 0)
+		return;
+
+	timer->tm_slot = 0;
+	last = porch_timers[porch_timers_cnt--];
+	if (last == timer)
+		return;
+
+	/* Move the last one into the hole, and let it find its place. */
+	porch_timer_place(last, slot);
+	porch_timer_sift_up(last);
+	porch_timer_sift_down(last);
+}
+
+/*
+ * Fire everything that's come due.
+ */
+void
+porch_timer_expire(void)
+{
+	struct porch_timer *timer;
+	struct timespec now;
+
+	if (porch_timers_cnt == 0)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	while (porch_timers_cnt > 0) {
+		timer = porch_timers[1];
+		if (porch_timer_before(&now, &timer->tm_deadline))
+			break;
+
+		porch_timer_disarm(timer);
+		timer->tm_flags |= PTIMER_FIRED;
+	}
+}
+
+bool
+porch_timer_fired(const struct porch_timer *timer)
+{
+
+	return ((timer->tm_flags & PTIMER_FIRED) != 0);
+}
+
+/*
+ * Fetch the time left until the nearest deadline, which may be zero if it's
+ * already passed.  Returns false if nothing is armed, i.e., the caller may
+ * block indefinitely.
+ */
+bool
+porch_timer_next(struct timespec *wait)
+{
+	const struct timespec *deadline;
+	struct timespec now;
+
+	if (porch_timers_cnt == 0)
+		return (false);
+
+	deadline = &porch_timers[1]->tm_deadline;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (!porch_timer_before(&now, deadline)) {
+		wait->tv_sec = wait->tv_nsec = 0;
+		return (true);
+	}
+
+	wait->tv_sec = deadline->tv_sec - now.tv_sec;
+	wait->tv_nsec = deadline->tv_nsec - now.tv_nsec;
+	if (wait->tv_nsec < 0) {
+		wait->tv_sec--;
+		wait->tv_nsec += 1000000000;
+	}
+
+	return (true);
+}
+
+/*
+ * timer([secs]) -- create a deadline for the script, armed for `secs` seconds
+ * from now if specified.  Its expiry ends any read that it's passed to, and a
+ * timer that has gone off reports as fired() until it's armed again.
+ */
+int
+porchlua_timer(lua_State *L)
+{
+	struct porch_timer *timer;
+	lua_Number secs = 0;
+	bool arm;
+
+	arm = !lua_isnoneornil(L, 1);
+	if (arm) {
+		secs = luaL_checknumber(L, 1);
+		if (secs < 0)
+			return (luaL_error(L, "timer must not be negative"));
+	}
+
+	timer = lua_newuserdata(L, sizeof(*timer));
+	memset(timer, 0, sizeof(*timer));
+	luaL_setmetatable(L, ORCHLUA_TIMERHANDLE);
+
+	if (arm && porch_timer_arm(timer, secs) != 0) {
+		luaL_pushfail(L);
+		lua_pushstring(L, strerror(ENOMEM));
+		return (2);
+	}
+
+	return (1);
+}
+
+static int
+porchlua_timer_arm(lua_State *L)
+{
+	struct porch_timer *timer;
+	lua_Number secs;
+
+	timer = luaL_checkudata(L, 1, ORCHLUA_TIMERHANDLE);
+	secs = luaL_checknumber(L, 2);
+	if (secs < 0)
+		return (luaL_error(L, "timer must not be negative"));
+
+	if (porch_timer_arm(timer, secs) != 0) {
+		luaL_pushfail(L);
+		lua_pushstring(L, strerror(ENOMEM));
+		return (2);
+	}
+
+	lua_pushboolean(L, 1);
+	return (1);
+}
+
+static int
+porchlua_timer_armed(lua_State *L)
+{
+	struct porch_timer *timer;
+
+	timer = luaL_checkudata(L, 1, ORCHLUA_TIMERHANDLE);
+	lua_pushboolean(L, timer->tm_slot != 0);
+	return (1);
+}
+
+static int
+porchlua_timer_disarm(lua_State *L)
+{
+	struct porch_timer *timer;
+
+	timer = luaL_checkudata(L, 1, ORCHLUA_TIMERHANDLE);
+	porch_timer_disarm(timer);
+	return (0);
+}
+
+static int
+porchlua_timer_fired(lua_State *L)
+{
+	struct porch_timer *timer;
+
+	timer = luaL_checkudata(L, 1, ORCHLUA_TIMERHANDLE);
+
+	/*
+	 * It may have come due since the last time a loop looked; fire just this
+	 * one, as anything else is for the next loop to notice.
+	 */
+	if (timer->tm_slot != 0) {
+		struct timespec now;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (!porch_timer_before(&now, &timer->tm_deadline)) {
+			porch_timer_disarm(timer);
+			timer->tm_flags |= PTIMER_FIRED;
+		}
+	}
+
+	lua_pushboolean(L, porch_timer_fired(timer));
+	return (1);
+}
+
+/*
+ * remaining() -- seconds until the timer fires, 0 if it already has, or nil if
+ * it isn't armed.
+ */
+static int
+porchlua_timer_remaining(lua_State *L)
+{
+	struct porch_timer *timer;
+	struct timespec now;
+	lua_Number remaining;
+
+	timer = luaL_checkudata(L, 1, ORCHLUA_TIMERHANDLE);
+	if (timer->tm_slot == 0) {
+		if (porch_timer_fired(timer))
+			lua_pushnumber(L, 0);
+		else
+			lua_pushnil(L);
+		return (1);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	remaining = (timer->tm_deadline.tv_sec - now.tv_sec) +
+	    (timer->tm_deadline.tv_nsec - now.tv_nsec) / 1e9;
+	lua_pushnumber(L, MAX(remaining, 0));
+	return (1);
+}
+
+static int
+porchlua_timer_gc(lua_State *L)
+{
+	struct porch_timer *timer;
+
+	timer = luaL_checkudata(L, 1, ORCHLUA_TIMERHANDLE);
+	porch_timer_disarm(timer);
+	return (0);
+}
+
+#define	TIMER_SIMPLE(n)	{ #n, porchlua_timer_ ## n }
+static const luaL_Reg porchlua_timer_methods[] = {
+	TIMER_SIMPLE(arm),
+	TIMER_SIMPLE(armed),
+	TIMER_SIMPLE(disarm),
+	TIMER_SIMPLE(fired),
+	TIMER_SIMPLE(remaining),
+	{ NULL, NULL },
+};
+
+static const luaL_Reg porchlua_timer_meta[] = {
+	{ "__index", NULL },	/* Set during registration */
+	{ "__gc", porchlua_timer_gc },
+	{ "__close", porchlua_timer_gc },
+	{ NULL, NULL },
+};
+
+void
+porchlua_register_timer_metatable(lua_State *L)
+{
+
+	luaL_newmetatable(L, ORCHLUA_TIMERHANDLE);
+	luaL_setfuncs(L, porchlua_timer_meta, 0);
+
+	luaL_newlibtable(L, porchlua_timer_methods);
+	luaL_setfuncs(L, porchlua_timer_methods, 0);
+	lua_setfield(L, -2, "__index");
+
+	lua_pop(L, 1);
+}
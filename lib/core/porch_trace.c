@@ -0,0 +1,229 @@
+/*-
+ * Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "porch_lua.h"
+
+/*
+ * Timing trace in the Chrome trace event format, which Perfetto and
+ * chrome://tracing both understand.  This is enabled by setting PORCH_TRACE in
+ * the environment to the file to write it to.  We use the JSON array flavor of
+ * the format, which explicitly permits the closing bracket to be missing, so
+ * a trace from a script that blew up is still usable.
+ *
+ * Every trace point is guarded by a check of porch_trace_enabled, so there's
+ * nothing more than a branch to pay for when tracing is off.
+ */
+bool porch_trace_enabled;
+
+static FILE *porch_trace_file;
+static struct timespec porch_trace_epoch;
+static pid_t porch_trace_pid;
+static bool porch_trace_first = true;
+
+static void
+porch_trace_fini(void)
+{
+
+	if (porch_trace_file == NULL)
+		return;
+
+	/*
+	 * A child that we forked without exec'ing has a copy of our stdio
+	 * state, but it shouldn't be finishing our trace for us.
+	 */
+	if (getpid() != porch_trace_pid)
+		return;
+
+	fprintf(porch_trace_file, "\n]\n");
+	fclose(porch_trace_file);
+	porch_trace_file = NULL;
+	porch_trace_enabled = false;
+}
+
+void
+porch_trace_init(void)
+{
+	const char *path;
+
+	if (porch_trace_file != NULL)
+		return;
+
+	path = getenv("PORCH_TRACE");
+	if (path == NULL || path[0] == '\0')
+		return;
+
+	porch_trace_file = fopen(path, "w");
+	if (porch_trace_file == NULL) {
+		fprintf(stderr, "porch: failed to open trace file %s\n", path);
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &porch_trace_epoch);
+	porch_trace_pid = getpid();
+	porch_trace_enabled = true;
+
+	fprintf(porch_trace_file, "[\n");
+	atexit(porch_trace_fini);
+}
+
+static void
+porch_trace_putstr(const char *str)
+{
+	FILE *f = porch_trace_file;
+
+	fputc('"', f);
+	for (const char *c = str; *c != '\0'; c++) {
+		if (*c == '"' || *c == '\\')
+			fprintf(f, "\\%c", *c);
+		else if ((unsigned char)*c < 0x20)
+			fprintf(f, "\\u%04x", (unsigned char)*c);
+		else
+			fputc(*c, f);
+	}
+	fputc('"', f);
+}
+
+/*
+ * Write out everything but the args for an event of phase `ph` ('B'egin,
+ * 'E'nd, or 'i'nstant); the caller finishes it off.
+ */
+static FILE *
+porch_trace_event_start(char ph, const char *cat, const char *name)
+{
+	struct timespec now;
+	FILE *f = porch_trace_file;
+	double ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ts = (now.tv_sec - porch_trace_epoch.tv_sec) * 1e6 +
+	    (now.tv_nsec - porch_trace_epoch.tv_nsec) / 1e3;
+
+	if (!porch_trace_first)
+		fprintf(f, ",\n");
+	porch_trace_first = false;
+
+	fprintf(f, "{\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":1,",
+	    ph, ts, (int)porch_trace_pid);
+	fprintf(f, "\"cat\":");
+	porch_trace_putstr(cat);
+	fprintf(f, ",\"name\":");
+	porch_trace_putstr(name);
+	if (ph == 'i')
+		fprintf(f, ",\"s\":\"t\"");
+
+	return (f);
+}
+
+/*
+ * Emit a single event.  The `argfmt` describes the members of the event's args
+ * object, e.g., "\"bytes\":%zu", and may be NULL if there are none.
+ */
+void
+porch_trace_event(char ph, const char *cat, const char *name,
+    const char *argfmt, ...)
+{
+	va_list ap;
+	FILE *f;
+
+	if (porch_trace_file == NULL)
+		return;
+
+	f = porch_trace_event_start(ph, cat, name);
+	if (argfmt != NULL) {
+		fprintf(f, ",\"args\":{");
+		va_start(ap, argfmt);
+		vfprintf(f, argfmt, ap);
+		va_end(ap);
+		fputc('}', f);
+	}
+
+	fputc('}', f);
+}
+
+/*
+ * The Lua side passes its args as a table of strings, numbers and booleans;
+ * anything else is just stringified as best we can.
+ */
+static int
+porchlua_trace_event(lua_State *L, char ph)
+{
+	const char *cat, *name;
+	FILE *f;
+	bool first;
+
+	cat = luaL_checkstring(L, 1);
+	name = luaL_checkstring(L, 2);
+	if (!lua_isnoneornil(L, 3))
+		luaL_checktype(L, 3, LUA_TTABLE);
+	if (porch_trace_file == NULL)
+		return (0);
+
+	f = porch_trace_event_start(ph, cat, name);
+	if (lua_isnoneornil(L, 3))
+		goto out;
+
+	fprintf(f, ",\"args\":{");
+	first = true;
+	lua_settop(L, 3);
+	lua_pushnil(L);
+	while (lua_next(L, 3) != 0) {
+		if (lua_type(L, -2) != LUA_TSTRING) {
+			lua_pop(L, 1);
+			continue;
+		}
+
+		if (!first)
+			fputc(',', f);
+		first = false;
+
+		porch_trace_putstr(lua_tostring(L, -2));
+		fputc(':', f);
+		if (lua_type(L, -1) == LUA_TNUMBER) {
+			fprintf(f, LUA_NUMBER_FMT, lua_tonumber(L, -1));
+		} else if (lua_type(L, -1) == LUA_TBOOLEAN) {
+			fprintf(f, "%s", lua_toboolean(L, -1) ? "true" : "false");
+		} else {
+			porch_trace_putstr(luaL_tolstring(L, -1, NULL));
+			lua_pop(L, 1);
+		}
+
+		lua_pop(L, 1);
+	}
+	fputc('}', f);
+out:
+	fputc('}', f);
+	return (0);
+}
+
+int
+porchlua_trace_begin(lua_State *L)
+{
+
+	return (porchlua_trace_event(L, 'B'));
+}
+
+int
+porchlua_trace_end(lua_State *L)
+{
+
+	return (porchlua_trace_event(L, 'E'));
+}
+
+int
+porchlua_tracing(lua_State *L)
+{
+
+	lua_pushboolean(L, porch_trace_enabled);
+	return (1);
+}
@@ -329,6 +329,11 @@ porchlua_term_size(lua_State *L)
 				lua_pushstring(L, strerror(error));
 				return (2);
 			}
+
+			porch_record_resize(self->proc, self->winsz.ws_col,
+			    self->winsz.ws_row);
+			porch_vt_resize(self->proc->vt, self->winsz.ws_col,
+			    self->winsz.ws_row);
 	}
 
 	lua_pushnumber(L, self->winsz.ws_col);
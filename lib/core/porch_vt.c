@@ -0,0 +1,990 @@
+/*-
+ * Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sys/param.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "porch_lua.h"
+
+/*
+ * Screen model for matching against what a terminal would display, rather than
+ * the raw byte stream.  Full-screen programs redraw with cursor movement, so the
+ * text on screen rarely appears contiguously in their output.
+ *
+ * This is a subset of VT100/xterm: enough cursor movement, erasure, scrolling
+ * and the alternate screen to follow the usual curses output, with everything
+ * else (attributes, modes, OSC strings, charsets) parsed and dropped.  Every
+ * character is assumed to be one column wide.
+ *
+ * Each feed bumps a generation number, and each row notes the generation it was
+ * last changed in, so that watchers can cheaply tell whether the rows they're
+ * interested in have changed since they last looked.
+ */
+
+#define	VT_MAXPARAMS	16
+#define	VT_TABSTOP	8
+#define	VT_BLANK	((uint32_t)' ')
+#define	VT_REPLACEMENT	((uint32_t)0xfffd)
+
+enum porch_vt_state {
+	VT_GROUND,
+	VT_ESC,
+	VT_ESC_SKIP,		/* ESC followed by a byte we don't care about */
+	VT_CSI,
+	VT_CSI_IGNORE,
+	VT_STRING,		/* OSC, DCS, etc. until ST or BEL */
+	VT_STRING_ESC,
+};
+
+struct porch_vt {
+	uint32_t		*cells;		/* Active screen */
+	uint32_t		*other;		/* Inactive screen */
+	uint64_t		*rowgen;
+	uint64_t		 gen;
+	int			 cols;
+	int			 rows;
+	int			 cx;
+	int			 cy;
+	int			 savex;
+	int			 savey;
+	int			 top;		/* Scrolling region, inclusive */
+	int			 bottom;
+	bool			 altscreen;
+	bool			 autowrap;
+	bool			 wrapnext;
+
+	/* Parser state */
+	enum porch_vt_state	 state;
+	int			 params[VT_MAXPARAMS];
+	int			 nparams;
+	char			 priv;
+	uint32_t		 utf8cp;
+	int			 utf8need;
+};
+
+static uint32_t *
+porch_vt_cell(struct porch_vt *vt, int row, int col)
+{
+
+	return (&vt->cells[(size_t)row * vt->cols + col]);
+}
+
+static void
+porch_vt_dirty(struct porch_vt *vt, int first, int last)
+{
+
+	for (int row = first; row <= last; row++)
+		vt->rowgen[row] = vt->gen;
+}
+
+static void
+porch_vt_blank(struct porch_vt *vt, int row, int first, int last)
+{
+	uint32_t *cell;
+
+	if (first > last)
+		return;
+
+	cell = porch_vt_cell(vt, row, first);
+	for (int col = first; col <= last; col++)
+		*cell++ = VT_BLANK;
+	porch_vt_dirty(vt, row, row);
+}
+
+static void
+porch_vt_blank_rows(struct porch_vt *vt, int first, int last)
+{
+
+	for (int row = first; row <= last; row++)
+		porch_vt_blank(vt, row, 0, vt->cols - 1);
+}
+
+/* Scroll [top, bottom] up by `n` lines, or down if `n` is negative. */
+static void
+porch_vt_scroll(struct porch_vt *vt, int top, int bottom, int n)
+{
+	size_t rowsz = vt->cols * sizeof(*vt->cells);
+	int span = bottom - top + 1;
+
+	if (top > bottom)
+		return;
+	if (abs(n) >= span) {
+		porch_vt_blank_rows(vt, top, bottom);
+		return;
+	}
+
+	if (n > 0) {
+		memmove(porch_vt_cell(vt, top, 0), porch_vt_cell(vt, top + n, 0),
+		    (span - n) * rowsz);
+		porch_vt_blank_rows(vt, bottom - n + 1, bottom);
+	} else if (n < 0) {
+		n = -n;
+		memmove(porch_vt_cell(vt, top + n, 0), porch_vt_cell(vt, top, 0),
+		    (span - n) * rowsz);
+		porch_vt_blank_rows(vt, top, top + n - 1);
+	}
+
+	porch_vt_dirty(vt, top, bottom);
+}
+
+static void
+porch_vt_linefeed(struct porch_vt *vt)
+{
+
+	if (vt->cy == vt->bottom)
+		porch_vt_scroll(vt, vt->top, vt->bottom, 1);
+	else if (vt->cy < vt->rows - 1)
+		vt->cy++;
+}
+
+static void
+porch_vt_revindex(struct porch_vt *vt)
+{
+
+	if (vt->cy == vt->top)
+		porch_vt_scroll(vt, vt->top, vt->bottom, -1);
+	else if (vt->cy > 0)
+		vt->cy--;
+}
+
+static void
+porch_vt_moveto(struct porch_vt *vt, int col, int row)
+{
+
+	vt->cx = MAX(0, MIN(col, vt->cols - 1));
+	vt->cy = MAX(0, MIN(row, vt->rows - 1));
+	vt->wrapnext = false;
+}
+
+static void
+porch_vt_put(struct porch_vt *vt, uint32_t cp)
+{
+
+	if (vt->wrapnext) {
+		vt->cx = 0;
+		porch_vt_linefeed(vt);
+		vt->wrapnext = false;
+	}
+
+	*porch_vt_cell(vt, vt->cy, vt->cx) = cp;
+	porch_vt_dirty(vt, vt->cy, vt->cy);
+
+	if (vt->cx < vt->cols - 1)
+		vt->cx++;
+	else if (vt->autowrap)
+		vt->wrapnext = true;
+}
+
+static void
+porch_vt_reset(struct porch_vt *vt)
+{
+
+	if (vt->altscreen) {
+		uint32_t *cells = vt->cells;
+
+		vt->cells = vt->other;
+		vt->other = cells;
+		vt->altscreen = false;
+	}
+
+	porch_vt_blank_rows(vt, 0, vt->rows - 1);
+	vt->cx = vt->cy = vt->savex = vt->savey = 0;
+	vt->top = 0;
+	vt->bottom = vt->rows - 1;
+	vt->autowrap = true;
+	vt->wrapnext = false;
+	vt->state = VT_GROUND;
+	vt->utf8need = 0;
+}
+
+static void
+porch_vt_altscreen(struct porch_vt *vt, bool enter, bool clear)
+{
+	uint32_t *cells;
+
+	if (enter == vt->altscreen)
+		return;
+
+	cells = vt->cells;
+	vt->cells = vt->other;
+	vt->other = cells;
+	vt->altscreen = enter;
+
+	if (enter && clear)
+		porch_vt_blank_rows(vt, 0, vt->rows - 1);
+	porch_vt_dirty(vt, 0, vt->rows - 1);
+}
+
+static void
+porch_vt_setmode(struct porch_vt *vt, bool set)
+{
+
+	if (vt->priv != '?')
+		return;
+
+	for (int i = 0; i < vt->nparams; i++) {
+		switch (vt->params[i]) {
+		case 7:
+			vt->autowrap = set;
+			break;
+		case 47:
+		case 1047:
+			porch_vt_altscreen(vt, set, set);
+			break;
+		case 1049:
+			/* Like 1047, but with the cursor saved in the primary. */
+			if (set) {
+				vt->savex = vt->cx;
+				vt->savey = vt->cy;
+			}
+			porch_vt_altscreen(vt, set, set);
+			if (!set)
+				porch_vt_moveto(vt, vt->savex, vt->savey);
+			break;
+		}
+	}
+}
+
+static int
+porch_vt_param(const struct porch_vt *vt, int idx, int dflt)
+{
+
+	if (idx >= vt->nparams || vt->params[idx] == 0)
+		return (dflt);
+	return (vt->params[idx]);
+}
+
+static void
+porch_vt_csi(struct porch_vt *vt, char final)
+{
+	int n, row;
+
+	n = porch_vt_param(vt, 0, 1);
+	row = vt->cy;
+
+	if (vt->priv != '\0' && final != 'h' && final != 'l')
+		return;
+
+	switch (final) {
+	case '@':	/* ICH */
+		n = MIN(n, vt->cols - vt->cx);
+		memmove(porch_vt_cell(vt, row, vt->cx + n),
+		    porch_vt_cell(vt, row, vt->cx),
+		    (vt->cols - vt->cx - n) * sizeof(*vt->cells));
+		porch_vt_blank(vt, row, vt->cx, vt->cx + n - 1);
+		break;
+	case 'A':	/* CUU */
+		porch_vt_moveto(vt, vt->cx,
+		    vt->cy >= vt->top ? MAX(vt->top, vt->cy - n) : vt->cy - n);
+		break;
+	case 'B':	/* CUD */
+	case 'e':	/* VPR */
+		porch_vt_moveto(vt, vt->cx, vt->cy <= vt->bottom ?
+		    MIN(vt->bottom, vt->cy + n) : vt->cy + n);
+		break;
+	case 'C':	/* CUF */
+	case 'a':	/* HPR */
+		porch_vt_moveto(vt, vt->cx + n, vt->cy);
+		break;
+	case 'D':	/* CUB */
+		porch_vt_moveto(vt, vt->cx - n, vt->cy);
+		break;
+	case 'E':	/* CNL */
+		porch_vt_moveto(vt, 0, vt->cy + n);
+		break;
+	case 'F':	/* CPL */
+		porch_vt_moveto(vt, 0, vt->cy - n);
+		break;
+	case 'G':	/* CHA */
+	case '`':	/* HPA */
+		porch_vt_moveto(vt, n - 1, vt->cy);
+		break;
+	case 'H':	/* CUP */
+	case 'f':	/* HVP */
+		porch_vt_moveto(vt, porch_vt_param(vt, 1, 1) - 1, n - 1);
+		break;
+	case 'J':	/* ED */
+		switch (porch_vt_param(vt, 0, 0)) {
+		case 0:
+			porch_vt_blank(vt, row, vt->cx, vt->cols - 1);
+			porch_vt_blank_rows(vt, row + 1, vt->rows - 1);
+			break;
+		case 1:
+			porch_vt_blank_rows(vt, 0, row - 1);
+			porch_vt_blank(vt, row, 0, vt->cx);
+			break;
+		case 2:
+		case 3:
+			porch_vt_blank_rows(vt, 0, vt->rows - 1);
+			break;
+		}
+		break;
+	case 'K':	/* EL */
+		switch (porch_vt_param(vt, 0, 0)) {
+		case 0:
+			porch_vt_blank(vt, row, vt->cx, vt->cols - 1);
+			break;
+		case 1:
+			porch_vt_blank(vt, row, 0, vt->cx);
+			break;
+		case 2:
+			porch_vt_blank(vt, row, 0, vt->cols - 1);
+			break;
+		}
+		break;
+	case 'L':	/* IL */
+		if (row >= vt->top && row <= vt->bottom)
+			porch_vt_scroll(vt, row, vt->bottom, -n);
+		break;
+	case 'M':	/* DL */
+		if (row >= vt->top && row <= vt->bottom)
+			porch_vt_scroll(vt, row, vt->bottom, n);
+		break;
+	case 'P':	/* DCH */
+		n = MIN(n, vt->cols - vt->cx);
+		memmove(porch_vt_cell(vt, row, vt->cx),
+		    porch_vt_cell(vt, row, vt->cx + n),
+		    (vt->cols - vt->cx - n) * sizeof(*vt->cells));
+		porch_vt_blank(vt, row, vt->cols - n, vt->cols - 1);
+		break;
+	case 'S':	/* SU */
+		porch_vt_scroll(vt, vt->top, vt->bottom, n);
+		break;
+	case 'T':	/* SD */
+		porch_vt_scroll(vt, vt->top, vt->bottom, -n);
+		break;
+	case 'X':	/* ECH */
+		porch_vt_blank(vt, row, vt->cx, MIN(vt->cols - 1, vt->cx + n - 1));
+		break;
+	case 'd':	/* VPA */
+		porch_vt_moveto(vt, vt->cx, n - 1);
+		break;
+	case 'h':	/* SM */
+	case 'l':	/* RM */
+		porch_vt_setmode(vt, final == 'h');
+		break;
+	case 'r':	/* DECSTBM */
+		vt->top = porch_vt_param(vt, 0, 1) - 1;
+		vt->bottom = porch_vt_param(vt, 1, vt->rows) - 1;
+		if (vt->bottom >= vt->rows)
+			vt->bottom = vt->rows - 1;
+		if (vt->top >= vt->bottom) {
+			vt->top = 0;
+			vt->bottom = vt->rows - 1;
+		}
+		porch_vt_moveto(vt, 0, 0);
+		break;
+	case 's':	/* SCOSC */
+		vt->savex = vt->cx;
+		vt->savey = vt->cy;
+		break;
+	case 'u':	/* SCORC */
+		porch_vt_moveto(vt, vt->savex, vt->savey);
+		break;
+	default:
+		/* SGR and everything else that doesn't affect the text. */
+		break;
+	}
+}
+
+/* Returns true if `ch` was a C0 control that we handled. */
+static bool
+porch_vt_control(struct porch_vt *vt, unsigned char ch)
+{
+
+	switch (ch) {
+	case '\b':
+		if (vt->cx > 0)
+			vt->cx--;
+		vt->wrapnext = false;
+		break;
+	case '\t':
+		vt->cx = MIN(vt->cols - 1, (vt->cx / VT_TABSTOP + 1) * VT_TABSTOP);
+		vt->wrapnext = false;
+		break;
+	case '\n':
+	case '\v':
+	case '\f':
+		porch_vt_linefeed(vt);
+		vt->wrapnext = false;
+		break;
+	case '\r':
+		vt->cx = 0;
+		vt->wrapnext = false;
+		break;
+	case 0x18:	/* CAN */
+	case 0x1a:	/* SUB */
+		vt->state = VT_GROUND;
+		break;
+	case 0x1b:	/* ESC */
+		vt->state = VT_ESC;
+		break;
+	default:
+		if (ch >= 0x20 && ch != 0x7f)
+			return (false);
+		/* BEL, NUL, DEL, etc. */
+		break;
+	}
+
+	return (true);
+}
+
+static void
+porch_vt_esc(struct porch_vt *vt, unsigned char ch)
+{
+
+	vt->state = VT_GROUND;
+	switch (ch) {
+	case '[':
+		vt->state = VT_CSI;
+		vt->nparams = 0;
+		vt->priv = '\0';
+		memset(vt->params, 0, sizeof(vt->params));
+		break;
+	case ']':	/* OSC */
+	case 'P':	/* DCS */
+	case 'X':	/* SOS */
+	case '^':	/* PM */
+	case '_':	/* APC */
+		vt->state = VT_STRING;
+		break;
+	case '(':
+	case ')':
+	case '*':
+	case '+':
+	case '#':
+	case '%':
+		vt->state = VT_ESC_SKIP;
+		break;
+	case '7':	/* DECSC */
+		vt->savex = vt->cx;
+		vt->savey = vt->cy;
+		break;
+	case '8':	/* DECRC */
+		porch_vt_moveto(vt, vt->savex, vt->savey);
+		break;
+	case 'D':	/* IND */
+		porch_vt_linefeed(vt);
+		break;
+	case 'E':	/* NEL */
+		vt->cx = 0;
+		porch_vt_linefeed(vt);
+		break;
+	case 'M':	/* RI */
+		porch_vt_revindex(vt);
+		break;
+	case 'c':	/* RIS */
+		porch_vt_reset(vt);
+		break;
+	default:
+		break;
+	}
+}
+
+static void
+porch_vt_csi_byte(struct porch_vt *vt, unsigned char ch)
+{
+
+	if (ch >= '0' && ch <= '9') {
+		int *param;
+
+		if (vt->nparams == 0)
+			vt->nparams = 1;
+		param = &vt->params[vt->nparams - 1];
+		if (*param < 10000)
+			*param = *param * 10 + (ch - '0');
+	} else if (ch == ';' || ch == ':') {
+		if (vt->nparams == 0)
+			vt->nparams = 1;
+		if (vt->nparams < VT_MAXPARAMS)
+			vt->nparams++;
+	} else if (ch >= '<' && ch <= '?') {
+		vt->priv = ch;
+	} else if (ch >= 0x20 && ch <= 0x2f) {
+		/* Intermediates; none of those sequences are interesting. */
+		vt->state = VT_CSI_IGNORE;
+	} else if (ch >= 0x40 && ch <= 0x7e) {
+		vt->state = VT_GROUND;
+		porch_vt_csi(vt, ch);
+	} else {
+		vt->state = VT_GROUND;
+	}
+}
+
+static void
+porch_vt_utf8(struct porch_vt *vt, unsigned char ch)
+{
+
+	if (vt->utf8need != 0) {
+		if ((ch & 0xc0) == 0x80) {
+			vt->utf8cp = (vt->utf8cp << 6) | (ch & 0x3f);
+			if (--vt->utf8need == 0)
+				porch_vt_put(vt, vt->utf8cp);
+			return;
+		}
+
+		/* Truncated sequence, then start over with this byte. */
+		vt->utf8need = 0;
+		porch_vt_put(vt, VT_REPLACEMENT);
+		if (ch < 0x80) {
+			if (!porch_vt_control(vt, ch))
+				porch_vt_put(vt, ch);
+			return;
+		}
+	}
+
+	if (ch >= 0xc2 && ch <= 0xdf) {
+		vt->utf8cp = ch & 0x1f;
+		vt->utf8need = 1;
+	} else if (ch >= 0xe0 && ch <= 0xef) {
+		vt->utf8cp = ch & 0x0f;
+		vt->utf8need = 2;
+	} else if (ch >= 0xf0 && ch <= 0xf4) {
+		vt->utf8cp = ch & 0x07;
+		vt->utf8need = 3;
+	} else {
+		porch_vt_put(vt, VT_REPLACEMENT);
+	}
+}
+
+void
+porch_vt_feed(struct porch_vt *vt, const char *buf, size_t bufsz)
+{
+	const unsigned char *data = (const unsigned char *)buf;
+	unsigned char ch;
+
+	if (vt == NULL || bufsz == 0)
+		return;
+
+	vt->gen++;
+	for (size_t i = 0; i < bufsz; i++) {
+		ch = data[i];
+
+		switch (vt->state) {
+		case VT_GROUND:
+			if (ch >= 0x80 || vt->utf8need != 0)
+				porch_vt_utf8(vt, ch);
+			else if (!porch_vt_control(vt, ch))
+				porch_vt_put(vt, ch);
+			break;
+		case VT_ESC:
+			if (ch < 0x20 && porch_vt_control(vt, ch))
+				break;
+			porch_vt_esc(vt, ch);
+			break;
+		case VT_ESC_SKIP:
+			vt->state = VT_GROUND;
+			break;
+		case VT_CSI:
+		case VT_CSI_IGNORE:
+			/* C0 controls still take effect mid-sequence. */
+			if (ch < 0x20) {
+				porch_vt_control(vt, ch);
+				break;
+			}
+
+			if (vt->state == VT_CSI)
+				porch_vt_csi_byte(vt, ch);
+			else if (ch >= 0x40 && ch <= 0x7e)
+				vt->state = VT_GROUND;
+			break;
+		case VT_STRING:
+			if (ch == 0x07)
+				vt->state = VT_GROUND;
+			else if (ch == 0x1b)
+				vt->state = VT_STRING_ESC;
+			else if (ch == 0x18 || ch == 0x1a)
+				vt->state = VT_GROUND;
+			break;
+		case VT_STRING_ESC:
+			if (ch == '\\')
+				vt->state = VT_GROUND;
+			else
+				porch_vt_esc(vt, ch);
+			break;
+		}
+	}
+}
+
+static int
+porch_vt_alloc_screens(struct porch_vt *vt, int cols, int rows)
+{
+	size_t ncells = (size_t)cols * rows;
+
+	vt->cells = porch_mem_calloc(PORCH_MEM_CORE, ncells,
+	    sizeof(*vt->cells));
+	vt->other = porch_mem_calloc(PORCH_MEM_CORE, ncells,
+	    sizeof(*vt->other));
+	vt->rowgen = porch_mem_calloc(PORCH_MEM_CORE, rows,
+	    sizeof(*vt->rowgen));
+	if (vt->cells == NULL || vt->other == NULL || vt->rowgen == NULL) {
+		porch_mem_free(vt->cells);
+		porch_mem_free(vt->other);
+		porch_mem_free(vt->rowgen);
+		return (-1);
+	}
+
+	for (size_t i = 0; i < ncells; i++)
+		vt->cells[i] = vt->other[i] = VT_BLANK;
+
+	vt->cols = cols;
+	vt->rows = rows;
+	return (0);
+}
+
+struct porch_vt *
+porch_vt_alloc(int cols, int rows)
+{
+	struct porch_vt *vt;
+
+	if (cols <= 0 || rows <= 0) {
+		errno = EINVAL;
+		return (NULL);
+	}
+
+	vt = porch_mem_calloc(PORCH_MEM_CORE, 1, sizeof(*vt));
+	if (vt == NULL)
+		return (NULL);
+
+	if (porch_vt_alloc_screens(vt, cols, rows) != 0) {
+		porch_mem_free(vt);
+		return (NULL);
+	}
+
+	vt->gen = 1;
+	porch_vt_reset(vt);
+	return (vt);
+}
+
+void
+porch_vt_free(struct porch_vt *vt)
+{
+
+	if (vt == NULL)
+		return;
+
+	porch_mem_free(vt->cells);
+	porch_mem_free(vt->other);
+	porch_mem_free(vt->rowgen);
+	porch_mem_free(vt);
+}
+
+/*
+ * Resize the screen, keeping whatever of the old contents still fits in the
+ * top left corner.
+ */
+int
+porch_vt_resize(struct porch_vt *vt, int cols, int rows)
+{
+	struct porch_vt old;
+	int ccols, crows;
+
+	if (vt == NULL || (cols == vt->cols && rows == vt->rows))
+		return (0);
+	if (cols <= 0 || rows <= 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	old = *vt;
+	if (porch_vt_alloc_screens(vt, cols, rows) != 0) {
+		*vt = old;
+		return (-1);
+	}
+
+	ccols = MIN(cols, old.cols);
+	crows = MIN(rows, old.rows);
+	for (int row = 0; row < crows; row++) {
+		memcpy(porch_vt_cell(vt, row, 0),
+		    &old.cells[(size_t)row * old.cols],
+		    ccols * sizeof(*vt->cells));
+		memcpy(&vt->other[(size_t)row * cols],
+		    &old.other[(size_t)row * old.cols],
+		    ccols * sizeof(*vt->other));
+	}
+
+	porch_mem_free(old.cells);
+	porch_mem_free(old.other);
+	porch_mem_free(old.rowgen);
+
+	vt->gen++;
+	porch_vt_dirty(vt, 0, rows - 1);
+	porch_vt_moveto(vt, vt->cx, vt->cy);
+	vt->savex = MIN(vt->savex, cols - 1);
+	vt->savey = MIN(vt->savey, rows - 1);
+	vt->top = 0;
+	vt->bottom = rows - 1;
+	return (0);
+}
+
+void
+porch_vt_size(const struct porch_vt *vt, int *cols, int *rows)
+{
+
+	*cols = vt->cols;
+	*rows = vt->rows;
+}
+
+void
+porch_vt_cursor(const struct porch_vt *vt, int *col, int *row)
+{
+
+	*col = vt->cx;
+	*row = vt->cy;
+}
+
+/* The generation that any row in [top, bottom] was last changed in. */
+uint64_t
+porch_vt_generation(const struct porch_vt *vt, int top, int bottom)
+{
+	uint64_t gen = 0;
+
+	for (int row = MAX(top, 0); row <= MIN(bottom, vt->rows - 1); row++)
+		gen = MAX(gen, vt->rowgen[row]);
+
+	return (gen);
+}
+
+/*
+ * Render columns [left, right] of `row` as UTF-8 into `buf`, which must have
+ * room for PORCH_VT_MAXCHAR bytes per column.  Trailing blanks are trimmed, and
+ * the length of the result is returned.
+ */
+size_t
+porch_vt_row(const struct porch_vt *vt, int row, int left, int right,
+    char *buf)
+{
+	const uint32_t *cell;
+	size_t len, trimmed;
+	uint32_t cp;
+
+	len = trimmed = 0;
+	left = MAX(left, 0);
+	right = MIN(right, vt->cols - 1);
+	if (row < 0 || row >= vt->rows || left > right)
+		return (0);
+
+	cell = &vt->cells[(size_t)row * vt->cols + left];
+	for (int col = left; col <= right; col++) {
+		cp = *cell++;
+		if (cp < 0x80) {
+			buf[len++] = cp;
+		} else if (cp < 0x800) {
+			buf[len++] = 0xc0 | (cp >> 6);
+			buf[len++] = 0x80 | (cp & 0x3f);
+		} else if (cp < 0x10000) {
+			buf[len++] = 0xe0 | (cp >> 12);
+			buf[len++] = 0x80 | ((cp >> 6) & 0x3f);
+			buf[len++] = 0x80 | (cp & 0x3f);
+		} else {
+			buf[len++] = 0xf0 | (cp >> 18);
+			buf[len++] = 0x80 | ((cp >> 12) & 0x3f);
+			buf[len++] = 0x80 | ((cp >> 6) & 0x3f);
+			buf[len++] = 0x80 | (cp & 0x3f);
+		}
+
+		if (cp != VT_BLANK)
+			trimmed = len;
+	}
+
+	return (trimmed);
+}
+
+/*
+ * Translates the 1-based, inclusive region at `idx` (top, bottom, left, right;
+ * any of them may be nil) into 0-based bounds on the screen.
+ */
+void
+porchlua_vt_region(lua_State *L, const struct porch_vt *vt, int idx, int *top,
+    int *bottom, int *left, int *right)
+{
+
+	*top = luaL_optinteger(L, idx, 1) - 1;
+	*bottom = luaL_optinteger(L, idx + 1, vt->rows) - 1;
+	*left = luaL_optinteger(L, idx + 2, 1) - 1;
+	*right = luaL_optinteger(L, idx + 3, vt->cols) - 1;
+
+	*top = MAX(*top, 0);
+	*bottom = MIN(*bottom, vt->rows - 1);
+	*left = MAX(*left, 0);
+	*right = MIN(*right, vt->cols - 1);
+}
+
+/*
+ * Pushes the text in the region at `idx` of the screen, one line per row with
+ * trailing blanks trimmed, along with the generation that the region last
+ * changed in and the cursor's row and column.
+ */
+int
+porchlua_vt_push_screen(lua_State *L, const struct porch_vt *vt, int idx)
+{
+	luaL_Buffer b;
+	char *rowbuf;
+	size_t rowsz;
+	int bottom, left, right, top;
+
+	porchlua_vt_region(L, vt, idx, &top, &bottom, &left, &right);
+
+	luaL_buffinit(L, &b);
+	for (int row = top; row <= bottom; row++) {
+		if (row != top)
+			luaL_addchar(&b, '\n');
+		if (left > right)
+			continue;
+
+		rowbuf = luaL_prepbuffsize(&b,
+		    (right - left + 1) * PORCH_VT_MAXCHAR);
+		rowsz = porch_vt_row(vt, row, left, right, rowbuf);
+		luaL_addsize(&b, rowsz);
+	}
+	luaL_pushresult(&b);
+
+	lua_pushinteger(L, (lua_Integer)porch_vt_generation(vt, top, bottom));
+	lua_pushinteger(L, vt->cy + 1);
+	lua_pushinteger(L, vt->cx + 1);
+	return (4);
+}
+
+/*
+ * vt([cols, rows]) -- a screen model that isn't attached to any process, for
+ * output that doesn't come from one, e.g., a replayed transcript.  It defaults
+ * to the same size as a process' model without a window size.
+ */
+int
+porchlua_vt(lua_State *L)
+{
+	struct porch_vt **vtp;
+	lua_Integer cols, rows;
+
+	cols = luaL_optinteger(L, 1, 0);
+	rows = luaL_optinteger(L, 2, 0);
+	luaL_argcheck(L, cols <= INT_MAX, 1, "too many columns");
+	luaL_argcheck(L, rows <= INT_MAX, 2, "too many rows");
+	if (cols <= 0 || rows <= 0) {
+		cols = PORCH_VT_DEFAULT_COLS;
+		rows = PORCH_VT_DEFAULT_ROWS;
+	}
+
+	vtp = lua_newuserdata(L, sizeof(*vtp));
+	*vtp = porch_vt_alloc(cols, rows);
+	if (*vtp == NULL) {
+		int serrno = errno;
+
+		luaL_pushfail(L);
+		lua_pushstring(L, strerror(serrno));
+		return (2);
+	}
+
+	luaL_setmetatable(L, ORCHLUA_VTHANDLE);
+	return (1);
+}
+
+static int
+porchlua_vt_feed(lua_State *L)
+{
+	struct porch_vt **vtp;
+	const char *data;
+	size_t datasz;
+
+	vtp = luaL_checkudata(L, 1, ORCHLUA_VTHANDLE);
+	data = luaL_checklstring(L, 2, &datasz);
+
+	porch_vt_feed(*vtp, data, datasz);
+	return (0);
+}
+
+/* gen([top[, bottom]]) -- as for process:screen_gen() */
+static int
+porchlua_vt_gen(lua_State *L)
+{
+	struct porch_vt **vtp;
+	int bottom, left, right, top;
+
+	vtp = luaL_checkudata(L, 1, ORCHLUA_VTHANDLE);
+	lua_settop(L, 3);
+	porchlua_vt_region(L, *vtp, 2, &top, &bottom, &left, &right);
+	lua_pushinteger(L, (lua_Integer)porch_vt_generation(*vtp, top, bottom));
+	return (1);
+}
+
+static int
+porchlua_vt_resize(lua_State *L)
+{
+	struct porch_vt **vtp;
+	lua_Integer cols, rows;
+
+	vtp = luaL_checkudata(L, 1, ORCHLUA_VTHANDLE);
+	cols = luaL_checkinteger(L, 2);
+	rows = luaL_checkinteger(L, 3);
+	luaL_argcheck(L, cols <= INT_MAX, 2, "too many columns");
+	luaL_argcheck(L, rows <= INT_MAX, 3, "too many rows");
+
+	if (porch_vt_resize(*vtp, cols, rows) != 0) {
+		int serrno = errno;
+
+		luaL_pushfail(L);
+		lua_pushstring(L, strerror(serrno));
+		return (2);
+	}
+
+	lua_pushboolean(L, 1);
+	return (1);
+}
+
+/* screen([top[, bottom[, left[, right]]]]) -- as for process:screen() */
+static int
+porchlua_vt_screen(lua_State *L)
+{
+	struct porch_vt **vtp;
+
+	vtp = luaL_checkudata(L, 1, ORCHLUA_VTHANDLE);
+	return (porchlua_vt_push_screen(L, *vtp, 2));
+}
+
+static int
+porchlua_vt_gc(lua_State *L)
+{
+	struct porch_vt **vtp;
+
+	vtp = luaL_checkudata(L, 1, ORCHLUA_VTHANDLE);
+	porch_vt_free(*vtp);
+	*vtp = NULL;
+	return (0);
+}
+
+#define	VT_SIMPLE(n)	{ #n, porchlua_vt_ ## n }
+static const luaL_Reg porchlua_vt_methods[] = {
+	VT_SIMPLE(feed),
+	VT_SIMPLE(gen),
+	VT_SIMPLE(resize),
+	VT_SIMPLE(screen),
+	{ NULL, NULL },
+};
+
+static const luaL_Reg porchlua_vt_meta[] = {
+	{ "__index", NULL },	/* Set during registration */
+	{ "__gc", porchlua_vt_gc },
+	{ NULL, NULL },
+};
+
+void
+porchlua_register_vt_metatable(lua_State *L)
+{
+
+	luaL_newmetatable(L, ORCHLUA_VTHANDLE);
+	luaL_setfuncs(L, porchlua_vt_meta, 0);
+
+	luaL_newlibtable(L, porchlua_vt_methods);
+	luaL_setfuncs(L, porchlua_vt_methods, 0);
+	lua_setfield(L, -2, "__index");
+
+	lua_pop(L, 1);
+}
@@ -12,7 +12,10 @@
 #include <assert.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <lua.h>
@@ -27,10 +30,13 @@
 #define	luaL_pushfail(L)	lua_pushnil(L)
 #endif
 
+struct porch_filter;
 struct porch_ipc_msg;
 typedef struct porch_ipc *porch_ipc_t;
 
+struct porch_record;
 struct porch_term;
+struct porch_vt;
 
 enum porch_ipc_tag {
 	IPC_NOXMIT = 0,
@@ -51,9 +57,55 @@ enum porch_ipc_tag {
 	IPC_SETID_ACK,		/* Child -> Parent */
 	IPC_SETGROUPS,		/* Parent -> Child */
 	IPC_SETGROUPS_ACK,	/* Child -> Parent */
+	IPC_SCHED,		/* Parent -> Child */
+	IPC_SCHED_ACK,		/* Child -> Parent */
+
+	/*
+	 * The agent protocol, between rporch and a porch --agent on the remote
+	 * end of the rsh.  Every payload starts with a struct porch_agent_hdr
+	 * naming the process it's about.
+	 */
+	IPC_AGENT_SPAWN,	/* Local -> Agent: NUL-separated argv */
+	IPC_AGENT_SPAWNED,	/* Agent -> Local: struct porch_agent_term */
+	IPC_AGENT_CHDIR,	/* Local -> Agent: directory */
+	IPC_AGENT_RELEASE,	/* Local -> Agent */
+	IPC_AGENT_TERM,		/* Local -> Agent: struct porch_agent_term */
+	IPC_AGENT_SIGNAL,	/* Local -> Agent: arg is the signal */
+	IPC_AGENT_ACK,		/* Agent -> Local: arg is an errno */
+	IPC_AGENT_WRITE,	/* Local -> Agent: input */
+	IPC_AGENT_OUTPUT,	/* Agent -> Local: output, empty at EOF */
+	IPC_AGENT_EXIT,		/* Agent -> Local: see below */
+	IPC_AGENT_CLOSE,	/* Local -> Agent */
 	IPC_LAST,
 };
 
+struct porch_agent_hdr {
+	uint32_t		 id;
+	/*
+	 * The signal, or the errno of the request being acked.  For an exit,
+	 * the exit status if >= 0, or the negated signal that killed it.
+	 */
+	int32_t			 arg;
+};
+
+struct porch_agent_term {
+	uint64_t		 iflag;
+	uint64_t		 oflag;
+	uint64_t		 cflag;
+	uint64_t		 lflag;
+	uint32_t		 cols;
+	uint32_t		 rows;
+};
+
+enum porch_mem_type {
+	PORCH_MEM_LUA,		/* Lua heap */
+	PORCH_MEM_BUFFER,	/* Match buffers, part of the Lua heap */
+	PORCH_MEM_IPC,		/* IPC messages and queues */
+	PORCH_MEM_LOG,		/* Session recordings and logs */
+	PORCH_MEM_CORE,		/* Everything else: argv, payloads, ... */
+	PORCH_MEM_NTYPES,
+};
+
 struct porch_env {
 	size_t			 setsz;
 	size_t			 unsetsz;
@@ -61,10 +113,41 @@ struct porch_env {
 	char			 envstr[];
 };
 
+/*
+ * Work done on behalf of a process, for process:stats().  Counters for the
+ * match buffer are kept on the Lua side, since that's where matching happens.
+ */
+struct porch_stats {
+	uint64_t		 reads;		/* read(2) calls on the pty */
+	uint64_t		 bytes_read;
+	uint64_t		 writes;	/* write(2) calls on the pty */
+	uint64_t		 bytes_written;
+	uint64_t		 wakeups;	/* select(2)/poll(2) returns */
+	uint64_t		 callbacks;	/* Lua callbacks invoked */
+	uint64_t		 ipc_msgs;	/* IPC messages sent/received */
+};
+
+/*
+ * A deadline in the event loop's timer heap, see porch_timer.c.  A zeroed timer
+ * is disarmed; timers may be embedded anywhere as long as they're disarmed
+ * before their memory goes away.
+ */
+struct porch_timer {
+	struct timespec		 tm_deadline;	/* CLOCK_MONOTONIC */
+	size_t			 tm_slot;	/* In the heap, 0 if disarmed */
+	int			 tm_flags;
+};
+
+#define	PTIMER_FIRED	0x01	/* Expired since it was last armed */
+
 struct porch_process {
 	lua_State		*L;
 	struct porch_term	*term;
 	porch_ipc_t		 ipc;
+	struct porch_stats	 stats;
+	struct porch_record	*record;
+	struct porch_vt		*vt;
+	struct porch_filter	*filter;
 	sigset_t		 sigcaughtmask;
 	sigset_t		 sigmask;
 	int			 cmdsock;
@@ -72,14 +155,19 @@ struct porch_process {
 	int			 last_signal;
 	int			 status;
 	int			 termctl;
+	int			 errctl;	/* Separate stderr, or -1 */
 	uid_t			 uid;
 	gid_t			 gid;
+	bool			 pty;
+	bool			 split_stderr;
 	bool			 raw;
 	bool			 released;
 	bool			 eof;
 	bool			 buffered;
 	bool			 error;
 	bool			 draining;
+	struct porch_timer	 read_timer;
+	struct porch_timer	 pulse_timer;	/* For proxy() */
 };
 
 struct porch_setgroups {
@@ -98,6 +186,20 @@ struct porch_setid {
 	gid_t		setid_gid;
 };
 
+#define	PORCH_SCHED_MAXCPU	1024
+
+struct porch_sched {
+	int		sched_flags;
+#define	PSCHED_AFFINITY	0x01
+#define	PSCHED_NICE	0x02
+#define	PSCHED_POLICY	0x04
+#define	PSCHED_PRIORITY	0x08
+	int		sched_nice;
+	int		sched_policy;
+	int		sched_priority;
+	uint64_t	sched_cpus[PORCH_SCHED_MAXCPU / 64];
+};
+
 struct porch_sigcatch {
 	sigset_t		 mask;
 	bool			 catch;
@@ -127,10 +229,18 @@ struct porchlua_tty_mode {
 #define	CNTRL_BOTH	0x03
 #define	CNTRL_LITERAL	0x04
 
+/* porch_filter.c */
+int porch_filter_add(struct porch_filter *, const char *);
+struct porch_filter *porch_filter_alloc(void);
+const char *porch_filter_apply(struct porch_filter *, const char *, size_t,
+    size_t *);
+void porch_filter_free(struct porch_filter *);
+
 /* porch_ipc.c */
 typedef int (porch_ipc_handler)(porch_ipc_t, struct porch_ipc_msg *, void *);
 int porch_ipc_close(porch_ipc_t);
 porch_ipc_t porch_ipc_open(int);
+porch_ipc_t porch_ipc_open_pair(int, int);
 bool porch_ipc_okay(porch_ipc_t);
 int porch_ipc_recv(porch_ipc_t, struct porch_ipc_msg **);
 struct porch_ipc_msg *porch_ipc_msg_alloc(enum porch_ipc_tag, size_t, void **);
@@ -142,9 +252,50 @@ int porch_ipc_send(porch_ipc_t, struct porch_ipc_msg *);
 int porch_ipc_send_nodata(porch_ipc_t, enum porch_ipc_tag);
 int porch_ipc_wait(porch_ipc_t, bool *);
 
+/* porch_mem.c */
+void porch_mem_account(enum porch_mem_type, ptrdiff_t);
+void *porch_mem_alloc(enum porch_mem_type, size_t);
+void *porch_mem_calloc(enum porch_mem_type, size_t, size_t);
+void *porch_mem_realloc(enum porch_mem_type, void *, size_t);
+void porch_mem_free(void *);
+void porch_mem_init(lua_State *);
+
+/* porch_record.c */
+int porch_record_open(struct porch_process *, const char *, const char *);
+void porch_record_close(struct porch_process *);
+void porch_record_event(struct porch_process *, char, const char *, size_t);
+void porch_record_resize(struct porch_process *, int, int);
+
 /* porch_spawn.c */
 int porch_release(porch_ipc_t);
 int porch_spawn(int, const char *[], struct porch_process *, porch_ipc_handler *);
+int porch_spawn_piped(const char *[], pid_t *, int *);
+
+/* porch_sched.c */
+int porch_sched_apply(const struct porch_sched *);
+int porch_sched_cpus(struct porch_sched *, const char *);
+int porch_sched_policy(struct porch_sched *, const char *);
+
+/* porch_timer.c */
+int porch_timer_arm(struct porch_timer *, double);
+void porch_timer_disarm(struct porch_timer *);
+void porch_timer_expire(void);
+bool porch_timer_fired(const struct porch_timer *);
+bool porch_timer_next(struct timespec *);
+
+/* porch_trace.c */
+extern bool porch_trace_enabled;
+void porch_trace_init(void);
+void porch_trace_event(char, const char *, const char *, const char *, ...);
+
+#define	porch_trace_begin(cat, name, ...)	do {			\
+	if (porch_trace_enabled)					\
+		porch_trace_event('B', cat, name, __VA_ARGS__);		\
+} while (0)
+#define	porch_trace_end(cat, name, ...)		do {			\
+	if (porch_trace_enabled)					\
+		porch_trace_event('E', cat, name, __VA_ARGS__);		\
+} while (0)
 
 /* porch_tty.c */
 int porchlua_setup_tty(lua_State *);
@@ -157,6 +308,19 @@ extern const struct porchlua_tty_mode porchlua_output_modes[];
 extern const struct porchlua_tty_mode porchlua_cntrl_modes[];
 extern const struct porchlua_tty_mode porchlua_local_modes[];
 
+/* porch_vt.c */
+#define	PORCH_VT_DEFAULT_COLS	80
+#define	PORCH_VT_DEFAULT_ROWS	24
+#define	PORCH_VT_MAXCHAR	4	/* Longest UTF-8 encoding of a cell */
+struct porch_vt *porch_vt_alloc(int, int);
+void porch_vt_cursor(const struct porch_vt *, int *, int *);
+void porch_vt_feed(struct porch_vt *, const char *, size_t);
+void porch_vt_free(struct porch_vt *);
+uint64_t porch_vt_generation(const struct porch_vt *, int, int);
+int porch_vt_resize(struct porch_vt *, int, int);
+size_t porch_vt_row(const struct porch_vt *, int, int, int, char *);
+void porch_vt_size(const struct porch_vt *, int *, int *);
+
 static inline int
 porch_lua_ipc_send_acked_payload(lua_State *L, struct porch_process *proc,
     struct porch_ipc_msg **msgp, enum porch_ipc_tag ack_type, size_t *payloadsz,
@@ -170,6 +334,8 @@ porch_lua_ipc_send_acked_payload(lua_State *L, struct porch_process *proc,
 	error = porch_ipc_send(proc->ipc, msg);
 	if (error != 0)
 		error = errno;
+	else
+		proc->stats.ipc_msgs++;
 
 	porch_ipc_msg_free(msg);
 	msg = NULL;
@@ -193,7 +359,10 @@ porch_lua_ipc_send_acked_payload(lua_State *L, struct porch_process *proc,
 		luaL_pushfail(L);
 		lua_pushstring(L, "unknown unexpected message received");
 		return (2);
-	} else if (porch_ipc_msg_tag(msg) != ack_type) {
+	}
+
+	proc->stats.ipc_msgs++;
+	if (porch_ipc_msg_tag(msg) != ack_type) {
 		luaL_pushfail(L);
 		lua_pushfstring(L, "unexpected message type '%d'",
 		    porch_ipc_msg_tag(msg));
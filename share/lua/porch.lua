@@ -17,7 +17,8 @@ local porch = {}
 porch.env = scripter.env
 
 -- Matchers available to the direct user.  The currently implemented matchers
--- available in matchers.available[] are: lua (default), plain, posix.
+-- available in matchers.available[] are: lua (default), plain, iplain and
+-- posix.
 porch.matchers = matchers
 
 -- generate_script(scriptfile, config): run the command described by the config
@@ -28,10 +29,31 @@ porch.generate_script = generator.generate_script
 -- an optional configuration table that may be supplied.
 --
 -- The currently recognized configuration items are `alter_path` (boolean) that
--- indicates that the script's directory should be added to PATH, and `command`
--- (table) to indicate the argv of a process to spawn before running the script.
+-- indicates that the script's directory should be added to PATH, `command`
+-- (table) to indicate the argv of a process to spawn before running the script,
+-- and `replay` (table) to replay transcripts in place of spawning anything.
+-- The `replay` table holds the list of transcripts in `files`, with the
+-- optional `timing` ("compress" or "honor") and `input` ("check" or "ignore")
+-- modes.
 porch.run_script = scripter.run_script
 
+-- memstats(): returns a table of live and peak memory usage in bytes, keyed by
+-- category: `lua` (the Lua heap), `buffer` (match buffers, which are also part
+-- of the Lua heap), `ipc`, `log` (session recordings), `core`, and `total`.
+-- Each category is a table with `live` and `peak` fields.
+porch.memstats = core.memstats
+
+-- regcache([limit]): returns a table describing the cache of compiled patterns
+-- for all of the matchers above, with `entries`, `limit`, `hits` and `misses`
+-- fields.  If `limit` is given, then the cache is first resized to hold at most
+-- that many patterns; zero disables caching.
+porch.regcache = core.regcache
+
+-- sched(cfg): apply a CPU affinity, nice level and/or scheduling policy to the
+-- calling process, as described for process:sched().  Children spawned
+-- afterwards inherit them unless they're given their own.
+porch.sched = core.sched
+
 -- signals: table of signal names, always with a SIG prefix.
 porch.signals = core.signals
 
@@ -40,11 +62,18 @@ porch.signals = core.signals
 -- is at least somewhat high resolution.
 porch.sleep = core.sleep
 
+-- timer([seconds]): create a deadline in the same timer heap that the
+-- processes' reads wait on.  It's armed for `seconds` from now if given, and
+-- has arm(), disarm(), armed(), fired() and remaining() methods.  It won't
+-- interrupt anything on its own.
+porch.timer = core.timer
+
 -- spawn(cmd...): spawn the given command, returning a process that may be
--- manipulated as needed.  This is the primary interface we expose to users of
--- the lib; most of the things one would do with the scripting interface are
--- broken out via methods on the DirectProcess instead to provide a more
--- object-oriented feel.
+-- manipulated as needed.  The command may also be a single table, which may set
+-- pty = false to spawn it without a terminal.  This is the primary interface we
+-- expose to users of the lib; most of the things one would do with the
+-- scripting interface are broken out via methods on the DirectProcess instead
+-- to provide a more object-oriented feel.
 porch.spawn = direct.spawn
 
 -- Expose the tty module so that direct scripts can access, e.g., defined lflags.
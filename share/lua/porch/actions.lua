@@ -14,6 +14,21 @@ local actions = {}
 actions.default_matcher = matchers.available.default
 actions.default_timeout = 10
 
+-- Run each line of `batch` through `linefilter`, dropping those that it returns
+-- nil for.
+local function filter_lines(batch, linefilter)
+	local filtered = {}
+
+	for line in batch:gmatch("[^\n]*\n?") do
+		line = line ~= "" and linefilter(line)
+		if line then
+			filtered[#filtered + 1] = line
+		end
+	end
+
+	return table.concat(filtered)
+end
+
 local MatchAction = {}
 function MatchAction:new(action, func)
 	local obj = setmetatable({}, self)
@@ -44,18 +59,38 @@ function MatchAction:dump(level)
 		self.match_ctx:dump(level + 1)
 	end
 end
-function MatchAction:matches(buffer)
+-- Returns the first, last and callback of the best match, as well as the number
+-- of bytes that we scanned for the sake of process stats.
+--
+-- If `resume` is passed, then `buffer` only ever grew since the last call with
+-- the same `resume` table: patterns whose matcher can scan() pick up where the
+-- last miss left off, rather than going over the whole buffer again.
+function MatchAction:matches(buffer, resume)
 	local first, last, cb
 	local len
+	local scanned = 0
+	local scan = resume and self.matcher.scan
 
 	for pattern, def in pairs(self.patterns) do
 		local matcher_arg = def._compiled or pattern
+		local tfirst, tlast
+		local init = 1
 
 		-- We use the earliest and longest match, rather than the first to
 		-- match, to provide predictable semantics.  If any more control than
 		-- that is desired, it should be split up into multiple distinct matches
 		-- or, in a scripter context, switched to a one() block.
-		local tfirst, tlast = self.matcher.match(matcher_arg, buffer)
+		if scan then
+			init = resume[def] or 1
+			tfirst, tlast = scan(matcher_arg, buffer, init)
+			if not tfirst then
+				resume[def] = tlast
+			end
+		else
+			tfirst, tlast = self.matcher.match(matcher_arg, buffer)
+		end
+
+		scanned = scanned + math.max(0, #buffer - init + 1)
 		if not tfirst then
 			goto next
 		end
@@ -78,7 +113,7 @@ function MatchAction:matches(buffer)
 ::next::
 	end
 
-	return first, last, cb
+	return first, last, cb, scanned
 end
 
 actions.MatchAction = MatchAction
@@ -186,43 +221,123 @@ actions.defined = {
 			else
 				action.log_writes = true
 			end
+			action.cfg = args[3]
 		end,
 		execute = function(action)
 			local current_process = action.ctx.process
 
-			current_process:logfile(action.file, action.log_writes)
+			current_process:logfile(action.file, action.log_writes,
+			    action.cfg)
 			return true
 		end,
 	},
+	match_screen = {
+		need_process = true,
+		diagnostics = function(action)
+			local pattern = next(action.patterns)
+
+			return string.format(
+			    "[%s]:%d: match_screen (pattern '%s') failed\n",
+			    action.src, action.line, pattern)
+		end,
+		init = function(action, args)
+			local pattern = args[1]
+			local patterns = { [pattern] = {} }
+
+			if action.matcher.compile then
+				patterns[pattern]._compiled =
+				    action.matcher.compile(pattern)
+			end
+
+			action.patterns = patterns
+			action.region = args[2]
+			action.timeout = action.ctx.timeout
+
+			-- Model the screen from the start if the process hasn't
+			-- been spawned yet.
+			action.ctx.screen = true
+
+			local function set_cfg(cfg)
+				for k, v in pairs(cfg) do
+					if k ~= "callback" and k ~= "timeout" then
+						error(k .. " is not a valid cfg field")
+					end
+
+					action[k] = v
+				end
+			end
+
+			return set_cfg
+		end,
+		execute = function(action)
+			local current_process = action.ctx.process
+
+			return current_process:match_screen(action)
+		end,
+	},
 	pipe = {
 		need_process = true,
 		init = function(action, args)
 			action.command = args[1]
 			action.linefilter = args[2]
+			action.termfn = args[3]
 		end,
 		execute = function(action)
 			local current_process = action.ctx.process
+			local cfg = current_process.cfg
+			local wstatus
+
+			-- Without a filter or a rate to observe, we can let the
+			-- core feed the output straight into the process.
+			-- Otherwise we take it in batches of complete lines, and
+			-- only split those back up if the filter needs it.
+			if not action.linefilter and not (cfg and cfg.rate) then
+				wstatus = assert(current_process:pipe(action.command))
+			else
+				local function collect(batch)
+					if action.linefilter then
+						batch = filter_lines(batch,
+						    action.linefilter)
+					end
+					if batch ~= "" then
+						current_process:write(batch)
+					end
+				end
 
-			local inpipe = io.popen(action.command)
-			if not inpipe then
-				error("Failed to popen command '" .. action.command .. "'")
+				wstatus = assert(core.exec(action.command, collect,
+				    { batch = true }))
 			end
 
-			while true do
-				local line = inpipe:read("L")
-				if not line then
-					break
-				end
+			if action.termfn then
+				action.termfn(wstatus)
+			end
 
-				if action.linefilter then
-					line = action.linefilter(line)
-				end
-				if line then
-					current_process:write(line)
-				end
+			return true
+		end,
+	},
+	quiet = {
+		need_process = true,
+		init = function(action, args)
+			local idle, max = args[1], args[2]
+
+			if type(idle) ~= "number" or idle < 0 then
+				error("quiet: idle period must be a " ..
+				    "non-negative number of milliseconds")
+			elseif max ~= nil and
+			    (type(max) ~= "number" or max < 0) then
+				error("quiet: max must be a non-negative " ..
+				    "number of seconds")
 			end
 
-			inpipe:close()
+			action.idle = idle / 1000
+			action.timeout = max or action.ctx.timeout or
+			    actions.default_timeout
+		end,
+		execute = function(action)
+			local current_process = action.ctx.process
+
+			-- Like sleep(), running out the clock isn't a failure.
+			current_process:quiet(action.idle, action.timeout)
 			return true
 		end,
 	},
@@ -238,6 +353,18 @@ actions.defined = {
 			return true
 		end,
 	},
+	record = {
+		need_process = true,
+		init = function(action, args)
+			action.path = args[1]
+		end,
+		execute = function(action)
+			local current_process = action.ctx.process
+
+			assert(current_process:record(action.path))
+			return true
+		end,
+	},
 	release = {
 		need_process = true,
 		execute = function(action)
@@ -247,6 +374,48 @@ actions.defined = {
 			return true
 		end,
 	},
+	sched = {
+		allow_direct = true,
+		need_process = true,
+		need_prerelease = true,
+		init = function(action, args)
+			action.cfg = args[1]
+		end,
+		execute = function(action)
+			local current_process = action.ctx.process
+
+			current_process:sched(action.cfg)
+			return true
+		end,
+	},
+	screen = {
+		need_process = true,
+		init = function(action, args)
+			action.callback = args[1]
+			action.region = args[2]
+			action.ctx.screen = true
+		end,
+		execute = function(action)
+			local current_process = action.ctx.process
+
+			action.callback(current_process:screen(action.region))
+			return true
+		end,
+	},
+	send_file = {
+		need_process = true,
+		init = function(action, args)
+			action.file = args[1]
+			action.cfg = args[2]
+		end,
+		execute = function(action)
+			local current_process = action.ctx.process
+
+			-- The byte count is always truthy, so scripts carry on.
+			return assert(current_process:send_file(action.file,
+			    action.cfg))
+		end,
+	},
 	setgroups = {
 		allow_direct = true,
 		need_process = true,
@@ -369,6 +538,18 @@ actions.defined = {
 			return true
 		end,
 	},
+	stats = {
+		need_process = true,
+		init = function(action, args)
+			action.callback = args[1]
+		end,
+		execute = function(action)
+			local current_process = action.ctx.process
+
+			action.callback(current_process:stats())
+			return true
+		end,
+	},
 	stop = {
 		need_process = true,
 		execute = function(action)
@@ -406,7 +587,8 @@ actions.defined = {
 			local set, unset = action.set, action.unset
 			local current_process = action.ctx.process
 
-			local value = current_process.term:fetch(field)
+			local term = current_process:terminal("stty")
+			local value = term:fetch(field)
 			if type(value) == "table" then
 				set = set or {}
 
@@ -422,7 +604,7 @@ actions.defined = {
 				value = (value | set) & ~unset
 			end
 
-			assert(current_process.term:update({
+			assert(term:update({
 				[field] = value
 			}))
 
@@ -0,0 +1,559 @@
+--
+-- Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+--
+-- SPDX-License-Identifier: BSD-2-Clause
+--
+
+-- Agent backend: stands in for the process handle that core.spawn() would
+-- return, but the process is spawned by a porch --agent at the other end of a
+-- single rsh connection that all of the script's processes share.  Output and
+-- exit statuses come back over that connection as messages tagged with the
+-- process' id, so each process keeps a queue of what's arrived for it while
+-- something else was being waited on.
+
+local core = require("porch.core")
+
+local agent = {}
+
+-- struct porch_agent_term
+local TERM_FORMAT = "=I8I8I8I8I4I4"
+local TERM_FLAGS = { "iflag", "oflag", "cflag", "lflag" }
+
+-- Just enough of a term object for process setup, stty and term:size(); the
+-- agent applies changes to the real terminal as they're made.
+local AgentTerm = {}
+function AgentTerm:new(process, data)
+	local obj = setmetatable({}, self)
+	self.__index = self
+
+	local iflag, oflag, cflag, lflag, cols, rows =
+	    string.unpack(TERM_FORMAT, data)
+
+	obj.process = process
+	obj.fields = {
+		iflag = iflag,
+		oflag = oflag,
+		cflag = cflag,
+		lflag = lflag,
+	}
+	obj.width = cols
+	obj.height = rows
+	return obj
+end
+function AgentTerm:_send(fields, width, height)
+	local packed = {}
+
+	for i, name in ipairs(TERM_FLAGS) do
+		packed[i] = fields[name]
+	end
+
+	return self.process:_acked("term", 0, string.pack(TERM_FORMAT,
+	    packed[1], packed[2], packed[3], packed[4], width or 0,
+	    height or 0))
+end
+function AgentTerm:fetch(field)
+	if field == "cc" then
+		return {}
+	end
+
+	return self.fields[field]
+end
+function AgentTerm:update(fields)
+	local updated = {}
+
+	for k, v in pairs(self.fields) do
+		updated[k] = v
+	end
+	for k, v in pairs(fields) do
+		if k == "cc" then
+			if next(v) ~= nil then
+				return nil, "cc is not supported with an agent"
+			end
+		elseif updated[k] then
+			updated[k] = v
+		end
+	end
+
+	local ok, err = self:_send(updated)
+	if not ok then
+		return nil, err
+	end
+
+	self.fields = updated
+	return true
+end
+function AgentTerm:size(width, height)
+	if not width and not height then
+		return self.width, self.height
+	end
+
+	width = width or self.width
+	height = height or self.height
+
+	local ok, err = self:_send(self.fields, width, height)
+	if not ok then
+		return nil, err
+	end
+
+	self.width, self.height = width, height
+	return width, height
+end
+
+local AgentProcess = {}
+function AgentProcess:new(conn, id, termdata)
+	local obj = setmetatable({}, self)
+	self.__index = self
+
+	obj.conn = conn
+	obj.id = id
+	obj.termdata = termdata
+	obj.is_released = false
+	obj.is_eof = false
+	obj.counters = {
+		reads = 0,
+		bytes_read = 0,
+		writes = 0,
+		bytes_written = 0,
+		wakeups = 0,
+		callbacks = 0,
+		ipc_msgs = 1,	-- The spawn
+	}
+	return obj
+end
+function AgentProcess:_send(msg, arg, data)
+	self.counters.ipc_msgs = self.counters.ipc_msgs + 1
+	return self.conn:_send(msg, self.id, arg, data)
+end
+-- Requests that the agent acks are answered in order, so the first ack that we
+-- find is ours; an error comes back with a description in the data.
+function AgentProcess:_acked(msg, arg, data)
+	local ok, err = self:_send(msg, arg, data)
+	if not ok then
+		return nil, err
+	end
+
+	local ack
+	ack, err = self.conn:_wait(self.id, "ack")
+	if not ack then
+		return nil, err
+	end
+
+	self.counters.ipc_msgs = self.counters.ipc_msgs + 1
+	if ack.arg ~= 0 then
+		return nil, ack.data
+	end
+
+	return true
+end
+function AgentProcess:_exited(msg)
+	if msg.arg >= 0 then
+		self.status = core.wrap_status("exit", msg.arg)
+	else
+		self.status = core.wrap_status("signal", -msg.arg)
+	end
+end
+-- We need to know if it was killed by a signal by the time we hit EOF; the
+-- agent sends the status right behind it if it's already been reaped.
+function AgentProcess:_collect(timeout)
+	if self.status then
+		return true
+	end
+
+	local msg = self.conn:_wait(self.id, "exit", timeout)
+	if msg then
+		self:_exited(msg)
+		return true
+	end
+
+	return false
+end
+function AgentProcess:_killed()
+	local status = self.status
+
+	if status and status:is_signaled() and
+	    status:status() ~= self.last_signal then
+		return "spawned process killed with signal '" ..
+		    status:status() .. "'"
+	end
+end
+function AgentProcess:release(penv)
+	local clear, set = 0, ""
+
+	-- The agent only needs what to set, same as the core's child.
+	if penv then
+		local do_clear, _
+		set, _, do_clear = penv:expand()
+		set = set or ""
+		clear = do_clear and 1 or 0
+	end
+
+	local ok, err = self:_acked("release", clear, set)
+	if not ok then
+		return nil, err
+	end
+
+	self.is_released = true
+	return true
+end
+function AgentProcess:released()
+	return self.is_released
+end
+-- Mirrors the core's read(): calls `func` with each chunk of output until it
+-- returns true, with nil at EOF.
+function AgentProcess:read(func, timeout)
+	local counters = self.counters
+	local deadline = timeout and (core.monotime() + timeout)
+	local first = true
+
+	while not self.is_eof do
+		local msg = self.conn:_take(self.id, "output")
+
+		if not msg then
+			local wait
+
+			if deadline then
+				wait = deadline - core.monotime()
+				if wait <= 0 and not first then
+					break
+				end
+				wait = math.max(wait, 0)
+			end
+
+			first = false
+			counters.wakeups = counters.wakeups + 1
+
+			local ok, err = self.conn:_pump(wait)
+			if ok == nil then
+				return nil, err
+			end
+		elseif #msg.data == 0 then
+			local held = self.filter and self.filter:apply(nil)
+
+			counters.ipc_msgs = counters.ipc_msgs + 1
+			self.is_eof = true
+			if held and #held > 0 then
+				counters.callbacks = counters.callbacks + 1
+				func(held, "")
+			end
+			counters.callbacks = counters.callbacks + 1
+			func(nil)
+
+			self:_collect(0)
+
+			local err = self:_killed()
+			if err then
+				return nil, err
+			end
+
+			return true
+		else
+			counters.ipc_msgs = counters.ipc_msgs + 1
+			counters.reads = counters.reads + 1
+			counters.bytes_read = counters.bytes_read + #msg.data
+			counters.callbacks = counters.callbacks + 1
+			if self.filter then
+				if func(self.filter:apply(msg.data), msg.data) then
+					return true
+				end
+			elseif func(msg.data) then
+				return true
+			end
+		end
+	end
+
+	return true
+end
+function AgentProcess:write(data)
+	local counters = self.counters
+
+	local ok, err = self:_send("write", 0, data)
+	if not ok then
+		return nil, err
+	end
+
+	counters.writes = counters.writes + 1
+	counters.bytes_written = counters.bytes_written + #data
+	return #data
+end
+function AgentProcess:send_file(fh, readfn, cfg)
+	local chunksz = cfg.chunk or (64 * 1024)
+	local total = fh:seek("end")
+	local sent = 0
+
+	fh:seek("set")
+	while true do
+		local data = fh:read(chunksz)
+		if not data then
+			break
+		end
+
+		if cfg.eol then
+			data = data:gsub("\n", cfg.eol)
+		end
+
+		local ok, err = self:write(data)
+		if not ok then
+			return nil, err
+		end
+
+		sent = sent + #data
+		if cfg.written then
+			cfg.written(data)
+		end
+		if cfg.progress then
+			cfg.progress(sent, total)
+		end
+
+		-- Keep the output moving while we feed it.
+		local rok, rerr = self:read(readfn, 0)
+		if not rok then
+			return nil, rerr
+		end
+	end
+
+	return sent
+end
+-- Same filters as the core, applied to the output as it arrives.
+function AgentProcess:filters(list)
+	local filter, err
+
+	if list and #list > 0 then
+		filter, err = core.filter(list)
+		if not filter then
+			return nil, err
+		end
+	end
+
+	self.filter = filter
+	return true
+end
+function AgentProcess:eof(timeout)
+	if not self.is_eof then
+		return false
+	end
+
+	-- A nil timeout waits for as long as it takes, as with the core.
+	if timeout and timeout < 0 then
+		timeout = nil
+	end
+	if self:_collect(timeout) then
+		return true, self.status
+	end
+
+	return true
+end
+function AgentProcess:chdir(dir)
+	return self:_acked("chdir", 0, dir)
+end
+function AgentProcess:signal(signo)
+	if not self.is_released then
+		return nil, "process not yet released"
+	end
+
+	self.last_signal = signo
+	return self:_acked("signal", signo)
+end
+-- The agent takes care of the SIGTERM, and the SIGKILL if that doesn't do it;
+-- output is discarded from here on, so there's nothing for us to drain.
+function AgentProcess:close()
+	local conn = self.conn
+
+	if not conn then
+		return true
+	end
+
+	local err = self:_killed()
+	if not self.status then
+		local ok, serr = self:_send("close")
+		if not ok then
+			return nil, serr
+		end
+
+		local msg
+		msg, serr = conn:_wait(self.id, "exit")
+		if not msg then
+			return nil, serr
+		end
+
+		self:_exited(msg)
+	else
+		conn:_send("close", self.id)
+	end
+
+	self.is_eof = true
+	self.conn = nil
+	conn:_forget(self.id)
+
+	if err then
+		return nil, err
+	end
+
+	return true
+end
+function AgentProcess:stats()
+	local stats = {}
+
+	for k, v in pairs(self.counters) do
+		stats[k] = v
+	end
+
+	return stats
+end
+function AgentProcess:term()
+	if not self.term_obj then
+		self.term_obj = AgentTerm:new(self, self.termdata)
+	end
+
+	return self.term_obj
+end
+
+-- These need the process to be local, or the agent to know a lot more about
+-- the process than it does.
+local function agent_unsupported(name)
+	return function()
+		return nil, name .. " is not supported with an agent"
+	end
+end
+AgentProcess.continue = agent_unsupported("continue")
+AgentProcess.gid = agent_unsupported("gid")
+AgentProcess.pipe = agent_unsupported("pipe")
+AgentProcess.proxy = agent_unsupported("proxy")
+AgentProcess.record = agent_unsupported("record")
+AgentProcess.sched = agent_unsupported("sched")
+AgentProcess.screen = agent_unsupported("screen")
+AgentProcess.screen_enable = agent_unsupported("screen")
+AgentProcess.screen_gen = agent_unsupported("screen")
+AgentProcess.shutdown = agent_unsupported("shutdown")
+AgentProcess.setgroups = agent_unsupported("setgroups")
+AgentProcess.setid = agent_unsupported("setid")
+AgentProcess.sigcatch = agent_unsupported("sigcatch")
+AgentProcess.sigmask = agent_unsupported("sigmask")
+AgentProcess.stop = agent_unsupported("stop")
+AgentProcess.uid = agent_unsupported("uid")
+
+-- An Agent is the connection; spawn() hands out processes on it.
+local Agent = {}
+function Agent:new(cmd)
+	local obj = setmetatable({}, self)
+	self.__index = self
+
+	local conn, err = core.agent(cmd)
+	if not conn then
+		return nil, "agent: " .. err
+	end
+
+	obj.conn = conn
+	obj.next_id = 1
+	obj.queues = {}
+	return obj
+end
+function Agent:_send(msg, id, arg, data)
+	local ok, err = self.conn:send(msg, id, arg, data)
+	if not ok then
+		return nil, "agent: " .. err
+	end
+
+	return true
+end
+-- Wait up to `timeout` for the next message from the agent and queue it up
+-- for its process; false if nothing came in time.
+function Agent:_pump(timeout)
+	local msg, id, arg, data = self.conn:recv(timeout)
+
+	if not msg then
+		if id then
+			return nil, "agent: " .. id
+		end
+
+		return false
+	end
+
+	-- Anything for a process that's been closed is just dropped.
+	local queue = self.queues[id]
+	if queue then
+		queue[#queue + 1] = { msg = msg, arg = arg, data = data }
+	end
+
+	return true
+end
+-- Dequeue the first `msg` that's arrived for process `id`, if any.
+function Agent:_take(id, msg)
+	local queue = self.queues[id]
+
+	for i = 1, #queue do
+		if queue[i].msg == msg then
+			return table.remove(queue, i)
+		end
+	end
+end
+function Agent:_wait(id, msg, timeout)
+	local deadline = timeout and (core.monotime() + timeout)
+
+	while true do
+		local found = self:_take(id, msg)
+		if found then
+			return found
+		end
+
+		local wait
+		if deadline then
+			wait = math.max(deadline - core.monotime(), 0)
+		end
+
+		local ok, err = self:_pump(wait)
+		if ok == nil then
+			return nil, err
+		elseif not ok and deadline then
+			return nil
+		end
+	end
+end
+function Agent:_forget(id)
+	self.queues[id] = nil
+end
+function Agent:spawn(cmd, opts)
+	if opts and (opts.pty == false or opts.stderr) then
+		return nil, "agent: only processes on a pty are supported"
+	end
+
+	local id = self.next_id
+	self.next_id = id + 1
+	self.queues[id] = {}
+
+	local ok, err = self:_send("spawn", id, 0, table.concat(cmd, "\0") ..
+	    "\0")
+	if ok then
+		ok, err = self:_wait(id, "spawned")
+	end
+	if not ok then
+		self:_forget(id)
+		return nil, err
+	elseif ok.arg ~= 0 then
+		self:_forget(id)
+		return nil, "agent: " .. cmd[1] .. ": " .. ok.data
+	end
+
+	return AgentProcess:new(self, id, ok.data)
+end
+-- Hanging up on the agent kills anything that's still running over there.
+function Agent:close()
+	if not self.conn then
+		return true
+	end
+
+	local ok, err = self.conn:close()
+	self.conn = nil
+	if not ok then
+		return nil, "agent: " .. err
+	end
+
+	return true
+end
+
+-- new(cmd): start the agent with argv table `cmd`, which would typically be the
+-- rsh command followed by the host and porch --agent.
+function agent.new(cmd)
+	return Agent:new(cmd)
+end
+
+return agent
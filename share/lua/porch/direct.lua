@@ -34,12 +34,14 @@ local proc_inherited = {
 	"continue",
 	"gid",
 	"proxy",
+	"sched",
 	"setgroups",
 	"setid",
 	"sigisblocked",
 	"sigiscaught",
 	"sigisignored",
 	"sigisunblocked",
+	"stats",
 	"stop",
 	"stopped",
 	"uid",
@@ -62,7 +64,9 @@ end
 function DirectProcess:close()
 	return self._process:close()
 end
-function DirectProcess:match(pattern, matcher)
+-- `cfg` may select the `stream` to match against and set a `lines` callback,
+-- as in orch(5).
+function DirectProcess:match(pattern, matcher, cfg)
 	matcher = matcher or matchers.available.default
 
 	local action = actions.MatchAction:new("match")
@@ -75,6 +79,8 @@ function DirectProcess:match(pattern, matcher)
 	end
 	action.timeout = self.timeout
 	action.matcher = matcher
+	action.stream = cfg and cfg.stream
+	action.lines = cfg and cfg.lines
 
 	if matcher.compile then
 		for pat, v in pairs(patterns) do
@@ -86,6 +92,37 @@ function DirectProcess:match(pattern, matcher)
 
 	return self._process:match(action)
 end
+function DirectProcess:match_screen(pattern, region, matcher)
+	matcher = matcher or matchers.available.default
+
+	local action = actions.MatchAction:new("match_screen",
+	    actions.defined.match_screen.execute)
+	local patterns = { [pattern] = {} }
+
+	if matcher.compile then
+		patterns[pattern]._compiled = matcher.compile(pattern)
+	end
+
+	action.matcher = matcher
+	action.patterns = patterns
+	action.region = region
+	action.timeout = self.timeout
+
+	return self._process:match_screen(action)
+end
+-- quiet(ms[, max]): returns true once the process has been silent for `ms`
+-- milliseconds, or false if it's still going after `max` seconds.
+function DirectProcess:quiet(idle, max)
+	if type(idle) ~= "number" or idle < 0 then
+		return nil, "quiet: idle period must be a non-negative " ..
+		    "number of milliseconds"
+	end
+
+	return self._process:quiet(idle / 1000, max or self.timeout)
+end
+function DirectProcess:screen(region)
+	return self._process:screen(region)
+end
 function DirectProcess:eof(timeout)
 	local buffer = self._process.buffer
 
@@ -140,13 +177,24 @@ for name, def in pairs(actions.defined) do
 end
 
 function direct.spawn(...)
+	local cmd = { ... }
 	local fresh_ctx = {}
 
+	-- As with the spawn action, the command may instead be a single table,
+	-- which is also where options like pty go.
+	if type(cmd[1]) == "table" then
+		if #cmd > 1 then
+			return nil, "spawn: bad mix of table and additional arguments"
+		end
+
+		cmd = cmd[1]
+	end
+
 	for k, v in pairs(direct_ctx) do
 		fresh_ctx[k] = v
 	end
 
-	return DirectProcess:new({...}, fresh_ctx)
+	return DirectProcess:new(cmd, fresh_ctx)
 end
 
 return direct
@@ -17,18 +17,76 @@ function PatternMatcher.match()
 	-- All matchers should return start, last of match
 	return false
 end
+-- Matchers may also provide scan(pattern, buffer, init), which is match() but
+-- starting at `init`, and returning nil plus where to start next time on a miss
+-- if the buffer is only appended to in the meantime.  The match buffer uses it
+-- to avoid rescanning output that can't match.
 
 local LuaMatcher = PatternMatcher:new()
+LuaMatcher.name = "lua"
+-- Compiled once by the core rather than re-parsed by string.find() on every
+-- attempt; it finds the same matches.
+function LuaMatcher.compile(pattern)
+	return assert(core.luapat(pattern))
+end
 function LuaMatcher.match(pattern, buffer)
-	return buffer:find(pattern)
+	if type(pattern) == "string" then
+		return buffer:find(pattern)
+	end
+
+	return pattern:find(buffer)
+end
+function LuaMatcher.scan(pattern, buffer, init)
+	if type(pattern) == "string" then
+		return buffer:find(pattern, init)
+	end
+
+	return pattern:scan(buffer, init)
 end
 
 local PlainMatcher = PatternMatcher:new()
+PlainMatcher.name = "plain"
+function PlainMatcher.compile(pattern)
+	return assert(core.plain(pattern))
+end
 function PlainMatcher.match(pattern, buffer)
-	return buffer:find(pattern, nil, true)
+	if type(pattern) == "string" then
+		return buffer:find(pattern, nil, true)
+	end
+
+	return pattern:find(buffer)
+end
+function PlainMatcher.scan(pattern, buffer, init)
+	if type(pattern) == "string" then
+		pattern = PlainMatcher.compile(pattern)
+	end
+
+	return pattern:scan(buffer, init)
+end
+
+-- Same as plain, but ignoring ASCII case.
+local IPlainMatcher = PatternMatcher:new()
+IPlainMatcher.name = "iplain"
+function IPlainMatcher.compile(pattern)
+	return assert(core.plain(pattern, "i"))
+end
+function IPlainMatcher.match(pattern, buffer)
+	if type(pattern) == "string" then
+		return IPlainMatcher.compile(pattern):find(buffer)
+	end
+
+	return pattern:find(buffer)
+end
+function IPlainMatcher.scan(pattern, buffer, init)
+	if type(pattern) == "string" then
+		pattern = IPlainMatcher.compile(pattern)
+	end
+
+	return pattern:scan(buffer, init)
 end
 
 local PosixMatcher = PatternMatcher:new()
+PosixMatcher.name = "posix"
 function PosixMatcher.compile(pattern)
 	return assert(core.regcomp(pattern))
 end
@@ -43,6 +101,7 @@ matchers.PatternMatcher = PatternMatcher
 -- default will be configurable via `matcher()`
 matchers.available = {
 	default = LuaMatcher,
+	iplain = IPlainMatcher,
 	lua = LuaMatcher,
 	plain = PlainMatcher,
 	posix = PosixMatcher,
@@ -10,6 +10,8 @@ local tty = core.tty
 
 local debug_categories = {
 	bootstrap = true,
+	mem = true,	-- Reported by the core at exit
+	stats = true,
 }
 local function process_debug_env(debug_env)
 	local debugtbl = {}
@@ -25,26 +27,41 @@ local function process_debug_env(debug_env)
 end
 
 local MatchBuffer = {}
-function MatchBuffer:new(process, ctx)
+-- The buffer's contents are accounted for as match buffer memory until it's
+-- collected.
+function MatchBuffer:__gc()
+	core.memacct("buffer", -#self.buffer)
+end
+-- `stream` is "stderr" for the buffer of a separate stderr, nil otherwise.
+function MatchBuffer:new(process, ctx, stream)
 	local obj = setmetatable({}, self)
 	self.__index = self
 
+	obj.stream = stream
 	obj.buffer = ""
 	obj.ctx = ctx
 	obj.process = process
 	obj.eof = false
+	obj.trims = 0
+	obj.stats = {
+		buffer_hwm = 0,
+		match_attempts = 0,
+		scanned = {},
+	}
 	return obj
 end
-function MatchBuffer:_matches(action)
-	local first, last, callback = action:matches(self.buffer)
-
-	if not first then
-		return false
-	end
+function MatchBuffer:_scanned(action, bytes)
+	local stats = self.stats
+	local mname = action.matcher.name or "custom"
 
+	stats.scanned[mname] = (stats.scanned[mname] or 0) + (bytes or 0)
+end
+-- Consume everything up to and including `last`, and complete the action.
+function MatchBuffer:_consume(action, last, callback)
 	-- On match, we need to trim the buffer and signal completion.
 	action.completed = true
-	self.buffer = self.buffer:sub(last + 1)
+	self.trims = self.trims + 1
+	self:_set(self.buffer:sub(last + 1))
 
 	-- Return value is not significant, ignored.
 	callback = callback or action.callback
@@ -54,6 +71,109 @@ function MatchBuffer:_matches(action)
 
 	return true
 end
+-- Line mode: the patterns are matched against each line on its own, so that
+-- ^ and $ anchor to the line, and each line is only ever scanned once per
+-- action.  The partial line at the end, e.g., a prompt, is scanned too, but
+-- only again once it has grown.  A match consumes the whole line it was found
+-- in, or up to the end of the match in the partial line.  The action's `lines`
+-- callback, if any, gets each batch of complete lines in a single call.
+function MatchBuffer:_matches_lines(action)
+	local buffer = self.buffer
+	local state = action.line_state
+
+	-- Positions are only good for this buffer until it's trimmed.
+	if not state or state.buffer ~= self or state.trims ~= self.trims then
+		state = {
+			buffer = self,
+			trims = self.trims,
+			pos = 1,
+			partial = 0,
+		}
+		action.line_state = state
+	end
+
+	self.stats.match_attempts = self.stats.match_attempts + 1
+
+	local lines, partial_pos = core.lines(buffer, state.pos)
+	for idx, line in ipairs(lines) do
+		local first, _, callback, scanned = action:matches(line)
+
+		self:_scanned(action, scanned)
+		if first then
+			local stop = state.pos
+
+			for _ = 1, idx do
+				stop = buffer:find("\n", stop, true) + 1
+			end
+
+			if action.lines then
+				for i = #lines, idx + 1, -1 do
+					lines[i] = nil
+				end
+
+				action.lines(lines)
+			end
+
+			return self:_consume(action, stop - 1, callback)
+		end
+	end
+
+	if action.lines and #lines > 0 then
+		action.lines(lines)
+	end
+
+	if partial_pos ~= state.pos then
+		state.pos = partial_pos
+		state.partial = 0
+	end
+
+	local partial = buffer:sub(partial_pos)
+	if #partial > state.partial then
+		state.partial = #partial
+		if partial:byte(-1) == 13 then
+			partial = partial:sub(1, -2)
+		end
+
+		local first, last, callback, scanned = action:matches(partial)
+
+		self:_scanned(action, scanned)
+		if first then
+			return self:_consume(action, partial_pos + last - 1,
+			    callback)
+		end
+	end
+
+	return false
+end
+function MatchBuffer:_matches(action)
+	if self.process.cfg.mode == "line" then
+		return self:_matches_lines(action)
+	end
+
+	-- Where each of the action's patterns left off; only good until the
+	-- buffer is trimmed.
+	local state = action.scan_state
+	if not state or state.buffer ~= self or state.trims ~= self.trims then
+		state = { buffer = self, trims = self.trims, resume = {} }
+		action.scan_state = state
+	end
+
+	local first, last, callback, scanned = action:matches(self.buffer,
+	    state.resume)
+
+	self.stats.match_attempts = self.stats.match_attempts + 1
+	self:_scanned(action, scanned)
+
+	if not first then
+		return false
+	end
+
+	return self:_consume(action, last, callback)
+end
+function MatchBuffer:_set(buffer)
+	core.memacct("buffer", #buffer - #self.buffer)
+	self.buffer = buffer
+end
 function MatchBuffer:contents()
 	return self.buffer
 end
@@ -67,23 +187,37 @@ end
 function MatchBuffer:empty()
 	return #self.buffer == 0
 end
-function MatchBuffer:refill(action, timeout)
-	assert(not self.eof)
+-- Returns true if we've hit EOF, false otherwise.  If the output went through
+-- a filter chain, then `raw` is what the process actually sent and that's what
+-- gets logged.
+function MatchBuffer:append(input, raw)
+	if not input then
+		self.eof = true
+		return true
+	end
 
-	if not self.process:released() then
-		self.process:release()
+	if self.process.log then
+		self.process.log:write(raw or input)
 	end
-	local function refill(input)
-		if not input then
-			self.eof = true
-			return true
-		end
 
-		if self.process.log then
-			self.process.log:write(input)
-		end
+	self:_set(self.buffer .. input)
+	if #self.buffer > self.stats.buffer_hwm then
+		self.stats.buffer_hwm = #self.buffer
+	end
+	return false
+end
+-- Any timers in the `timers` list also end the refill early if they fire, see
+-- Process:read().
+function MatchBuffer:refill(action, timeout, timers)
+	assert(not self.eof)
+
+	local process = self.process
+	local done = false
 
-		self.buffer = self.buffer .. input
+	if not process:released() then
+		process:release()
+	end
+	local function check()
 		if type(action) == "table" then
 			return self:_matches(action)
 		elseif action then
@@ -92,12 +226,65 @@ function MatchBuffer:refill(action, timeout)
 			return action()
 		end
 	end
+	local function refill(input, raw)
+		if self:append(input, raw) then
+			done = true
+			return true
+		end
 
-	if timeout then
-		assert(self.process:read(refill, timeout))
-	else
-		assert(self.process:read(refill))
+		done = check()
+		return done
+	end
+
+	if not process.errbuffer then
+		assert(process:read(refill, timeout, nil, timers))
+		return
+	end
+
+	-- The other stream still needs to be drained while we wait on this one,
+	-- or the process could block writing to it.  Its output only finishes
+	-- the read for a function action, i.e., one(), whose matches could be
+	-- against either buffer.
+	local other = process.errbuffer
+	if self.stream == "stderr" then
+		other = process.buffer
+	end
+	local function drain(input, raw)
+		if other:append(input, raw) or type(action) ~= "function" then
+			return false
+		end
+
+		done = check()
+		return done
+	end
+
+	if self.stream ~= "stderr" then
+		assert(process:read(refill, timeout, drain, timers))
+		return
+	end
+
+	local function woken()
+		for _, timer in ipairs(timers or {}) do
+			if timer:fired() then
+				return true
+			end
+		end
+
+		return false
 	end
+
+	-- The core's read() returns at EOF on the terminal, but stderr may well
+	-- have more to come after that.
+	local deadline = timeout and (core.monotime() + timeout)
+	repeat
+		local remaining = deadline and (deadline - core.monotime())
+
+		if (remaining and remaining <= 0) or woken() then
+			break
+		end
+
+		assert(process:read(drain, remaining, refill, timers))
+	until done or self.eof or not process.buffer.eof
 end
 function MatchBuffer:match(action)
 	if not self:_matches(action) and not self.eof then
@@ -113,7 +300,21 @@ function Process:new(cmd, ctx)
 	local pwrap = setmetatable({}, self)
 	self.__index = self
 
-	if ctx.remote then
+	-- Only an explicit false opts out of the pty.
+	pwrap.pty = cmd.pty ~= false
+
+	-- The remote prefix below drops the non-argv fields, so grab it now.
+	local sched = cmd.sched
+
+	local spawn_opts
+	if not pwrap.pty or cmd.stderr then
+		spawn_opts = { pty = pwrap.pty, stderr = cmd.stderr }
+	end
+
+	-- An agent is already at the other end of the rsh, so the command goes
+	-- to it as-is.
+	local agent = ctx.remote and ctx.remote.agent
+	if ctx.remote and not agent then
 		-- Prefix the command with the remote configuration
 		if not ctx.remote["rsh"] then
 			error("rsh required for remote host spec")
@@ -136,9 +337,22 @@ function Process:new(cmd, ctx)
 
 		cmd = full_cmd
 	end
-	pwrap._process = assert(core.spawn(table.unpack(cmd)))
+	if agent then
+		pwrap._process = assert(agent:spawn(cmd, spawn_opts))
+	elseif ctx.replay then
+		pwrap._process = assert(ctx.replay:spawn(cmd))
+	elseif spawn_opts then
+		pwrap._process = assert(core.spawn(spawn_opts,
+		    table.unpack(cmd)))
+	else
+		pwrap._process = assert(core.spawn(table.unpack(cmd)))
+	end
 	pwrap.buffer = MatchBuffer:new(pwrap, ctx)
+	if spawn_opts and spawn_opts.stderr == "separate" and not ctx.replay then
+		pwrap.errbuffer = MatchBuffer:new(pwrap, ctx, "stderr")
+	end
 	pwrap.cfg = {}
+	pwrap.cmd = cmd
 	pwrap.ctx = ctx
 	pwrap.is_raw = false
 	pwrap.env = env:new(ctx.env)
@@ -147,13 +361,22 @@ function Process:new(cmd, ctx)
 	-- wants to debug different features at different processes.
 	pwrap.debug_env = os.getenv("PORCH_DEBUG") or ""
 
-	pwrap.term = assert(pwrap._process:term())
-	local mask = pwrap.term:fetch("lflag")
+	if pwrap.pty then
+		pwrap.term = assert(pwrap._process:term())
 
-	mask = mask & ~tty.lflag.ECHO
-	assert(pwrap.term:update({
-		lflag = mask,
-	}))
+		local mask = pwrap.term:fetch("lflag")
+
+		mask = mask & ~tty.lflag.ECHO
+		assert(pwrap.term:update({
+			lflag = mask,
+		}))
+	end
+	if ctx.screen then
+		pwrap:screen_enable()
+	end
+	if sched then
+		pwrap:sched(sched)
+	end
 
 	return pwrap
 end
@@ -184,12 +407,95 @@ function Process:gid(...)
 
 	return self:setid(nil, args[1])
 end
+function Process:pipe(cmd)
+	if not self:released() then
+		self:release()
+	end
+
+	local feedcfg = { escape = not self.is_raw }
+	if self.log and self.log_writes then
+		feedcfg.written = function(data)
+			self.log:write(data)
+		end
+	end
+
+	local function drain(input, raw)
+		self.buffer:append(input, raw)
+	end
+	if self.errbuffer then
+		feedcfg.stderr = function(input)
+			self.errbuffer:append(input)
+		end
+	end
+
+	return self._process:pipe(cmd, drain, feedcfg)
+end
 function Process:proxy(...)
 	if not self:released() then
 		self:release()
 	end
 	return self._process:proxy(...)
 end
+-- Wait for the process to go `idle` seconds without any output, for at most
+-- `max` seconds.  Returns true if it went quiet or hit EOF, false if it was
+-- still talking when we gave up.  Whatever it says in the meantime is buffered
+-- for later matches.
+function Process:quiet(idle, max)
+	local buffer = self.buffer
+
+	if not self:released() then
+		self:release()
+	end
+
+	local limit = max and assert(core.timer(max))
+	local timers = limit and { limit }
+	local last = core.monotime()
+	local heard
+	local function listen(input, raw)
+		heard = true
+		buffer:append(input, raw)
+		return true
+	end
+	local function listen_err(input)
+		heard = true
+		self.errbuffer:append(input)
+		return true
+	end
+
+	-- The read's own timeout covers the idle period, while `limit` ends
+	-- it early if we run out of time first.
+	local function wait_quiet()
+		while not buffer.eof do
+			local wait = idle - (core.monotime() - last)
+
+			if wait <= 0 then
+				return true
+			elseif limit and limit:fired() then
+				return false
+			end
+
+			heard = false
+			assert(self:read(listen, wait,
+			    self.errbuffer and listen_err, timers))
+			if heard then
+				last = core.monotime()
+			end
+		end
+
+		return true
+	end
+
+	-- `limit` mustn't be left armed if the read blows up.
+	local ok, res = pcall(wait_quiet)
+	if limit then
+		limit:disarm()
+	end
+	if not ok then
+		error(res, 0)
+	end
+
+	return res
+end
 function Process:released()
 	return self._process:released()
 end
@@ -200,18 +506,95 @@ function Process:release()
 	end
 	return self._process:release(penv)
 end
-function Process:read(func, timeout)
-	if timeout then
+-- A separate stderr is always drained along with the terminal, into its own
+-- buffer unless the caller wants it.
+-- The read also ends early if any of the core.timer()s in `timers` fire; no
+-- other timer will interrupt it.
+function Process:read(func, timeout, errfunc, timers)
+	if self.errbuffer and not errfunc then
+		errfunc = function(input)
+			self.errbuffer:append(input)
+			return false
+		end
+	end
+
+	if timers then
+		return self._process:read(func, timeout, errfunc, timers)
+	elseif errfunc then
+		return self._process:read(func, timeout, errfunc)
+	elseif timeout then
 		return self._process:read(func, timeout)
 	else
 		return self._process:read(func)
 	end
 end
+function Process:record(path)
+	if not path then
+		return self._process:record()
+	end
+
+	return self._process:record(path, table.concat(self.cmd, " "))
+end
 function Process:raw(is_raw)
 	local prev_raw = self.is_raw
 	self.is_raw = is_raw
 	return prev_raw
 end
+function Process:send_file(file, cfg)
+	local fh, err
+
+	if type(file) == "string" then
+		fh, err = io.open(file, "rb")
+		if not fh then
+			return nil, err
+		end
+	else
+		fh = file
+	end
+
+	if not self:released() then
+		self:release()
+	end
+
+	local feedcfg = {}
+	if cfg then
+		feedcfg.eol = cfg.eol
+		feedcfg.chunk = cfg.chunk
+		feedcfg.progress = cfg.progress
+	end
+
+	if self.log and (self.log_writes or (cfg and cfg.log)) then
+		if cfg and type(cfg.log) == "string" then
+			self.log:write(cfg.log)
+		else
+			feedcfg.written = function(data)
+				self.log:write(data)
+			end
+		end
+	end
+
+	-- Anything the process sends back while we're feeding it lands in
+	-- the buffer, just as if we had read() it.
+	local function drain(input, raw)
+		self.buffer:append(input, raw)
+	end
+	if self.errbuffer then
+		feedcfg.stderr = function(input)
+			self.errbuffer:append(input)
+		end
+	end
+
+	local sent
+	sent, err = self._process:send_file(fh, drain, feedcfg)
+	if fh ~= file then
+		fh:close()
+	end
+
+	return sent, err
+end
+function Process:sched(cfg)
+	return assert(self._process:sched(cfg))
+end
 function Process:setgroups(...)
 	return assert(self._process:setgroups(...))
 end
@@ -390,6 +773,27 @@ end
 function Process:signal(signo)
 	return self._process:signal(signo)
 end
+function Process:stats()
+	local stats = self._process:stats()
+	local bstats = self.buffer.stats
+
+	stats.buffer_hwm = bstats.buffer_hwm
+	stats.log_written = self.log_written or 0
+	stats.log_dropped = self.log_dropped or 0
+	if self.log then
+		local lstats = self.log:stats()
+
+		stats.log_written = stats.log_written + lstats.written
+		stats.log_dropped = stats.log_dropped + lstats.dropped
+	end
+	stats.match_attempts = bstats.match_attempts
+	stats.scanned = {}
+	for mname, scanned in pairs(bstats.scanned) do
+		stats.scanned[mname] = scanned
+	end
+
+	return stats
+end
 function Process:stop()
 	local ret = assert(self._process:stop())
 	self.is_stopped = true
@@ -438,6 +842,19 @@ function Process:write(data, cfg)
 			end
 		end
 	end
+
+	-- Without a terminal, there's no line discipline to turn a ^D into EOF
+	-- for us; we close our end of the socket for writing instead.
+	local eof_at
+	if not self.is_raw and not self.pty then
+		eof_at = data:find("\004", 1, true)
+		if eof_at and eof_at < #data then
+			error("Data written after ^D to a process without a pty")
+		elseif eof_at then
+			data = data:sub(1, eof_at - 1)
+		end
+	end
+
 	if self.log then
 		local log_write = self.log_writes or (cfg and cfg.log)
 
@@ -491,6 +908,10 @@ function Process:write(data, cfg)
 		end
 	end
 
+	if eof_at then
+		assert(self._process:shutdown())
+	end
+
 	return sent
 end
 function Process:close()
@@ -507,6 +928,7 @@ function Process:close()
 	end
 
 	assert(self._process:close(procdrain))
+	self:report_stats()
 
 	-- Flush output, close everything out
 	self:logfile(nil)
@@ -514,22 +936,79 @@ function Process:close()
 	self.term = nil
 	return true
 end
+-- Write our counters out to `file`, one per line and sorted by name.
+function Process:dump_stats(file)
+	local stats = self:stats()
+	local keys = {}
+
+	for k, v in pairs(stats) do
+		if k ~= "scanned" then
+			keys[#keys + 1] = k
+		end
+	end
+	for mname in pairs(stats.scanned) do
+		keys[#keys + 1] = "scanned." .. mname
+	end
+	table.sort(keys)
+
+	file:write("porch: stats for " .. self.cmd[1] .. "\n")
+	for _, k in ipairs(keys) do
+		local mname = k:match("^scanned%.(.+)")
+		local v = (mname and stats.scanned[mname]) or stats[k]
+
+		file:write(string.format("  %-20s %d\n", k, v))
+	end
+end
+-- Dump our stats for PORCH_DEBUG=stats, at most once per process.
+function Process:report_stats()
+	if self.stats_reported or not self:debugging("stats") then
+		return
+	end
+
+	self:dump_stats(io.stderr)
+	self.stats_reported = true
+end
 -- Our own special salt
-function Process:logfile(file, log_writes)
+-- The log itself is written out by a thread in the core, see core.logfile();
+-- `file` is only held onto so that we can close it once we're done with it.
+function Process:logfile(file, log_writes, cfg)
 	if self.log then
-		self.log:flush()
-		self.log:close()
+		assert(self.log:close())
+		self.logstream:close()
+
+		local lstats = self.log:stats()
+
+		self.log_written = (self.log_written or 0) + lstats.written
+		self.log_dropped = (self.log_dropped or 0) + lstats.dropped
+		self.log = nil
+		self.logstream = nil
 	end
 
-	self.log = file
+	if file then
+		self.log = assert(core.logfile(file, cfg))
+		self.logstream = file
+	end
 	if log_writes ~= nil then
 		self.log_writes = log_writes
 	else
 		self.log_writes = true
 	end
 end
+-- Returns the buffer for `stream`, either "stdout" (the default) or "stderr";
+-- the latter only exists if the process was spawned with a separate stderr.
+function Process:stream_buffer(stream)
+	if not stream or stream == "stdout" then
+		return self.buffer
+	elseif stream ~= "stderr" then
+		error("unknown stream '" .. tostring(stream) .. "'")
+	elseif not self.errbuffer then
+		error("process was not spawned with a separate stderr")
+	end
+
+	return self.errbuffer
+end
 function Process:match(action)
-	local buffer = self.buffer
+	local buffer = self:stream_buffer(action.stream)
 	if not buffer:match(action) then
 		if not self.ctx:fail(action, buffer:contents()) then
 			return false
@@ -538,10 +1017,99 @@ function Process:match(action)
 
 	return true
 end
+-- Like match(), but against the rendered screen rather than the output stream,
+-- and within the action's region.  The screen is only re-rendered and matched
+-- when the region has changed, and the match buffer is left untouched.
+function Process:match_screen(action)
+	local region = action.region or {}
+	local buffer = self.buffer
+	local seen
+
+	self:screen_enable()
+
+	local function check()
+		local gen = assert(self._process:screen_gen(region.top,
+		    region.bottom))
+
+		if gen == seen then
+			return false
+		end
+
+		seen = gen
+
+		local text = self:screen(region)
+		local first, _, callback = action:matches(text)
+		if not first then
+			return false
+		end
+
+		action.completed = true
+		callback = callback or action.callback
+		if callback then
+			self.ctx:execute(callback)
+		end
+
+		return true
+	end
+
+	if not check() and not buffer.eof then
+		buffer:refill(check, action.timeout)
+	end
+
+	if not action.completed then
+		if not self.ctx:fail(action, self:screen(region)) then
+			return false
+		end
+	end
+
+	return true
+end
+-- Returns the text in `region` of the screen model, and the cursor's row and
+-- column.  The model is started if it wasn't already, but it won't know about
+-- anything that was output before then.
+function Process:screen(region)
+	-- After close(), we only hang on to the process for its final screen.
+	local handle = self._process or self.screen_process
+
+	region = region or {}
+	if not self.screen_process then
+		self:screen_enable()
+		handle = self._process
+	end
+
+	local text, _, row, col = assert(handle:screen(region.top,
+	    region.bottom, region.left, region.right))
+	return text, row, col
+end
+-- Returns the process' term object for `what`, which needs one; processes
+-- spawned with pty = false don't have one.
+function Process:terminal(what)
+	if not self.term then
+		error(what .. ": process has no terminal")
+	end
+
+	return self.term
+end
+function Process:screen_enable()
+	assert(self._process:screen_enable())
+	self.screen_process = self._process
+	return true
+end
 function Process:set(cfg)
+	if cfg.mode and cfg.mode ~= "line" and cfg.mode ~= "stream" then
+		error("mode must be line or stream")
+	end
+
 	for k, v in pairs(cfg) do
 		self.cfg[k] = v
 	end
+
+	if cfg.screen then
+		self:screen_enable()
+	end
+	if cfg.filters then
+		assert(self._process:filters(cfg.filters))
+	end
 end
 
 return Process
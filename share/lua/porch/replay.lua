@@ -0,0 +1,514 @@
+--
+-- Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+--
+-- SPDX-License-Identifier: BSD-2-Clause
+--
+
+-- Replay backend: stands in for the process handle that core.spawn() would
+-- return, but feeds output from an asciicast v2 transcript, e.g., one made with
+-- record(), into the same read path instead of running anything.  Writes are
+-- either checked against the input in the transcript or ignored.
+
+local core = require("porch.core")
+local tty = core.tty
+
+local replay = {}
+
+local json_escapes = {
+	['"'] = '"',
+	['\\'] = '\\',
+	['/'] = '/',
+	b = '\b',
+	f = '\f',
+	n = '\n',
+	r = '\r',
+	t = '\t',
+}
+
+-- Decode the contents of a JSON string.  Code points below 0x100 are taken as
+-- raw bytes rather than encoded, since that's how record() escapes bytes that
+-- aren't valid UTF-8.
+local function json_decode_string(str)
+	local out = {}
+	local pos = 1
+
+	while true do
+		local esc = str:find("\\", pos, true)
+		if not esc then
+			out[#out + 1] = str:sub(pos)
+			break
+		end
+
+		out[#out + 1] = str:sub(pos, esc - 1)
+
+		local ch = str:sub(esc + 1, esc + 1)
+		if ch == "u" then
+			local cp = tonumber(str:sub(esc + 2, esc + 5), 16)
+			if not cp then
+				return nil, "bad unicode escape"
+			end
+
+			pos = esc + 6
+			if cp >= 0xd800 and cp <= 0xdbff and
+			    str:sub(pos, pos + 1) == "\\u" then
+				local lo = tonumber(str:sub(pos + 2, pos + 5), 16)
+				if lo and lo >= 0xdc00 and lo <= 0xdfff then
+					cp = 0x10000 + ((cp - 0xd800) << 10) +
+					    (lo - 0xdc00)
+					pos = pos + 6
+				end
+			end
+
+			if cp < 0x100 then
+				out[#out + 1] = string.char(cp)
+			else
+				out[#out + 1] = utf8.char(cp)
+			end
+		elseif json_escapes[ch] then
+			out[#out + 1] = json_escapes[ch]
+			pos = esc + 2
+		else
+			return nil, "bad escape '\\" .. ch .. "'"
+		end
+	end
+
+	return table.concat(out)
+end
+
+-- Load the transcript at `path`.  Output events are annotated with the amount
+-- of input that had been recorded before them, so that we don't get ahead of
+-- the script.
+function replay.load(path)
+	local fh, err = io.open(path, "r")
+	if not fh then
+		return nil, err
+	end
+
+	local header = fh:read("l")
+	if not header or not header:match('"version"%s*:%s*2[,}%s]') then
+		fh:close()
+		return nil, path .. ": not an asciicast v2 transcript"
+	end
+
+	local transcript = {
+		width = tonumber(header:match('"width"%s*:%s*(%d+)')),
+		height = tonumber(header:match('"height"%s*:%s*(%d+)')),
+		input = {},
+		output = {},
+	}
+
+	local inputsz = 0
+	local lineno = 1
+	for line in fh:lines() do
+		lineno = lineno + 1
+		if line:match("^%s*$") then
+			goto next
+		end
+
+		local offset, etype, data = line:match(
+		    '^%s*%[%s*([%d.eE+-]+)%s*,%s*"(%a)"%s*,%s*"(.*)"%s*%]%s*$')
+		if offset then
+			data, err = json_decode_string(data)
+		end
+		if not data then
+			fh:close()
+			return nil, string.format("%s:%d: malformed event%s", path,
+			    lineno, err and (": " .. err) or "")
+		end
+
+		if etype == "o" then
+			transcript.output[#transcript.output + 1] = {
+				offset = tonumber(offset),
+				data = data,
+				after = inputsz,
+			}
+		elseif etype == "i" then
+			transcript.input[#transcript.input + 1] = data
+			inputsz = inputsz + #data
+		end
+::next::
+	end
+
+	fh:close()
+	transcript.input = table.concat(transcript.input)
+	return transcript
+end
+
+-- Just enough of a term object for process setup and term:size().
+local ReplayTerm = {}
+function ReplayTerm:new(transcript)
+	local obj = setmetatable({}, self)
+	self.__index = self
+
+	obj.fields = {
+		iflag = 0,
+		oflag = 0,
+		cflag = 0,
+		lflag = tty.lflag.ECHO | tty.lflag.ICANON,
+		cc = {},
+	}
+	obj.width = transcript.width or 0
+	obj.height = transcript.height or 0
+	return obj
+end
+function ReplayTerm:fetch(field)
+	local value = self.fields[field]
+
+	if type(value) == "table" then
+		local copy = {}
+		for k, v in pairs(value) do
+			copy[k] = v
+		end
+		return copy
+	end
+
+	return value
+end
+function ReplayTerm:update(fields)
+	for k, v in pairs(fields) do
+		self.fields[k] = v
+	end
+
+	return true
+end
+function ReplayTerm:size(width, height)
+	self.width = width or self.width
+	self.height = height or self.height
+	if self.vt and (width or height) then
+		assert(self.vt:resize(self.width, self.height))
+	end
+	return self.width, self.height
+end
+
+local ReplayProcess = {}
+function ReplayProcess:new(transcript, cfg)
+	local obj = setmetatable({}, self)
+	self.__index = self
+
+	obj.transcript = transcript
+	obj.check_input = cfg.input ~= "ignore"
+	obj.honor_timing = cfg.timing == "honor"
+	obj.next_output = 1
+	obj.written = 0
+	obj.is_released = false
+	obj.is_eof = false
+	obj.counters = {
+		reads = 0,
+		bytes_read = 0,
+		writes = 0,
+		bytes_written = 0,
+		wakeups = 0,
+		callbacks = 0,
+		ipc_msgs = 0,
+	}
+	return obj
+end
+function ReplayProcess:release()
+	self.is_released = true
+	self.clock = core.monotime()
+	self.last_offset = nil
+	return true
+end
+function ReplayProcess:released()
+	return self.is_released
+end
+-- The time by which a read has to give up: its timeout, or the soonest of the
+-- `timers` that it was handed, if that's sooner.  nil if it could wait forever.
+local function read_deadline(timeout, timers)
+	local now = core.monotime()
+	local deadline = timeout and (now + timeout)
+
+	for _, timer in ipairs(timers or {}) do
+		local remaining = timer:remaining()
+
+		if remaining and
+		    (not deadline or now + remaining < deadline) then
+			deadline = now + remaining
+		end
+	end
+
+	return deadline
+end
+-- Mirrors the core's read(): calls `func` with each chunk of output until it
+-- returns true, with nil at EOF.  If the next chunk was recorded after input
+-- that the script hasn't sent yet, then the real program would still be waiting
+-- on it and we just time out; with timing honored, that takes as long as it
+-- would have live.
+function ReplayProcess:read(func, timeout, _, timers)
+	local counters = self.counters
+	local output = self.transcript.output
+	local deadline = read_deadline(timeout, timers)
+
+	while true do
+		local event = output[self.next_output]
+
+		counters.wakeups = counters.wakeups + 1
+		if not event then
+			local held = self.filter and self.filter:apply(nil)
+
+			self.is_eof = true
+			if held and #held > 0 then
+				counters.callbacks = counters.callbacks + 1
+				func(held, "")
+			end
+			counters.callbacks = counters.callbacks + 1
+			func(nil)
+			return true
+		elseif self.check_input and event.after > self.written then
+			if self.honor_timing and deadline then
+				local now = core.monotime()
+
+				core.sleep(math.max(0, deadline - now))
+			end
+			return true
+		end
+
+		if self.honor_timing then
+			local now = core.monotime()
+			local due = self.clock
+
+			if self.last_offset then
+				due = due + (event.offset - self.last_offset)
+			end
+			if deadline and due > deadline then
+				core.sleep(math.max(0, deadline - now))
+				return true
+			elseif due > now then
+				core.sleep(due - now)
+			end
+
+			self.clock = math.max(due, now)
+			self.last_offset = event.offset
+		end
+
+		self.next_output = self.next_output + 1
+		counters.reads = counters.reads + 1
+		counters.bytes_read = counters.bytes_read + #event.data
+		if self.vt then
+			self.vt:feed(event.data)
+		end
+		counters.callbacks = counters.callbacks + 1
+		if self.filter then
+			if func(self.filter:apply(event.data), event.data) then
+				return true
+			end
+		elseif func(event.data) then
+			return true
+		end
+	end
+end
+function ReplayProcess:write(data)
+	local counters = self.counters
+
+	if self.check_input then
+		local input = self.transcript.input
+		local expected = input:sub(self.written + 1, self.written + #data)
+
+		if expected ~= data then
+			return nil, string.format(
+			    "replay: unexpected input at byte %d: expected %q, got %q",
+			    self.written, expected, data)
+		end
+	end
+
+	self.written = self.written + #data
+	counters.writes = counters.writes + 1
+	counters.bytes_written = counters.bytes_written + #data
+	return #data
+end
+function ReplayProcess:send_file(fh, readfn, cfg)
+	local chunksz = cfg.chunk or (64 * 1024)
+	local total = fh:seek("end")
+	local consumed, sent = 0, 0
+
+	fh:seek("set")
+	while true do
+		local data = fh:read(chunksz)
+		if not data then
+			break
+		end
+
+		-- Progress is in bytes of the file, like the total.
+		consumed = consumed + #data
+		if cfg.eol then
+			data = data:gsub("\n", cfg.eol)
+		end
+
+		local ok, err = self:write(data)
+		if not ok then
+			return nil, err
+		end
+
+		sent = sent + #data
+		if cfg.written then
+			cfg.written(data)
+		end
+		if cfg.progress then
+			cfg.progress(consumed, total)
+		end
+
+		-- Let the transcript catch up with what we've sent, as the core
+		-- would by draining the process while it feeds it.
+		self:read(readfn, 0)
+	end
+
+	return sent
+end
+-- Same filters as the core, applied to the transcript's output.
+function ReplayProcess:filters(list)
+	local filter, err
+
+	if list and #list > 0 then
+		filter, err = core.filter(list)
+		if not filter then
+			return nil, err
+		end
+	end
+
+	self.filter = filter
+	return true
+end
+function ReplayProcess:eof()
+	if not self.is_eof then
+		return false
+	end
+
+	-- The transcript doesn't know how the program exited, so we just say
+	-- that it did so successfully.
+	if not self.status then
+		self.status = core.wrap_status("exit", 0)
+	end
+
+	return true, self.status
+end
+function ReplayProcess:close()
+	self.is_eof = true
+	return true
+end
+function ReplayProcess:stats()
+	local stats = {}
+
+	for k, v in pairs(self.counters) do
+		stats[k] = v
+	end
+
+	return stats
+end
+function ReplayProcess:term()
+	if not self.term_obj then
+		self.term_obj = ReplayTerm:new(self.transcript)
+	end
+
+	return self.term_obj
+end
+-- The screen is modeled from the transcript's output, as the core would from
+-- the process', sized to match the recording.
+function ReplayProcess:screen_enable()
+	if not self.vt then
+		local term = self:term()
+		local vt, err = core.vt(term.width, term.height)
+
+		if not vt then
+			return nil, err
+		end
+
+		self.vt = vt
+		term.vt = vt
+	end
+
+	return true
+end
+function ReplayProcess:screen(...)
+	if not self.vt then
+		return nil, "screen model not enabled"
+	end
+
+	return self.vt:screen(...)
+end
+function ReplayProcess:screen_gen(...)
+	if not self.vt then
+		return nil, "screen model not enabled"
+	end
+
+	return self.vt:gen(...)
+end
+function ReplayProcess:gid()
+	return core.gid()
+end
+function ReplayProcess:uid()
+	return core.uid()
+end
+function ReplayProcess:sigcatch(...)
+	if select("#", ...) == 0 then
+		return {}
+	end
+
+	return true
+end
+function ReplayProcess:sigmask(...)
+	if select("#", ...) == 0 then
+		return {}
+	end
+
+	return true
+end
+
+-- None of these have any bearing on the transcript.
+local function replay_noop()
+	return true
+end
+ReplayProcess.chdir = replay_noop
+ReplayProcess.continue = replay_noop
+ReplayProcess.sched = replay_noop
+ReplayProcess.setgroups = replay_noop
+ReplayProcess.setid = replay_noop
+ReplayProcess.shutdown = replay_noop
+ReplayProcess.signal = replay_noop
+ReplayProcess.stop = replay_noop
+
+-- And these can't be meaningfully replayed.
+local function replay_unsupported(name)
+	return function()
+		return nil, name .. " is not supported in replay mode"
+	end
+end
+ReplayProcess.pipe = replay_unsupported("pipe")
+ReplayProcess.proxy = replay_unsupported("proxy")
+ReplayProcess.record = replay_unsupported("record")
+
+-- A Replayer hands out the configured transcripts in order, one per spawn().
+local Replayer = {}
+function Replayer:new(cfg)
+	local obj = setmetatable({}, self)
+	self.__index = self
+
+	obj.cfg = cfg
+	obj.files = cfg.files or {}
+	obj.next_file = 1
+	return obj
+end
+function Replayer:spawn()
+	local path = self.files[self.next_file]
+	if not path then
+		return nil, "replay: no transcript left for spawn #" ..
+		    self.next_file
+	end
+
+	self.next_file = self.next_file + 1
+
+	local transcript, err = replay.load(path)
+	if not transcript then
+		return nil, err
+	end
+
+	return ReplayProcess:new(transcript, self.cfg)
+end
+
+-- new(cfg): cfg.files is the list of transcripts to replay, cfg.timing is
+-- either "compress" (the default) or "honor", and cfg.input is either "check"
+-- (the default) or "ignore".
+function replay.new(cfg)
+	return Replayer:new(cfg)
+end
+
+return replay
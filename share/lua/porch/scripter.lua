@@ -8,8 +8,10 @@ local core = require("porch.core")
 
 local context = require("porch.context")
 local actions = require("porch.actions")
+local agent = require("porch.agent")
 local matchers = require("porch.matchers")
 local process = require("porch.process")
+local replay = require("porch.replay")
 local tty = core.tty
 local scripter = {env = {}}
 
@@ -19,6 +21,19 @@ local CTX_CALLBACK = 3
 
 local current_ctx
 
+-- Only consulted when PORCH_TRACE is set in the environment, see porch(1).
+local tracing = core.tracing()
+
+local function trace_begin(action, args)
+	args = args or {}
+	args.src = (action.src or "?") .. ":" .. (action.line or 0)
+	core.trace_begin("action", action.type, args)
+end
+
+local function trace_end(action, args)
+	core.trace_end("action", action.type, args)
+end
+
 -- Configuration keys valid for an individual pattern specified to a match
 local match_pattern_valid_cfg = {
 	callback = true,
@@ -27,6 +42,8 @@ local match_pattern_valid_cfg = {
 -- Configuration keys valid for a single match statement
 local match_valid_cfg = {
 	callback = true,
+	lines = true,
+	stream = true,
 	timeout = true,
 }
 
@@ -128,7 +145,29 @@ function MatchContext:process()
 			-- Another action in this context could have swapped out the process
 			-- from underneath us, so pull the buffer at the last possible
 			-- minute.
-			if not current_process:match(action) then
+			if tracing then
+				trace_begin(action, {
+					buffered = #current_process.buffer:contents(),
+				})
+			end
+
+			local matched
+			if tracing then
+				-- A callback may raise, e.g., to exit(), and the end
+				-- of the span still needs to be recorded.
+				local ok, err = pcall(current_process.match,
+				    current_process, action)
+				trace_end(action, { matched = ok and err })
+				if not ok then
+					error(err, 0)
+				end
+
+				matched = err
+			else
+				matched = current_process:match(action)
+			end
+
+			if not matched then
 				self.errors = true
 				return false
 			end
@@ -140,7 +179,24 @@ function MatchContext:process()
 			end
 		else
 			check_prereqs(current_ctx, action)
-			if not action:execute() then
+			if tracing then
+				trace_begin(action)
+			end
+
+			local ret
+			if tracing then
+				local ok, err = pcall(action.execute, action)
+				trace_end(action)
+				if not ok then
+					error(err, 0)
+				end
+
+				ret = err
+			else
+				ret = action:execute()
+			end
+
+			if not ret then
 				return false
 			end
 		end
@@ -152,45 +208,64 @@ function MatchContext:process()
 end
 function MatchContext:process_one()
 	local ctx_actions = self:items()
-	local elapsed = 0
 	local current_process = current_ctx.process
 
 	if not current_process then
 		error("Script did not spawn process prior to matching")
 	end
 
-	-- Return low, high timeout of current batch
-	local function get_timeout()
-		local low
+	-- Each branch's timeout goes into the core's timer heap, and we hand
+	-- the live ones to each refill so that it ends as soon as one of them
+	-- fires.  Expired branches are only weeded out at that point, rather
+	-- than on every refill.
+	local live, all = {}, {}
+	for _, action in ipairs(ctx_actions) do
+		local timer = assert(core.timer(action.timeout))
 
-		for _, action in ipairs(ctx_actions) do
-			if action.timeout <= elapsed then
-				goto skip
-			end
-			if low == nil then
-				low = action.timeout
-				goto skip
-			end
+		live[#live + 1] = { action = action, timer = timer }
+		all[#all + 1] = timer
+	end
+
+	-- Drop the branches that have timed out, and return the time left
+	-- until the soonest of the rest along with their timers, or nil if
+	-- they've all timed out.
+	local function prune()
+		local soonest
+		local timers = {}
+		local i = 1
 
-			low = math.min(low, action.timeout)
+		while live[i] do
+			local timer = live[i].timer
 
-			::skip::
+			if timer:fired() then
+				table.remove(live, i)
+			else
+				local remaining = timer:remaining()
+
+				if not soonest or remaining < soonest then
+					soonest = remaining
+				end
+
+				timers[#timers + 1] = timer
+				i = i + 1
+			end
 		end
-		return low
+
+		return soonest, timers
 	end
 
 	-- The process can't be swapped out by an immediate descendant of a one()
 	-- block, but it could be swapped out by a later block.  We don't care,
 	-- though, because we won't need the buffer anymore.
 	local buffer = current_process.buffer
-
-	local start = core.time()
 	local matched
 
 	local function match_any()
-		local elapsed_now = core.time() - start
-		for _, action in ipairs(ctx_actions) do
-			if action.timeout >= elapsed_now and buffer:_matches(action) then
+		for _, branch in ipairs(live) do
+			local action = branch.action
+			local abuffer = current_process:stream_buffer(action.stream)
+
+			if abuffer:_matches(action) then
 				matched = true
 				return true
 			end
@@ -199,21 +274,33 @@ function MatchContext:process_one()
 		return false
 	end
 
-	local tlo
+	if tracing then
+		core.trace_begin("match", "one", { actions = #ctx_actions })
+	end
 
-	while not matched and not buffer.eof do
-		-- We recalculate every iteration to rule out any actions that have
-		-- timed out.  Anything with a timeout lower than our current will be
-		-- ignored for matching.
-		elapsed = core.time() - start
-		tlo = get_timeout()
+	local function refill_any()
+		while not matched and not buffer.eof do
+			local remaining, timers = prune()
 
-		if tlo == nil then
-			break
+			if not remaining then
+				break
+			end
+
+			buffer:refill(match_any, remaining, timers)
 		end
+	end
 
-		assert(tlo > elapsed)
-		buffer:refill(match_any, tlo - elapsed)
+	-- The timers mustn't be left armed if the refill blows up, and the
+	-- trace still needs its end.
+	local ok, err = pcall(refill_any)
+	for _, timer in ipairs(all) do
+		timer:disarm()
+	end
+	if tracing then
+		core.trace_end("match", "one", { matched = matched or false })
+	end
+	if not ok then
+		error(err, 0)
 	end
 
 	if not matched then
@@ -284,7 +371,14 @@ function script_ctx:reset()
 		assert(self.process:close())
 	end
 
+	if self.remote and self.remote.agent then
+		assert(self.remote.agent:close())
+	end
+
 	self.process = nil
+	self.remote = nil
+	self.replay = nil
+	self.screen = nil
 
 	self.match_ctx_stack:clear()
 	self.match_ctx = nil
@@ -400,7 +494,7 @@ end
 function scripter.env.size(w, h)
 	local current_process = current_ctx.process
 
-	return current_process.term:size(w, h)
+	return current_process:terminal("size"):size(w, h)
 end
 
 function scripter.env.timeout(val)
@@ -462,40 +556,18 @@ local extra_actions = {
 			action.command = args[1]
 			action.collector = args[2]
 			action.termfn = args[3]
+			action.cfg = args[4]
 		end,
 		execute = function(action)
 			-- Note that we don't actually care if the user doesn't
 			-- spawn a process off beforehand; the output is theirs
-			-- to deal with.
-			local inpipe = io.popen(action.command)
-			if not inpipe then
-				error("Failed to popen command '" .. action.command .. "'")
-			end
-
-			-- If there's not a collector, we can just read until
-			-- EOF then close the process out.  Otherwise, we offer
-			-- the caller line-by-line output.
-			if not action.collector then
-				inpipe:read("a")
-				goto eof
-			end
-
-			while true do
-				local line = inpipe:read("L")
-				if not line then
-					break
-				end
-
-				action.collector(line)
-			end
+			-- to deal with.  Without a collector, the output is
+			-- simply discarded until EOF.
+			local wstatus = assert(core.exec(action.command,
+			    action.collector, action.cfg))
 
-			::eof::
-			local _, termstatus, code = inpipe:close()
 			if action.termfn then
-				local wobj = assert(core.wrap_status(termstatus,
-				    code))
-
-				action.termfn(wobj)
+				action.termfn(wstatus)
 			end
 
 			return true
@@ -554,7 +626,7 @@ local extra_actions = {
 						end
 					end
 					if action.matcher.compile then
-						cfg._compiled = action.matcher.compile(pattern)
+						cfg._compiled = action.matcher.compile(pat)
 					end
 				end
 
@@ -573,6 +645,12 @@ local extra_actions = {
 				for k, v in pairs(cfg) do
 					if not match_valid_cfg[k] then
 						error(k .. " is not a valid cfg field")
+					elseif k == "stream" and v ~= "stdout" and
+					    v ~= "stderr" then
+						error("stream must be stdout or stderr")
+					elseif k == "lines" and
+					    type(v) ~= "function" then
+						error("lines must be a function")
 					end
 
 					action[k] = v
@@ -793,6 +871,27 @@ function scripter.run_script(scriptfile, config)
 			host = config.remote["host"],
 			rsh = cmd_split(config.remote["rsh"]),
 		}
+
+		-- With an agent, that's the only thing that goes over the rsh.
+		if config.remote["agent"] then
+			local cmd = {}
+			for _, word in ipairs(current_ctx.remote.rsh) do
+				cmd[#cmd + 1] = word
+			end
+			if current_ctx.remote.host then
+				cmd[#cmd + 1] = current_ctx.remote.host
+			end
+			for _, word in ipairs(cmd_split(config.remote["agent"])) do
+				cmd[#cmd + 1] = word
+			end
+
+			current_ctx.remote.agent = assert(agent.new(cmd))
+		end
+	end
+
+	-- Likewise, any replay has to be setup before we spawn.
+	if config and config.replay then
+		current_ctx.replay = replay.new(config.replay)
 	end
 
 	if config and config.command then
@@ -803,6 +902,14 @@ function scripter.run_script(scriptfile, config)
 		return nil, "script did not define any actions"
 	end
 
+	-- The last process spawned is left running when the script finishes, so
+	-- we need to report its stats on the way out.
+	local function report_stats()
+		if current_ctx.process then
+			current_ctx.process:report_stats()
+		end
+	end
+
 	-- To run the script, we'll grab the back of the context stack and process
 	-- that.
 	while not done do
@@ -813,6 +920,7 @@ function scripter.run_script(scriptfile, config)
 			-- res is an error object
 			if type(res) == "table" and res.type == "exit" then
 				assert(res.code ~= nil, "exit without return value")
+				report_stats()
 
 				if config and config.allow_exit then
 					os.exit(res.code)
@@ -829,10 +937,12 @@ function scripter.run_script(scriptfile, config)
 			current_ctx.match_ctx_stack:remove(run_ctx)
 			done = current_ctx.match_ctx_stack:empty()
 		elseif run_ctx:error() then
+			report_stats()
 			return nil, "match error"
 		end
 	end
 
+	report_stats()
 	return true
 end
 
@@ -4,6 +4,11 @@
  * SPDX-License-Identifier: BSD-2-Clause
  */
 
+#include <err.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -18,9 +23,38 @@
 
 static const char *porch_shortopts = "f:i:hV";
 static const char *porchgen_shortopts = "f:hV";
-static const char *rporch_shortopts = "e:f:i:hV";
+static const char *rporch_shortopts = "ae:f:H:i:o:P:shV";
+
+enum {
+	OPT_AGENT = CHAR_MAX + 1,
+	OPT_BUNDLE,
+	OPT_CPUS,
+	OPT_NICE,
+	OPT_POLICY,
+	OPT_PROFILE,
+	OPT_REPLAY,
+	OPT_REPLAY_INPUT,
+	OPT_REPLAY_TIMING,
+};
+
+static const struct option porch_longopts[] = {
+	{ "agent",		no_argument,		NULL,	OPT_AGENT },
+	{ "bundle",		no_argument,		NULL,	OPT_BUNDLE },
+	{ "cpus",		required_argument,	NULL,	OPT_CPUS },
+	{ "nice",		required_argument,	NULL,	OPT_NICE },
+	{ "policy",		required_argument,	NULL,	OPT_POLICY },
+	{ "profile",		required_argument,	NULL,	OPT_PROFILE },
+	{ "replay",		required_argument,	NULL,	OPT_REPLAY },
+	{ "replay-input",	required_argument,	NULL,	OPT_REPLAY_INPUT },
+	{ "replay-timing",	required_argument,	NULL,	OPT_REPLAY_TIMING },
+	{ NULL,			0,			NULL,	0 },
+};
 
 enum porch_mode porch_mode = PMODE_LOCAL;
+const char *porch_agent_cmd;
+const char *porch_profile;
+const char *porch_replay_input;
+const char *porch_replay_timing;
 const char *porch_rsh;
 
 static void __dead2
@@ -35,15 +69,23 @@ usage(const char *name, int error)
 
 	switch (porch_mode) {
 	case PMODE_REMOTE:
-		fprintf(f, "usage: %s [-e rsh] [-f file] [-i include] [host]\n", name);
+		fprintf(f, "usage: %s [-a] [-e rsh] [-f file] [-i include] "
+		    "[--profile=file] [host]\n"
+		    "       %s [-a | -s] [-e rsh] [-f file] [-H hostsfile] "
+		    "[-i include] [-o logdir]\n"
+		    "              [-P jobs] [host ...]\n"
+		    "       %s -s [-e rsh] [-f file] [-i include] [host]\n",
+		    name, name, name);
 		break;
 	case PMODE_GENERATE:
 		fprintf(f, "usage: %s -f file command [argument ...]\n",
 		    name);
 		break;
 	case PMODE_LOCAL:
-		fprintf(f, "usage: %s [-f file] [-i include] [command [argument ...]]\n",
-		    name);
+		fprintf(f, "usage: %s [-f file] [-i include] [--profile=file] "
+		    "[--replay=transcript] [command [argument ...]]\n"
+		    "       %s --agent\n"
+		    "       %s --bundle\n", name, name, name);
 		break;
 	}
 
@@ -63,7 +105,11 @@ main(int argc, char *argv[])
 	const char *invoke_base, *invoke_path = argv[0];
 	const char *scriptf;
 	const char *shortopts;
+	const char *sched_cpus = NULL, *sched_nice = NULL, *sched_policy = NULL;
+	char *end;
+	long jobs;
 	int ch;
+	bool agent = false, bundle = false, fleet = false;
 
 	if (argc == 0)
 		usage("<empty>", 1);
@@ -82,6 +128,7 @@ main(int argc, char *argv[])
 	switch (porch_mode) {
 	case PMODE_REMOTE:
 		shortopts = rporch_shortopts;
+		scriptf = "-";	/* stdin */
 		break;
 	case PMODE_GENERATE:
 		shortopts = porchgen_shortopts;
@@ -93,21 +140,86 @@ main(int argc, char *argv[])
 		break;
 	}
 
-	while ((ch = getopt(argc, argv, shortopts)) != -1) {
+	while ((ch = getopt_long(argc, argv, shortopts, porch_longopts,
+	    NULL)) != -1) {
 		switch (ch) {
+		case 'a':
+			agent = true;
+			break;
 		case 'e':
 			porch_rsh = optarg;
 			break;
 		case 'f':
 			scriptf = optarg;
 			break;
+		case 'H':
+			porch_fleet_hostfile(optarg);
+			fleet = true;
+			break;
 		case 'i':
 			porch_interp_include(optarg);
 			break;
+		case 'o':
+			porch_fleet_logdir = optarg;
+			fleet = true;
+			break;
+		case 'P':
+			errno = 0;
+			jobs = strtol(optarg, &end, 10);
+			if (errno != 0 || *end != '\0' || jobs < 1 ||
+			    jobs > INT_MAX)
+				usage(invoke_path, 1);
+			porch_fleet_jobs = jobs;
+			fleet = true;
+			break;
+		case 's':
+			bundle = true;
+			break;
 		case 'h':
 			usage(invoke_path, 0);
 		case 'V':
 			version();
+		case OPT_AGENT:
+			if (porch_mode != PMODE_LOCAL)
+				usage(invoke_path, 1);
+			agent = true;
+			break;
+		case OPT_BUNDLE:
+			if (porch_mode != PMODE_LOCAL)
+				usage(invoke_path, 1);
+			bundle = true;
+			break;
+		case OPT_CPUS:
+			sched_cpus = optarg;
+			break;
+		case OPT_NICE:
+			sched_nice = optarg;
+			break;
+		case OPT_POLICY:
+			sched_policy = optarg;
+			break;
+		case OPT_PROFILE:
+			if (porch_mode == PMODE_GENERATE)
+				usage(invoke_path, 1);
+			porch_profile = optarg;
+			break;
+		case OPT_REPLAY:
+			if (porch_mode != PMODE_LOCAL)
+				usage(invoke_path, 1);
+			porch_interp_replay(optarg);
+			break;
+		case OPT_REPLAY_INPUT:
+			if (strcmp(optarg, "check") != 0 &&
+			    strcmp(optarg, "ignore") != 0)
+				usage(invoke_path, 1);
+			porch_replay_input = optarg;
+			break;
+		case OPT_REPLAY_TIMING:
+			if (strcmp(optarg, "compress") != 0 &&
+			    strcmp(optarg, "honor") != 0)
+				usage(invoke_path, 1);
+			porch_replay_timing = optarg;
+			break;
 		default:
 			usage(invoke_path, 1);
 		}
@@ -116,15 +228,29 @@ main(int argc, char *argv[])
 	argc -= optind;
 	argv += optind;
 
+	/*
+	 * Applied to ourselves first thing, so that the agent and everything
+	 * we spawn starts out with them too.
+	 */
+	if ((sched_cpus != NULL || sched_nice != NULL ||
+	    sched_policy != NULL) &&
+	    porch_sched_self(sched_cpus, sched_nice, sched_policy) != 0)
+		err(1, "failed to apply --cpus, --nice or --policy");
+
 	switch (porch_mode) {
 	case PMODE_REMOTE:
 		/*
 		 * May have a host specified to execute the script on.  We
 		 * explicitly allow no host in case the rsh script is designed
 		 * to connect to a single remote host without a host argument.
-		 * We don't allow more than one host.
+		 * More than one host, or any of the fleet options, runs the
+		 * script against each of them in its own process instead.
 		 */
 		if (argc > 1)
+			fleet = true;
+		if (fleet && porch_profile != NULL)
+			usage(invoke_path, 1);
+		if (bundle && (agent || porch_profile != NULL))
 			usage(invoke_path, 1);
 
 		/*
@@ -135,15 +261,55 @@ main(int argc, char *argv[])
 			porch_rsh = getenv("PORCH_RSH");
 		if (porch_rsh == NULL || porch_rsh[0] == '\0')
 			porch_rsh = "ssh";
+
+		/*
+		 * With -a, processes are spawned through one porch --agent on
+		 * the other end rather than an rsh apiece.  PORCH_AGENT can
+		 * point at a porch that isn't in the remote $PATH.
+		 */
+		if (agent) {
+			porch_agent_cmd = getenv("PORCH_AGENT");
+			if (porch_agent_cmd == NULL ||
+			    porch_agent_cmd[0] == '\0')
+				porch_agent_cmd = "porch --agent";
+		}
+
+		/*
+		 * With -s, the whole script goes over to a porch --bundle on
+		 * the other end and runs there instead.
+		 */
+		if (bundle) {
+			porch_bundle_cmd = getenv("PORCH_BUNDLE");
+			if (porch_bundle_cmd == NULL ||
+			    porch_bundle_cmd[0] == '\0')
+				porch_bundle_cmd = "porch --bundle";
+		}
 		break;
 	case PMODE_GENERATE:
 		if (argc == 0 || scriptf == NULL)
 			usage(invoke_path, 1);
 		break;
 	default:
+		if (agent || bundle) {
+			if (agent == bundle || argc != 0 ||
+			    porch_profile != NULL)
+				usage(invoke_path, 1);
+			if (bundle)
+				return (porch_bundle_serve(invoke_path));
+			return (porch_agent());
+		}
 		break;
 	}
 
+	if (fleet) {
+		for (int i = 0; i < argc; i++)
+			porch_fleet_add(argv[i]);
+		return (porch_fleet(scriptf, invoke_path));
+	}
+
+	if (porch_bundle_cmd != NULL)
+		return (porch_bundle_run(scriptf, argc > 0 ? argv[0] : NULL));
+
 	/*
 	 * If we have a command supplied, we'll spawn() it for the script just to
 	 * simplify things.  If we didn't, then the script just needs to make sure
@@ -12,8 +12,31 @@ extern enum porch_mode {
 	PMODE_GENERATE,
 } porch_mode;
 
+extern const char *porch_agent_cmd;
+extern const char *porch_bundle_cmd;
+extern const char *porch_profile;
+extern const char *porch_replay_input;
+extern const char *porch_replay_timing;
 extern const char *porch_rsh;
 
+/* porch_bundle.c */
+int porch_bundle_run(const char *, const char *);
+int porch_bundle_serve(const char *);
+
+/* porch_fleet.c */
+extern const char *porch_fleet_logdir;
+extern int porch_fleet_jobs;
+
+void porch_fleet_add(const char *);
+void porch_fleet_hostfile(const char *);
+int porch_fleet(const char *, const char *);
+
 /* porch_interp.c */
 void porch_interp_include(const char *);
+void porch_interp_foreach_include(void (*)(const char *, void *), void *);
+void porch_interp_replay(const char *);
 int porch_interp(const char *, const char *, int, const char * const []);
+
+/* porch_profile.c */
+void porch_profile_start(lua_State *, const char *);
+void porch_profile_stop(void);
@@ -0,0 +1,783 @@
+/*-
+ * Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "porch.h"
+#include "porch_bin.h"
+
+/*
+ * Script mode for rporch: rather than running the script here and crossing the
+ * network for every match and write, the script and its includes are shipped
+ * over a single rsh to a `porch --bundle` on the other end that runs it next to
+ * the commands it spawns.
+ *
+ * The bundle is plain framing over the rsh's stdin:
+ *
+ *	porch-bundle 1
+ *	S <len> <name>		the script, <len> bytes follow
+ *	I <len> <name>		an include, in the order given to -i
+ *	T			PORCH_TRACE is set here, send a trace back
+ *	E			end of the bundle
+ *
+ * and the reply on its stdout is:
+ *
+ *	O <len>			script stdout, <len> bytes follow
+ *	E <len>			script stderr
+ *	T <len>			a chunk of the trace, once the script is done
+ *	X <status>		the script's exit status, always last
+ *
+ * The rsh's own stderr is left alone, so connection errors still surface.
+ */
+
+#ifndef nitems
+#define	nitems(x)	(sizeof((x)) / sizeof((x)[0]))
+#endif
+
+#define	BUNDLE_MAGIC	"porch-bundle 1"
+#define	BUNDLE_CHUNK	4096
+
+const char *porch_bundle_cmd;
+
+static int
+porch_bundle_write(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t nw;
+
+	while (len > 0) {
+		nw = write(fd, p, len);
+		if (nw == -1) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+
+		p += nw;
+		len -= nw;
+	}
+
+	return (0);
+}
+
+static int
+porch_bundle_frame(int fd, char type, const void *buf, size_t len)
+{
+	char hdr[32];
+	int hlen;
+
+	hlen = snprintf(hdr, sizeof(hdr), "%c %zu\n", type, len);
+	if (porch_bundle_write(fd, hdr, hlen) != 0 ||
+	    porch_bundle_write(fd, buf, len) != 0)
+		return (-1);
+
+	return (0);
+}
+
+static char *
+porch_bundle_slurp(int fd, size_t *lenp)
+{
+	char *buf, *nbuf;
+	size_t len, size;
+	ssize_t nr;
+
+	len = 0;
+	size = BUNDLE_CHUNK;
+	if ((buf = malloc(size)) == NULL)
+		err(1, "malloc");
+
+	for (;;) {
+		if (len == size) {
+			size *= 2;
+			if ((nbuf = realloc(buf, size)) == NULL)
+				err(1, "malloc");
+			buf = nbuf;
+		}
+
+		nr = read(fd, buf + len, size - len);
+		if (nr == -1) {
+			if (errno == EINTR)
+				continue;
+			free(buf);
+			return (NULL);
+		}
+		if (nr == 0)
+			break;
+
+		len += nr;
+	}
+
+	*lenp = len;
+	return (buf);
+}
+
+static int
+porch_bundle_add(int fd, char type, const char *path)
+{
+	const char *name;
+	char *buf;
+	size_t len;
+	int rfd, serr;
+
+	if (strcmp(path, "-") == 0) {
+		rfd = STDIN_FILENO;
+		name = "stdin";
+	} else {
+		if ((rfd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+			warn("%s", path);
+			return (-1);
+		}
+
+		name = strrchr(path, '/');
+		name = name != NULL ? name + 1 : path;
+	}
+
+	buf = porch_bundle_slurp(rfd, &len);
+	serr = errno;
+	if (rfd != STDIN_FILENO)
+		close(rfd);
+	if (buf == NULL) {
+		errno = serr;
+		warn("%s", path);
+		return (-1);
+	}
+
+	if (dprintf(fd, "%c %zu %s\n", type, len, name) < 0 ||
+	    porch_bundle_write(fd, buf, len) != 0) {
+		free(buf);
+		return (-1);
+	}
+
+	free(buf);
+	return (0);
+}
+
+struct porch_bundle_incl {
+	int	fd;
+	int	error;
+};
+
+static void
+porch_bundle_add_include(const char *path, void *cookie)
+{
+	struct porch_bundle_incl *incl = cookie;
+
+	if (incl->error == 0 && porch_bundle_add(incl->fd, 'I', path) != 0)
+		incl->error = -1;
+}
+
+static int
+porch_bundle_send(int fd, const char *scriptf)
+{
+	struct porch_bundle_incl incl = { .fd = fd };
+	const char *trace;
+
+	if (dprintf(fd, "%s\n", BUNDLE_MAGIC) < 0 ||
+	    porch_bundle_add(fd, 'S', scriptf) != 0)
+		return (-1);
+
+	porch_interp_foreach_include(porch_bundle_add_include, &incl);
+	if (incl.error != 0)
+		return (-1);
+
+	trace = getenv("PORCH_TRACE");
+	if (trace != NULL && trace[0] != '\0' && dprintf(fd, "T\n") < 0)
+		return (-1);
+
+	if (dprintf(fd, "E\n") < 0)
+		return (-1);
+
+	return (0);
+}
+
+static void
+porch_bundle_argv_add(char ***argvp, size_t *argcp, const char *word)
+{
+	char **argv;
+
+	argv = realloc(*argvp, (*argcp + 2) * sizeof(*argv));
+	if (argv == NULL || (argv[*argcp] = strdup(word)) == NULL)
+		err(1, "malloc");
+
+	argv[++*argcp] = NULL;
+	*argvp = argv;
+}
+
+/*
+ * Split an rsh string into words the same way that scripter.lua does for
+ * spawning through one: whitespace separates words, outside of a pair of
+ * quotes, and a backslash escapes the next character.
+ */
+static int
+porch_bundle_split(const char *cmd, char ***argvp, size_t *argcp)
+{
+	char *word, *wp;
+	char quote = '\0';
+	bool escaped = false;
+
+	if ((word = malloc(strlen(cmd) + 1)) == NULL)
+		err(1, "malloc");
+
+	wp = word;
+	for (const char *c = cmd;; c++) {
+		if (*c != '\0' && escaped) {
+			*wp++ = *c;
+			escaped = false;
+			continue;
+		} else if (*c == '\\') {
+			escaped = true;
+			continue;
+		} else if (*c == '"' || *c == '\'') {
+			if (quote == '\0')
+				quote = *c;
+			else if (quote == *c)
+				quote = '\0';
+			else
+				*wp++ = *c;
+			continue;
+		} else if (*c != '\0' &&
+		    (quote != '\0' || (*c != ' ' && *c != '\t'))) {
+			*wp++ = *c;
+			continue;
+		}
+
+		if (*c == '\0' && quote != '\0') {
+			warnx("unterminated <%c> in cmd string <%s>", quote,
+			    cmd);
+			free(word);
+			return (-1);
+		}
+
+		if (wp != word) {
+			*wp = '\0';
+			porch_bundle_argv_add(argvp, argcp, word);
+			wp = word;
+		}
+
+		if (*c == '\0')
+			break;
+	}
+
+	free(word);
+	return (0);
+}
+
+static pid_t
+porch_bundle_connect(const char *host, int *infd, int *outfd)
+{
+	char **argv = NULL;
+	size_t argc = 0;
+	pid_t pid;
+	int inpipe[2], outpipe[2];
+
+	if (porch_bundle_split(porch_rsh, &argv, &argc) != 0)
+		return (-1);
+	if (host != NULL && host[0] != '\0')
+		porch_bundle_argv_add(&argv, &argc, host);
+	if (porch_bundle_split(porch_bundle_cmd, &argv, &argc) != 0)
+		return (-1);
+	if (argc == 0) {
+		warnx("empty rsh");
+		return (-1);
+	}
+
+	if (pipe(inpipe) == -1 || pipe(outpipe) == -1)
+		err(1, "pipe");
+
+	fflush(stdout);
+	fflush(stderr);
+
+	pid = fork();
+	if (pid == -1)
+		err(1, "fork");
+	if (pid == 0) {
+		if (dup2(inpipe[0], STDIN_FILENO) == -1 ||
+		    dup2(outpipe[1], STDOUT_FILENO) == -1) {
+			warn("dup2");
+			_exit(1);
+		}
+
+		close(inpipe[0]);
+		close(inpipe[1]);
+		close(outpipe[0]);
+		close(outpipe[1]);
+
+		execvp(argv[0], argv);
+		warn("execvp %s", argv[0]);
+		_exit(1);
+	}
+
+	close(inpipe[0]);
+	close(outpipe[1]);
+
+	for (size_t i = 0; i < argc; i++)
+		free(argv[i]);
+	free(argv);
+
+	*infd = inpipe[1];
+	*outfd = outpipe[0];
+	return (pid);
+}
+
+/*
+ * Unpack the reply from the remote porch.  Returns the script's exit status, or
+ * -1 if the connection went away before we got one.
+ */
+static int
+porch_bundle_recv(int fd)
+{
+	FILE *in, *tracef = NULL;
+	const char *trace;
+	char buf[BUFSIZ];
+	size_t len, nr;
+	int ch, outfd, status = -1;
+
+	if ((in = fdopen(fd, "r")) == NULL)
+		err(1, "fdopen");
+
+	while ((ch = fgetc(in)) != EOF) {
+		if (ch == 'X') {
+			if (fscanf(in, " %d\n", &status) != 1)
+				status = -1;
+			break;
+		}
+
+		if (fscanf(in, " %zu", &len) != 1 || fgetc(in) != '\n') {
+			warnx("malformed reply from the remote porch");
+			break;
+		}
+
+		switch (ch) {
+		case 'O':
+			fflush(stdout);
+			outfd = STDOUT_FILENO;
+			break;
+		case 'E':
+			fflush(stderr);
+			outfd = STDERR_FILENO;
+			break;
+		case 'T':
+			outfd = -1;
+			if (tracef != NULL)
+				break;
+
+			trace = getenv("PORCH_TRACE");
+			if (trace == NULL || trace[0] == '\0')
+				break;
+
+			if ((tracef = fopen(trace, "w")) == NULL)
+				warn("%s", trace);
+			break;
+		default:
+			warnx("malformed reply from the remote porch");
+			goto out;
+		}
+
+		while (len > 0) {
+			nr = fread(buf, 1, MIN(len, sizeof(buf)), in);
+			if (nr == 0)
+				goto out;
+
+			if (outfd != -1)
+				(void)porch_bundle_write(outfd, buf, nr);
+			else if (tracef != NULL)
+				fwrite(buf, 1, nr, tracef);
+			len -= nr;
+		}
+	}
+
+out:
+	if (tracef != NULL)
+		fclose(tracef);
+	fclose(in);
+	return (status);
+}
+
+int
+porch_bundle_run(const char *scriptf, const char *host)
+{
+	pid_t pid;
+	int infd, outfd, rshstatus, status;
+
+	if ((pid = porch_bundle_connect(host, &infd, &outfd)) == -1)
+		return (1);
+
+	/*
+	 * The whole bundle goes over before the other side starts on the
+	 * script, so we won't block on its output while we're writing.  If the
+	 * rsh fails to connect, then its stderr will say why.
+	 */
+	signal(SIGPIPE, SIG_IGN);
+	if (porch_bundle_send(infd, scriptf) != 0 && errno != EPIPE)
+		warn("failed to send the script");
+	close(infd);
+
+	status = porch_bundle_recv(outfd);
+
+	while (waitpid(pid, &rshstatus, 0) == -1) {
+		if (errno != EINTR)
+			err(1, "waitpid");
+	}
+
+	if (status == -1) {
+		warnx("lost connection to the remote porch");
+		return (1);
+	}
+
+	return (status);
+}
+
+/*
+ * The other end, `porch --bundle`.
+ */
+struct porch_bundle_files {
+	char	**paths;
+	size_t	  count;
+};
+
+static void
+porch_bundle_track(struct porch_bundle_files *files, const char *path)
+{
+	char **paths;
+
+	paths = realloc(files->paths, (files->count + 1) * sizeof(*paths));
+	if (paths == NULL || (paths[files->count] = strdup(path)) == NULL)
+		err(1, "malloc");
+
+	files->paths = paths;
+	files->count++;
+}
+
+static void
+porch_bundle_cleanup(struct porch_bundle_files *files)
+{
+
+	/* Unwinds in reverse, so the directories are empty by then. */
+	while (files->count > 0) {
+		files->count--;
+		(void)remove(files->paths[files->count]);
+		free(files->paths[files->count]);
+	}
+
+	free(files->paths);
+	files->paths = NULL;
+}
+
+static int
+porch_bundle_extract(FILE *in, const char *dir, size_t idx, size_t len,
+    const char *name, struct porch_bundle_files *files, char *path,
+    size_t pathsz)
+{
+	char buf[BUFSIZ];
+	size_t nr;
+	int fd;
+
+	if (name[0] == '\0' || strchr(name, '/') != NULL ||
+	    strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+		warnx("bad file name in bundle: '%s'", name);
+		return (-1);
+	}
+
+	/*
+	 * Includes each get a directory of their own, so that they keep their
+	 * names for error messages even if two of them share one.
+	 */
+	if (idx == 0) {
+		snprintf(path, pathsz, "%s/%s", dir, name);
+	} else {
+		snprintf(path, pathsz, "%s/%zu", dir, idx);
+		if (mkdir(path, 0700) == -1) {
+			warn("mkdir %s", path);
+			return (-1);
+		}
+
+		porch_bundle_track(files, path);
+		snprintf(path, pathsz, "%s/%zu/%s", dir, idx, name);
+	}
+
+	fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (fd == -1) {
+		warn("%s", path);
+		return (-1);
+	}
+
+	porch_bundle_track(files, path);
+	while (len > 0) {
+		nr = fread(buf, 1, MIN(len, sizeof(buf)), in);
+		if (nr == 0) {
+			warnx("truncated bundle");
+			close(fd);
+			return (-1);
+		}
+
+		if (porch_bundle_write(fd, buf, nr) != 0) {
+			warn("write %s", path);
+			close(fd);
+			return (-1);
+		}
+
+		len -= nr;
+	}
+
+	close(fd);
+	return (0);
+}
+
+static pid_t
+porch_bundle_start(const char *scriptf, const char *tracef,
+    const char *invoke_path, int *outfd, int *errfd)
+{
+	pid_t pid;
+	int nullfd, outpipe[2], errpipe[2];
+
+	if (pipe(outpipe) == -1 || pipe(errpipe) == -1)
+		err(1, "pipe");
+
+	fflush(stdout);
+	fflush(stderr);
+
+	pid = fork();
+	if (pid == -1)
+		err(1, "fork");
+	if (pid != 0) {
+		close(outpipe[1]);
+		close(errpipe[1]);
+		*outfd = outpipe[0];
+		*errfd = errpipe[0];
+		return (pid);
+	}
+
+	if ((nullfd = open("/dev/null", O_RDONLY)) == -1) {
+		warn("/dev/null");
+		_exit(1);
+	}
+
+	if (dup2(nullfd, STDIN_FILENO) == -1 ||
+	    dup2(outpipe[1], STDOUT_FILENO) == -1 ||
+	    dup2(errpipe[1], STDERR_FILENO) == -1) {
+		warn("dup2");
+		_exit(1);
+	}
+
+	close(nullfd);
+	close(outpipe[0]);
+	close(outpipe[1]);
+	close(errpipe[0]);
+	close(errpipe[1]);
+
+	/* Script output should trickle back as it would to a terminal. */
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	if (tracef != NULL)
+		setenv("PORCH_TRACE", tracef, 1);
+	else
+		unsetenv("PORCH_TRACE");
+
+	/* exit(), not _exit(), so that stdio and the trace get flushed. */
+	exit(porch_interp(scriptf, invoke_path, 0, NULL));
+}
+
+static int
+porch_bundle_relay(int outfd, int errfd)
+{
+	struct pollfd pfd[2];
+	char buf[BUNDLE_CHUNK];
+	ssize_t nr;
+	int nopen = 2;
+
+	pfd[0].fd = outfd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = errfd;
+	pfd[1].events = POLLIN;
+
+	while (nopen > 0) {
+		if (poll(pfd, nitems(pfd), -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			err(1, "poll");
+		}
+
+		for (size_t i = 0; i < nitems(pfd); i++) {
+			if (pfd[i].fd == -1 || pfd[i].revents == 0)
+				continue;
+
+			nr = read(pfd[i].fd, buf, sizeof(buf));
+			if (nr == -1 && errno == EINTR)
+				continue;
+			if (nr <= 0) {
+				close(pfd[i].fd);
+				pfd[i].fd = -1;
+				nopen--;
+				continue;
+			}
+
+			if (porch_bundle_frame(STDOUT_FILENO, i == 0 ? 'O' : 'E',
+			    buf, nr) != 0)
+				return (-1);
+		}
+	}
+
+	return (0);
+}
+
+static void
+porch_bundle_send_trace(const char *tracef)
+{
+	char buf[BUNDLE_CHUNK];
+	ssize_t nr;
+	int fd;
+
+	if ((fd = open(tracef, O_RDONLY | O_CLOEXEC)) == -1)
+		return;
+
+	while ((nr = read(fd, buf, sizeof(buf))) != 0) {
+		if (nr == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (porch_bundle_frame(STDOUT_FILENO, 'T', buf, nr) != 0)
+			break;
+	}
+
+	close(fd);
+}
+
+int
+porch_bundle_serve(const char *invoke_path)
+{
+	struct porch_bundle_files files = { 0 };
+	char dir[MAXPATHLEN], path[MAXPATHLEN], scriptf[MAXPATHLEN];
+	char tracef[MAXPATHLEN];
+	char *end, *line = NULL, *name;
+	const char *tmpdir;
+	size_t idx, len, linesz = 0;
+	pid_t pid;
+	int errfd, outfd, status, wstatus;
+	bool have_script = false, trace = false;
+
+	if (isatty(STDIN_FILENO))
+		errx(1, "--bundle is for rporch, not interactive use");
+
+	/* Nothing should be coming in on stdin once the bundle is read. */
+	signal(SIGPIPE, SIG_IGN);
+
+	tmpdir = getenv("TMPDIR");
+	if (tmpdir == NULL || tmpdir[0] == '\0')
+		tmpdir = "/tmp";
+
+	snprintf(dir, sizeof(dir), "%s/porch.XXXXXX", tmpdir);
+	if (mkdtemp(dir) == NULL)
+		err(1, "mkdtemp");
+	porch_bundle_track(&files, dir);
+
+	status = 1;
+	if (getline(&line, &linesz, stdin) == -1 ||
+	    strcmp(line, BUNDLE_MAGIC "\n") != 0) {
+		warnx("not a porch bundle");
+		goto out;
+	}
+
+	idx = 0;
+	for (;;) {
+		if (getline(&line, &linesz, stdin) == -1) {
+			warnx("truncated bundle");
+			goto out;
+		}
+
+		if (strcmp(line, "E\n") == 0)
+			break;
+		if (strcmp(line, "T\n") == 0) {
+			trace = true;
+			continue;
+		}
+
+		errno = 0;
+		if ((line[0] != 'S' && line[0] != 'I') || line[1] != ' ' ||
+		    (len = strtoul(&line[2], &end, 10), errno != 0) ||
+		    end == &line[2] || *end != ' ') {
+			warnx("malformed bundle");
+			goto out;
+		}
+
+		name = end + 1;
+		name[strcspn(name, "\n")] = '\0';
+
+		if (line[0] == 'S') {
+			if (have_script) {
+				warnx("malformed bundle");
+				goto out;
+			}
+
+			if (porch_bundle_extract(stdin, dir, 0, len, name,
+			    &files, scriptf, sizeof(scriptf)) != 0)
+				goto out;
+			have_script = true;
+		} else {
+			if (porch_bundle_extract(stdin, dir, ++idx, len, name,
+			    &files, path, sizeof(path)) != 0)
+				goto out;
+
+			/*
+			 * The interp only hangs onto the pointer, and the one
+			 * we just tracked lives until we clean up.
+			 */
+			porch_interp_include(files.paths[files.count - 1]);
+		}
+	}
+
+	if (!have_script) {
+		warnx("bundle is missing a script");
+		goto out;
+	}
+
+	if (trace) {
+		strlcpy(tracef, dir, sizeof(tracef));
+		strlcat(tracef, "/trace.json", sizeof(tracef));
+		porch_bundle_track(&files, tracef);
+	}
+
+	pid = porch_bundle_start(scriptf, trace ? tracef : NULL, invoke_path,
+	    &outfd, &errfd);
+	if (porch_bundle_relay(outfd, errfd) != 0) {
+		/* rporch went away; nobody is left to report to. */
+		kill(pid, SIGTERM);
+	}
+
+	while (waitpid(pid, &wstatus, 0) == -1) {
+		if (errno != EINTR)
+			err(1, "waitpid");
+	}
+
+	if (WIFEXITED(wstatus))
+		status = WEXITSTATUS(wstatus);
+	else
+		status = 128 + WTERMSIG(wstatus);
+
+	if (trace)
+		porch_bundle_send_trace(tracef);
+
+	dprintf(STDOUT_FILENO, "X %d\n", status);
+
+out:
+	free(line);
+	porch_bundle_cleanup(&files);
+	return (status);
+}
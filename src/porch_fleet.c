@@ -0,0 +1,360 @@
+/*-
+ * Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sys/param.h>
+#include <sys/wait.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "porch.h"
+#include "porch_bin.h"
+
+/*
+ * Fleet mode for rporch: the same script is run against each host in its own
+ * porch process, forked off from here before any lua state exists, with up to
+ * porch_fleet_jobs of them running at once.  Each one's stdout and stderr go to
+ * a log named for the host, and we write a summary line per host as they
+ * finish.
+ */
+
+struct porch_fleet_host {
+	const char	*host;
+	pid_t		 pid;
+	int		 status;
+	struct timespec	 start;
+	double		 elapsed;
+	bool		 owned;		/* host was allocated by us */
+};
+
+static struct porch_fleet_host *porch_fleet_hosts;
+static size_t porch_fleet_count;
+
+const char *porch_fleet_logdir;
+int porch_fleet_jobs;
+
+static void
+porch_fleet_append(const char *host, bool owned)
+{
+	struct porch_fleet_host *hosts;
+
+	hosts = realloc(porch_fleet_hosts,
+	    (porch_fleet_count + 1) * sizeof(*hosts));
+	if (hosts == NULL)
+		err(1, "malloc");
+
+	memset(&hosts[porch_fleet_count], 0, sizeof(*hosts));
+	hosts[porch_fleet_count].host = host;
+	hosts[porch_fleet_count++].owned = owned;
+	porch_fleet_hosts = hosts;
+}
+
+/*
+ * `host` is borrowed, e.g., from argv, and must outlive the fleet run.
+ */
+void
+porch_fleet_add(const char *host)
+{
+
+	porch_fleet_append(host, false);
+}
+
+/*
+ * One host per line; blank lines and anything after a # are ignored, as is
+ * surrounding whitespace.
+ */
+void
+porch_fleet_hostfile(const char *path)
+{
+	FILE *fp;
+	char *host, *line, *p;
+	size_t linesz;
+
+	if (strcmp(path, "-") == 0)
+		fp = stdin;
+	else if ((fp = fopen(path, "r")) == NULL)
+		err(1, "%s", path);
+
+	line = NULL;
+	linesz = 0;
+	while (getline(&line, &linesz, fp) != -1) {
+		if ((p = strchr(line, '#')) != NULL)
+			*p = '\0';
+
+		host = line + strspn(line, " \t");
+		host[strcspn(host, " \t\r\n")] = '\0';
+		if (*host == '\0')
+			continue;
+
+		if ((host = strdup(host)) == NULL)
+			err(1, "strdup");
+		porch_fleet_append(host, true);
+	}
+
+	if (ferror(fp))
+		err(1, "%s", path);
+
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+}
+
+/*
+ * Every host runs the script, so one coming in on stdin has to be stashed away
+ * first.  The copy is unlinked once we're done.
+ */
+static char *
+porch_fleet_stash_script(void)
+{
+	static char path[MAXPATHLEN];
+	const char *tmpdir;
+	char buf[BUFSIZ];
+	ssize_t nr;
+	int fd;
+
+	tmpdir = getenv("TMPDIR");
+	if (tmpdir == NULL || tmpdir[0] == '\0')
+		tmpdir = "/tmp";
+
+	snprintf(path, sizeof(path), "%s/rporch.XXXXXX", tmpdir);
+	if ((fd = mkstemp(path)) == -1)
+		err(1, "mkstemp");
+
+	while ((nr = read(STDIN_FILENO, buf, sizeof(buf))) != 0) {
+		if (nr == -1) {
+			if (errno == EINTR)
+				continue;
+			unlink(path);
+			err(1, "read");
+		}
+
+		if (write(fd, buf, nr) != nr) {
+			unlink(path);
+			err(1, "write %s", path);
+		}
+	}
+
+	close(fd);
+	return (path);
+}
+
+/*
+ * Build the path of a per-host file in the log directory, named for the host
+ * with `suffix` tacked on.
+ */
+static int
+porch_fleet_path(char *path, size_t pathsz, const char *host,
+    const char *suffix)
+{
+	char *p;
+	int len;
+
+	len = snprintf(path, pathsz, "%s/%s%s",
+	    porch_fleet_logdir != NULL ? porch_fleet_logdir : ".", host,
+	    suffix);
+	if (len < 0 || (size_t)len >= pathsz) {
+		errno = ENAMETOOLONG;
+		return (-1);
+	}
+
+	/* Hosts may be paths for some rsh, but the log can't be. */
+	p = path + len - strlen(host) - strlen(suffix);
+	for (; *p != '\0'; p++) {
+		if (*p == '/')
+			*p = '_';
+	}
+
+	return (0);
+}
+
+static int
+porch_fleet_logfile(const char *host)
+{
+	char path[MAXPATHLEN];
+
+	if (porch_fleet_path(path, sizeof(path), host, ".log") != 0)
+		return (-1);
+
+	return (open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+}
+
+/*
+ * Every host would otherwise write its trace over the others', so each one gets
+ * its own next to its log.
+ */
+static int
+porch_fleet_tracefile(const char *host)
+{
+	char path[MAXPATHLEN];
+	const char *trace;
+
+	trace = getenv("PORCH_TRACE");
+	if (trace == NULL || trace[0] == '\0')
+		return (0);
+
+	if (porch_fleet_path(path, sizeof(path), host, ".trace.json") != 0)
+		return (-1);
+
+	return (setenv("PORCH_TRACE", path, 1));
+}
+
+static void
+porch_fleet_start(struct porch_fleet_host *fhost, const char *scriptf,
+    const char *invoke_path)
+{
+	const char *argv[1] = { fhost->host };
+	int fd, nullfd;
+
+	clock_gettime(CLOCK_MONOTONIC, &fhost->start);
+
+	/* Don't let the children inherit anything we haven't written yet. */
+	fflush(stdout);
+	fflush(stderr);
+
+	fhost->pid = fork();
+	if (fhost->pid == -1)
+		err(1, "fork");
+	if (fhost->pid != 0)
+		return;
+
+	if ((fd = porch_fleet_logfile(fhost->host)) == -1) {
+		warn("%s: log", fhost->host);
+		_exit(1);
+	}
+
+	if (porch_fleet_tracefile(fhost->host) != 0) {
+		warn("%s: trace", fhost->host);
+		_exit(1);
+	}
+
+	if ((nullfd = open("/dev/null", O_RDONLY)) == -1) {
+		warn("/dev/null");
+		_exit(1);
+	}
+
+	if (dup2(nullfd, STDIN_FILENO) == -1 ||
+	    dup2(fd, STDOUT_FILENO) == -1 ||
+	    dup2(fd, STDERR_FILENO) == -1) {
+		warn("dup2");
+		_exit(1);
+	}
+
+	close(nullfd);
+	close(fd);
+
+	/* exit(), not _exit(), so that stdio gets flushed to the log. */
+	if (porch_bundle_cmd != NULL)
+		exit(porch_bundle_run(scriptf, fhost->host));
+	exit(porch_interp(scriptf, invoke_path, 1, argv));
+}
+
+static struct porch_fleet_host *
+porch_fleet_reap(void)
+{
+	struct porch_fleet_host *fhost;
+	struct timespec now;
+	pid_t pid;
+	int status;
+
+	while ((pid = waitpid(-1, &status, 0)) == -1) {
+		if (errno != EINTR)
+			err(1, "waitpid");
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (size_t i = 0; i < porch_fleet_count; i++) {
+		fhost = &porch_fleet_hosts[i];
+		if (fhost->pid != pid)
+			continue;
+
+		fhost->pid = 0;
+		fhost->status = status;
+		fhost->elapsed = (now.tv_sec - fhost->start.tv_sec) +
+		    (now.tv_nsec - fhost->start.tv_nsec) / 1e9;
+		return (fhost);
+	}
+
+	/* Not one of ours; nothing else should be forking in here. */
+	return (NULL);
+}
+
+static bool
+porch_fleet_report(const struct porch_fleet_host *fhost)
+{
+	int status = fhost->status;
+
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+		printf("%s: ok (%.2fs)\n", fhost->host, fhost->elapsed);
+		return (true);
+	}
+
+	if (WIFSIGNALED(status)) {
+		printf("%s: failed, signal %d (%.2fs)\n", fhost->host,
+		    WTERMSIG(status), fhost->elapsed);
+	} else {
+		printf("%s: failed, exit %d (%.2fs)\n", fhost->host,
+		    WEXITSTATUS(status), fhost->elapsed);
+	}
+
+	return (false);
+}
+
+int
+porch_fleet(const char *scriptf, const char *invoke_path)
+{
+	struct porch_fleet_host *fhost;
+	char *stashed = NULL;
+	size_t failed, next, running;
+	int jobs;
+
+	if (porch_fleet_count == 0)
+		errx(1, "no hosts to run against");
+
+	if (strcmp(scriptf, "-") == 0)
+		scriptf = stashed = porch_fleet_stash_script();
+
+	jobs = porch_fleet_jobs > 0 ? porch_fleet_jobs : 1;
+	failed = next = running = 0;
+	while (next < porch_fleet_count || running > 0) {
+		while (next < porch_fleet_count && running < (size_t)jobs) {
+			porch_fleet_start(&porch_fleet_hosts[next++], scriptf,
+			    invoke_path);
+			running++;
+		}
+
+		if ((fhost = porch_fleet_reap()) == NULL)
+			continue;
+
+		running--;
+		if (!porch_fleet_report(fhost))
+			failed++;
+		fflush(stdout);
+	}
+
+	printf("%zu hosts: %zu ok, %zu failed\n", porch_fleet_count,
+	    porch_fleet_count - failed, failed);
+
+	if (stashed != NULL)
+		unlink(stashed);
+
+	for (size_t i = 0; i < porch_fleet_count; i++) {
+		if (porch_fleet_hosts[i].owned)
+			free((void *)(uintptr_t)porch_fleet_hosts[i].host);
+	}
+	free(porch_fleet_hosts);
+	porch_fleet_hosts = NULL;
+	porch_fleet_count = 0;
+
+	return (failed == 0 ? 0 : 1);
+}
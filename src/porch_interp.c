@@ -25,6 +25,9 @@ static struct porch_incl {
 } *porch_incl_head, *porch_incl_last;
 static size_t porch_incl_count = 0;
 
+static const char **porch_replay_files;
+static size_t porch_replay_count;
+
 static const char *
 porch_interp_script(const char *porch_invoke_path)
 {
@@ -130,6 +133,61 @@ porch_interp_include(const char *scriptf)
 	porch_incl_count++;
 }
 
+/*
+ * rporch -s ships the includes off to the remote porch rather than loading
+ * them here.
+ */
+void
+porch_interp_foreach_include(void (*cb)(const char *, void *), void *cookie)
+{
+
+	for (struct porch_incl *walker = porch_incl_head; walker != NULL;
+	    walker = walker->incl_next)
+		cb(walker->incl_path, cookie);
+}
+
+void
+porch_interp_replay(const char *transcript)
+{
+	const char **files;
+
+	files = realloc(porch_replay_files,
+	    (porch_replay_count + 1) * sizeof(*files));
+	if (files == NULL)
+		err(1, "malloc");
+
+	files[porch_replay_count++] = transcript;
+	porch_replay_files = files;
+}
+
+static void
+porch_interp_replay_table(lua_State *L)
+{
+
+	lua_createtable(L, 0, 3);
+
+	lua_createtable(L, porch_replay_count, 0);
+	for (size_t i = 0; i < porch_replay_count; i++) {
+		lua_pushstring(L, porch_replay_files[i]);
+		lua_rawseti(L, -2, i + 1);
+	}
+	lua_setfield(L, -2, "files");
+
+	if (porch_replay_input != NULL) {
+		lua_pushstring(L, porch_replay_input);
+		lua_setfield(L, -2, "input");
+	}
+
+	if (porch_replay_timing != NULL) {
+		lua_pushstring(L, porch_replay_timing);
+		lua_setfield(L, -2, "timing");
+	}
+
+	free(porch_replay_files);
+	porch_replay_files = NULL;
+	porch_replay_count = 0;
+}
+
 static void
 porch_interp_include_table(lua_State *L)
 {
@@ -211,10 +269,16 @@ porch_interp(const char *scriptf, const char *porch_invoke_path,
 			lua_setfield(L, -2, "includes");
 		}
 
+		if (porch_replay_count > 0) {
+			/* config.replay */
+			porch_interp_replay_table(L);
+			lua_setfield(L, -2, "replay");
+		}
+
 		switch (porch_mode) {
 		case PMODE_REMOTE:
 			/* config.remote */
-			lua_createtable(L, 0, 2);
+			lua_createtable(L, 0, 3);
 
 			if (argc == 1 && argv[0][0] != '\0') {
 				/* config.remote[host] */
@@ -226,6 +290,12 @@ porch_interp(const char *scriptf, const char *porch_invoke_path,
 			lua_pushstring(L, porch_rsh);
 			lua_setfield(L, -2, "rsh");
 
+			if (porch_agent_cmd != NULL) {
+				/* config.remote[agent] */
+				lua_pushstring(L, porch_agent_cmd);
+				lua_setfield(L, -2, "agent");
+			}
+
 			lua_setfield(L, -2, "remote");
 			break;
 		case PMODE_GENERATE:
@@ -244,10 +314,16 @@ porch_interp(const char *scriptf, const char *porch_invoke_path,
 			break;
 		}
 
+		if (porch_profile != NULL)
+			porch_profile_start(L, porch_profile);
+
 		if (lua_pcall(L, nargs, 2, 0) == LUA_OK && !lua_isnil(L, -2))
 			status = lua_toboolean(L, -2) ? 0 : 1;
 		else
 			status = porch_interp_error(L);
+
+		if (porch_profile != NULL)
+			porch_profile_stop();
 	}
 
 	lua_close(L);
@@ -0,0 +1,259 @@
+/*-
+ * Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sys/time.h>
+
+#include <err.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "porch.h"
+#include "porch_bin.h"
+
+#include <lauxlib.h>
+
+/*
+ * Sampling profiler for scripts, enabled with --profile.  A SIGPROF timer ticks
+ * over the CPU time that we consume, and each tick arms a one-shot hook that
+ * records the Lua stack at the next hook event before disarming itself again.
+ * The cost is thus bounded by the sampling rate rather than by how much Lua we
+ * end up running, and nothing at all is paid between samples.
+ *
+ * If the tick landed while we were in a C function, e.g., the core's read loop,
+ * the next hook event will be that function calling back into Lua or returning
+ * to its caller.  We can spot both of those, and we flag the sample with a
+ * synthetic [C] leaf frame so that time spent in the core stands out.
+ *
+ * The output is in the folded stack format that flamegraph.pl and most other
+ * flame graph tools accept: one line per unique stack, frames from the root to
+ * the leaf separated by semicolons, and the number of samples at the end.
+ */
+
+#define	PROFILE_INTERVAL_US	1000
+#define	PROFILE_BUCKETS		1024
+#define	PROFILE_MAXDEPTH	64
+#define	PROFILE_MAXSTACK	4096
+
+struct porch_profile_stack {
+	char				*stack;
+	unsigned long			 count;
+	struct porch_profile_stack	*next;
+};
+
+static struct porch_profile_stack *porch_profile_buckets[PROFILE_BUCKETS];
+static lua_State *porch_profile_L;
+static FILE *porch_profile_file;
+static pid_t porch_profile_pid;
+static volatile sig_atomic_t porch_profile_ticks;
+
+static uint32_t
+porch_profile_hash(const char *str)
+{
+	uint32_t hash = 2166136261U;
+
+	for (; *str != '\0'; str++) {
+		hash ^= (unsigned char)*str;
+		hash *= 16777619U;
+	}
+
+	return (hash);
+}
+
+static void
+porch_profile_record(const char *stack, unsigned long count)
+{
+	struct porch_profile_stack *ent;
+	uint32_t bucket;
+
+	bucket = porch_profile_hash(stack) % PROFILE_BUCKETS;
+	for (ent = porch_profile_buckets[bucket]; ent != NULL; ent = ent->next) {
+		if (strcmp(ent->stack, stack) == 0) {
+			ent->count += count;
+			return;
+		}
+	}
+
+	ent = malloc(sizeof(*ent));
+	if (ent == NULL)
+		return;
+	ent->stack = strdup(stack);
+	if (ent->stack == NULL) {
+		free(ent);
+		return;
+	}
+
+	ent->count = count;
+	ent->next = porch_profile_buckets[bucket];
+	porch_profile_buckets[bucket] = ent;
+}
+
+/*
+ * Append a frame to `buf`, sanitized so that it can't be confused with the
+ * separators in the folded format.
+ */
+static size_t
+porch_profile_frame(char *buf, size_t bufsz, size_t off, lua_Debug *ar)
+{
+	char frame[256];
+	const char *name;
+	int len;
+
+	name = ar->name;
+	if (name == NULL)
+		name = (strcmp(ar->what, "main") == 0) ? "main" : "?";
+
+	if (strcmp(ar->what, "C") == 0)
+		len = snprintf(frame, sizeof(frame), "%s [C]", name);
+	else
+		len = snprintf(frame, sizeof(frame), "%s (%s:%d)", name,
+		    ar->short_src, ar->linedefined);
+	if (len < 0)
+		return (off);
+
+	for (char *c = frame; *c != '\0'; c++) {
+		if (*c == ';' || *c == '\n')
+			*c = '_';
+	}
+
+	if (off != 0 && off < bufsz - 1)
+		buf[off++] = ';';
+	return (off + strlcpy(&buf[off], frame, bufsz - off));
+}
+
+static void
+porch_profile_hook(lua_State *L, lua_Debug *ar)
+{
+	lua_Debug frames[PROFILE_MAXDEPTH];
+	char stack[PROFILE_MAXSTACK];
+	unsigned long count;
+	size_t off;
+	int depth, level;
+	bool in_c;
+
+	lua_sethook(L, NULL, 0, 0);
+
+	count = porch_profile_ticks;
+	porch_profile_ticks = 0;
+	if (count == 0)
+		count = 1;
+
+	/*
+	 * A call event means that the tick landed in the caller, while a return
+	 * event may have caught a C function on its way out.
+	 */
+	level = 0;
+	in_c = false;
+	if (ar->event == LUA_HOOKCALL || ar->event == LUA_HOOKTAILCALL) {
+		if (lua_getstack(L, 1, &frames[0]))
+			level = 1;
+	}
+
+	for (depth = 0; depth < PROFILE_MAXDEPTH; depth++) {
+		if (!lua_getstack(L, level + depth, &frames[depth]))
+			break;
+		lua_getinfo(L, "Sn", &frames[depth]);
+	}
+
+	if (depth == 0)
+		return;
+	if (ar->event != LUA_HOOKCOUNT && ar->event != LUA_HOOKLINE)
+		in_c = strcmp(frames[0].what, "C") == 0;
+
+	off = 0;
+	stack[0] = '\0';
+	for (int i = depth - 1; i >= 0 && off < sizeof(stack) - 1; i--)
+		off = porch_profile_frame(stack, sizeof(stack), off, &frames[i]);
+	if (in_c && off < sizeof(stack) - 1)
+		strlcat(stack, ";[C]", sizeof(stack));
+
+	porch_profile_record(stack, count);
+}
+
+static void
+porch_profile_tick(int signo __unused)
+{
+
+	if (porch_profile_L == NULL)
+		return;
+
+	/*
+	 * lua_sethook() is explicitly safe to call from a signal handler; the
+	 * hook fires at the next call, return or instruction.
+	 */
+	porch_profile_ticks++;
+	lua_sethook(porch_profile_L, porch_profile_hook,
+	    LUA_MASKCALL | LUA_MASKRET | LUA_MASKCOUNT, 1);
+}
+
+void
+porch_profile_start(lua_State *L, const char *path)
+{
+	struct sigaction sa = {
+		.sa_handler = porch_profile_tick,
+		.sa_flags = SA_RESTART,
+	};
+	struct itimerval itv;
+
+	porch_profile_file = fopen(path, "w");
+	if (porch_profile_file == NULL)
+		err(1, "%s", path);
+
+	porch_profile_L = L;
+	porch_profile_pid = getpid();
+	atexit(porch_profile_stop);
+
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGPROF, &sa, NULL) != 0)
+		err(1, "sigaction");
+
+	itv.it_interval.tv_sec = 0;
+	itv.it_interval.tv_usec = PROFILE_INTERVAL_US;
+	itv.it_value = itv.it_interval;
+	if (setitimer(ITIMER_PROF, &itv, NULL) != 0)
+		err(1, "setitimer");
+}
+
+void
+porch_profile_stop(void)
+{
+	struct itimerval itv = { 0 };
+	struct porch_profile_stack *ent, *next;
+
+	/*
+	 * We may get here either through porch_interp() or at exit if the script
+	 * called exit(); we only want to write the profile out once, and never
+	 * from a child that we forked.
+	 */
+	if (porch_profile_file == NULL || getpid() != porch_profile_pid)
+		return;
+
+	setitimer(ITIMER_PROF, &itv, NULL);
+	signal(SIGPROF, SIG_DFL);
+
+	lua_sethook(porch_profile_L, NULL, 0, 0);
+	porch_profile_L = NULL;
+
+	for (size_t i = 0; i < PROFILE_BUCKETS; i++) {
+		for (ent = porch_profile_buckets[i]; ent != NULL; ent = next) {
+			next = ent->next;
+
+			fprintf(porch_profile_file, "%s %lu\n", ent->stack,
+			    ent->count);
+			free(ent->stack);
+			free(ent);
+		}
+
+		porch_profile_buckets[i] = NULL;
+	}
+
+	fclose(porch_profile_file);
+	porch_profile_file = NULL;
+}
@@ -0,0 +1,89 @@
+#!/bin/sh
+#
+# Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+#
+# SPDX-License-Identifier: BSD-2-Clause
+#
+
+scriptdir=$(dirname $(realpath "$0"))
+if [ -n "$PORCHBIN" ]; then
+	porchbin="$PORCHBIN"
+else
+	porchbin="$scriptdir/../src/porch"
+	if [ ! -x "$porchbin" ]; then
+		porchbin="$(which porch)"
+	fi
+fi
+if [ ! -x "$porchbin" ]; then
+	1>&2 echo "Failed to find a usable porch binary"
+	exit 1
+fi
+
+rporchbin="$(dirname "$porchbin")/rporch"
+
+if [ -n "$PORCHLUA_PATH" ]; then
+	cd "$PORCHLUA_PATH"
+fi
+
+# Some of the tests we borrow from basic_test.sh look for this.
+export PORCHTESTS=yes
+
+# These work the same through an agent as they do locally.
+borrowed="one_timeout resize_basic spawn_chdir spawn_env_clear_local_basic
+    spawn_env_set_local spawn_multi spawn_quiet spawn_signal"
+
+fails=0
+testid=1
+
+echo "1..$((2 + $(echo $borrowed | wc -w)))"
+
+ok()
+{
+	local f="$1"
+
+	echo "ok $testid - $f"
+	testid=$((testid + 1))
+}
+
+not_ok()
+{
+	local f="$1"
+	local msg="$2"
+
+	fails=$((fails + 1))
+	echo "not ok $testid - $f: $msg"
+	testid=$((testid + 1))
+}
+
+# A local stand-in for ssh that logs every connection it makes.
+countf=$(mktemp)
+rsh="sh -c 'echo \"\$*\" >> \"$countf\"; exec \"\$@\"' rsh"
+
+export PORCH_AGENT="$porchbin --agent"
+
+# Check: several processes, their output, exit statuses and signals.
+if ! "$rporchbin" -a -e "$rsh" -f "$scriptdir"/agent_basic.orch; then
+	not_ok "agent_basic" "rporch failed"
+else
+	ok "agent_basic"
+fi
+
+# Check: ... and the rsh was only needed once, to start the agent.
+if [ $(wc -l < "$countf") -ne 1 ] ||
+    ! grep -q -- "--agent" "$countf"; then
+	cat "$countf" 1>&2
+	not_ok "agent_connections" "expected a single rsh for the agent"
+else
+	ok "agent_connections"
+fi
+
+for t in $borrowed; do
+	if ! "$rporchbin" -a -e "$rsh" -f "$scriptdir"/"$t".orch > /dev/null; then
+		not_ok "agent_$t" "rporch failed"
+	else
+		ok "agent_$t"
+	fi
+done
+
+rm -f "$countf"
+exit "$fails"
@@ -45,7 +45,7 @@ tfilter() {
 		testname=$(basename "$testf" .orch)
 
 		case "$testname" in
-		include_*)
+		agent_*|bundle_*|fleet_*|include_*|profile_*|sched_*|trace_*)
 			# Ignored
 			;;
 		*)
@@ -0,0 +1,119 @@
+#!/bin/sh
+#
+# Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+#
+# SPDX-License-Identifier: BSD-2-Clause
+#
+
+scriptdir=$(dirname $(realpath "$0"))
+if [ -n "$PORCHBIN" ]; then
+	porchbin="$PORCHBIN"
+else
+	porchbin="$scriptdir/../src/porch"
+	if [ ! -x "$porchbin" ]; then
+		porchbin="$(which porch)"
+	fi
+fi
+if [ ! -x "$porchbin" ]; then
+	1>&2 echo "Failed to find a usable porch binary"
+	exit 1
+fi
+
+rporchbin="$(dirname "$porchbin")/rporch"
+
+if [ -n "$PORCHLUA_PATH" ]; then
+	cd "$PORCHLUA_PATH"
+fi
+
+fails=0
+testid=1
+
+echo "1..6"
+
+ok()
+{
+	local f="$1"
+
+	echo "ok $testid - $f"
+	testid=$((testid + 1))
+}
+
+not_ok()
+{
+	local f="$1"
+	local msg="$2"
+
+	fails=$((fails + 1))
+	echo "not ok $testid - $f: $msg"
+	testid=$((testid + 1))
+}
+
+# A local stand-in for ssh that logs every connection it makes.
+tmpdir=$(mktemp -d)
+countf="$tmpdir/count"
+rsh="sh -c 'echo \"\$*\" >> \"$countf\"; exec \"\$@\"' rsh"
+
+export PORCH_BUNDLE="$porchbin --bundle"
+
+# Check: the script and its include both make it over.
+if ! "$rporchbin" -s -e "$rsh" -f "$scriptdir"/include_basic.orch \
+    -i "$scriptdir"/include_globals.lua; then
+	not_ok "bundle_include" "rporch failed"
+else
+	ok "bundle_include"
+fi
+
+# Check: a script that spawns more than one process, coming in on stdin ...
+if ! "$rporchbin" -s -e "$rsh" < "$scriptdir"/spawn_multi.orch; then
+	not_ok "bundle_multi" "rporch failed"
+else
+	ok "bundle_multi"
+fi
+
+# Check: ... still only needed the one rsh per script.
+if [ $(wc -l < "$countf") -ne 2 ] ||
+    [ $(grep -c -- "--bundle" "$countf") -ne 2 ]; then
+	cat "$countf" 1>&2
+	not_ok "bundle_connections" "expected a single rsh per script"
+else
+	ok "bundle_connections"
+fi
+
+# Check: failures come back on stderr, with the exit status.
+if "$rporchbin" -s -e "$rsh" -f "$scriptdir"/bundle_fail.orch \
+    > "$tmpdir/out" 2> "$tmpdir/err"; then
+	not_ok "bundle_fail" "rporch should have failed"
+elif [ -s "$tmpdir/out" ] ||
+    ! grep -q "match (pattern 'Biscuits') failed" "$tmpdir/err"; then
+	cat "$tmpdir/out" "$tmpdir/err" 1>&2
+	not_ok "bundle_fail" "failure not reported"
+else
+	ok "bundle_fail"
+fi
+
+# Check: the trace is written here, not left on the other end.
+if ! PORCH_TRACE="$tmpdir/trace.json" "$rporchbin" -s -e "$rsh" \
+    -f "$scriptdir"/spawn_multi.orch; then
+	not_ok "bundle_trace" "rporch failed"
+elif ! grep -q '"cat":"action","name":"spawn"' "$tmpdir/trace.json" ||
+    [ "$(tail -n 1 "$tmpdir/trace.json")" != "]" ]; then
+	cat "$tmpdir/trace.json" 1>&2
+	not_ok "bundle_trace" "incomplete trace"
+else
+	ok "bundle_trace"
+fi
+
+# Check: fleet mode ships the script to each host; the "host" is sh's $0.
+if ! "$rporchbin" -s -e "sh -c 'exec \"\$@\"'" -o "$tmpdir" \
+    -f "$scriptdir"/spawn_multi.orch alpha beta > "$tmpdir/summary"; then
+	cat "$tmpdir/summary" 1>&2
+	not_ok "bundle_fleet" "rporch failed"
+elif ! grep -q '^2 hosts: 2 ok, 0 failed$' "$tmpdir/summary"; then
+	cat "$tmpdir/summary" 1>&2
+	not_ok "bundle_fleet" "bad summary"
+else
+	ok "bundle_fleet"
+fi
+
+rm -rf "$tmpdir"
+exit "$fails"
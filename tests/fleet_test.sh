@@ -0,0 +1,128 @@
+#!/bin/sh
+#
+# Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+#
+# SPDX-License-Identifier: BSD-2-Clause
+#
+
+scriptdir=$(dirname $(realpath "$0"))
+if [ -n "$PORCHBIN" ]; then
+	porchbin="$PORCHBIN"
+else
+	porchbin="$scriptdir/../src/porch"
+	if [ ! -x "$porchbin" ]; then
+		porchbin="$(which porch)"
+	fi
+fi
+if [ ! -x "$porchbin" ]; then
+	1>&2 echo "Failed to find a usable porch binary"
+	exit 1
+fi
+
+rporchbin="$(dirname "$porchbin")/rporch"
+
+if [ -n "$PORCHLUA_PATH" ]; then
+	cd "$PORCHLUA_PATH"
+fi
+
+fails=0
+testid=1
+
+echo "1..5"
+
+ok()
+{
+	local f="$1"
+
+	echo "ok $testid - $f"
+	testid=$((testid + 1))
+}
+
+not_ok()
+{
+	local f="$1"
+	local msg="$2"
+
+	fails=$((fails + 1))
+	echo "not ok $testid - $f: $msg"
+	testid=$((testid + 1))
+}
+
+# A local stand-in for ssh: the "host" is sh's $0, and the "bad" host can't be
+# reached.
+rsh="sh -c 'test \"\$0\" != bad || exit 1; echo \"connected to \$0\"; exec \"\$@\"'"
+
+logdir=$(mktemp -d)
+summary="$logdir/summary"
+
+# Check: every host gets its own run and its own log, in parallel.
+start=$(date +"%s")
+if ! "$rporchbin" -e "$rsh" -P 3 -o "$logdir" -f "$scriptdir"/fleet_basic.orch \
+    alpha beta gamma > "$summary"; then
+	cat "$summary" 1>&2
+	not_ok "fleet_basic" "rporch failed"
+elif [ $(($(date +"%s") - start)) -ge 3 ]; then
+	not_ok "fleet_basic" "hosts were not run concurrently"
+elif [ ! -f "$logdir/alpha.log" ] || [ ! -f "$logdir/beta.log" ] ||
+    [ ! -f "$logdir/gamma.log" ]; then
+	ls "$logdir" 1>&2
+	not_ok "fleet_basic" "missing per-host log"
+else
+	ok "fleet_basic"
+fi
+
+# Check: the summary has a line per host, and a total.
+if [ $(grep -c '^[a-z]*: ok (' "$summary") -ne 3 ] ||
+    ! grep -q '^3 hosts: 3 ok, 0 failed$' "$summary"; then
+	cat "$summary" 1>&2
+	not_ok "fleet_summary" "bad summary"
+else
+	ok "fleet_summary"
+fi
+
+# Check: hosts from a file, with one failing; the script comes in on stdin.
+cat > "$logdir/hosts" <<EOHOSTS
+# A comment, then a blank line
+
+alpha
+  bad	# unreachable
+EOHOSTS
+
+if "$rporchbin" -e "$rsh" -P 2 -o "$logdir" -H "$logdir/hosts" \
+    < "$scriptdir"/fleet_basic.orch > "$summary"; then
+	cat "$summary" 1>&2
+	not_ok "fleet_hostsfile" "rporch should have failed"
+elif ! grep -q '^alpha: ok (' "$summary" ||
+    ! grep -q '^bad: failed, exit 1 (' "$summary" ||
+    ! grep -q '^2 hosts: 1 ok, 1 failed$' "$summary"; then
+	cat "$summary" 1>&2
+	not_ok "fleet_hostsfile" "bad summary"
+else
+	ok "fleet_hostsfile"
+fi
+
+# Check: the failing host's log says why.
+if ! grep -q "match (pattern 'connected to %S+') failed" "$logdir/bad.log"; then
+	cat "$logdir/bad.log" 1>&2
+	not_ok "fleet_log" "failure not logged"
+else
+	ok "fleet_log"
+fi
+
+# Check: a trace is written per host, rather than each over the last.
+rm -f "$logdir"/*.trace.json
+if ! PORCH_TRACE="$logdir/trace.json" "$rporchbin" -e "$rsh" -P 2 \
+    -o "$logdir" -f "$scriptdir"/fleet_basic.orch alpha beta > "$summary"; then
+	cat "$summary" 1>&2
+	not_ok "fleet_trace" "rporch failed"
+elif [ -e "$logdir/trace.json" ] ||
+    ! grep -q '"name"' "$logdir/alpha.trace.json" ||
+    ! grep -q '"name"' "$logdir/beta.trace.json"; then
+	ls "$logdir" 1>&2
+	not_ok "fleet_trace" "missing per-host trace"
+else
+	ok "fleet_trace"
+fi
+
+rm -rf "$logdir"
+exit "$fails"
@@ -0,0 +1,70 @@
+#!/bin/sh
+#
+# Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+#
+# SPDX-License-Identifier: BSD-2-Clause
+#
+
+scriptdir=$(dirname $(realpath "$0"))
+if [ -n "$PORCHBIN" ]; then
+	porchbin="$PORCHBIN"
+else
+	porchbin="$scriptdir/../src/porch"
+	if [ ! -x "$porchbin" ]; then
+		porchbin="$(which porch)"
+	fi
+fi
+if [ ! -x "$porchbin" ]; then
+	1>&2 echo "Failed to find a usable porch binary"
+	exit 1
+fi
+
+if [ -n "$PORCHLUA_PATH" ]; then
+	cd "$PORCHLUA_PATH"
+fi
+
+fails=0
+testid=1
+
+echo "1..2"
+
+ok()
+{
+	local f="$1"
+
+	echo "ok $testid - $f"
+	testid=$((testid + 1))
+}
+
+not_ok()
+{
+	local f="$1"
+	local msg="$2"
+
+	fails=$((fails + 1))
+	echo "not ok $testid - $f: $msg"
+	testid=$((testid + 1))
+}
+
+proffile=$(mktemp)
+
+# Check: the profile is written and the slow callback shows up in it.
+if ! $porchbin --profile="$proffile" -f "$scriptdir"/profile_busy.orch -- cat; then
+	not_ok "profile_basic" "script failed"
+elif ! grep -q "spin (.*profile_busy.orch:[0-9]*) [0-9]*$" "$proffile"; then
+	cat "$proffile" 1>&2
+	not_ok "profile_basic" "spin() not sampled"
+else
+	ok "profile_basic"
+fi
+
+# Check: every line is in the folded format.
+if grep -qv ' [0-9][0-9]*$' "$proffile"; then
+	cat "$proffile" 1>&2
+	not_ok "profile_folded" "malformed line in profile"
+else
+	ok "profile_folded"
+fi
+
+rm -f "$proffile"
+exit "$fails"
@@ -0,0 +1,120 @@
+#!/bin/sh
+#
+# Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+#
+# SPDX-License-Identifier: BSD-2-Clause
+#
+
+scriptdir=$(dirname $(realpath "$0"))
+if [ -n "$PORCHBIN" ]; then
+	porchbin="$PORCHBIN"
+else
+	porchbin="$scriptdir/../src/porch"
+	if [ ! -x "$porchbin" ]; then
+		porchbin="$(which porch)"
+	fi
+fi
+if [ ! -x "$porchbin" ]; then
+	1>&2 echo "Failed to find a usable porch binary"
+	exit 1
+fi
+
+if [ -n "$PORCHLUA_PATH" ]; then
+	cd "$PORCHLUA_PATH"
+fi
+
+fails=0
+testid=1
+
+echo "1..5"
+
+ok()
+{
+	local f="$1"
+
+	echo "ok $testid - $f"
+	testid=$((testid + 1))
+}
+
+skip()
+{
+	local f="$1"
+	local msg="$2"
+
+	echo "ok $testid - $f # skip $msg"
+	testid=$((testid + 1))
+}
+
+not_ok()
+{
+	local f="$1"
+	local msg="$2"
+
+	fails=$((fails + 1))
+	echo "not ok $testid - $f: $msg"
+	testid=$((testid + 1))
+}
+
+outfile=$(mktemp)
+
+# Run a command under porch with the given scheduling options, then check that
+# what it wrote to $outfile matches the expected pattern.
+check_sched()
+{
+	local f="$1"
+	local opts="$2"
+	local cmd="$3"
+	local expected="$4"
+
+	if ! $porchbin $opts -f "$scriptdir"/sched_eof.orch -- \
+	    sh -c "$cmd > $outfile"; then
+		not_ok "$f" "porch failed"
+	elif ! grep -Eq "$expected" "$outfile"; then
+		cat "$outfile" 1>&2
+		not_ok "$f" "not applied"
+	else
+		ok "$f"
+	fi
+}
+
+# Check: the spawned process inherits the nice level.
+check_sched "sched_nice" "--nice=4" 'ps -o nice= -p $$' '^ *4$'
+
+# Check: it also inherits the affinity, which we can only read back on Linux.
+if [ -r /proc/self/status ]; then
+	cpu=$(sed -n 's/^Cpus_allowed_list:[[:space:]]*\([0-9]*\).*/\1/p' \
+	    /proc/self/status)
+	check_sched "sched_cpus" "--cpus=$cpu" \
+	    'grep Cpus_allowed_list /proc/self/status' \
+	    "^Cpus_allowed_list:[[:space:]]*$cpu\$"
+else
+	skip "sched_cpus" "no /proc/self/status"
+fi
+
+# Check: ... and the policy, as long as chrt(1) is there to read it back.
+if [ -r /proc/self/status ] && command -v chrt > /dev/null; then
+	check_sched "sched_policy" "--policy=batch" 'chrt -p $$' 'SCHED_BATCH'
+else
+	skip "sched_policy" "no chrt(1)"
+fi
+
+# Check: a valid policy is either applied, or refused where there's no
+# sched_setscheduler(2) to apply it with.
+if ! $porchbin --policy=other -f "$scriptdir"/sched_eof.orch -- true \
+    2> "$outfile" && ! grep -q "not supported" "$outfile"; then
+	cat "$outfile" 1>&2
+	not_ok "sched_other" "policy not applied"
+else
+	ok "sched_other"
+fi
+
+# Check: a bad policy is rejected before anything is run.
+if $porchbin --policy=bogus -f "$scriptdir"/sched_eof.orch -- true \
+    2> /dev/null; then
+	not_ok "sched_bad" "bogus policy accepted"
+else
+	ok "sched_bad"
+fi
+
+rm -f "$outfile"
+exit "$fails"
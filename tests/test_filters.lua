@@ -0,0 +1,61 @@
+--
+-- Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+--
+-- SPDX-License-Identifier: BSD-2-Clause
+--
+
+require('./libtest')
+local porch = require('porch')
+
+local ESC = "\027"
+
+local function spawn_filtered(output, filters)
+	local proc = assert(porch.spawn("printf", "%s", output))
+
+	proc.timeout = 3
+	assert(proc:cfg({ filters = filters }))
+	return proc
+end
+
+-- Colors and CRLF are gone from what we match against, but the log still gets
+-- exactly what the process wrote.
+local tmpfile = os.tmpname()
+local logfh = assert(io.open(tmpfile, "w"))
+local proc = spawn_filtered(ESC .. "[1;31mred" .. ESC .. "[0m plain\nnext\n",
+    { "strip_ansi", "crlf" })
+proc:log(logfh)
+assert(proc:match("^red plain\nnext\n"))
+assert(proc:eof())
+assert(proc:close())
+
+-- close() closes the log for us.
+logfh = assert(io.open(tmpfile, "r"))
+local logged = logfh:read("a")
+logfh:close()
+os.remove(tmpfile)
+assert(logged:find(ESC .. "[1;31mred", 1, true), "Log missing raw colors")
+assert(logged:find("next\r\n", 1, true), "Log missing raw CRLF")
+
+-- A CR at the end of a chunk is held until we know what follows, so it must
+-- still make it out at EOF.
+proc = spawn_filtered("end\r", { "crlf" })
+assert(proc:match("end\r"))
+assert(proc:close())
+
+-- bracketed_paste only takes its own sequences out.
+proc = spawn_filtered(ESC .. "[?2004hprompt> " .. ESC .. "[1mbold" ..
+    ESC .. "[?2004l", { "bracketed_paste" })
+assert(proc:match("^prompt> " .. ESC .. "%[1mbold$"))
+assert(proc:close())
+
+-- An empty list turns them back off.
+proc = spawn_filtered("a\n", { "crlf" })
+assert(proc:cfg({ filters = {} }))
+assert(proc:match("^a\r\n"))
+assert(proc:close())
+
+proc = assert(porch.spawn("cat"))
+local ok, err = proc:cfg({ filters = { "bogus" } })
+assert(not ok, "Unknown filter accepted")
+assert(tostring(err):find("unknown filter 'bogus'", 1, true), tostring(err))
+assert(proc:close())
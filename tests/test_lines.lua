@@ -0,0 +1,70 @@
+--
+-- Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+--
+-- SPDX-License-Identifier: BSD-2-Clause
+--
+
+require('./libtest')
+local core = require('porch.core')
+local porch = require('porch')
+
+-- The splitter strips both kinds of line endings and leaves the partial line.
+local lines, partial = core.lines("one\r\ntwo\nthr", 1)
+assert(#lines == 2 and lines[1] == "one" and lines[2] == "two")
+assert(partial == 10, "Unexpected partial line position: " .. partial)
+lines, partial = core.lines("one\r\ntwo\nthr", 6)
+assert(#lines == 1 and lines[1] == "two" and partial == 10)
+
+local function spawn_lines(output)
+	local proc = assert(porch.spawn("printf", "%s", output))
+
+	proc.timeout = 3
+	assert(proc:cfg({ mode = "line" }))
+	return proc
+end
+
+-- Anchors apply to each line, and a match consumes the rest of its line.
+local proc = spawn_lines("noise prompt\nprompt trailer\nprompt\nlogin: ")
+assert(proc:match("^prompt$"))
+assert(proc:match("^login: $"))
+assert(proc:close())
+
+-- Each line is only scanned once while we wait.
+local output = {}
+for i = 1, 200 do
+	output[#output + 1] = "line " .. i .. "\n"
+end
+output = table.concat(output)
+
+proc = spawn_lines(output)
+assert(proc:match("^line 200$"))
+
+local stats = proc:stats()
+assert(stats.scanned.lua <= #output,
+    "Scanned more than the output: " .. stats.scanned.lua)
+assert(proc:close())
+
+-- Lines are handed over in batches, and only up to the line that matched.
+local batches, seen = 0, {}
+local function collect(batch)
+	batches = batches + 1
+	for _, line in ipairs(batch) do
+		seen[#seen + 1] = line
+	end
+end
+
+proc = spawn_lines(output .. "after\npartial")
+assert(proc:match("^line 200$", nil, { lines = collect }))
+assert(#seen == 200 and seen[200] == "line 200",
+    "Unexpected lines seen: " .. #seen)
+assert(batches < #seen, "Lines were not batched")
+
+seen = {}
+assert(proc:match("^partial$", nil, { lines = collect }))
+assert(#seen == 1 and seen[1] == "after", "Partial line passed as complete")
+assert(proc:close())
+
+proc = assert(porch.spawn("true"))
+local ok = proc:cfg({ mode = "bogus" })
+assert(not ok, "Invalid mode accepted")
+assert(proc:close())
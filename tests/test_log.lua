@@ -0,0 +1,59 @@
+--
+-- Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+--
+-- SPDX-License-Identifier: BSD-2-Clause
+--
+
+require('./libtest')
+local core = require('porch.core')
+local porch = require('porch')
+
+local function slurp(path)
+	local fh = assert(io.open(path, "r"))
+	local data = fh:read("a")
+
+	fh:close()
+	return data
+end
+
+local tmpfile = os.tmpname()
+
+-- A long interval and a threshold we won't hit means that only log(nil) can
+-- get the log out in time for us to check it.
+local cat = assert(porch.spawn("cat"))
+cat.timeout = 3
+cat:log(assert(io.open(tmpfile, "w")), true,
+    { interval = 60, threshold = 4096 })
+assert(cat:write("Hello there\r"))
+assert(cat:match("there"))
+cat:log(nil)
+
+local logged = slurp(tmpfile)
+assert(logged:find("Hello there\r", 1, true), "Write missing from the log")
+assert(logged:find("Hello there\r\n", 1, true), "Output missing from the log")
+
+local stats = cat:stats()
+assert(stats.log_written == #logged,
+    "Unexpected log_written: " .. stats.log_written)
+assert(stats.log_dropped == 0, "Dropped log output")
+assert(cat:close())
+
+-- Chunks that don't fit in the buffer are dropped whole and counted.
+os.remove(tmpfile)
+local log = assert(core.logfile(tmpfile, { buffer = 8, interval = 60 }))
+assert(log:write("1234"))
+assert(log:write("too long to fit"))
+assert(log:flush())
+assert(log:write("5678"))
+assert(log:close())
+
+stats = log:stats()
+assert(stats.written == 8, "Unexpected written: " .. stats.written)
+assert(stats.dropped == #"too long to fit",
+    "Unexpected dropped: " .. stats.dropped)
+assert(slurp(tmpfile) == "12345678", "Unexpected log contents")
+
+local ok = pcall(log.write, log, "x")
+assert(not ok, "Wrote to a closed log")
+
+os.remove(tmpfile)
@@ -0,0 +1,62 @@
+--
+-- Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+--
+-- SPDX-License-Identifier: BSD-2-Clause
+--
+
+require('./libtest')
+local core = require('porch.core')
+local porch = require('porch')
+
+-- Compiled patterns must find exactly what string.find() does, captures and
+-- all.
+local patterns = {
+	"", "login: ", "^login", "%$ $", "[Pp]assword:", "%d+%s*$", "^%s*(.-)%s*$",
+	"(%w+)@(%w+)", "()x()", "%b()", "%f[%w]%w+", "(a)%1", "a-b", "a?b",
+	"[^%s]+", "[a-]+", "[]]", "[^]]", "x*$", "%%", "$x", "a)", "%.",
+	"[%a_][%w_]*", "\0", "a\0b", "^$",
+}
+local subjects = {
+	"", "login: root\n", "prompt $ ", "Password: ", "abc 123   ",
+	"   trim me   ", "user@host", "(a(b)c)d", "THE (quick) fox", "aa",
+	"xaab", "]]", "x$x", "50%", "a\0b", "\n",
+}
+
+for _, pat in ipairs(patterns) do
+	local compiled = assert(core.luapat(pat))
+
+	for _, subject in ipairs(subjects) do
+		for _, init in ipairs({ 1, 2, -2, 0, #subject + 1, #subject + 2 }) do
+			local expected = table.pack(subject:find(pat, init))
+			local actual = table.pack(compiled:find(subject, init))
+
+			assert(expected.n == actual.n,
+			    string.format("%q on %q: %d values, expected %d",
+			    pat, subject, actual.n, expected.n))
+			for i = 1, expected.n do
+				assert(expected[i] == actual[i],
+				    string.format("%q on %q: value %d is %s, expected %s",
+				    pat, subject, i, actual[i], expected[i]))
+			end
+		end
+	end
+end
+
+-- Malformed patterns are caught up front.
+for _, pat in ipairs({ "%", "[a", "(a", "a)(", "%1", "(a%1)", "%bx", "%fx" }) do
+	local compiled, err = core.luapat(pat)
+	assert(not compiled and err, "Malformed pattern accepted: " .. pat)
+end
+
+-- Compiled patterns share the pattern cache with the posix matcher.
+local base = porch.regcache()
+assert(core.luapat("cached") == core.luapat("cached"))
+local stats = porch.regcache()
+assert(stats.hits == base.hits + 1 and stats.misses == base.misses + 1)
+
+-- The lua matcher compiles its patterns, and still matches as before.
+local proc = assert(porch.spawn("printf", "user@host $ "))
+proc.timeout = 3
+assert(proc:match("(%w+)@(%w+)"))
+assert(proc:match("%$ $"))
+assert(proc:close())
@@ -0,0 +1,64 @@
+--
+-- Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+--
+-- SPDX-License-Identifier: BSD-2-Clause
+--
+
+require('./libtest')
+local porch = require('porch')
+
+local categories = { "lua", "buffer", "ipc", "log", "core", "total" }
+
+local stats = porch.memstats()
+for _, cat in ipairs(categories) do
+	assert(stats[cat], "Missing memory category " .. cat)
+	assert(stats[cat].peak >= stats[cat].live,
+	    "Peak below live usage for " .. cat)
+end
+assert(stats.lua.live > 0, "Lua heap not accounted for")
+assert(stats.total.live >= stats.lua.live, "Total smaller than the Lua heap")
+
+local baseline = stats.buffer.live
+local cat = assert(porch.spawn("cat"))
+cat.timeout = 3
+
+-- Spawning goes through IPC to set up the child.
+stats = porch.memstats()
+assert(stats.ipc.peak > 0, "IPC allocations not accounted for")
+
+-- Leave some unmatched output in the buffer.
+local payload = string.rep("x", 1000)
+assert(cat:write(payload .. "\rmarker\r"))
+assert(cat:match("marker"))
+
+stats = porch.memstats()
+assert(stats.buffer.peak - baseline >= #payload,
+    "Match buffer growth not accounted for: " .. stats.buffer.peak)
+
+local tmpfile = os.tmpname()
+assert(cat:record(tmpfile))
+stats = porch.memstats()
+assert(stats.log.live > 0, "Recording buffer not accounted for")
+
+assert(cat:close())
+os.remove(tmpfile)
+
+stats = porch.memstats()
+assert(stats.log.live == 0, "Recording buffer leaked: " .. stats.log.live)
+
+-- Once collected, the buffer's contents should be released.
+cat = nil
+collectgarbage()
+collectgarbage()
+stats = porch.memstats()
+assert(stats.buffer.live == baseline,
+    "Match buffer not released: " .. stats.buffer.live)
+
+-- A bad agent request shouldn't leak the message it was building.
+local core = require('porch.core')
+local agent = assert(core.agent({ "cat" }))
+local ipc = porch.memstats().ipc.live
+assert(not pcall(agent.send, agent, "write", "bogus"))
+assert(not pcall(agent.send, agent, "signal", 1, "bogus"))
+assert(porch.memstats().ipc.live == ipc, "Agent message leaked")
+assert(agent:close())
@@ -0,0 +1,67 @@
+--
+-- Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+--
+-- SPDX-License-Identifier: BSD-2-Clause
+--
+
+require('./libtest')
+local porch = require('porch')
+
+-- Output arrives untouched by a line discipline, and stderr is merged in just
+-- as it would be on a terminal.
+local proc = assert(porch.spawn({ "sh", "-c", "echo out; echo err 1>&2",
+    pty = false }))
+proc.timeout = 3
+assert(not proc.term, "Process without a pty has a term")
+assert(proc:match("^out\nerr\n"))
+
+assert(proc:eof())
+assert(proc:close())
+
+-- Terminal-only operations fail cleanly.
+proc = assert(porch.spawn({ "cat", pty = false }))
+proc.timeout = 3
+
+local ok, err = proc:stty("lflag", porch.tty.lflag.ECHO)
+assert(not ok, "stty succeeded without a terminal")
+assert(tostring(err):find("no terminal", 1, true), tostring(err))
+
+-- A large write shouldn't stall while cat echoes it back.
+local payload = string.rep("x", 64 * 1024) .. "\nmarker\n"
+assert(proc:write(payload, { raw = true }))
+assert(proc:match("marker"))
+assert(proc:close())
+
+-- Writing to a process that's gone away is an error, not a SIGPIPE.
+proc = assert(porch.spawn({ "true", pty = false }))
+proc.timeout = 3
+assert(proc:eof())
+ok = proc._process._process:write("after exit")
+assert(not ok, "Write to an exited process succeeded")
+assert(proc:close())
+
+local bad = porch.spawn({ "cat" }, "extra")
+assert(not bad, "spawn accepted a mix of table and arguments")
+
+-- ^D closes the process' stdin, since there's no line discipline to do it.
+proc = assert(porch.spawn({ "wc", "-c", pty = false }))
+proc.timeout = 3
+assert(proc:write("hello\n^D"))
+assert(proc:match("^%s*6\n"))
+assert(proc:eof())
+assert(proc:close())
+
+proc = assert(porch.spawn({ "sort", pty = false }))
+proc.timeout = 3
+assert(proc:write("b\na\n"))
+assert(proc:write("c\n^D"))
+assert(proc:match("^a\nb\nc\n"))
+assert(proc:close())
+
+-- Nothing may follow it.
+proc = assert(porch.spawn({ "cat", pty = false }))
+proc.timeout = 3
+ok, err = proc:write("^Dmore")
+assert(not ok, "Wrote past ^D")
+assert(tostring(err):find("after ^D", 1, true), tostring(err))
+assert(proc:close())
@@ -0,0 +1,57 @@
+--
+-- Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+--
+-- SPDX-License-Identifier: BSD-2-Clause
+--
+
+require('./libtest')
+local core = require('porch.core')
+
+-- The compiled searcher works a block at a time with a scalar tail, so try a
+-- range of haystack lengths and needle positions that straddle the blocks.
+local needles = { "", "n", "ne", "needle", "n.e[dl]e%", string.rep("ab", 20) }
+
+local function check(compiled, haystack, needle, init, icase)
+	local expected
+	if icase then
+		expected = table.pack(haystack:lower():find(needle:lower(), init,
+		    true))
+	else
+		expected = table.pack(haystack:find(needle, init, true))
+	end
+
+	local actual = table.pack(compiled:find(haystack, init))
+	assert(expected.n == actual.n and expected[1] == actual[1] and
+	    expected[2] == actual[2], string.format(
+	    "%q in %q (init %d, icase %s): got %s, expected %s", needle,
+	    haystack, init, icase, actual[1], expected[1]))
+end
+
+for _, needle in ipairs(needles) do
+	local plain = assert(core.plain(needle))
+	local iplain = assert(core.plain(needle, "i"))
+	local folded = needle:upper()
+
+	for len = 0, 80 do
+		-- Noise that shares the needle's first byte.
+		local noise = string.rep("nx", len // 2 + 1):sub(1, len)
+
+		for pos = 0, len, 7 do
+			local pre, post = noise:sub(1, pos), noise:sub(pos + 1)
+
+			for _, hay in ipairs({ pre .. needle .. post,
+			    pre .. folded .. post, noise }) do
+				for _, init in ipairs({ 1, 2, -3, #hay + 1,
+				    #hay + 2 }) do
+					check(plain, hay, needle, init, false)
+					check(iplain, hay, needle, init, true)
+				end
+			end
+		end
+	end
+end
+
+-- Only ASCII is folded.
+assert(core.plain("\xc3\xa9", "i"):find("\xc3\x89") == nil)
+assert(core.plain("[A]", "i"):find("x[a]") == 2)
+assert(not pcall(core.plain, "x", "q"), "Unknown flag accepted")
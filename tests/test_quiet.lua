@@ -0,0 +1,43 @@
+--
+-- Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+--
+-- SPDX-License-Identifier: BSD-2-Clause
+--
+
+require('./libtest')
+local core = require('porch.core')
+local porch = require('porch')
+
+-- Settles after a pause in the middle, well before the cap.
+local proc = assert(porch.spawn("sh", "-c",
+    "printf one; sleep 0.3; printf two; sleep 10"))
+proc.timeout = 5
+
+local start = core.monotime()
+assert(proc:quiet(500) == true, "Process never went quiet")
+local elapsed = core.monotime() - start
+assert(elapsed >= 0.8 and elapsed < 3, "Unexpected wait: " .. elapsed)
+
+-- Nothing was lost while we were listening.
+assert(proc:match("^onetwo$"))
+assert(proc:close())
+
+-- A process that keeps talking runs out the clock.
+proc = assert(porch.spawn("sh", "-c",
+    "while :; do echo x; sleep 0.05; done"))
+start = core.monotime()
+assert(proc:quiet(500, 1) == false, "Noisy process reported quiet")
+elapsed = core.monotime() - start
+assert(elapsed >= 1 and elapsed < 2, "Unexpected wait: " .. elapsed)
+assert(proc:close())
+
+-- EOF is as quiet as it gets.
+proc = assert(porch.spawn("true"))
+start = core.monotime()
+assert(proc:quiet(5000) == true)
+assert(core.monotime() - start < 2, "Waited out the idle period at EOF")
+assert(proc:close())
+
+proc = assert(porch.spawn("true"))
+assert(not proc:quiet(-1), "Negative idle period accepted")
+assert(proc:close())
@@ -0,0 +1,52 @@
+--
+-- Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+--
+-- SPDX-License-Identifier: BSD-2-Clause
+--
+
+require('./libtest')
+local porch = require('porch')
+
+local fname = os.tmpname()
+local cat = assert(porch.spawn("cat"))
+cat.timeout = 3
+
+assert(cat:record(fname))
+assert(cat:write("Hello\r"))
+assert(cat:match("Hello"))
+
+assert(cat.term:size(100, 30))
+
+-- Valid UTF-8 should go through as-is, but a stray byte must be escaped.
+assert(cat:write("h\xc3\xa9llo \xff\r"))
+assert(cat:match("llo"))
+assert(cat:close())
+
+local lines = {}
+for line in io.lines(fname) do
+	lines[#lines + 1] = line
+end
+os.remove(fname)
+
+assert(lines[1]:match('^{"version": 2, "width": 80, "height": 24, '),
+    "Bad header: " .. lines[1])
+assert(lines[1]:find('"command": "cat"', 1, true), "Missing command")
+
+local last = 0
+local seen = {}
+for i = 2, #lines do
+	local offset, etype, data = lines[i]:match('^%[([%d.]+), "(%a)", "(.*)"%]$')
+
+	assert(offset, "Malformed event: " .. lines[i])
+	offset = tonumber(offset)
+	assert(offset >= last, "Event offsets went backwards")
+	last = offset
+
+	seen[etype] = (seen[etype] or "") .. data
+end
+
+assert(seen.i and seen.i:find("Hello\\r", 1, true), "Input not recorded")
+assert(seen.o and seen.o:find("Hello", 1, true), "Output not recorded")
+assert(seen.r == "100x30", "Resize not recorded")
+assert(seen.o:find("h\xc3\xa9llo \\u00ff", 1, true),
+    "Output not escaped correctly: " .. seen.o)
@@ -0,0 +1,81 @@
+--
+-- Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+--
+-- SPDX-License-Identifier: BSD-2-Clause
+--
+
+require('./libtest')
+local core = require('porch.core')
+local porch = require('porch')
+
+-- Invoke __close directly rather than through a to-be-closed variable, so that
+-- this still loads on Lua 5.3.
+local function close(obj)
+	getmetatable(obj).__close(obj)
+end
+
+local stats = porch.regcache()
+assert(stats.limit > 0, "Cache disabled by default")
+
+-- The same pattern and flags hand back the same compiled object.
+local base = porch.regcache()
+local re = assert(core.regcomp("^cached [a-z]+$"))
+assert(core.regcomp("^cached [a-z]+$") == re, "Pattern not interned")
+assert(core.regcomp("^cached [a-z]+$", "i") ~= re, "Flags not part of the key")
+assert(core.regcomp("^CACHED [A-Z]+$", "i"):find("cached hit"))
+
+stats = porch.regcache()
+assert(stats.hits == base.hits + 1, "Unexpected hits: " .. stats.hits)
+assert(stats.misses == base.misses + 3, "Unexpected misses: " .. stats.misses)
+
+-- Repeated matches through the direct interface only compile once.
+local proc = assert(porch.spawn("printf", "one\ntwo\nthree\n"))
+proc.timeout = 3
+base = porch.regcache()
+for _, word in ipairs({ "one", "two", "three" }) do
+	assert(proc:match("^" .. word .. "|[[:space:]]" .. word,
+	    porch.matchers.available.posix))
+end
+assert(proc:close())
+
+stats = porch.regcache()
+assert(stats.misses - base.misses == 3, "Unexpected misses: " .. stats.misses)
+
+-- Shrinking the cache evicts the oldest patterns, which stay usable.
+stats = porch.regcache(2)
+assert(stats.entries == 2 and stats.limit == 2)
+assert(re:find("cached entry"))
+
+base = porch.regcache()
+assert(core.regcomp("^cached [a-z]+$") ~= re, "Evicted pattern still cached")
+stats = porch.regcache()
+assert(stats.misses == base.misses + 1)
+
+-- Closing one holder of a cached pattern doesn't pull it out from under
+-- another, even once it's been evicted.
+local other = assert(core.regcomp("^shared$"))
+local held = assert(core.regcomp("^shared$"))
+assert(held == other, "Pattern not interned")
+close(held)
+assert(other:find("shared"), "Cached pattern closed under another holder")
+
+held = assert(core.regcomp("^shared$"))
+porch.regcache(0)
+assert(held:find("shared"))
+close(held)
+assert(other:find("shared"), "Evicted pattern closed under another holder")
+porch.regcache(2)
+
+-- A limit of zero disables the cache altogether.
+porch.regcache(0)
+assert(core.regcomp("x") ~= core.regcomp("x"), "Cache not disabled")
+assert(porch.regcache().entries == 0)
+
+-- A closed pattern that wasn't cached can't be used anymore.
+re = assert(core.regcomp("closed"))
+close(re)
+assert(not re:find("closed"), "Closed pattern still usable")
+
+local ok, err = core.regcomp("(unbalanced")
+assert(not ok and err, "Invalid pattern compiled")
+assert(not pcall(core.regcomp, "x", "q"), "Unknown flag accepted")
@@ -0,0 +1,137 @@
+--
+-- Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+--
+-- SPDX-License-Identifier: BSD-2-Clause
+--
+
+require('./libtest')
+local core = require('porch.core')
+local porch = require('porch')
+
+-- Record a session for simple_callback.orch to replay against.
+local transcript = os.tmpname()
+local cat = assert(porch.spawn("cat"))
+cat.timeout = 3
+
+assert(cat:record(transcript))
+assert(cat:write("Hello\r"))
+assert(cat:match("Hello"))
+porch.sleep(0.5)
+assert(cat:write("There!\r"))
+assert(cat:match("There"))
+assert(cat:close())
+
+local function replay(script, cfg)
+	cfg = cfg or {}
+	cfg.files = { transcript }
+
+	local ok, err = porch.run_script(script, {
+		command = { "cat" },
+		replay = cfg,
+	})
+
+	porch.reset()
+	return ok, err
+end
+
+-- The recorded delay should be compressed away by default.
+local start = core.monotime()
+assert(replay("simple_callback.orch"))
+assert(core.monotime() - start < 0.5, "Replay did not compress timing")
+
+start = core.monotime()
+assert(replay("simple_callback.orch", { timing = "honor" }))
+assert(core.monotime() - start >= 0.4, "Replay did not honor timing")
+
+-- Input that doesn't match the transcript is an error, unless we're ignoring
+-- it.
+local script = os.tmpname()
+local fh = assert(io.open(script, "w"))
+fh:write('write "Goodbye\\r"\nmatch "Hello"\n')
+fh:close()
+
+local ok, err = replay(script)
+assert(not ok, "Replay accepted unexpected input")
+assert(tostring(err):find("unexpected input", 1, true),
+    "Unexpected error: " .. tostring(err))
+
+assert(replay(script, { input = "ignore" }))
+
+-- Output withheld for input never comes, and with timing honored, the match
+-- waits out its timeout just as it would have against the real thing.
+fh = assert(io.open(script, "w"))
+fh:write('timeout(1)\nmatch "Hello"\n')
+fh:close()
+
+start = core.monotime()
+assert(not replay(script), "Replay matched output withheld for input")
+assert(core.monotime() - start < 0.5, "Replay did not compress the timeout")
+
+start = core.monotime()
+assert(not replay(script, { timing = "honor" }),
+    "Replay matched output withheld for input")
+assert(core.monotime() - start >= 0.9, "Replay did not honor the timeout")
+
+-- The transcript ends with a clean exit.
+local proc = assert(require('porch.replay').new({
+	files = { transcript },
+	input = "ignore",
+}):spawn())
+assert(not proc:eof(), "EOF before the transcript was read")
+assert(proc:release())
+assert(proc:read(function(data)
+	return data == nil
+end))
+
+local is_eof, status = proc:eof()
+assert(is_eof and status, "No exit status at EOF")
+assert(status:is_exited() and status:status() == 0,
+    "Unexpected exit status at EOF")
+
+-- The screen is modeled from the transcript just as it would be from the
+-- process, so screen_basic.orch works against a recording of what it spawns.
+local screen = os.tmpname()
+proc = assert(porch.spawn("printf",
+    "\027[2J\027[3;4Hld\027[3;1HWor\027[1;1Hready"))
+proc.timeout = 3
+assert(proc:record(screen))
+assert(proc:eof(3))
+assert(proc:close())
+
+ok, err = porch.run_script("screen_basic.orch", {
+	replay = { files = { screen } },
+})
+porch.reset()
+os.remove(screen)
+assert(ok, "Screen not modeled in replay: " .. tostring(err))
+
+-- Progress through a file is reported in the same units as its size.
+local sendfile = os.tmpname()
+fh = assert(io.open(sendfile, "w"))
+fh:write("one\ntwo\n")
+fh:close()
+
+fh = assert(io.open(script, "w"))
+fh:write(string.format([[
+local sent, total
+send_file(%q, {
+	eol = "\r\n",
+	progress = function(nsent, ntotal)
+		sent, total = nsent, ntotal
+	end,
+})
+match "Hello" {
+	callback = function()
+		if sent ~= total then
+			match "never"
+		end
+	end
+}
+]], sendfile))
+fh:close()
+
+assert(replay(script, { input = "ignore" }), "Progress not in file bytes")
+
+os.remove(sendfile)
+os.remove(script)
+os.remove(transcript)
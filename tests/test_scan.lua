@@ -0,0 +1,90 @@
+--
+-- Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+--
+-- SPDX-License-Identifier: BSD-2-Clause
+--
+
+require('./libtest')
+local core = require('porch.core')
+local porch = require('porch')
+
+-- Feed `subject` to the compiled pattern a chunk at a time, resuming each scan
+-- where the last miss said to; the first match has to be the same one that
+-- string.find() would have found in the buffer at that point.
+local function check(compiled, find, subject, chunk)
+	local buffer = ""
+	local init = 1
+
+	for pos = 1, #subject, chunk do
+		buffer = buffer .. subject:sub(pos, pos + chunk - 1)
+
+		local efirst, elast = find(buffer)
+		local first, last = compiled:scan(buffer, init)
+
+		assert(first == efirst and (not first or last == elast),
+		    string.format("%q after %d bytes (resumed at %d): got %s, expected %s",
+		    buffer, #buffer, init, first, efirst))
+		if first then
+			return
+		end
+
+		-- Anchored patterns don't get to skip anything.
+		init = last or 1
+		assert(init <= #buffer + 1)
+	end
+end
+
+local patterns = {
+	"login: ", "[Pp]assword:", "%d+%s*$", "(%w+)@(%w+)", "%b()", "%f[%w]%w+",
+	"(a)%1", "a-b", "a?b", "x*$", "^xa", "a.-b", "%s+%$ ", "ab*c",
+}
+local subjects = {
+	"login: root\n", "prompt $ ", "Password: ", "abc 123   ",
+	"user@host", "(a(b)c)d", "aa", "xaab", "x$x", "acabbbbbbbc",
+	"nothing to see here  $ ", "Xpassword:",
+}
+
+for _, pat in ipairs(patterns) do
+	local compiled = assert(core.luapat(pat))
+	local function find(buffer)
+		return buffer:find(pat)
+	end
+
+	for _, subject in ipairs(subjects) do
+		for chunk = 1, 4 do
+			check(compiled, find, subject, chunk)
+		end
+	end
+end
+
+for _, needle in ipairs({ "", "n", "login: ", "Pass" }) do
+	for _, flags in ipairs({ "", "i" }) do
+		local compiled = assert(core.plain(needle, flags))
+		local function find(buffer)
+			if flags == "i" then
+				buffer, needle = buffer:lower(), needle:lower()
+			end
+			return buffer:find(needle, nil, true)
+		end
+
+		for _, subject in ipairs(subjects) do
+			for chunk = 1, 4 do
+				check(compiled, find, subject, chunk)
+			end
+		end
+	end
+end
+
+-- The match buffer only scans what a pattern hasn't already ruled out, so
+-- waiting on output that trickles in doesn't go over the buffer again and again.
+local proc = assert(porch.spawn("sh", "-c",
+    "printf 'aaaaaaaa'; sleep 0.2; printf 'bbbbbbbb'; sleep 0.2; printf 'done'"))
+proc.timeout = 5
+assert(proc:match("done", porch.matchers.available.plain))
+
+-- Everything once, plus the last few bytes again after each read.
+local stats = proc:stats()
+assert(stats.scanned.plain <= 20 + 3 * stats.reads,
+    "scanned " .. stats.scanned.plain .. " bytes")
+assert(proc:close())
+
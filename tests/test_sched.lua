@@ -0,0 +1,76 @@
+--
+-- Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+--
+-- SPDX-License-Identifier: BSD-2-Clause
+--
+
+require('./libtest')
+local porch = require('porch')
+
+-- Spawn `cmd` under sh with `cfg` applied before release, and match `pattern`
+-- against what it prints.
+local function check(cmd, cfg, pattern)
+	local proc = assert(porch.spawn("sh", "-c", cmd))
+	proc.timeout = 3
+
+	if cfg then
+		assert(proc:sched(cfg))
+	end
+
+	local ok = proc:match(pattern)
+	assert(proc:close())
+	return ok
+end
+
+local nice_cmd = "echo nice=$(ps -o nice= -p $$)"
+
+assert(check(nice_cmd, { nice = 5 }, "nice=%s*5"), "nice not applied")
+
+local ok, err = porch.sched({ policy = "bogus" })
+assert(not ok and err, "Unknown policy accepted")
+ok, err = porch.sched({ cpus = "3-1" })
+assert(not ok and err, "Backwards cpu list accepted")
+ok, err = porch.sched({ cpus = {} })
+assert(not ok and err, "Empty cpu list accepted")
+
+-- Affinity and policies are only checked where we know how to read them back.
+local status = io.open("/proc/self/status")
+if status then
+	local cpus
+
+	for line in status:lines() do
+		cpus = line:match("^Cpus_allowed_list:%s*(%d+)")
+		if cpus then
+			break
+		end
+	end
+	status:close()
+	assert(cpus, "No Cpus_allowed_list in /proc/self/status")
+
+	local cpus_cmd = "grep Cpus_allowed_list /proc/self/status"
+	local cpus_pattern = "Cpus_allowed_list:%s*" .. cpus .. "\r?\n"
+
+	assert(check(cpus_cmd, { cpus = cpus }, cpus_pattern),
+	    "cpu list not applied")
+	assert(check(cpus_cmd, { cpus = { tonumber(cpus) } }, cpus_pattern),
+	    "cpu table not applied")
+
+	if os.execute("command -v chrt >/dev/null") then
+		assert(check("chrt -p $$", { policy = "batch" }, "SCHED_BATCH"),
+		    "policy not applied")
+		assert(check("chrt -p $$", { policy = "idle" }, "SCHED_IDLE"),
+		    "policy not applied")
+	end
+
+	-- What we apply to ourselves is inherited by what we spawn afterwards.
+	assert(porch.sched({ cpus = cpus, policy = "batch" }))
+	assert(check(cpus_cmd, nil, cpus_pattern), "cpu list not inherited")
+	if os.execute("command -v chrt >/dev/null") then
+		assert(check("chrt -p $$", nil, "SCHED_BATCH"),
+		    "policy not inherited")
+	end
+end
+
+-- Done last, since we can't take it back.
+assert(porch.sched({ nice = 9 }))
+assert(check(nice_cmd, nil, "nice=%s*9"), "nice not inherited")
@@ -0,0 +1,75 @@
+--
+-- Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+--
+-- SPDX-License-Identifier: BSD-2-Clause
+--
+
+require('./libtest')
+local porch = require('porch')
+
+local ESC = "\027"
+
+local function spawn_screen(output)
+	local proc = assert(porch.spawn("printf", "%s", output))
+
+	proc.timeout = 3
+	assert(proc:cfg({ screen = true }))
+	return proc
+end
+
+-- Lines written past the bottom scroll the top off, and the default size with
+-- no window size set is 80x24.
+local lines = {}
+for i = 1, 30 do
+	lines[#lines + 1] = "line " .. i
+end
+
+local proc = spawn_screen(table.concat(lines, "\r\n"))
+assert(proc:match_screen("line 30", { top = 24, bottom = 24 }))
+local text = proc:screen({ top = 1, bottom = 1 })
+assert(text == "line 7", "Unexpected top line after scrolling: " .. text)
+assert(proc:eof())
+assert(proc:close())
+
+-- The alternate screen should leave the primary screen as it was.
+proc = spawn_screen("primary" .. ESC .. "[?1049h" .. ESC .. "[HALT" ..
+    ESC .. "[?1049l" .. "\r\nafter")
+assert(proc:eof())
+
+-- The model survives close() so that the final screen can be inspected.
+assert(proc:close())
+text = proc:screen({ top = 1, bottom = 2 })
+assert(text == "primary\nafter", "Alternate screen leaked: " .. text)
+
+-- Erasing and overwriting in place, as a progress meter would.
+proc = spawn_screen("50%" .. ESC .. "[2K\r100%" .. ESC .. "[1;5HX" ..
+    ESC .. "[1;2H" .. ESC .. "[P")
+assert(proc:match_screen("^10%%X$", { top = 1, bottom = 1 }))
+assert(proc:close())
+
+-- A failed match times out and hands the fail handler the screen.
+proc = spawn_screen("nothing to see")
+proc.timeout = 1
+
+local failed_screen
+proc.ctx.fail_handler = function(contents)
+	failed_screen = contents
+end
+
+assert(not proc:match_screen("something"))
+assert(failed_screen and failed_screen:match("^nothing to see"),
+    "Fail handler didn't get the screen")
+assert(proc:close())
+
+-- Resizing the terminal resizes the model.
+proc = assert(porch.spawn("cat"))
+proc.timeout = 3
+assert(proc:cfg({ screen = true }))
+assert(proc.term:size(40, 10))
+assert(proc:write("resized\r"))
+assert(proc:match_screen("resized"))
+
+text = proc:screen()
+local _, nlines = text:gsub("\n", "")
+assert(nlines == 9, "Expected 10 rows, got " .. nlines + 1)
+assert(proc:close())
@@ -0,0 +1,81 @@
+--
+-- Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+--
+-- SPDX-License-Identifier: BSD-2-Clause
+--
+
+require('./libtest')
+local porch = require('porch')
+
+-- Big enough that cat(1) will echo back more than the pty can buffer before
+-- we're done sending it, so we'll wedge if we aren't draining it as we go.
+local nlines = 2000
+local fname = os.tmpname()
+local fh = assert(io.open(fname, "w"))
+for i = 1, nlines do
+	fh:write("line " .. i .. "\n")
+end
+
+local total = fh:seek("end")
+fh:close()
+
+local cat = assert(porch.spawn("cat"))
+cat.timeout = 3
+
+local last_sent, last_total
+local sent = assert(cat:send_file(fname, {
+	chunk = 4096,
+	progress = function(nsent, ntotal)
+		assert(not last_sent or nsent > last_sent)
+		last_sent = nsent
+		last_total = ntotal
+	end,
+}))
+
+assert(sent == total, "Sent " .. sent .. " bytes, expected " .. total)
+assert(last_sent == total, "Final progress did not cover the whole file")
+assert(last_total == total, "Progress total did not match file size")
+assert(cat:match("line " .. nlines), "Failed to find the last line")
+
+assert(cat:close())
+
+-- Progress is counted in bytes of the file, even as newlines are expanded.
+cat = assert(porch.spawn("cat"))
+cat.timeout = 3
+
+last_sent, last_total = nil, nil
+sent = assert(cat:send_file(fname, {
+	chunk = 4096,
+	eol = "\r\n",
+	progress = function(nsent, ntotal)
+		last_sent = nsent
+		last_total = ntotal
+	end,
+}))
+
+assert(sent == total + nlines, "Sent " .. sent .. " bytes, expected " ..
+    total + nlines)
+assert(last_sent == total and last_total == total,
+    "Progress was not in bytes of the file: " .. last_sent .. "/" .. last_total)
+assert(cat:match("line " .. nlines), "Failed to find the last line")
+
+assert(cat:close())
+
+-- An empty eol strips the newlines altogether.
+fh = assert(io.open(fname, "w"))
+fh:write("one\ntwo\nthree\n")
+fh:close()
+
+cat = assert(porch.spawn("cat"))
+cat.timeout = 3
+
+sent = assert(cat:send_file(fname, { eol = "" }))
+os.remove(fname)
+
+assert(sent == #"onetwothree", "Sent " .. sent .. " bytes, newlines kept")
+
+-- cat(1) won't see any of it until we finish the line.
+assert(cat:write("\r"))
+assert(cat:match("onetwothree"), "Newlines were not stripped")
+
+assert(cat:close())
@@ -0,0 +1,36 @@
+--
+-- Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+--
+-- SPDX-License-Identifier: BSD-2-Clause
+--
+
+require('./libtest')
+local porch = require('porch')
+
+local cat = assert(porch.spawn("cat"))
+cat.timeout = 3
+
+-- Nothing should have gone over the pty yet.
+local stats = cat:stats()
+assert(stats.reads == 0, "Read from the process before release")
+assert(stats.bytes_written == 0, "Wrote to the process before release")
+
+assert(cat:write("Hello there\r"))
+assert(cat:match("Hello"))
+assert(cat:match("there", porch.matchers.available.plain))
+
+stats = cat:stats()
+assert(stats.writes >= 1, "Write not counted")
+assert(stats.bytes_written == #"Hello there\r",
+    "Unexpected write count: " .. stats.bytes_written)
+assert(stats.reads >= 1, "Read not counted")
+assert(stats.bytes_read >= #"Hello", "Short byte count for reads")
+assert(stats.wakeups >= stats.reads, "Fewer wakeups than reads")
+assert(stats.callbacks >= 1, "Callbacks not counted")
+assert(stats.match_attempts >= 2, "Match attempts not counted")
+assert(stats.scanned.lua >= #"Hello", "Lua matcher scan not counted")
+assert(stats.scanned.plain ~= nil, "Plain matcher scan not counted")
+assert(stats.buffer_hwm >= #"Hello", "Buffer high-water mark not tracked")
+assert(stats.ipc_msgs >= 1, "Release not counted as an IPC message")
+
+assert(cat:close())
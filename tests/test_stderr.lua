@@ -0,0 +1,37 @@
+--
+-- Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+--
+-- SPDX-License-Identifier: BSD-2-Clause
+--
+
+require('./libtest')
+local porch = require('porch')
+
+local function spawn_split(script, pty)
+	local proc = assert(porch.spawn({ "sh", "-c", script,
+	    stderr = "separate", pty = pty }))
+
+	proc.timeout = 3
+	return proc
+end
+
+-- Each stream is matched on its own, regardless of how they interleave.
+local proc = spawn_split("echo out1; echo err1 1>&2; echo out2; echo err2 1>&2")
+assert(proc:match("err2", nil, { stream = "stderr" }))
+assert(proc:match("out1.*out2"))
+assert(not proc:match("err", nil, { stream = "stdout" }),
+    "stderr leaked into stdout")
+assert(proc:close())
+
+-- Output on stdout still lands in its buffer while we wait on stderr, even
+-- after the terminal has hit EOF.
+proc = spawn_split("echo out; exec 1>&-; sleep 1; echo late 1>&2", false)
+assert(proc:match("late", nil, { stream = "stderr" }))
+assert(proc:match("^out\n"))
+assert(proc:close())
+
+-- A process spawned without it doesn't get a stderr buffer.
+proc = assert(porch.spawn("true"))
+local ok, err = pcall(proc.match, proc, "x", nil, { stream = "stderr" })
+assert(not ok and tostring(err):find("separate stderr", 1, true), err)
+assert(proc:close())
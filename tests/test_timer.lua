@@ -0,0 +1,57 @@
+--
+-- Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+--
+-- SPDX-License-Identifier: BSD-2-Clause
+--
+
+require('./libtest')
+local core = require('porch.core')
+local porch = require('porch')
+
+local idle = core.timer()
+assert(not idle:armed(), "Timer armed without a deadline")
+assert(idle:remaining() == nil, "Disarmed timer has time remaining")
+
+-- Armed out of order, they still come due soonest first.
+local late = assert(core.timer(0.4))
+local soon = assert(core.timer(0.1))
+local never = assert(core.timer(60))
+assert(late:armed() and soon:armed() and never:armed())
+assert(soon:remaining() <= 0.1, "Unexpected remaining: " .. soon:remaining())
+
+core.sleep(0.2)
+assert(soon:fired(), "Soonest timer did not fire")
+assert(not late:fired(), "Later timer fired early")
+assert(not soon:armed(), "Fired timer still armed")
+assert(soon:remaining() == 0)
+
+-- Rearming resets it, and disarming takes it out for good.
+assert(soon:arm(60))
+assert(not soon:fired(), "Rearmed timer still reports fired")
+soon:disarm()
+never:disarm()
+assert(not soon:armed() and not never:armed())
+
+core.sleep(0.3)
+assert(late:fired(), "Later timer did not fire")
+assert(not soon:fired() and not never:fired(), "Disarmed timer fired")
+
+-- A timer that has nothing to do with a match doesn't cut it short.
+local unrelated = assert(porch.timer(0.3))
+local proc = assert(porch.spawn("sh", "-c", "sleep 1; echo hello"))
+proc.timeout = 5
+assert(proc:match("hello"), "Unrelated timer ended the match")
+assert(unrelated:fired())
+assert(proc:close())
+
+-- quiet()'s own limit cuts short a read that would otherwise sit out its own,
+-- much longer, timeout.
+local cat = assert(porch.spawn("cat"))
+local start = core.monotime()
+assert(cat:quiet(5000, 0.3) == false, "Silent process outlasted its limit")
+local elapsed = core.monotime() - start
+assert(elapsed >= 0.3 and elapsed < 2, "Unexpected wait: " .. elapsed)
+assert(cat:close())
+
+local ok = pcall(core.timer, -1)
+assert(not ok, "Negative timer accepted")
@@ -0,0 +1,71 @@
+#!/bin/sh
+#
+# Copyright (c) 2025 Kyle Evans <kevans@FreeBSD.org>
+#
+# SPDX-License-Identifier: BSD-2-Clause
+#
+
+scriptdir=$(dirname $(realpath "$0"))
+if [ -n "$PORCHBIN" ]; then
+	porchbin="$PORCHBIN"
+else
+	porchbin="$scriptdir/../src/porch"
+	if [ ! -x "$porchbin" ]; then
+		porchbin="$(which porch)"
+	fi
+fi
+if [ ! -x "$porchbin" ]; then
+	1>&2 echo "Failed to find a usable porch binary"
+	exit 1
+fi
+
+if [ -n "$PORCHLUA_PATH" ]; then
+	cd "$PORCHLUA_PATH"
+fi
+
+fails=0
+testid=1
+
+echo "1..3"
+
+ok()
+{
+	local f="$1"
+
+	echo "ok $testid - $f"
+	testid=$((testid + 1))
+}
+
+not_ok()
+{
+	local f="$1"
+	local msg="$2"
+
+	fails=$((fails + 1))
+	echo "not ok $testid - $f: $msg"
+	testid=$((testid + 1))
+}
+
+tracefile=$(mktemp)
+
+# Check: every span that's begun is ended, even when the script unwinds out of
+# the middle of it.
+for f in trace_exit trace_match trace_one; do
+	if ! PORCH_TRACE="$tracefile" $porchbin -f "$scriptdir"/$f.orch \
+	    -- cat; then
+		not_ok "$f" "script failed"
+		continue
+	fi
+
+	begins=$(grep -c '"ph":"B"' "$tracefile")
+	ends=$(grep -c '"ph":"E"' "$tracefile")
+	if [ "$begins" -eq 0 ] || [ "$begins" -ne "$ends" ]; then
+		cat "$tracefile" 1>&2
+		not_ok "$f" "$begins spans begun, $ends ended"
+	else
+		ok "$f"
+	fi
+done
+
+rm -f "$tracefile"
+exit "$fails"